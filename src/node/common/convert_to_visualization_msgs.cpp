@@ -542,7 +542,8 @@ visualization_msgs::MarkerArrayPtr createTrafficLatticeMsg(
     pt.z = transform.location.z;
 
     lattice_node_msg->points.push_back(pt);
-    if (node->vehicle()) lattice_node_msg->colors.push_back(special_color);
+    if (traffic_lattice->nodeVehicle(node->index()))
+      lattice_node_msg->colors.push_back(special_color);
     else lattice_node_msg->colors.push_back(color);
   }
 
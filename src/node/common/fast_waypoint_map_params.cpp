@@ -0,0 +1,43 @@
+/*
+ * Copyright 2020 Ke Sun
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <node/common/fast_waypoint_map_params.h>
+
+namespace node {
+
+boost::shared_ptr<utils::FastWaypointMap> createFastWaypointMap(
+    ros::NodeHandle& nh,
+    const boost::shared_ptr<const carla::client::Map>& map,
+    const boost::shared_ptr<const router::Router>& router) {
+
+  // The fast waypoint map is cached on disk, so that it is only generated
+  // once for all nodes and all episodes. It can also be shared by all
+  // nodes on the machine through shared memory.
+  // Alternatively, the map can be restricted to the route, which is
+  // faster to build and takes less memory if the route is short.
+  std::string cache_dir = "/tmp/conformal_lattice_planner";
+  bool on_route = false;
+  bool shared_memory = false;
+  nh.param<std::string>("fast_map_cache_dir", cache_dir, "/tmp/conformal_lattice_planner");
+  nh.param<bool>("fast_map_on_route", on_route, false);
+  nh.param<bool>("fast_map_shared_memory", shared_memory, false);
+
+  if (on_route)
+    return boost::make_shared<utils::FastWaypointMap>(map, router, 10.0, 50.0);
+  else
+    return boost::make_shared<utils::FastWaypointMap>(map, cache_dir, shared_memory);
+}
+
+} // End namespace node.
@@ -0,0 +1,50 @@
+/*
+ * Copyright 2020 Ke Sun
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#pragma once
+
+#include <string>
+#include <boost/smart_ptr.hpp>
+
+#include <ros/ros.h>
+#include <carla/client/Map.h>
+
+#include <router/common/router.h>
+#include <planner/common/fast_waypoint_map.h>
+
+namespace node {
+
+/**
+ * \brief Create the fast waypoint map with the parameters of the node.
+ *
+ * The following parameters are read from the node handle:
+ * - \c fast_map_cache_dir The directory of the cache files,
+ *   "/tmp/conformal_lattice_planner" by default.
+ * - \c fast_map_on_route Whether to restrict the map to the route,
+ *   false by default.
+ * - \c fast_map_shared_memory Whether to share the map with other nodes
+ *   through shared memory, false by default.
+ *
+ * \param[in] nh The node handle to read the parameters from.
+ * \param[in] map The carla map.
+ * \param[in] router The router providing the route.
+ * \return The fast waypoint map.
+ */
+boost::shared_ptr<utils::FastWaypointMap> createFastWaypointMap(
+    ros::NodeHandle& nh,
+    const boost::shared_ptr<const carla::client::Map>& map,
+    const boost::shared_ptr<const router::Router>& router);
+
+} // End namespace node.
@@ -25,6 +25,7 @@
 #include <planner/common/vehicle_speed_planner.h>
 #include <planner/lane_follower/lane_follower.h>
 #include <planner/common/utils.h>
+#include <node/common/fast_waypoint_map_params.h>
 #include <node/planner/agents_lane_following_node.h>
 
 using namespace router;
@@ -51,7 +52,8 @@ bool AgentsLaneFollowingNode::initialize() {
   // Create world and map.
   world_ = boost::make_shared<CarlaWorld>(client_->GetWorld());
   map_ = world_->GetMap();
-  fast_map_ = boost::make_shared<utils::FastWaypointMap>(map_);
+  // Create the fast waypoint map.
+  fast_map_ = createFastWaypointMap(nh_, map_, router_);
 
   // Start the action server.
   ROS_INFO_NAMED("agents_planner", "start action server.");
@@ -235,7 +237,7 @@ void AgentsLaneFollowingNode::executeCallback(
         updated_speed,
         agent_policy_[agent.id()].first,
         accel,
-        utils::curvatureAtWaypoint(map_->GetWaypoint(updated_transform.location), map_));
+        fast_map_->curvature(updated_transform.location));
 
     result.agents.push_back(conformal_lattice_planner::Vehicle());
     populateVehicleMsg(updated_agent, result.agents.back());
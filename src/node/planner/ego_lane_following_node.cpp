@@ -24,6 +24,7 @@
 #include <planner/common/utils.h>
 #include <planner/lane_follower/lane_follower.h>
 #include <node/common/convert_to_visualization_msgs.h>
+#include <node/common/fast_waypoint_map_params.h>
 #include <node/planner/ego_lane_following_node.h>
 
 using namespace router;
@@ -54,7 +55,8 @@ bool EgoLaneFollowingNode::initialize() {
   // Create world and map.
   world_ = boost::make_shared<CarlaWorld>(client_->GetWorld());
   map_ = world_->GetMap();
-  fast_map_ = boost::make_shared<utils::FastWaypointMap>(map_);
+  // Create the fast waypoint map.
+  fast_map_ = createFastWaypointMap(nh_, map_, router_);
 
   // Start the action server.
   ROS_INFO_NAMED("ego_planner", "start action server.");
@@ -129,7 +131,7 @@ void EgoLaneFollowingNode::executeCallback(
       updated_speed,
       snapshot->ego().policySpeed(),
       ego_accel,
-      utils::curvatureAtWaypoint(map_->GetWaypoint(updated_transform.location), map_));
+      fast_map_->curvature(updated_transform.location));
 
   conformal_lattice_planner::EgoPlanResult result;
   result.header.stamp = ros::Time::now();
@@ -22,6 +22,7 @@
 #include <ros/console.h>
 
 #include <node/common/convert_to_visualization_msgs.h>
+#include <node/common/fast_waypoint_map_params.h>
 #include <node/planner/ego_slc_lattice_planning_node.h>
 
 using namespace router;
@@ -57,11 +58,23 @@ bool EgoSLCLatticePlanningNode::initialize() {
   // Get the world and map.
   world_ = boost::make_shared<CarlaWorld>(client_->GetWorld());
   map_ = world_->GetMap();
-  fast_map_ = boost::make_shared<utils::FastWaypointMap>(map_);
+  // Create the fast waypoint map.
+  fast_map_ = createFastWaypointMap(nh_, map_, router_);
 
   // Initialize the path and speed planner.
   boost::shared_ptr<router::LoopRouter> router = boost::make_shared<router::LoopRouter>();
   path_planner_ = boost::make_shared<planner::SLCLatticePlanner>(0.1, 150.0, router, map_, fast_map_);
+  // The options of the planner are evaluated with a task pool if more than
+  // one thread is given.
+  int planner_threads = 1;
+  nh_.param<int>("planner_threads", planner_threads, 1);
+  if (planner_threads > 1)
+    path_planner_->taskPool() = boost::make_shared<utils::TaskPool>(planner_threads);
+  // The agents in the simulations can be moved with their lane coordinates
+  // instead of being matched onto the map at every step.
+  bool frenet_agents = false;
+  nh_.param<bool>("frenet_agents", frenet_agents, false);
+  path_planner_->frenetAgents() = frenet_agents;
   speed_planner_ = boost::make_shared<planner::VehicleSpeedPlanner>();
 
   // Start the action server.
@@ -86,6 +99,10 @@ void EgoSLCLatticePlanningNode::executeCallback(
   // Create the current snapshot.
   boost::shared_ptr<Snapshot> snapshot = createSnapshot(goal->snapshot);
 
+  // Set the time budget of the planning cycle, if any.
+  if (goal->planning_budget > 0.0) path_planner_->timeBudget() = goal->planning_budget;
+  else path_planner_->timeBudget() = boost::none;
+
   // Plan path.
   ros::Time start_time = ros::Time::now();
   const DiscretePath ego_path = path_planner_->planPath(snapshot->ego().id(), *snapshot);
@@ -141,6 +158,7 @@ void EgoSLCLatticePlanningNode::executeCallback(
   result.success = true;
   result.path_type = ego_path.laneChangeType();
   result.planning_time = path_planning_time.toSec();
+  result.horizon_coverage = path_planner_->horizonCoverage();
   populateVehicleMsg(updated_ego, result.ego);
   server_.setSucceeded(result);
 
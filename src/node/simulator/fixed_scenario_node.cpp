@@ -56,7 +56,8 @@ void FixedScenarioNode::spawnVehicles() {
     fast_map_->waypoint(start_transform.location);
 
   boost::shared_ptr<WaypointLattice> waypoint_lattice=
-    boost::make_shared<WaypointLattice>(start_waypoint, 150, 1.0, loop_router_);
+    boost::make_shared<WaypointLattice>(
+        start_waypoint, 150, 1.0, loop_router_, fast_map_->laneGraph(loop_router_));
 
   // Spawn the ego vehicle.
   // The ego vehicle is at 50m on the lattice, and there is an 100m buffer
@@ -18,6 +18,7 @@
 
 #include <ros/console.h>
 #include <planner/common/waypoint_lattice.h>
+#include <node/common/fast_waypoint_map_params.h>
 #include <node/simulator/no_traffic_node.h>
 
 using namespace router;
@@ -50,7 +51,8 @@ bool NoTrafficNode::initialize() {
 
   // Set the map.
   map_ = world_->GetMap();
-  fast_map_ = boost::make_shared<utils::FastWaypointMap>(map_);
+  // Create the fast waypoint map.
+  fast_map_ = createFastWaypointMap(nh_, map_, loop_router_);
 
   // Applying the world settings.
   double fixed_delta_seconds = 0.05;
@@ -60,6 +62,9 @@ bool NoTrafficNode::initialize() {
   all_param_exist &= nh_.param<bool>("no_rendering_mode", no_rendering_mode, true);
   all_param_exist &= nh_.param<bool>("synchronous_mode", synchronous_mode, true);
 
+  // The time budget of the ego planning cycles sent with the ego goals.
+  nh_.param<double>("ego_planning_budget", ego_planning_budget_, 0.0);
+
   ROS_INFO_NAMED("carla_simulator", "apply world settings.");
   carla::rpc::EpisodeSettings settings = world_->GetSettings();
   if (settings.fixed_delta_seconds) {
@@ -143,7 +148,8 @@ void NoTrafficNode::spawnVehicles() {
     fast_map_->waypoint(start_transform.location);
 
   boost::shared_ptr<WaypointLattice> waypoint_lattice=
-    boost::make_shared<WaypointLattice>(start_waypoint, 100, 1.0, loop_router_);
+    boost::make_shared<WaypointLattice>(
+        start_waypoint, 100, 1.0, loop_router_, fast_map_->laneGraph(loop_router_));
 
   // Spawn the ego vehicle.
   // The ego vehicle is at 50m on the lattice, and there is an 100m buffer
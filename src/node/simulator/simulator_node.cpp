@@ -22,6 +22,7 @@
 
 #include <planner/common/snapshot.h>
 #include <node/common/convert_to_visualization_msgs.h>
+#include <node/common/fast_waypoint_map_params.h>
 #include <node/simulator/simulator_node.h>
 
 namespace node {
@@ -51,7 +52,8 @@ bool SimulatorNode::initialize() {
 
   // Set the map.
   map_ = world_->GetMap();
-  fast_map_ = boost::make_shared<utils::FastWaypointMap>(map_);
+  // Create the fast waypoint map.
+  fast_map_ = createFastWaypointMap(nh_, map_, loop_router_);
 
   // Applying the world settings.
   double fixed_delta_seconds = 0.05;
@@ -61,6 +63,9 @@ bool SimulatorNode::initialize() {
   all_param_exist &= nh_.param<bool>("no_rendering_mode", no_rendering_mode, true);
   all_param_exist &= nh_.param<bool>("synchronous_mode", synchronous_mode, true);
 
+  // The time budget of the ego planning cycles sent with the ego goals.
+  nh_.param<double>("ego_planning_budget", ego_planning_budget_, 0.0);
+
   ROS_INFO_NAMED("carla_simulator", "apply world settings.");
   carla::rpc::EpisodeSettings settings = world_->GetSettings();
   if (settings.fixed_delta_seconds) {
@@ -366,6 +371,7 @@ void SimulatorNode::sendEgoGoal() {
   conformal_lattice_planner::EgoPlanGoal goal;
   goal.header.stamp = ros::Time::now();
   goal.simulation_time = simulation_time_;
+  goal.planning_budget = ego_planning_budget_;
   populateVehicleMsg(ego_, goal.snapshot.ego);
   for (const auto& item : agents_) {
     goal.snapshot.agents.push_back(conformal_lattice_planner::Vehicle());
@@ -587,8 +593,7 @@ void SimulatorNode::populateVehicleObj(
   // Transform.
   vehicle_obj.transform() = vehicle_actor->GetTransform();
   // Curvature.
-  vehicle_obj.curvature() = utils::curvatureAtWaypoint(
-      map_->GetWaypoint(vehicle_actor->GetLocation()), map_);
+  vehicle_obj.curvature() = fast_map_->curvature(vehicle_actor->GetLocation());
   // Acceleration.
   vehicle_obj.acceleration() = 0.0;
   // Speed and policy speed should be set by the caller.
@@ -81,6 +81,9 @@ protected:
   /// Indicates if the agents' planner action server has returned success.
   bool agents_ready_ = true;
 
+  /// The time budget (s) of the ego planning cycles, 0 if not limited.
+  double ego_planning_budget_ = 0.0;
+
   /// Loop router, the router is predefined on Town04.
   boost::shared_ptr<router::LoopRouter> loop_router_ = nullptr;
 
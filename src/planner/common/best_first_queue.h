@@ -0,0 +1,138 @@
+/*
+ * Copyright 2020 Ke Sun
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <queue>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+#include <boost/smart_ptr.hpp>
+
+namespace planner {
+
+/**
+ * \brief BestFirstQueue stores the stations (vertices) to be expanded, which
+ *        are popped in the ascending order of their priorities.
+ *
+ * The priority of a station decreases if a better parent is found for the
+ * station. Instead of updating the entry in place, the station is pushed
+ * again with the new priority. Only the last entry pushed for a station is
+ * valid, the outdated ones are skipped while popping. Stations with the same
+ * priority are popped in the order they are pushed.
+ *
+ * Each station is popped at most once.
+ */
+template<typename T>
+class BestFirstQueue {
+
+protected:
+
+  struct Entry {
+    double priority;
+    size_t order;
+    boost::shared_ptr<T> item;
+
+    bool operator>(const Entry& other) const {
+      if (priority != other.priority) return priority > other.priority;
+      return order > other.order;
+    }
+  };
+
+protected:
+
+  /// The entries, with the smallest priority at the top.
+  std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> entries_;
+
+  /// Number of entries pushed so far, which is used to break ties.
+  size_t pushed_ = 0;
+
+  /// The order of the last entry pushed for each item in the queue.
+  /// The items are kept alive by their entries in \c entries_.
+  std::unordered_map<const T*, size_t> latest_;
+
+  /// The items which have been popped. The items are kept alive, so that
+  /// their addresses are not taken by new items while the queue is in use.
+  std::unordered_map<const T*, boost::shared_ptr<T>> popped_;
+
+public:
+
+  /// Push an item, or update the priority of an item already in the queue.
+  void push(const boost::shared_ptr<T>& item, const double priority) {
+    if (popped_.count(item.get()) != 0) return;
+    latest_[item.get()] = pushed_;
+    entries_.push(Entry{priority, pushed_++, item});
+    return;
+  }
+
+  /**
+   * \brief Pop the item with the smallest priority.
+   * \return The item, or \c nullptr if there is no item to be popped.
+   */
+  boost::shared_ptr<T> pop() {
+
+    while (!entries_.empty()) {
+      const Entry entry = entries_.top();
+      entries_.pop();
+
+      // Skip the entries of the popped items, and the outdated entries.
+      if (!isLatest(entry)) continue;
+
+      latest_.erase(entry.item.get());
+      popped_.emplace(entry.item.get(), entry.item);
+      return entry.item;
+    }
+
+    return nullptr;
+  }
+
+  /**
+   * \brief Get the items with the smallest priorities without popping them.
+   *
+   * The outdated entries on the way are dropped. The queue is otherwise
+   * unchanged, i.e. the items are popped in the returned order unless
+   * other items are pushed in between.
+   *
+   * \param[in] n The maximum number of items to get.
+   * \return The items, in the order they would be popped.
+   */
+  std::vector<boost::shared_ptr<T>> top(const size_t n) {
+
+    std::vector<Entry> top_entries;
+    while (!entries_.empty() && top_entries.size() < n) {
+      const Entry entry = entries_.top();
+      entries_.pop();
+      if (isLatest(entry)) top_entries.push_back(entry);
+    }
+
+    std::vector<boost::shared_ptr<T>> items;
+    for (const Entry& entry : top_entries) {
+      items.push_back(entry.item);
+      entries_.push(entry);
+    }
+    return items;
+  }
+
+protected:
+
+  /// Check if the entry is the last one pushed for an item not popped yet.
+  bool isLatest(const Entry& entry) const {
+    typename std::unordered_map<const T*, size_t>::const_iterator iter =
+      latest_.find(entry.item.get());
+    return iter != latest_.end() && iter->second == entry.order;
+  }
+
+}; // End class BestFirstQueue.
+
+} // End namespace planner.
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2020 Ke Sun
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <utility>
+#include <stdexcept>
+#include <boost/optional.hpp>
+
+namespace utils {
+
+/**
+ * \brief Expected holds either a value, or the reason why the value
+ *        is not available.
+ *
+ * Expected is used to report the failures that happen in normal operation,
+ * e.g. a path cannot be optimized between two waypoints, or an agent drives
+ * off the map during a simulation. Such failures are returned without
+ * throwing an exception or formatting an error message. Exceptions are kept
+ * for the violations of invariants.
+ *
+ * The reason of a failure should be a string literal, which is never copied.
+ */
+template<typename T>
+class Expected {
+
+private:
+
+  /// The value, empty in the case of a failure.
+  boost::optional<T> value_;
+
+  /// The reason of the failure, \c nullptr if the value is available.
+  const char* error_ = nullptr;
+
+public:
+
+  /// Construct with a value.
+  Expected(const T& value) : value_(value) {}
+
+  /// Construct with a value.
+  Expected(T&& value) : value_(std::move(value)) {}
+
+  /**
+   * \brief Construct a failure.
+   * \param[in] error The reason of the failure, which should be a string literal.
+   */
+  static Expected failure(const char* error) {
+    Expected expected;
+    expected.error_ = error;
+    return expected;
+  }
+
+  /// Check if the value is available.
+  explicit operator bool() const { return static_cast<bool>(value_); }
+
+  /// Get the value, which should be available.
+  const T& operator*() const { return *value_; }
+  T& operator*() { return *value_; }
+
+  const T* operator->() const { return value_.get_ptr(); }
+  T* operator->() { return value_.get_ptr(); }
+
+  /// Get the value, throws \c std::runtime_error if it is not available.
+  const T& value() const {
+    if (!value_) throw std::runtime_error(error_);
+    return *value_;
+  }
+
+  /// Get the reason of the failure, \c nullptr if the value is available.
+  const char* error() const { return error_; }
+
+private:
+
+  Expected() = default;
+
+}; // End class Expected.
+
+} // End namespace utils.
@@ -0,0 +1,1469 @@
+/*
+ * Copyright 2020 Ke Sun
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <tuple>
+#include <set>
+#include <map>
+#include <unordered_set>
+#include <limits>
+#include <fstream>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include <carla/road/Road.h>
+
+#include <planner/common/fast_waypoint_map.h>
+#include <planner/common/lane_graph.h>
+
+namespace utils {
+
+constexpr const char* FastWaypointMap::kCacheMagic_;
+constexpr uint32_t FastWaypointMap::kCacheVersion_;
+constexpr double FastWaypointMap::kCellSizeInResolution_;
+constexpr double FastWaypointMap::kHintRadius_;
+constexpr double FastWaypointMap::kSharedMemoryTimeout_;
+constexpr size_t FastWaypointMap::kHintWalkSteps_;
+constexpr int32_t FastWaypointMap::kTileSizeInCells_;
+
+FastWaypointMap::FastWaypointMap(
+    const boost::shared_ptr<const CarlaMap>& map,
+    const double resolution) :
+  resolution_(resolution), map_(map) {
+
+  generateRecords();
+  return;
+}
+
+FastWaypointMap::FastWaypointMap(
+    const boost::shared_ptr<const CarlaMap>& map,
+    const std::string& cache_dir,
+    const double resolution) :
+  resolution_(resolution), map_(map) {
+
+  initializeWithCache(cache_dir);
+  return;
+}
+
+FastWaypointMap::FastWaypointMap(
+    const boost::shared_ptr<const CarlaMap>& map,
+    const std::string& cache_dir,
+    const bool shared_memory,
+    const double resolution) :
+  resolution_(resolution), map_(map) {
+
+  if (!shared_memory) {
+    initializeWithCache(cache_dir);
+    return;
+  }
+
+  // The process which creates the segment is responsible to fill it in.
+  const std::string name = sharedMemoryName(map_, resolution_);
+  int fd = ::shm_open(name.c_str(), O_CREAT|O_EXCL|O_RDWR, 0644);
+
+  // The segment is created by another process. If the segment is abandoned,
+  // it is removed, and this process takes over publishing the map.
+  if (fd < 0) {
+    if (attachSharedMemory(name)) return;
+    fd = ::shm_open(name.c_str(), O_CREAT|O_EXCL|O_RDWR, 0644);
+  }
+
+  if (fd < 0) {
+    initializeWithCache(cache_dir);
+    return;
+  }
+
+  // Failing to publish the map is not fatal, in which case the segment
+  // is removed and the private copy of the map is used. Closing the file
+  // descriptor releases the lock taken by \c claimSharedMemory().
+  const bool claimed = claimSharedMemory(fd);
+  initializeWithCache(cache_dir);
+  if (!claimed || !publishSharedMemory(fd)) ::shm_unlink(name.c_str());
+  ::close(fd);
+
+  return;
+}
+
+FastWaypointMap::FastWaypointMap(
+    const boost::shared_ptr<const CarlaMap>& map,
+    const boost::shared_ptr<const router::Router>& router,
+    const double lateral_margin,
+    const double longitudinal_margin,
+    const double resolution) :
+  resolution_(resolution), map_(map), route_restricted_(true) {
+
+  generateRecords(routeWaypoints(router, longitudinal_margin));
+
+  if (record_num_ == 0) {
+    throw std::runtime_error(
+        "FastWaypointMap::FastWaypointMap(): "
+        "cannot find any waypoint on the given route.\n");
+  }
+
+  buildRegion(lateral_margin);
+  return;
+}
+
+FastWaypointMap::FastWaypointMap(
+    const boost::shared_ptr<const CarlaMap>& map,
+    const std::vector<boost::shared_ptr<CarlaWaypoint>>& waypoints,
+    const double resolution) :
+  resolution_(resolution), map_(map) {
+
+  generateRecords(waypoints);
+  return;
+}
+
+FastWaypointMap::~FastWaypointMap() {
+  if (mapped_cache_) ::munmap(mapped_cache_, mapped_cache_size_);
+  return;
+}
+
+boost::shared_ptr<FastWaypointMap::CarlaWaypoint> FastWaypointMap::waypoint(
+    const CarlaLocation& location) const {
+
+  checkNonEmpty(location);
+
+  if (!inRegion(location)) {
+    boost::shared_ptr<CarlaWaypoint> waypoint = tileWaypoint(location);
+    if (waypoint) return waypoint;
+  }
+
+  return recordWaypoint(closestRecord(location));
+}
+
+boost::shared_ptr<FastWaypointMap::CarlaWaypoint> FastWaypointMap::waypoint(
+    const CarlaLocation& location, boost::optional<size_t>& hint) const {
+
+  checkNonEmpty(location);
+
+  size_t index = 0;
+  if (hint && *hint<record_num_ &&
+      (closestRecordAlongHint(location, *hint, index) ||
+       closestRecordAroundHint(location, *hint, index))) {
+    hint = index;
+    return recordWaypoint(index);
+  }
+
+  // Waypoints from the tiles are not indexed by records,
+  // which cannot be used as hints.
+  if (!inRegion(location)) {
+    boost::shared_ptr<CarlaWaypoint> waypoint = tileWaypoint(location);
+    if (waypoint) {
+      hint = boost::none;
+      return waypoint;
+    }
+  }
+
+  index = closestRecord(location);
+  hint = index;
+  return recordWaypoint(index);
+}
+
+std::vector<boost::shared_ptr<FastWaypointMap::CarlaWaypoint>>
+  FastWaypointMap::waypoints(const std::vector<CarlaLocation>& locations) const {
+  std::vector<boost::optional<size_t>> hints(locations.size(), boost::none);
+  return waypoints(locations, hints);
+}
+
+std::vector<boost::shared_ptr<FastWaypointMap::CarlaWaypoint>>
+  FastWaypointMap::waypoints(
+    const std::vector<CarlaLocation>& locations,
+    std::vector<boost::optional<size_t>>& hints) const {
+
+  if (hints.size() != locations.size()) {
+    throw std::runtime_error(
+        (boost::format(
+          "FastWaypointMap::waypoints(): "
+          "the number of hints %1% does not match the number of locations %2%.\n")
+         % hints.size()
+         % locations.size()).str());
+  }
+
+  std::vector<boost::shared_ptr<CarlaWaypoint>> matches(locations.size());
+  if (locations.empty()) return matches;
+  for (const auto& location : locations) checkNonEmpty(location);
+
+  // Queries with valid hints are resolved locally first. The rest are
+  // collected for the global search.
+  std::vector<std::pair<uint64_t, size_t>> queries;
+  queries.reserve(locations.size());
+
+  for (size_t i = 0; i < locations.size(); ++i) {
+    size_t index = 0;
+    if (hints[i] && *(hints[i])<record_num_ &&
+        (closestRecordAlongHint(locations[i], *(hints[i]), index) ||
+         closestRecordAroundHint(locations[i], *(hints[i]), index))) {
+      hints[i] = index;
+      continue;
+    }
+
+    if (!inRegion(locations[i])) {
+      matches[i] = tileWaypoint(locations[i]);
+      if (matches[i]) {
+        hints[i] = boost::none;
+        continue;
+      }
+    }
+
+    // The key orders the queries by the cells they are in, row by row,
+    // which is the same order as the records are stored.
+    const uint64_t cx = static_cast<uint32_t>(cellCoordinate(locations[i].x));
+    const uint64_t cy = static_cast<uint32_t>(cellCoordinate(locations[i].y));
+    queries.push_back(std::make_pair(((cy^0x80000000)<<32) | (cx^0x80000000), i));
+  }
+
+  std::sort(queries.begin(), queries.end());
+  for (const auto& query : queries)
+    hints[query.second] = closestRecord(locations[query.second]);
+
+  for (size_t i = 0; i < locations.size(); ++i)
+    if (!matches[i]) matches[i] = recordWaypoint(*(hints[i]));
+
+  return matches;
+}
+
+std::string FastWaypointMap::sharedMemoryName(
+    const boost::shared_ptr<const CarlaMap>& map,
+    const double resolution) {
+  // The version is included so that processes built with different
+  // versions of the layout never attach to the same segment.
+  return (boost::format("/%1%.v%2%")
+      % cacheFile(map, "", resolution)
+      % kCacheVersion_).str();
+}
+
+std::string FastWaypointMap::cacheFile(
+    const boost::shared_ptr<const CarlaMap>& map,
+    const std::string& cache_dir,
+    const double resolution) {
+
+  // Map names may contain path separators, e.g. "/Game/Carla/Maps/Town04".
+  std::string map_name = map->GetName();
+  std::replace(map_name.begin(), map_name.end(), '/', '_');
+
+  const std::string filename = (boost::format("%1%_%2$016x_%3%mm.fwm")
+      % map_name
+      % fnv1aHash(map->GetOpenDrive())
+      % static_cast<int>(std::round(resolution*1000.0))).str();
+
+  if (cache_dir.empty()) return filename;
+  return cache_dir + "/" + filename;
+}
+
+const bool FastWaypointMap::saveCache(const std::string& filename) const {
+
+  const CacheHeader header = cacheLayout();
+
+  const std::string tmp_filename = (
+      boost::format("%1%.tmp.%2%") % filename % ::getpid()).str();
+
+  {
+    std::ofstream fout(tmp_filename, std::ios::binary|std::ios::trunc);
+    if (!fout.is_open()) return false;
+
+    fout.write(reinterpret_cast<const char*>(&header), sizeof(CacheHeader));
+    fout.write(reinterpret_cast<const char*>(records_),
+               record_num_*sizeof(WaypointRecord));
+    fout.write(reinterpret_cast<const char*>(cells_),
+               cell_num_*sizeof(GridCell));
+    fout.write(reinterpret_cast<const char*>(xs_), record_num_*sizeof(float));
+    fout.write(reinterpret_cast<const char*>(ys_), record_num_*sizeof(float));
+    fout.write(reinterpret_cast<const char*>(zs_), record_num_*sizeof(float));
+    fout.write(reinterpret_cast<const char*>(geometries_),
+               record_num_*sizeof(WaypointGeometry));
+    if (!fout.good()) {
+      std::remove(tmp_filename.c_str());
+      return false;
+    }
+  }
+
+  if (std::rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+    std::remove(tmp_filename.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+void FastWaypointMap::generateRecords() {
+  // Generate waypoints on the map with the given resolution.
+  generateRecords(map_->GenerateWaypoints(resolution_));
+  return;
+}
+
+void FastWaypointMap::generateRecords(
+    const std::vector<boost::shared_ptr<CarlaWaypoint>>& waypoints) {
+
+  // Convert the waypoints into records. The index of the waypoint is
+  // temporarily kept in the record so that the waypoints can be
+  // rearranged together with the records.
+  record_buffer_.clear();
+  record_buffer_.reserve(waypoints.size());
+
+  for (size_t i = 0; i < waypoints.size(); ++i) {
+    const CarlaLocation location = waypoints[i]->GetTransform().location;
+    WaypointRecord record;
+    record.x = location.x;
+    record.y = location.y;
+    record.z = location.z;
+    record.s = waypoints[i]->GetDistance();
+    record.road = waypoints[i]->GetRoadId();
+    record.section = waypoints[i]->GetSectionId();
+    record.lane = waypoints[i]->GetLaneId();
+    record.reserved = i;
+    record_buffer_.push_back(record);
+  }
+
+  // Arrange the records into the grid.
+  buildGrid();
+
+  // Arrange the waypoints and compute the lane geometry in the same
+  // order as the records.
+  waypoints_.resize(record_buffer_.size());
+  geometry_buffer_.resize(record_buffer_.size());
+  for (size_t i = 0; i < record_buffer_.size(); ++i) {
+    waypoints_[i] = waypoints[record_buffer_[i].reserved];
+    geometry_buffer_[i] = waypointGeometry(waypoints_[i]);
+    record_buffer_[i].reserved = 0;
+  }
+  geometries_ = geometry_buffer_.data();
+
+  return;
+}
+
+FastWaypointMap::WaypointGeometry FastWaypointMap::waypointGeometry(
+    const boost::shared_ptr<CarlaWaypoint>& waypoint) const {
+
+  WaypointGeometry geometry;
+  geometry.heading = waypoint->GetTransform().rotation.yaw;
+  geometry.lane_width = waypoint->GetLaneWidth();
+  geometry.reserved = 0.0f;
+
+  // The curvature is not available on some roads, e.g. spiral roads.
+  // The error is delayed until the curvature is actually queried.
+  try {
+    geometry.curvature = utils::curvatureAtWaypoint(waypoint, map_);
+  } catch (const std::runtime_error&) {
+    geometry.curvature = std::numeric_limits<float>::quiet_NaN();
+  }
+
+  return geometry;
+}
+
+void FastWaypointMap::initializeWithCache(const std::string& cache_dir) {
+
+  // Try to load the map from the cache file first.
+  const std::string filename = cacheFile(map_, cache_dir, resolution_);
+  if (loadCache(filename)) return;
+
+  // Construct the map from scratch and create the cache file.
+  // The cache directory is created if it does not exist yet.
+  // Failing to write the cache file is not fatal.
+  generateRecords();
+  ::mkdir(cache_dir.c_str(), 0755);
+  saveCache(filename);
+
+  return;
+}
+
+const bool FastWaypointMap::loadCache(const std::string& filename) {
+
+  const int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat file_stat;
+  if (::fstat(fd, &file_stat)!=0 || static_cast<size_t>(file_stat.st_size)<sizeof(CacheHeader)) {
+    ::close(fd);
+    return false;
+  }
+
+  const size_t file_size = file_stat.st_size;
+  void* mapped = ::mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping stays valid after the file descriptor is closed.
+  ::close(fd);
+  if (mapped == MAP_FAILED) return false;
+
+  if (!attachCache(mapped, file_size)) {
+    ::munmap(mapped, file_size);
+    return false;
+  }
+
+  return true;
+}
+
+const bool FastWaypointMap::attachCache(void* mapped, const size_t size) {
+
+  // Make sure the cache matches the map.
+  const CacheHeader& header = *static_cast<const CacheHeader*>(mapped);
+  const CacheHeader expected_header = cacheHeader(map_, resolution_);
+
+  const bool valid =
+    std::memcmp(header.magic, expected_header.magic, sizeof(header.magic))==0 &&
+    header.version        == expected_header.version &&
+    header.record_size    == expected_header.record_size &&
+    header.opendrive_hash == expected_header.opendrive_hash &&
+    header.resolution     == expected_header.resolution &&
+    std::strncmp(header.map_name, expected_header.map_name, sizeof(header.map_name))==0 &&
+    header.record_offset  >= sizeof(CacheHeader) &&
+    header.record_offset%alignof(WaypointRecord) == 0 &&
+    header.record_offset+header.record_num*sizeof(WaypointRecord) <= size &&
+    header.cell_size      == expected_header.cell_size &&
+    header.cell_num > 0 && (header.cell_num&(header.cell_num-1)) == 0 &&
+    header.cell_offset%alignof(GridCell) == 0 &&
+    header.cell_offset+header.cell_num*sizeof(GridCell) <= size &&
+    header.coordinate_offset%alignof(float) == 0 &&
+    header.geometry_offset == header.coordinate_offset+3*header.record_num*sizeof(float) &&
+    header.geometry_offset%alignof(WaypointGeometry) == 0 &&
+    cacheSize(header) <= size;
+
+  if (!valid) return false;
+
+  mapped_cache_ = mapped;
+  mapped_cache_size_ = size;
+  records_ = reinterpret_cast<const WaypointRecord*>(
+      static_cast<const char*>(mapped) + header.record_offset);
+  record_num_ = header.record_num;
+
+  cell_size_ = header.cell_size;
+  cell_min_[0] = header.cell_min[0];
+  cell_min_[1] = header.cell_min[1];
+  cell_max_[0] = header.cell_max[0];
+  cell_max_[1] = header.cell_max[1];
+  cells_ = reinterpret_cast<const GridCell*>(
+      static_cast<const char*>(mapped) + header.cell_offset);
+  cell_num_ = header.cell_num;
+
+  xs_ = reinterpret_cast<const float*>(
+      static_cast<const char*>(mapped) + header.coordinate_offset);
+  ys_ = xs_ + record_num_;
+  zs_ = ys_ + record_num_;
+
+  geometries_ = reinterpret_cast<const WaypointGeometry*>(
+      static_cast<const char*>(mapped) + header.geometry_offset);
+
+  waypoints_.clear();
+  waypoints_.resize(record_num_);
+
+  return true;
+}
+
+void FastWaypointMap::buildGrid() {
+
+  cell_size_ = resolution_ * kCellSizeInResolution_;
+
+  // Sort the records by cells. Within each cell, the records are
+  // grouped by lanes and sorted by the distance along the lane.
+  std::sort(record_buffer_.begin(), record_buffer_.end(),
+      [this](const WaypointRecord& r1, const WaypointRecord& r2)->bool{
+        const int32_t x1 = cellCoordinate(r1.x), y1 = cellCoordinate(r1.y);
+        const int32_t x2 = cellCoordinate(r2.x), y2 = cellCoordinate(r2.y);
+        return std::tie(y1, x1, r1.road, r1.section, r1.lane, r1.s) <
+               std::tie(y2, x2, r2.road, r2.section, r2.lane, r2.s);
+      });
+
+  // Collect the cells, i.e. the ranges of the records in the same cell.
+  std::vector<GridCell> cells;
+  cell_min_[0] = cell_min_[1] = std::numeric_limits<int32_t>::max();
+  cell_max_[0] = cell_max_[1] = std::numeric_limits<int32_t>::min();
+
+  for (size_t i = 0; i < record_buffer_.size(); ++i) {
+    const int32_t x = cellCoordinate(record_buffer_[i].x);
+    const int32_t y = cellCoordinate(record_buffer_[i].y);
+
+    if (cells.empty() || cells.back().x!=x || cells.back().y!=y) {
+      cells.push_back(GridCell{x, y, static_cast<uint32_t>(i), static_cast<uint32_t>(i)});
+      cell_min_[0] = std::min(cell_min_[0], x);
+      cell_min_[1] = std::min(cell_min_[1], y);
+      cell_max_[0] = std::max(cell_max_[0], x);
+      cell_max_[1] = std::max(cell_max_[1], y);
+    }
+    ++(cells.back().end);
+  }
+
+  // Insert the cells into the hash table with linear probing.
+  // The load factor of the table is kept below 0.5.
+  cell_num_ = 1;
+  while (cell_num_ < 2*cells.size()+1) cell_num_ <<= 1;
+  cell_buffer_.assign(cell_num_, GridCell{0, 0, 0, 0});
+
+  const size_t mask = cell_num_ - 1;
+  for (const GridCell& cell : cells) {
+    size_t i = cellHash(cell.x, cell.y) & mask;
+    while (cell_buffer_[i].begin != cell_buffer_[i].end) i = (i+1) & mask;
+    cell_buffer_[i] = cell;
+  }
+
+  records_ = record_buffer_.data();
+  record_num_ = record_buffer_.size();
+  cells_ = cell_buffer_.data();
+
+  buildCoordinates();
+  return;
+}
+
+void FastWaypointMap::buildCoordinates() {
+
+  coordinate_buffer_.resize(3*record_num_);
+  float* xs = coordinate_buffer_.data();
+  float* ys = xs + record_num_;
+  float* zs = ys + record_num_;
+
+  for (size_t i = 0; i < record_num_; ++i) {
+    xs[i] = records_[i].x;
+    ys[i] = records_[i].y;
+    zs[i] = records_[i].z;
+  }
+
+  xs_ = xs;
+  ys_ = ys;
+  zs_ = zs;
+  return;
+}
+
+std::vector<boost::shared_ptr<FastWaypointMap::CarlaWaypoint>>
+  FastWaypointMap::routeWaypoints(
+    const boost::shared_ptr<const router::Router>& router,
+    const double longitudinal_margin) const {
+
+  using LaneKey = LaneKeyCompare::LaneKey;
+
+  // Collect the entries of all lanes (in all lane sections), and the
+  // roads connected to the lanes from the topology of the map. Each pair
+  // in the topology links the entry of a lane to the entry of its successor.
+  // The successor is also recorded as an entry, since the lanes without
+  // any successor only show up in the topology as successors.
+  std::map<LaneKey, boost::shared_ptr<CarlaWaypoint>> entries;
+  std::map<LaneKey, std::unordered_set<size_t>> prev_roads;
+  std::map<LaneKey, std::unordered_set<size_t>> next_roads;
+
+  for (const auto& segment : map_->GetTopology()) {
+    const LaneKey entry_key = laneKey(segment.first);
+    const LaneKey next_key = laneKey(segment.second);
+    entries.emplace(entry_key, segment.first);
+    entries.emplace(next_key, segment.second);
+    next_roads[entry_key].insert(segment.second->GetRoadId());
+    prev_roads[next_key].insert(segment.first->GetRoadId());
+  }
+
+  auto onRoute = [&router](const std::unordered_set<size_t>& roads)->bool{
+    for (const size_t road : roads) if (router->hasRoad(road)) return true;
+    return false;
+  };
+
+  const size_t margin_num = static_cast<size_t>(
+      std::floor(longitudinal_margin/resolution_)) + 1;
+
+  std::vector<boost::shared_ptr<CarlaWaypoint>> waypoints;
+  for (const auto& entry : entries) {
+    const bool routed  = router->hasRoad(std::get<0>(entry.first));
+    const bool entered = onRoute(prev_roads[entry.first]);
+    const bool exited  = onRoute(next_roads[entry.first]);
+    if (!routed && !entered && !exited) continue;
+
+    const std::vector<boost::shared_ptr<CarlaWaypoint>> lane_waypoints =
+      laneSegmentWaypoints(entry.second, resolution_);
+
+    // The complete lanes are kept for the roads on the route, and the
+    // junction connectors between two roads on the route.
+    if (routed || (entry.second->IsJunction() && entered && exited)) {
+      waypoints.insert(waypoints.end(), lane_waypoints.begin(), lane_waypoints.end());
+      continue;
+    }
+
+    // Only the part within the margin to the route is kept for the lanes
+    // leaving or entering the route.
+    for (size_t i = 0; i < lane_waypoints.size(); ++i) {
+      if ((entered && i < margin_num) ||
+          (exited && i+margin_num >= lane_waypoints.size()))
+        waypoints.push_back(lane_waypoints[i]);
+    }
+  }
+
+  return waypoints;
+}
+
+std::vector<boost::shared_ptr<FastWaypointMap::CarlaWaypoint>>
+  FastWaypointMap::laneSegmentWaypoints(
+    const boost::shared_ptr<CarlaWaypoint>& entry,
+    const double distance) const {
+
+  const LaneKeyCompare::LaneKey entry_key = laneKey(entry);
+
+  // The number of waypoints is bounded by the length of the road,
+  // in case the lane does not end properly.
+  const double road_length =
+    map_->GetMap().GetMap().GetRoad(entry->GetRoadId()).GetLength();
+  const size_t max_num = static_cast<size_t>(std::ceil(road_length/distance)) + 1;
+
+  std::vector<boost::shared_ptr<CarlaWaypoint>> waypoints {entry};
+  while (waypoints.size() < max_num) {
+    boost::shared_ptr<CarlaWaypoint> next_waypoint = nullptr;
+    for (const auto& candidate : waypoints.back()->GetNext(distance)) {
+      if (laneKey(candidate) != entry_key) continue;
+      next_waypoint = candidate;
+      break;
+    }
+
+    if (!next_waypoint) break;
+    waypoints.push_back(next_waypoint);
+  }
+
+  return waypoints;
+}
+
+void FastWaypointMap::buildRegion(const double lateral_margin) {
+
+  const int32_t margin = static_cast<int32_t>(
+      std::ceil(std::max(lateral_margin, 0.0)/cell_size_));
+
+  region_min_[0] = cell_min_[0] - margin;
+  region_min_[1] = cell_min_[1] - margin;
+  region_size_[0] = cell_max_[0] - cell_min_[0] + 1 + 2*margin;
+  region_size_[1] = cell_max_[1] - cell_min_[1] + 1 + 2*margin;
+  region_.assign((static_cast<size_t>(region_size_[0])*region_size_[1]+63) / 64, 0);
+
+  // Mark the square of cells around every non-empty cell.
+  for (size_t i = 0; i < cell_num_; ++i) {
+    const GridCell& slot = cells_[i];
+    if (slot.begin == slot.end) continue;
+
+    for (int32_t y = slot.y-margin; y <= slot.y+margin; ++y) {
+      for (int32_t x = slot.x-margin; x <= slot.x+margin; ++x) {
+        const size_t bit =
+          static_cast<size_t>(y-region_min_[1])*region_size_[0] + (x-region_min_[0]);
+        region_[bit>>6] |= static_cast<uint64_t>(1) << (bit&63);
+      }
+    }
+  }
+
+  return;
+}
+
+boost::optional<size_t> FastWaypointMap::waypointRecord(
+    const boost::shared_ptr<const CarlaWaypoint>& waypoint) const {
+
+  if (record_num_ == 0) return boost::none;
+
+  const CarlaLocation location = waypoint->GetTransform().location;
+  const GridCell* grid_cell = cell(
+      cellCoordinate(location.x), cellCoordinate(location.y));
+  if (!grid_cell) return boost::none;
+
+  // The records of the lane in the cell, which are sorted by the distance.
+  const std::pair<const WaypointRecord*, const WaypointRecord*> lane = std::equal_range(
+      records_+grid_cell->begin, records_+grid_cell->end,
+      std::make_tuple(static_cast<uint32_t>(waypoint->GetRoadId()),
+                      static_cast<uint32_t>(waypoint->GetSectionId()),
+                      static_cast<int32_t>(waypoint->GetLaneId())),
+      LaneKeyCompare());
+  if (lane.first == lane.second) return boost::none;
+
+  const float s = waypoint->GetDistance();
+  const WaypointRecord* iter = std::lower_bound(lane.first, lane.second, s,
+      [](const WaypointRecord& record, const float s)->bool{ return record.s < s; });
+
+  if (iter == lane.second ||
+      (iter != lane.first && s-(iter-1)->s < iter->s-s)) --iter;
+
+  // The closest record may be in the next cell if the waypoint is close
+  // to the border, which is at most two records away.
+  if (std::fabs(iter->s-s) > 2.0*resolution_) return boost::none;
+  return static_cast<size_t>(iter - records_);
+}
+
+const double FastWaypointMap::curvature(
+    const boost::shared_ptr<const CarlaWaypoint>& waypoint) const {
+  const boost::optional<size_t> index = waypointRecord(waypoint);
+  if (index && !std::isnan(geometries_[*index].curvature))
+    return geometries_[*index].curvature;
+  return utils::curvatureAtWaypoint(waypoint, map_);
+}
+
+const double FastWaypointMap::curvature(const CarlaLocation& location) const {
+
+  checkNonEmpty(location);
+
+  if (!inRegion(location)) {
+    const std::pair<boost::shared_ptr<const FastWaypointMap>, size_t>
+      tile_record = tileRecord(location);
+    if (tile_record.first)
+      return tile_record.first->recordCurvature(tile_record.second);
+  }
+
+  return recordCurvature(closestRecord(location));
+}
+
+boost::shared_ptr<const LaneGraph> FastWaypointMap::laneGraph(
+    const boost::shared_ptr<const router::Router>& router) const {
+
+  std::lock_guard<std::mutex> lock(lane_graphs_mutex_);
+  boost::shared_ptr<const LaneGraph>& lane_graph = lane_graphs_[router.get()];
+  if (!lane_graph) lane_graph = boost::make_shared<LaneGraph>(*this, router);
+  return lane_graph;
+}
+
+std::pair<boost::shared_ptr<const FastWaypointMap>, size_t>
+  FastWaypointMap::tileRecord(const CarlaLocation& location) const {
+
+  const double tile_size = kTileSizeInCells_ * cell_size_;
+  const int32_t tx = static_cast<int32_t>(std::floor(location.x/tile_size));
+  const int32_t ty = static_cast<int32_t>(std::floor(location.y/tile_size));
+
+  // The tiles are not modified once constructed.
+  std::vector<boost::shared_ptr<const FastWaypointMap>> neighbor_tiles;
+  for (int32_t y = ty-1; y <= ty+1; ++y) {
+    for (int32_t x = tx-1; x <= tx+1; ++x) {
+      boost::shared_ptr<const FastWaypointMap> neighbor_tile = tile(x, y);
+      if (neighbor_tile) neighbor_tiles.push_back(neighbor_tile);
+    }
+  }
+
+  boost::shared_ptr<const FastWaypointMap> best_tile = nullptr;
+  size_t best_index = 0;
+  float best_sqr_dist = std::numeric_limits<float>::max();
+
+  for (const auto& neighbor_tile : neighbor_tiles) {
+    const size_t index = neighbor_tile->closestRecord(location);
+    const float sqr_dist = neighbor_tile->sqrDistance(location, index);
+    if (sqr_dist < best_sqr_dist) {
+      best_tile = neighbor_tile;
+      best_index = index;
+      best_sqr_dist = sqr_dist;
+    }
+  }
+
+  // Waypoints further than one tile size may not be the closest,
+  // since the tiles beyond the neighbors are not searched.
+  if (!best_tile || best_sqr_dist > tile_size*tile_size)
+    return std::make_pair(nullptr, 0);
+  return std::make_pair(best_tile, best_index);
+}
+
+boost::shared_ptr<const FastWaypointMap> FastWaypointMap::tile(
+    const int32_t x, const int32_t y) const {
+
+  const uint64_t key = (static_cast<uint64_t>(static_cast<uint32_t>(y)) << 32) |
+                       static_cast<uint32_t>(x);
+
+  // Find the slot of the tile, which is added if not available. Only the
+  // slots are guarded by \c tiles_mutex_, so that the queries hitting the
+  // existing tiles can run concurrently.
+  boost::shared_ptr<TileSlot> slot = nullptr;
+  {
+    std::shared_lock<std::shared_timed_mutex> tiles_lock(tiles_mutex_);
+    std::unordered_map<uint64_t, boost::shared_ptr<TileSlot>>::const_iterator
+      iter = tiles_.find(key);
+    if (iter != tiles_.end()) slot = iter->second;
+  }
+
+  if (!slot) {
+    std::unique_lock<std::shared_timed_mutex> tiles_lock(tiles_mutex_);
+    boost::shared_ptr<TileSlot>& new_slot = tiles_[key];
+    if (!new_slot) new_slot = boost::make_shared<TileSlot>();
+    slot = new_slot;
+  }
+
+  // The tile is constructed by the first query reaching it, without holding
+  // \c tiles_mutex_. The other queries on the same tile wait for it.
+  std::call_once(slot->flag, [this, &slot, x, y]()->void{
+      slot->tile = buildTile(x, y);
+    });
+  return slot->tile;
+}
+
+boost::shared_ptr<const FastWaypointMap> FastWaypointMap::buildTile(
+    const int32_t x, const int32_t y) const {
+
+  std::call_once(lane_segments_flag_, [this]()->void{ buildLaneSegments(); });
+
+  const float tile_size = kTileSizeInCells_ * cell_size_;
+  const float min_x = x * tile_size;
+  const float min_y = y * tile_size;
+  const float max_x = min_x + tile_size;
+  const float max_y = min_y + tile_size;
+
+  // Generate the waypoints of the lanes overlapping with the tile.
+  std::vector<boost::shared_ptr<CarlaWaypoint>> waypoints;
+  for (const LaneSegment& lane_segment : lane_segments_) {
+    if (lane_segment.max[0] < min_x || lane_segment.min[0] >= max_x ||
+        lane_segment.max[1] < min_y || lane_segment.min[1] >= max_y) continue;
+
+    for (const auto& waypoint : laneSegmentWaypoints(lane_segment.entry, resolution_)) {
+      const CarlaLocation location = waypoint->GetTransform().location;
+      if (location.x < min_x || location.x >= max_x ||
+          location.y < min_y || location.y >= max_y) continue;
+      waypoints.push_back(waypoint);
+    }
+  }
+
+  boost::shared_ptr<const FastWaypointMap> new_tile = nullptr;
+  if (!waypoints.empty())
+    new_tile.reset(new FastWaypointMap(map_, waypoints, resolution_));
+
+  return new_tile;
+}
+
+void FastWaypointMap::buildLaneSegments() const {
+
+  // The lanes are sampled sparsely to find their bounding boxes. The lanes
+  // cannot bend away from the samples more than the sample distance.
+  const double distance = kTileSizeInCells_ * cell_size_ / 4.0;
+
+  // Both waypoints in a topology pair are lane entries, see routeWaypoints().
+  std::vector<boost::shared_ptr<CarlaWaypoint>> entries;
+  std::set<LaneKeyCompare::LaneKey> visited_lanes;
+  for (const auto& segment : map_->GetTopology()) {
+    if (visited_lanes.insert(laneKey(segment.first)).second)
+      entries.push_back(segment.first);
+    if (visited_lanes.insert(laneKey(segment.second)).second)
+      entries.push_back(segment.second);
+  }
+
+  for (const auto& entry : entries) {
+    LaneSegment lane_segment;
+    lane_segment.entry = entry;
+    lane_segment.min[0] = lane_segment.min[1] = std::numeric_limits<float>::max();
+    lane_segment.max[0] = lane_segment.max[1] = std::numeric_limits<float>::lowest();
+
+    for (const auto& waypoint : laneSegmentWaypoints(entry, distance)) {
+      const CarlaLocation location = waypoint->GetTransform().location;
+      lane_segment.min[0] = std::min(lane_segment.min[0], location.x);
+      lane_segment.min[1] = std::min(lane_segment.min[1], location.y);
+      lane_segment.max[0] = std::max(lane_segment.max[0], location.x);
+      lane_segment.max[1] = std::max(lane_segment.max[1], location.y);
+    }
+
+    lane_segment.min[0] -= distance;
+    lane_segment.min[1] -= distance;
+    lane_segment.max[0] += distance;
+    lane_segment.max[1] += distance;
+    lane_segments_.push_back(lane_segment);
+  }
+
+  return;
+}
+
+const size_t FastWaypointMap::closestRecord(const CarlaLocation& location) const {
+
+  const int32_t cx = cellCoordinate(location.x);
+  const int32_t cy = cellCoordinate(location.y);
+
+  // Distance from the query to the borders of the cell it is in.
+  const double fx = location.x - cx*cell_size_;
+  const double fy = location.y - cy*cell_size_;
+  const double margin = std::min(std::min(fx, cell_size_-fx),
+                                 std::min(fy, cell_size_-fy));
+
+  size_t best_index = 0;
+  float best_sqr_dist = std::numeric_limits<float>::max();
+
+  auto searchCell = [this, &location, &best_index, &best_sqr_dist](
+      const int32_t x, const int32_t y)->void{
+    const GridCell* grid_cell = cell(x, y);
+    if (!grid_cell) return;
+    closestRecordInRange(location, grid_cell->begin, grid_cell->end,
+                         best_index, best_sqr_dist);
+    return;
+  };
+
+  // Search the cells ring by ring around the query cell. The search stops
+  // once the cells in the next ring cannot be closer than the best record.
+  const int32_t max_ring = std::max(
+      std::max(std::abs(cx-cell_min_[0]), std::abs(cx-cell_max_[0])),
+      std::max(std::abs(cy-cell_min_[1]), std::abs(cy-cell_max_[1])));
+
+  for (int32_t r = 0; r <= max_ring; ++r) {
+    if (r > 0) {
+      const double bound = (r-1)*cell_size_ + margin;
+      if (bound*bound >= best_sqr_dist) break;
+    }
+
+    // Only the cells within the bounding box of the grid are checked.
+    const int32_t x_begin = std::max(cx-r, cell_min_[0]);
+    const int32_t x_end   = std::min(cx+r, cell_max_[0]);
+    const int32_t y_begin = std::max(cy-r+1, cell_min_[1]);
+    const int32_t y_end   = std::min(cy+r-1, cell_max_[1]);
+
+    // Bottom and top rows of the ring.
+    if (cy-r >= cell_min_[1])
+      for (int32_t x = x_begin; x <= x_end; ++x) searchCell(x, cy-r);
+    if (r>0 && cy+r <= cell_max_[1])
+      for (int32_t x = x_begin; x <= x_end; ++x) searchCell(x, cy+r);
+
+    // Left and right columns of the ring, excluding the corners.
+    if (cx-r >= cell_min_[0])
+      for (int32_t y = y_begin; y <= y_end; ++y) searchCell(cx-r, y);
+    if (r>0 && cx+r <= cell_max_[0])
+      for (int32_t y = y_begin; y <= y_end; ++y) searchCell(cx+r, y);
+  }
+
+  return best_index;
+}
+
+void FastWaypointMap::closestRecordInRange(
+    const CarlaLocation& location,
+    const size_t begin, const size_t end,
+    size_t& index, float& sqr_dist) const {
+
+  size_t i = begin;
+
+#if defined(__AVX2__)
+  if (end-begin >= 8) {
+    const __m256 qx = _mm256_set1_ps(location.x);
+    const __m256 qy = _mm256_set1_ps(location.y);
+    const __m256 qz = _mm256_set1_ps(location.z);
+
+    __m256 best_dists = _mm256_set1_ps(std::numeric_limits<float>::max());
+    __m256i best_indices = _mm256_set1_epi32(0);
+    __m256i indices = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    indices = _mm256_add_epi32(indices, _mm256_set1_epi32(static_cast<int32_t>(begin)));
+    const __m256i stride = _mm256_set1_epi32(8);
+
+    for (; i+8 <= end; i += 8) {
+      const __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(xs_+i), qx);
+      const __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(ys_+i), qy);
+      const __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(zs_+i), qz);
+      const __m256 dists = _mm256_add_ps(
+          _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+          _mm256_mul_ps(dz, dz));
+
+      // Keep the first minimum in each lane.
+      const __m256 closer = _mm256_cmp_ps(dists, best_dists, _CMP_LT_OQ);
+      best_dists = _mm256_blendv_ps(best_dists, dists, closer);
+      best_indices = _mm256_blendv_epi8(
+          best_indices, indices, _mm256_castps_si256(closer));
+      indices = _mm256_add_epi32(indices, stride);
+    }
+
+    alignas(32) float lane_dists[8];
+    alignas(32) int32_t lane_indices[8];
+    _mm256_store_ps(lane_dists, best_dists);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lane_indices), best_indices);
+    // Among the lanes, ties are resolved to the smaller index so that the
+    // result is the same as the scalar loop.
+    size_t best_lane = 0;
+    for (size_t k = 1; k < 8; ++k) {
+      if (lane_dists[k] < lane_dists[best_lane] ||
+          (lane_dists[k] == lane_dists[best_lane] &&
+           lane_indices[k] < lane_indices[best_lane])) best_lane = k;
+    }
+    if (lane_dists[best_lane] < sqr_dist) {
+      sqr_dist = lane_dists[best_lane];
+      index = static_cast<size_t>(lane_indices[best_lane]);
+    }
+  }
+#elif defined(__SSE2__)
+  if (end-begin >= 4) {
+    const __m128 qx = _mm_set1_ps(location.x);
+    const __m128 qy = _mm_set1_ps(location.y);
+    const __m128 qz = _mm_set1_ps(location.z);
+
+    __m128 best_dists = _mm_set1_ps(std::numeric_limits<float>::max());
+    __m128i best_indices = _mm_set1_epi32(0);
+    __m128i indices = _mm_setr_epi32(0, 1, 2, 3);
+    indices = _mm_add_epi32(indices, _mm_set1_epi32(static_cast<int32_t>(begin)));
+    const __m128i stride = _mm_set1_epi32(4);
+
+    for (; i+4 <= end; i += 4) {
+      const __m128 dx = _mm_sub_ps(_mm_loadu_ps(xs_+i), qx);
+      const __m128 dy = _mm_sub_ps(_mm_loadu_ps(ys_+i), qy);
+      const __m128 dz = _mm_sub_ps(_mm_loadu_ps(zs_+i), qz);
+      const __m128 dists = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+          _mm_mul_ps(dz, dz));
+
+      // Keep the first minimum in each lane. SSE2 has no blend instruction,
+      // the selection is done with bitwise operations instead.
+      const __m128 closer = _mm_cmplt_ps(dists, best_dists);
+      const __m128i closer_mask = _mm_castps_si128(closer);
+      best_dists = _mm_or_ps(_mm_and_ps(closer, dists),
+                             _mm_andnot_ps(closer, best_dists));
+      best_indices = _mm_or_si128(_mm_and_si128(closer_mask, indices),
+                                  _mm_andnot_si128(closer_mask, best_indices));
+      indices = _mm_add_epi32(indices, stride);
+    }
+
+    alignas(16) float lane_dists[4];
+    alignas(16) int32_t lane_indices[4];
+    _mm_store_ps(lane_dists, best_dists);
+    _mm_store_si128(reinterpret_cast<__m128i*>(lane_indices), best_indices);
+    // Among the lanes, ties are resolved to the smaller index so that the
+    // result is the same as the scalar loop.
+    size_t best_lane = 0;
+    for (size_t k = 1; k < 4; ++k) {
+      if (lane_dists[k] < lane_dists[best_lane] ||
+          (lane_dists[k] == lane_dists[best_lane] &&
+           lane_indices[k] < lane_indices[best_lane])) best_lane = k;
+    }
+    if (lane_dists[best_lane] < sqr_dist) {
+      sqr_dist = lane_dists[best_lane];
+      index = static_cast<size_t>(lane_indices[best_lane]);
+    }
+  }
+#endif
+
+  // The remaining records, or all the records if SIMD is not available.
+  for (; i < end; ++i) {
+    const float dx = xs_[i] - location.x;
+    const float dy = ys_[i] - location.y;
+    const float dz = zs_[i] - location.z;
+    const float dist = dx*dx + dy*dy + dz*dz;
+    if (dist < sqr_dist) {
+      sqr_dist = dist;
+      index = i;
+    }
+  }
+
+  return;
+}
+
+const bool FastWaypointMap::closestRecordAlongHint(
+    const CarlaLocation& location, const size_t hint, size_t& index) const {
+
+  // Records of the same lane are contiguous within a cell. Note that the
+  // index wraps around to a large number if it goes below 0.
+  const WaypointRecord& hint_record = records_[hint];
+  auto onHintLane = [this, &hint_record](const size_t i)->bool{
+    return i < record_num_ &&
+           records_[i].road    == hint_record.road &&
+           records_[i].section == hint_record.section &&
+           records_[i].lane    == hint_record.lane;
+  };
+
+  // Jump along the lane by the displacement of the query projected onto
+  // the lane, which saves most of the steps if the query is far from the hint.
+  index = hint;
+  const size_t next = onHintLane(hint+1) ? hint+1 : hint-1;
+  if (onHintLane(next)) {
+    const long jump = std::lround(projection(location, hint, next));
+    const size_t target = next>hint ? hint+jump : hint-jump;
+    if (onHintLane(target)) index = target;
+  }
+
+  float sqr_dist = sqrDistance(location, index);
+
+  for (size_t step = 0; step < kHintWalkSteps_; ++step) {
+    if (onHintLane(index+1) && sqrDistance(location, index+1)<sqr_dist) {
+      sqr_dist = sqrDistance(location, ++index);
+      continue;
+    }
+    if (onHintLane(index-1) && sqrDistance(location, index-1)<sqr_dist) {
+      sqr_dist = sqrDistance(location, --index);
+      continue;
+    }
+
+    // The walk stops at a local minimum. It is accepted only if it is not
+    // at either end of the lane records, where the lane may continue in
+    // another cell or on another road.
+    return onHintLane(index-1) && onHintLane(index+1) &&
+           sqr_dist <= kHintRadius_*kHintRadius_;
+  }
+
+  return false;
+}
+
+const bool FastWaypointMap::closestRecordAroundHint(
+    const CarlaLocation& location, const size_t hint, size_t& index) const {
+
+  // The lanes to be searched, i.e. the lane of the hint and its adjacent
+  // lanes on the same road section. Note that there is no lane with ID 0.
+  const WaypointRecord& hint_record = records_[hint];
+  const int32_t lane = hint_record.lane;
+  const int32_t lanes[3] = {
+    lane, lane-1==0 ? -1 : lane-1, lane+1==0 ? 1 : lane+1};
+
+  float best_sqr_dist = std::numeric_limits<float>::max();
+  bool best_resolved = false;
+
+  auto searchCell = [this, &location, &hint_record, &lanes,
+                     &index, &best_sqr_dist, &best_resolved](
+      const int32_t x, const int32_t y)->void{
+    const GridCell* grid_cell = cell(x, y);
+    if (!grid_cell) return;
+
+    for (const int32_t lane : lanes) {
+      // Records of a lane are contiguous within a cell.
+      const auto key = std::make_tuple(hint_record.road, hint_record.section, lane);
+      const auto range = std::equal_range(
+          records_+grid_cell->begin, records_+grid_cell->end, key,
+          LaneKeyCompare());
+      if (range.first == range.second) continue;
+
+      bool resolved = false;
+      const size_t i = closestRecordOnLane(
+          location, range.first-records_, range.second-records_, resolved);
+      const float sqr_dist = sqrDistance(location, i);
+      if (sqr_dist < best_sqr_dist) {
+        best_sqr_dist = sqr_dist;
+        best_resolved = resolved;
+        index = i;
+      }
+    }
+    return;
+  };
+
+  const int32_t cx = cellCoordinate(location.x);
+  const int32_t cy = cellCoordinate(location.y);
+  searchCell(cx, cy);
+
+  // Search the neighboring cells that may contain a closer record.
+  const double fx = location.x - cx*cell_size_;
+  const double fy = location.y - cy*cell_size_;
+  for (int32_t dx = -1; dx <= 1; ++dx) {
+    for (int32_t dy = -1; dy <= 1; ++dy) {
+      if (dx==0 && dy==0) continue;
+      const double gap_x = dx<0 ? fx : (dx>0 ? cell_size_-fx : 0.0);
+      const double gap_y = dy<0 ? fy : (dy>0 ? cell_size_-fy : 0.0);
+      if (gap_x*gap_x+gap_y*gap_y >= best_sqr_dist) continue;
+      searchCell(cx+dx, cy+dy);
+    }
+  }
+
+  // If the query is beyond the end of the lane, the closest waypoint
+  // may be on the successor or predecessor roads, which are not searched.
+  return best_resolved && best_sqr_dist<=kHintRadius_*kHintRadius_;
+}
+
+const size_t FastWaypointMap::closestRecordOnLane(
+    const CarlaLocation& location, size_t begin, size_t end, bool& resolved) const {
+
+  // The query cannot be projected onto a lane with a single record.
+  resolved = false;
+  if (end-begin < 2) return begin;
+
+  // The query should be neither behind the first record nor ahead of
+  // the last record, otherwise the closest waypoint may be on another road.
+  const size_t first = begin;
+  const size_t last = end - 1;
+  resolved = projection(location, first, first+1)>=0.0f &&
+             projection(location, last-1, last)<=1.0f;
+
+  // Binary search for the first record, from which the query is behind
+  // w.r.t. the direction of the lane. The closest record is either this
+  // record or the one before it.
+  end = last;
+  while (begin < end) {
+    const size_t mid = begin + (end-begin)/2;
+    if (projection(location, mid, mid+1) > 0.0f) begin = mid + 1;
+    else end = mid;
+  }
+
+  if (begin == first) return begin;
+  return sqrDistance(location, begin-1)<sqrDistance(location, begin) ? begin-1 : begin;
+}
+
+void FastWaypointMap::checkNonEmpty(const CarlaLocation& location) const {
+  if (record_num_ > 0) return;
+
+  std::string error_msg("Cannot find a waypoint close to the query location.\n");
+  std::string location_msg = (
+      boost::format("Query location: x:%1% y:%2% z:%3%\n")
+      % location.x % location.y % location.z).str();
+  std::string fast_map_msg = (
+      boost::format("fast map size:%lu resolution:%f\n")
+      % size() % resolution()).str();
+  throw std::runtime_error(error_msg + location_msg + fast_map_msg);
+}
+
+boost::shared_ptr<FastWaypointMap::CarlaWaypoint>
+  FastWaypointMap::recordWaypoint(const size_t index) const {
+
+  // The waypoint may be recovered by different threads at the same time,
+  // which is harmless since the recovered waypoints are identical.
+  boost::shared_ptr<CarlaWaypoint> waypoint = boost::atomic_load(&waypoints_[index]);
+  if (waypoint) return waypoint;
+
+  // The waypoint is recovered by projecting the record location onto
+  // the driving lanes of the map.
+  const WaypointRecord& record = records_[index];
+  waypoint = map_->GetWaypoint(CarlaLocation(record.x, record.y, record.z));
+
+  // Where lanes overlap, e.g. in junctions and lane merges, the projection
+  // may end up on a different lane than the recorded one. The waypoint is
+  // then searched on the recorded lane instead.
+  if (!waypoint || laneKey(waypoint) != recordLaneKey(record))
+    waypoint = laneWaypoint(record);
+
+  if (!waypoint) {
+    std::string error_msg(
+        "FastWaypointMap::recordWaypoint(): "
+        "cannot recover the waypoint from the carla map.\n");
+    std::string record_msg = (
+        boost::format("record x:%1% y:%2% z:%3% road:%4% lane:%5% s:%6%\n")
+        % record.x % record.y % record.z
+        % record.road % record.lane % record.s).str();
+    throw std::runtime_error(error_msg + record_msg);
+  }
+
+  boost::atomic_store(&waypoints_[index], waypoint);
+  return waypoint;
+}
+
+boost::shared_ptr<FastWaypointMap::CarlaWaypoint>
+  FastWaypointMap::laneWaypoint(const WaypointRecord& record) const {
+
+  const LaneKeyCompare::LaneKey record_key = recordLaneKey(record);
+  boost::shared_ptr<CarlaWaypoint> waypoint = nullptr;
+  double min_error = std::numeric_limits<double>::max();
+
+  // Start from the entries of the recorded lane in the topology of the map,
+  // and move forward along the lane by the difference in s.
+  for (const auto& segment : map_->GetTopology()) {
+    for (const auto& entry : {segment.first, segment.second}) {
+      if (laneKey(entry) != record_key) continue;
+
+      // The s decreases along the lanes with positive ids.
+      const double offset = std::fabs(record.s - entry->GetDistance());
+      std::vector<boost::shared_ptr<CarlaWaypoint>> candidates {entry};
+      if (offset > 1.0e-3) candidates = entry->GetNext(offset);
+
+      for (const auto& candidate : candidates) {
+        if (laneKey(candidate) != record_key) continue;
+        const double error = std::fabs(candidate->GetDistance() - record.s);
+        if (error >= min_error) continue;
+        waypoint = candidate;
+        min_error = error;
+      }
+    }
+  }
+
+  return waypoint;
+}
+
+const uint64_t FastWaypointMap::fnv1aHash(const std::string& str) {
+  uint64_t hash = 14695981039346656037ull;
+  for (const char c : str) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+const bool FastWaypointMap::attachSharedMemory(const std::string& name) {
+
+  const int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) return false;
+
+  // Wait for the publishing process to fill in the segment. The publishing
+  // process locks the segment, and then sizes it to hold the header. It is
+  // resized to hold the whole map before anything else is written, and the
+  // magic string is written at last, which marks it as ready. The lock is
+  // held until then, and released by the system if the process is gone.
+  const std::chrono::steady_clock::time_point deadline =
+    std::chrono::steady_clock::now() +
+    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(kSharedMemoryTimeout_));
+
+  void* mapped = MAP_FAILED;
+  size_t size = 0;
+
+  auto release = [&mapped, &size, fd]()->void{
+    if (mapped != MAP_FAILED) ::munmap(mapped, size);
+    ::close(fd);
+  };
+
+  // Size of the segment, or 0 if it cannot be read.
+  auto segmentSize = [fd]()->size_t{
+    struct stat segment_stat;
+    if (::fstat(fd, &segment_stat) != 0) return 0;
+    return static_cast<size_t>(segment_stat.st_size);
+  };
+
+  // Remove the segment, unless the name already refers to a new segment
+  // created by another process taking over.
+  auto unlinkSegment = [fd, &name]()->void{
+    const int name_fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+    if (name_fd < 0) return;
+    struct stat segment_stat, name_stat;
+    if (::fstat(fd, &segment_stat) == 0 && ::fstat(name_fd, &name_stat) == 0 &&
+        segment_stat.st_ino == name_stat.st_ino) {
+      ::shm_unlink(name.c_str());
+    }
+    ::close(name_fd);
+  };
+
+  while (true) {
+    // Remap the segment if it is resized.
+    const size_t segment_size = segmentSize();
+    if (segment_size >= sizeof(CacheHeader) && segment_size != size) {
+      if (mapped != MAP_FAILED) ::munmap(mapped, size);
+      size = segment_size;
+      mapped = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+      if (mapped == MAP_FAILED) size = 0;
+    }
+
+    // The segment is ready if the magic string is written. The segment is
+    // resized before that, which is checked in case the resize happens
+    // right after the mapping above.
+    if (mapped != MAP_FAILED &&
+        std::memcmp(mapped, kCacheMagic_, sizeof(CacheHeader::magic)) == 0) {
+      if (segmentSize() == size) break;
+      continue;
+    }
+
+    // The segment is abandoned if the publishing process has released the
+    // lock without marking the segment as ready, e.g. it crashed while
+    // constructing the map. The segment is sized only after it is locked.
+    if (segment_size >= sizeof(CacheHeader) && ::flock(fd, LOCK_SH|LOCK_NB) == 0) {
+      ::flock(fd, LOCK_UN);
+      // The segment may be marked as ready right before the lock is released.
+      if (mapped != MAP_FAILED &&
+          std::memcmp(mapped, kCacheMagic_, sizeof(CacheHeader::magic)) == 0) continue;
+      unlinkSegment();
+      release();
+      return false;
+    }
+
+    // The publishing process may be stuck, or never get to lock the segment.
+    // The segment is removed, so that this and later processes do not wait
+    // for it again.
+    if (std::chrono::steady_clock::now() > deadline) {
+      unlinkSegment();
+      release();
+      return false;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+
+  // The mapping stays valid after the file descriptor is closed.
+  ::close(fd);
+  std::atomic_thread_fence(std::memory_order_acquire);
+
+  if (!attachCache(mapped, size)) {
+    ::munmap(mapped, size);
+    return false;
+  }
+
+  shared_memory_ = true;
+  return true;
+}
+
+const bool FastWaypointMap::claimSharedMemory(const int fd) {
+
+  // The lock is taken before the segment is sized, so that other processes
+  // never see a sized segment without the lock.
+  if (::flock(fd, LOCK_EX|LOCK_NB) != 0) return false;
+
+  CacheHeader header;
+  std::memset(&header, 0, sizeof(CacheHeader));
+
+  if (::ftruncate(fd, sizeof(CacheHeader)) != 0) return false;
+  return ::pwrite(fd, &header, sizeof(CacheHeader), 0) ==
+         static_cast<ssize_t>(sizeof(CacheHeader));
+}
+
+const bool FastWaypointMap::publishSharedMemory(const int fd) {
+
+  CacheHeader header = cacheLayout();
+  const size_t size = cacheSize(header);
+
+  if (::ftruncate(fd, size) != 0) return false;
+  void* mapped = ::mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapped == MAP_FAILED) return false;
+
+  char* buffer = static_cast<char*>(mapped);
+  std::memcpy(buffer+header.record_offset, records_, record_num_*sizeof(WaypointRecord));
+  std::memcpy(buffer+header.cell_offset, cells_, cell_num_*sizeof(GridCell));
+  std::memcpy(buffer+header.coordinate_offset, xs_, record_num_*sizeof(float));
+  std::memcpy(buffer+header.coordinate_offset+record_num_*sizeof(float),
+              ys_, record_num_*sizeof(float));
+  std::memcpy(buffer+header.coordinate_offset+2*record_num_*sizeof(float),
+              zs_, record_num_*sizeof(float));
+  std::memcpy(buffer+header.geometry_offset, geometries_,
+              record_num_*sizeof(WaypointGeometry));
+
+  // Write the magic string at last to mark the segment as ready.
+  std::memset(header.magic, 0, sizeof(header.magic));
+  std::memcpy(buffer, &header, sizeof(CacheHeader));
+  std::atomic_thread_fence(std::memory_order_release);
+  std::memcpy(buffer, kCacheMagic_, sizeof(header.magic));
+
+  // Drop the private copy of the map, and switch to the segment.
+  if (mapped_cache_) ::munmap(mapped_cache_, mapped_cache_size_);
+  mapped_cache_ = nullptr;
+  mapped_cache_size_ = 0;
+  std::vector<WaypointRecord>().swap(record_buffer_);
+  std::vector<GridCell>().swap(cell_buffer_);
+  std::vector<float>().swap(coordinate_buffer_);
+  std::vector<WaypointGeometry>().swap(geometry_buffer_);
+
+  ::mprotect(mapped, size, PROT_READ);
+  if (!attachCache(mapped, size)) {
+    // This should never happen, since the header is just written.
+    ::munmap(mapped, size);
+    throw std::runtime_error(
+        "FastWaypointMap::publishSharedMemory(): "
+        "cannot attach to the shared memory segment just published.\n");
+  }
+
+  shared_memory_ = true;
+  return true;
+}
+
+FastWaypointMap::CacheHeader FastWaypointMap::cacheLayout() const {
+
+  CacheHeader header = cacheHeader(map_, resolution_);
+  header.record_num = record_num_;
+  header.record_offset = sizeof(CacheHeader);
+  header.cell_min[0] = cell_min_[0];
+  header.cell_min[1] = cell_min_[1];
+  header.cell_max[0] = cell_max_[0];
+  header.cell_max[1] = cell_max_[1];
+  header.cell_num = cell_num_;
+  header.cell_offset = header.record_offset + record_num_*sizeof(WaypointRecord);
+  header.coordinate_offset = header.cell_offset + cell_num_*sizeof(GridCell);
+  header.geometry_offset = header.coordinate_offset + 3*record_num_*sizeof(float);
+
+  return header;
+}
+
+FastWaypointMap::CacheHeader FastWaypointMap::cacheHeader(
+    const boost::shared_ptr<const CarlaMap>& map,
+    const double resolution) {
+
+  CacheHeader header;
+  std::memset(&header, 0, sizeof(CacheHeader));
+
+  std::memcpy(header.magic, kCacheMagic_, sizeof(header.magic));
+  header.version = kCacheVersion_;
+  header.record_size = sizeof(WaypointRecord);
+  header.opendrive_hash = fnv1aHash(map->GetOpenDrive());
+  header.resolution = resolution;
+  header.cell_size = resolution * kCellSizeInResolution_;
+  std::strncpy(header.map_name, map->GetName().c_str(), sizeof(header.map_name)-1);
+
+  return header;
+}
+
+} // End namespace utils.
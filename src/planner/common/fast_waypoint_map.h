@@ -14,25 +14,68 @@
 
 #pragma once
 
+#include <cmath>
+#include <cstdint>
+#include <tuple>
 #include <string>
 #include <vector>
+#include <mutex>
+#include <shared_mutex>
 #include <unordered_map>
 #include <boost/format.hpp>
+#include <boost/optional.hpp>
 #include <boost/smart_ptr.hpp>
 #include <boost/core/noncopyable.hpp>
 
-#include <pcl/point_cloud.h>
-#include <pcl/kdtree/kdtree_flann.h>
-
 #include <carla/client/Map.h>
 #include <carla/client/Waypoint.h>
 
+#include <router/common/router.h>
 #include <planner/common/utils.h>
 
 namespace utils {
 
+class LaneGraph;
+
+/**
+ * \brief FastWaypointMap provides fast queries of the closest carla waypoint
+ *        to a given location.
+ *
+ * The waypoints are generated on the map with a fixed resolution and stored
+ * as a flat array of records. The records are indexed with a uniform grid
+ * (in the x-y plane), whose cells are kept in an open addressing hash table.
+ * Within each cell, the records are grouped by lanes and sorted by the
+ * distance along the lane, so that the records of a lane in a cell are
+ * always contiguous.
+ *
+ * The coordinates of the records are also kept as a structure of arrays,
+ * which allows scoring the records in a cell with SIMD instructions.
+ *
+ * The geometry of the lanes at the records, i.e. curvature, heading, and
+ * lane width, is computed once at construction, so that the planners do not
+ * have to look into the OpenDRIVE road data at runtime.
+ *
+ * Since the records and the cells are plain old data, they can be dumped to
+ * a cache file and memory mapped back at the next start, which skips both
+ * the waypoint generation and the index construction. With the same layout,
+ * the map can also be published into a POSIX shared memory segment, so that
+ * all processes on the machine attach to a single copy of the map.
+ *
+ * The carla waypoint objects cannot be serialized. If the map is loaded from
+ * a cache file, the waypoint objects are recovered from the carla map lazily,
+ * i.e. when a record is hit by a query for the first time.
+ *
+ * The map can also be restricted to a route, in which case only the lanes on
+ * the routed roads, the junction connectors between them, and the beginning
+ * (end) of the lanes leaving (entering) the route are indexed. Queries within
+ * the lateral margin of the indexed records are matched to the indexed
+ * records only. Queries further away are matched within square tiles of the
+ * full map, which are indexed on demand and kept for later queries.
+ */
 class FastWaypointMap : private boost::noncopyable {
 
+  friend class LaneGraph;
+
 protected:
 
   using CarlaMap       = carla::client::Map;
@@ -40,131 +83,711 @@ protected:
   using CarlaTransform = carla::geom::Transform;
   using CarlaLocation  = carla::geom::Location;
 
-  /// Hash function of \c pcl::PointXYZ.
-  struct PointXYZHash {
-    size_t operator()(const pcl::PointXYZ& point) const {
-      size_t seed = 0;
-      hashCombine(seed, point.x, point.y, point.z);
-      return seed;
-    }
+public:
+
+  /// A waypoint record stored in the map (and the cache file).
+  struct WaypointRecord {
+    float x;
+    float y;
+    float z;
+    float s;
+    uint32_t road;
+    uint32_t section;
+    int32_t lane;
+    uint32_t reserved;
   };
 
-  /// Compare function of \c pcl::PointXYZ.
-  struct PointXYZEqual {
-    bool operator()(const pcl::PointXYZ& p1, const pcl::PointXYZ& p2) const {
-      return (p1.x==p2.x) & (p1.y==p2.y) & (p1.z==p2.z);
-    }
+  /// Geometry of the lane at a waypoint record.
+  struct WaypointGeometry {
+    /// Curvature of the lane, with the same sign convention as
+    /// utils::curvatureAtWaypoint(). NaN if it cannot be computed,
+    /// e.g. on spiral roads.
+    float curvature;
+    /// Yaw of the waypoint in degrees.
+    float heading;
+    /// Width of the lane.
+    float lane_width;
+    float reserved;
   };
 
+  /// A cell of the grid, which owns the records in [begin, end).
+  /// A cell slot in the hash table is empty if begin==end.
+  struct GridCell {
+    int32_t x;
+    int32_t y;
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  /// Header of the cache file.
+  struct CacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t opendrive_hash;
+    double resolution;
+    char map_name[64];
+    uint64_t record_num;
+    uint64_t record_offset;
+    double cell_size;
+    int32_t cell_min[2];
+    int32_t cell_max[2];
+    uint64_t cell_num;
+    uint64_t cell_offset;
+    uint64_t coordinate_offset;
+    uint64_t geometry_offset;
+  };
+
+  /// Magic string at the beginning of every cache file.
+  static constexpr const char* kCacheMagic_ = "FASTWMAP";
+
+  /// Version of the cache file format.
+  /// Bump the version whenever the layout of the cache file changes.
+  static constexpr uint32_t kCacheVersion_ = 6;
+
+  /// The size of a grid cell in the unit of the waypoint resolution.
+  static constexpr double kCellSizeInResolution_ = 40.0;
+
+  /// A hinted query is accepted only if the matched waypoint is within
+  /// this distance (in meters). Lanes are at least 2.5m wide, so that no
+  /// other lane than the ones searched around the hint can be closer.
+  static constexpr double kHintRadius_ = 1.0;
+
+  /// Maximum time (in seconds) to wait for another process to publish
+  /// the map into the shared memory segment. The segment is removed and
+  /// published again if it is still not ready after this time.
+  static constexpr double kSharedMemoryTimeout_ = 120.0;
+
+  /// Maximum number of records to walk along the lane from the hint.
+  static constexpr size_t kHintWalkSteps_ = 20;
+
+  /// The size of the on-demand tiles in the unit of the grid cells.
+  static constexpr int32_t kTileSizeInCells_ = 50;
+
 protected:
 
   /// Resolution of the waypoints (minimum distance).
   double resolution_;
 
-  /// The map is stored as location-to-waypoint pair.
-  std::unordered_map<pcl::PointXYZ,
-                     boost::shared_ptr<CarlaWaypoint>,
-                     PointXYZHash,
-                     PointXYZEqual> xyz_to_waypoint_table_;
+  /// The carla map used to recover waypoints from the records.
+  boost::shared_ptr<const CarlaMap> map_ = nullptr;
+
+  /// Waypoint records sorted by grid cells.
+  /// The pointer either points to \c record_buffer_ or the mapped cache file.
+  const WaypointRecord* records_ = nullptr;
+
+  /// Number of the waypoint records.
+  size_t record_num_ = 0;
+
+  /// Storage of the records if they are not mapped from a cache file.
+  std::vector<WaypointRecord> record_buffer_;
 
-  /// KDtree built with all waypoint locations.
-  pcl::KdTreeFLANN<pcl::PointXYZ> kdtree_;
+  /// The x, y, z coordinates of the records (with the same index).
+  /// The pointers either point to \c coordinate_buffer_ or the mapped cache file.
+  const float* xs_ = nullptr;
+  const float* ys_ = nullptr;
+  const float* zs_ = nullptr;
 
-  /// The point cloud built with all waypoint locations.
-  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_ = nullptr;
+  /// Storage of the coordinates if they are not mapped from a cache file.
+  std::vector<float> coordinate_buffer_;
+
+  /// The lane geometry at the records (with the same index).
+  /// The pointer either points to \c geometry_buffer_ or the mapped cache file.
+  const WaypointGeometry* geometries_ = nullptr;
+
+  /// Storage of the lane geometry if it is not mapped from a cache file.
+  std::vector<WaypointGeometry> geometry_buffer_;
+
+  /// Size of the grid cells.
+  double cell_size_ = 0.0;
+
+  /// Range of the cell coordinates, i.e. the bounding box of the grid.
+  int32_t cell_min_[2] = {0, 0};
+  int32_t cell_max_[2] = {-1, -1};
+
+  /// Hash table of the grid cells.
+  /// The number of the slots is always a power of 2.
+  const GridCell* cells_ = nullptr;
+
+  /// Number of the slots in the hash table.
+  size_t cell_num_ = 0;
+
+  /// Storage of the hash table if it is not mapped from a cache file.
+  std::vector<GridCell> cell_buffer_;
+
+  /// The memory mapped cache file or shared memory segment.
+  void* mapped_cache_ = nullptr;
+  size_t mapped_cache_size_ = 0;
+
+  /// Whether \c mapped_cache_ is a shared memory segment.
+  bool shared_memory_ = false;
+
+  /// Carla waypoints corresponding to the records (with the same index).
+  /// The waypoints are filled in lazily if the map is loaded from a cache file.
+  mutable std::vector<boost::shared_ptr<CarlaWaypoint>> waypoints_;
+
+  /// Whether the records are restricted to a route.
+  bool route_restricted_ = false;
+
+  /// Cells (with the same coordinates as the grid) within the lateral margin
+  /// of the indexed records, stored as a bitmap over the rectangle starting
+  /// at \c region_min_. Only used if the map is restricted to a route.
+  std::vector<uint64_t> region_;
+  int32_t region_min_[2] = {0, 0};
+  int32_t region_size_[2] = {0, 0};
+
+  /// The entry waypoint of a lane in a lane section, together with
+  /// a (conservative) bounding box of the lane in the x-y plane.
+  struct LaneSegment {
+    boost::shared_ptr<CarlaWaypoint> entry;
+    float min[2];
+    float max[2];
+  };
+
+  /// All the lane segments of the map, collected at the first off-route query.
+  mutable std::vector<LaneSegment> lane_segments_;
+
+  /// Guards the construction of \c lane_segments_.
+  mutable std::once_flag lane_segments_flag_;
+
+  /// An on-demand tile, which is constructed once by the first query
+  /// reaching it. The other queries wait on \c flag for the construction.
+  struct TileSlot {
+    std::once_flag flag;
+    /// The tile, nullptr if there is no waypoint in the tile.
+    boost::shared_ptr<const FastWaypointMap> tile = nullptr;
+  };
+
+  /// On-demand tiles of the full map, keyed by the tile coordinates.
+  mutable std::unordered_map<uint64_t, boost::shared_ptr<TileSlot>> tiles_;
+
+  /// Guards \c tiles_. The tiles are constructed without holding the lock.
+  mutable std::shared_timed_mutex tiles_mutex_;
+
+  /// Lane graphs constructed on this map, keyed by the routers.
+  mutable std::unordered_map<const router::Router*,
+                             boost::shared_ptr<const LaneGraph>> lane_graphs_;
+
+  /// Guards \c lane_graphs_.
+  mutable std::mutex lane_graphs_mutex_;
 
 public:
 
+  /**
+   * \brief Construct the map by generating waypoints on the carla map.
+   * \param[in] map The carla map.
+   * \param[in] resolution The resolution of the waypoints.
+   */
   FastWaypointMap(const boost::shared_ptr<const CarlaMap>& map,
-                  const double resolution = 0.05) : resolution_(resolution) {
-
-    // Generate waypoints on the map with the given resolution.
-    const std::vector<boost::shared_ptr<CarlaWaypoint>>
-      waypoints = map->GenerateWaypoints(resolution_);
-
-    // Add all waypoints to the table.
-    // At the same time, collect all locations into a point cloud.
-    cloud_ = boost::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
-    cloud_->width = waypoints.size();
-    cloud_->height = 1;
-
-    for (const auto& waypoint : waypoints) {
-      const pcl::PointXYZ point = carlaLocationToPointXYZ(waypoint->GetTransform().location);
-      xyz_to_waypoint_table_[point] = waypoint;
-      cloud_->push_back(point);
-    }
-
-    // Build a KDtree with the point cloud.
-    kdtree_.setEpsilon(resolution_);
-    kdtree_.setInputCloud(cloud_);
+                  const double resolution = 0.05);
+
+  /**
+   * \brief Construct the map with a cache file.
+   *
+   * The cache file is identified by the map name, the hash of the OpenDRIVE
+   * content, and the resolution. If a matching cache file can be found in the
+   * given directory, the map is loaded from the cache file. Otherwise, the map
+   * is constructed from scratch and the cache file is written for later use.
+   *
+   * \param[in] map The carla map.
+   * \param[in] cache_dir The directory where the cache files are kept.
+   * \param[in] resolution The resolution of the waypoints.
+   */
+  FastWaypointMap(const boost::shared_ptr<const CarlaMap>& map,
+                  const std::string& cache_dir,
+                  const double resolution = 0.05);
+
+  /**
+   * \brief Construct the map with a cache file, optionally shared with other
+   *        processes through a POSIX shared memory segment.
+   *
+   * The first process creating the segment constructs the map (with the
+   * cache file if possible) and copies it into the segment. Other processes
+   * wait for the segment to be filled, and attach to it read-only. The
+   * segment is locked while it is filled. If the lock is released before
+   * the segment is filled, e.g. the publishing process crashed, or the
+   * segment is not filled in \c kSharedMemoryTimeout_, the segment is
+   * removed, and the map is published again by the waiting process.
+   *
+   * The segment is kept after all processes exit, so that later runs can
+   * attach to it directly. It lives in /dev/shm, named after the cache file.
+   *
+   * \param[in] map The carla map.
+   * \param[in] cache_dir The directory where the cache files are kept.
+   * \param[in] shared_memory Whether to share the map through shared memory.
+   * \param[in] resolution The resolution of the waypoints.
+   */
+  FastWaypointMap(const boost::shared_ptr<const CarlaMap>& map,
+                  const std::string& cache_dir,
+                  const bool shared_memory,
+                  const double resolution = 0.05);
+
+  /**
+   * \brief Construct the map restricted to the given route.
+   *
+   * The lanes on the roads of the route, and the lanes in the junctions
+   * connecting two roads on the route are indexed. For other lanes
+   * connected to the route, i.e. on-ramps and off-ramps, only the part
+   * within the longitudinal margin to the route is indexed.
+   *
+   * \param[in] map The carla map.
+   * \param[in] router The router providing the roads of the route.
+   * \param[in] lateral_margin Queries within this distance to the indexed
+   *                           records are matched to the indexed records.
+   *                           Other queries are matched within the tiles
+   *                           of the full map, which are indexed on demand.
+   * \param[in] longitudinal_margin The length of the connected lanes indexed
+   *                                together with the route.
+   * \param[in] resolution The resolution of the waypoints.
+   */
+  FastWaypointMap(const boost::shared_ptr<const CarlaMap>& map,
+                  const boost::shared_ptr<const router::Router>& router,
+                  const double lateral_margin,
+                  const double longitudinal_margin,
+                  const double resolution = 0.05);
 
-    return;
-  }
+  /// Destructor, unmaps the cache file if any.
+  ~FastWaypointMap();
 
   /// Get the resolution of the map.
   const double resolution() const { return resolution_; }
 
   /// Get the number of waypoints stored in the map.
-  const size_t size() const { return xyz_to_waypoint_table_.size(); }
+  const size_t size() const { return record_num_; }
+
+  /// Check if the map is loaded from a cache file.
+  const bool fromCache() const { return mapped_cache_ && !shared_memory_; }
+
+  /// Check if the map is attached to a shared memory segment.
+  const bool sharedMemory() const { return shared_memory_; }
+
+  /// Check if the map is restricted to a route.
+  const bool routeRestricted() const { return route_restricted_; }
+
+  /// Get the number of the tiles indexed on demand so far.
+  const size_t tileNum() const {
+    std::shared_lock<std::shared_timed_mutex> tiles_lock(tiles_mutex_);
+    return tiles_.size();
+  }
 
+  /// Get the closest waypoint to the given location.
+  boost::shared_ptr<CarlaWaypoint> waypoint(const CarlaLocation& location) const;
+
+  /// Get the closest waypoint to the given transform.
+  boost::shared_ptr<CarlaWaypoint> waypoint(const CarlaTransform& transform) const {
+    return waypoint(transform.location);
+  }
+
+  /**
+   * \brief Get the closest waypoints to a batch of locations.
+   *
+   * The queries are processed in the order of the grid cells they fall in,
+   * so that the cells shared by nearby queries stay in the cache.
+   *
+   * \param[in] locations The query locations.
+   * \return The closest waypoints, in the same order as the queries.
+   */
+  std::vector<boost::shared_ptr<CarlaWaypoint>> waypoints(
+      const std::vector<CarlaLocation>& locations) const;
+
+  /**
+   * \brief Get the closest waypoints to a batch of locations with hints.
+   *
+   * The queries with hints are tried with the hints first, see
+   * waypoint(const CarlaLocation&, boost::optional<size_t>&). The rest
+   * are processed as a batch without hints.
+   *
+   * \param[in] locations The query locations.
+   * \param[in,out] hints The hints for the queries, which are updated with
+   *                      the new matches. Should be of the same size as
+   *                      \c locations.
+   * \return The closest waypoints, in the same order as the queries.
+   */
+  std::vector<boost::shared_ptr<CarlaWaypoint>> waypoints(
+      const std::vector<CarlaLocation>& locations,
+      std::vector<boost::optional<size_t>>& hints) const;
+
+  /**
+   * \brief Get the closest waypoint to the given location with a hint.
+   *
+   * The hint is the record index of a previous match close to the query,
+   * e.g. the waypoint of the same vehicle at the last time step. The
+   * function first walks along the lane from the hint. If the walk does not
+   * end up close to the query, the lane of the hint and its adjacent lanes
+   * around the query are searched. If the matched waypoint is still not
+   * within \c kHintRadius_ to the query, or no hint is provided, the function
+   * falls back to the global search.
+   *
+   * \param[in] location The query location.
+   * \param[in,out] hint The record index of a previous match. It is updated
+   *                     with the record index of the new match.
+   * \return The closest waypoint to the query location.
+   */
   boost::shared_ptr<CarlaWaypoint> waypoint(
-      const CarlaLocation& location) const {
-
-    // Create the query point based on the location.
-    const pcl::PointXYZ query_point = carlaLocationToPointXYZ(location);
-
-    // Search for the closest point.
-    std::vector<int> indices(1);
-    std::vector<float> sqr_distance(1);
-    int num = kdtree_.nearestKSearch(query_point, 1, indices, sqr_distance);
-
-    if (num <= 0) {
-      std::string error_msg("Cannot find a waypoint close to the query location.\n");
-      std::string location_msg = (
-          boost::format("Query location: x:%1% y:%2% z:%3%\n")
-          % location.x % location.y % location.z).str();
-      std::string fast_map_msg = (
-          boost::format("fast map size:%lu resolution:%f\n")
-          % size() % resolution()).str();
-
-      throw std::runtime_error(error_msg + location_msg);
+      const CarlaLocation& location, boost::optional<size_t>& hint) const;
+
+  /// Get the lane geometry at a record, i.e. the index used as hints.
+  const WaypointGeometry& geometry(const size_t index) const {
+    return geometries_[index];
+  }
+
+  /**
+   * \brief Find the record of a carla waypoint.
+   *
+   * The waypoint is matched with the record on the same lane, in the cell
+   * containing the waypoint, with the closest distance along the lane.
+   *
+   * \param[in] waypoint The query waypoint.
+   * \return The index of the record. If the lane of the waypoint is not
+   *         indexed around the waypoint, \c boost::none is returned.
+   */
+  boost::optional<size_t> waypointRecord(
+      const boost::shared_ptr<const CarlaWaypoint>& waypoint) const;
+
+  /**
+   * \brief Get the curvature at a carla waypoint.
+   *
+   * The curvature is read from the precomputed lane geometry. The function
+   * falls back to utils::curvatureAtWaypoint() only if the waypoint is not
+   * indexed by the map.
+   *
+   * \param[in] waypoint The query waypoint.
+   * \return The curvature at the waypoint.
+   */
+  const double curvature(const boost::shared_ptr<const CarlaWaypoint>& waypoint) const;
+
+  /**
+   * \brief Get the curvature at the closest waypoint to the given location.
+   *
+   * Same as curvature(waypoint(location)), but the curvature is read from
+   * the precomputed lane geometry of the matched record directly, without
+   * constructing the carla waypoint.
+   *
+   * \param[in] location The query location.
+   * \return The curvature at the closest waypoint.
+   */
+  const double curvature(const CarlaLocation& location) const;
+
+  /**
+   * \brief Get the lane graph of the map restricted by the given router.
+   *
+   * The graph is constructed at the first call with the router, and is
+   * shared by the later calls. The graph refers to the records of this
+   * map, and should not be kept beyond the lifetime of the map.
+   *
+   * \param[in] router The router used to restrict the successor lanes.
+   * \return The lane graph.
+   */
+  boost::shared_ptr<const LaneGraph> laneGraph(
+      const boost::shared_ptr<const router::Router>& router) const;
+
+  /**
+   * \brief Get the path of the cache file for the given map.
+   * \param[in] map The carla map.
+   * \param[in] cache_dir The directory where the cache files are kept.
+   * \param[in] resolution The resolution of the waypoints.
+   * \return The full path of the cache file.
+   */
+  static std::string cacheFile(const boost::shared_ptr<const CarlaMap>& map,
+                               const std::string& cache_dir,
+                               const double resolution);
+
+  /**
+   * \brief Get the name of the shared memory segment for the given map.
+   * \param[in] map The carla map.
+   * \param[in] resolution The resolution of the waypoints.
+   * \return The name of the segment, which starts with a slash.
+   */
+  static std::string sharedMemoryName(const boost::shared_ptr<const CarlaMap>& map,
+                                      const double resolution);
+
+  /**
+   * \brief Write the map into a cache file.
+   *
+   * The file is first written to a temporary file and renamed afterwards,
+   * so that other processes never see a partially written cache file.
+   *
+   * \param[in] filename The path of the cache file.
+   * \return True if the cache file is written successfully.
+   */
+  const bool saveCache(const std::string& filename) const;
+
+protected:
+
+  /// Compare the records with lane keys, i.e. (road, section, lane).
+  struct LaneKeyCompare {
+    using LaneKey = std::tuple<uint32_t, uint32_t, int32_t>;
+    bool operator()(const WaypointRecord& record, const LaneKey& key) const {
+      return std::make_tuple(record.road, record.section, record.lane) < key;
+    }
+    bool operator()(const LaneKey& key, const WaypointRecord& record) const {
+      return key < std::make_tuple(record.road, record.section, record.lane);
     }
+  };
+
+  /// Get the lane key, i.e. (road, section, lane), of a waypoint.
+  static LaneKeyCompare::LaneKey laneKey(const boost::shared_ptr<CarlaWaypoint>& waypoint) {
+    return std::make_tuple(waypoint->GetRoadId(),
+                           waypoint->GetSectionId(),
+                           waypoint->GetLaneId());
+  }
 
-    const pcl::PointXYZ target_point = cloud_->at(indices[0]);
-    const auto iter = xyz_to_waypoint_table_.find(target_point);
-
-    const CarlaLocation target_location(
-        target_point.x, target_point.y, target_point.z);
-    if ((target_location-location).Length() > resolution_) {
-      std::string error_msg = (boost::format(
-          "FastWaypointMap::waypoint(): "
-          "the distance between query location and closest location > %1%") % resolution_).str();
-      std::string location_msg = (
-          boost::format("query location x:%1% y:%2% z:%3%\n")
-          % location.x % location.y % location.z).str();
-      std::string target_location_msg = (
-          boost::format("closest location x:%1% y:%2% z:%3%\n")
-          % target_location.x % target_location.y % target_location.z).str();
+  /// Get the lane key, i.e. (road, section, lane), of a record.
+  static LaneKeyCompare::LaneKey recordLaneKey(const WaypointRecord& record) {
+    return std::make_tuple(record.road, record.section, record.lane);
+  }
+
+  /**
+   * \brief Construct the map with the given waypoints.
+   *
+   * This is used to index the tiles of a route restricted map.
+   *
+   * \param[in] map The carla map.
+   * \param[in] waypoints The waypoints to be indexed.
+   * \param[in] resolution The resolution of the waypoints.
+   */
+  FastWaypointMap(const boost::shared_ptr<const CarlaMap>& map,
+                  const std::vector<boost::shared_ptr<CarlaWaypoint>>& waypoints,
+                  const double resolution);
+
+  /// Generate the waypoint records with the carla map.
+  void generateRecords();
+
+  /// Generate the waypoint records with the given waypoints.
+  void generateRecords(const std::vector<boost::shared_ptr<CarlaWaypoint>>& waypoints);
+
+  /**
+   * \brief Generate the waypoints around the given route.
+   * \param[in] router The router providing the roads of the route.
+   * \param[in] longitudinal_margin The length of the connected lanes to be
+   *                                kept together with the route.
+   * \return The waypoints on the routed lanes and the connected lanes.
+   */
+  std::vector<boost::shared_ptr<CarlaWaypoint>> routeWaypoints(
+      const boost::shared_ptr<const router::Router>& router,
+      const double longitudinal_margin) const;
+
+  /**
+   * \brief Generate the waypoints along a lane within a lane section.
+   * \param[in] entry The entry waypoint of the lane.
+   * \param[in] distance The distance between the waypoints.
+   * \return The waypoints from the entry to the end of the lane section.
+   */
+  std::vector<boost::shared_ptr<CarlaWaypoint>> laneSegmentWaypoints(
+      const boost::shared_ptr<CarlaWaypoint>& entry,
+      const double distance) const;
+
+  /// Mark the cells within the lateral margin of the records.
+  void buildRegion(const double lateral_margin);
+
+  /// Check if the query is within the lateral margin of the records.
+  /// Always true if the map is not restricted to a route.
+  const bool inRegion(const CarlaLocation& location) const {
+    if (!route_restricted_) return true;
+    const int32_t x = cellCoordinate(location.x) - region_min_[0];
+    const int32_t y = cellCoordinate(location.y) - region_min_[1];
+    if (x<0 || y<0 || x>=region_size_[0] || y>=region_size_[1]) return false;
+    const size_t bit = static_cast<size_t>(y)*region_size_[0] + x;
+    return (region_[bit>>6] >> (bit&63)) & 1;
+  }
+
+  /**
+   * \brief Match the query with the on-demand tiles of the full map.
+   *
+   * The tile of the query and the eight tiles around it are searched.
+   *
+   * \param[in] location The query location.
+   * \return The tile and the index of the closest record in the tile. If
+   *         there is no record within one tile size to the query, the
+   *         returned tile is \c nullptr.
+   */
+  std::pair<boost::shared_ptr<const FastWaypointMap>, size_t> tileRecord(
+      const CarlaLocation& location) const;
+
+  /// Get the closest waypoint in the on-demand tiles, see tileRecord().
+  boost::shared_ptr<CarlaWaypoint> tileWaypoint(const CarlaLocation& location) const {
+    const std::pair<boost::shared_ptr<const FastWaypointMap>, size_t>
+      tile_record = tileRecord(location);
+    if (!tile_record.first) return nullptr;
+    return tile_record.first->recordWaypoint(tile_record.second);
+  }
+
+  /// Get the tile at the given tile coordinates, which is indexed if it
+  /// has not been yet. Can be called concurrently.
+  boost::shared_ptr<const FastWaypointMap> tile(const int32_t x, const int32_t y) const;
+
+  /// Index the tile at the given tile coordinates.
+  boost::shared_ptr<const FastWaypointMap> buildTile(const int32_t x, const int32_t y) const;
+
+  /// Collect all the lane segments of the map.
+  /// Should only be called through \c lane_segments_flag_.
+  void buildLaneSegments() const;
+
+  /// Load the map from the cache file in the given directory, or generate
+  /// the map and write the cache file if it is not available.
+  void initializeWithCache(const std::string& cache_dir);
+
+  /// Memory map the cache file and validate the header.
+  const bool loadCache(const std::string& filename);
+
+  /// Validate the header of the mapped memory, and point the records,
+  /// cells, and coordinates into it. The mapping is owned by the object
+  /// if the function returns true.
+  const bool attachCache(void* mapped, const size_t size);
+
+  /// Attach to the shared memory segment published by another process.
+  /// The segment is removed if it is abandoned by the publishing process,
+  /// or not ready in \c kSharedMemoryTimeout_.
+  const bool attachSharedMemory(const std::string& name);
+
+  /// Lock the newly created (empty) shared memory segment, and size it to
+  /// hold the header, before the map is constructed. The lock is held
+  /// until the file descriptor is closed.
+  static const bool claimSharedMemory(const int fd);
+
+  /// Copy the map into the newly created (empty) shared memory segment,
+  /// and attach to the segment afterwards.
+  const bool publishSharedMemory(const int fd);
+
+  /// Fill in the header with the layout of the current records and cells.
+  CacheHeader cacheLayout() const;
+
+  /// The size of the cache with the given header.
+  static size_t cacheSize(const CacheHeader& header) {
+    return header.geometry_offset + header.record_num*sizeof(WaypointGeometry);
+  }
+
+  /// Sort the records into the grid cells and build the hash table.
+  void buildGrid();
+
+  /// Find the cell slot in the hash table, returns nullptr if not found.
+  const GridCell* cell(const int32_t x, const int32_t y) const {
+    const size_t mask = cell_num_ - 1;
+    for (size_t i = cellHash(x, y)&mask; ; i = (i+1)&mask) {
+      const GridCell& slot = cells_[i];
+      if (slot.begin == slot.end) return nullptr;
+      if (slot.x==x && slot.y==y) return &slot;
     }
+  }
 
-    return iter->second;
+  /// Hash function of the cell coordinates.
+  static size_t cellHash(const int32_t x, const int32_t y) {
+    return static_cast<size_t>(static_cast<uint32_t>(x)*73856093u ^
+                               static_cast<uint32_t>(y)*19349663u);
   }
 
-  boost::shared_ptr<CarlaWaypoint> waypoint(
-      const CarlaTransform& transform) const {
-    return waypoint(transform.location);
+  /// The coordinate of the cell containing the given value.
+  const int32_t cellCoordinate(const float value) const {
+    return static_cast<int32_t>(std::floor(value/cell_size_));
   }
 
-protected:
+  /// Find the index of the closest record to the query location.
+  const size_t closestRecord(const CarlaLocation& location) const;
+
+  /**
+   * \brief Find the closest record within the records [begin, end).
+   *
+   * The squared distances are computed with AVX2 or SSE instructions if
+   * available. Ties are broken by the smaller index, which is consistent
+   * with a sequential scan.
+   *
+   * \param[in] location The query location.
+   * \param[in] begin, end The range of the records to be checked.
+   * \param[in,out] index The index of the closest record so far.
+   * \param[in,out] sqr_dist The squared distance to the closest record so far.
+   */
+  void closestRecordInRange(const CarlaLocation& location,
+                            const size_t begin, const size_t end,
+                            size_t& index, float& sqr_dist) const;
+
+  /// Compute the lane geometry at a waypoint.
+  WaypointGeometry waypointGeometry(const boost::shared_ptr<CarlaWaypoint>& waypoint) const;
+
+  /// Set up the coordinate arrays with the records.
+  void buildCoordinates();
+
+  /**
+   * \brief Find the closest record by walking along the lane from the hint.
+   * \param[in] location The query location.
+   * \param[in] hint The record index of a previous match.
+   * \param[out] index The index of the closest record.
+   * \return False if the walk does not stop within \c kHintWalkSteps_
+   *         at a record within \c kHintRadius_.
+   */
+  const bool closestRecordAlongHint(
+      const CarlaLocation& location, const size_t hint, size_t& index) const;
+
+  /**
+   * \brief Find the closest record on the lanes around the hint.
+   * \param[in] location The query location.
+   * \param[in] hint The record index of a previous match.
+   * \param[out] index The index of the closest record.
+   * \return False if no record is found within \c kHintRadius_.
+   */
+  const bool closestRecordAroundHint(
+      const CarlaLocation& location, const size_t hint, size_t& index) const;
+
+  /**
+   * \brief Find the closest record within the records of a lane.
+   * \param[in] location The query location.
+   * \param[in] begin, end The records [begin, end) of a lane in a cell,
+   *                       which are sorted by the distance along the lane.
+   * \param[out] resolved False if the query is beyond either end of the records.
+   * \return The index of the closest record.
+   */
+  const size_t closestRecordOnLane(const CarlaLocation& location,
+                                   size_t begin, size_t end,
+                                   bool& resolved) const;
+
+  /// Squared distance from the query location to a record.
+  const float sqrDistance(const CarlaLocation& location, const size_t index) const {
+    const float dx = location.x - records_[index].x;
+    const float dy = location.y - records_[index].y;
+    const float dz = location.z - records_[index].z;
+    return dx*dx + dy*dy + dz*dz;
+  }
 
-  pcl::PointXYZ carlaLocationToPointXYZ(const CarlaLocation& location) const {
-    pcl::PointXYZ point;
-    point.x = location.x;
-    point.y = location.y;
-    point.z = location.z;
-    return point;
+  /// Projection of the query location onto the segment from record i to
+  /// record j, normalized by the squared length of the segment.
+  const float projection(const CarlaLocation& location,
+                         const size_t i, const size_t j) const {
+    const float sx = records_[j].x - records_[i].x;
+    const float sy = records_[j].y - records_[i].y;
+    const float sz = records_[j].z - records_[i].z;
+    const float sqr_length = sx*sx + sy*sy + sz*sz;
+    if (sqr_length <= 0.0f) return 0.0f;
+    return ((location.x-records_[i].x)*sx +
+            (location.y-records_[i].y)*sy +
+            (location.z-records_[i].z)*sz) / sqr_length;
   }
 
+  /// Throw an exception if the map is empty.
+  void checkNonEmpty(const CarlaLocation& location) const;
+
+  /// Get (or recover) the carla waypoint of a record.
+  boost::shared_ptr<CarlaWaypoint> recordWaypoint(const size_t index) const;
+
+  /// Get the curvature at a record, which falls back to
+  /// utils::curvatureAtWaypoint() if it is not precomputed.
+  const double recordCurvature(const size_t index) const {
+    if (!std::isnan(geometries_[index].curvature)) return geometries_[index].curvature;
+    return utils::curvatureAtWaypoint(recordWaypoint(index), map_);
+  }
+
+  /**
+   * \brief Find the carla waypoint on the road, section, and lane of a record,
+   *        closest to the s of the record.
+   * \return The waypoint, or \c nullptr if the lane is not in the map.
+   */
+  boost::shared_ptr<CarlaWaypoint> laneWaypoint(const WaypointRecord& record) const;
+
+  /// Compute the 64-bit FNV-1a hash of a string.
+  static const uint64_t fnv1aHash(const std::string& str);
+
+  /// Fill in the header with the information of the given map.
+  static CacheHeader cacheHeader(const boost::shared_ptr<const CarlaMap>& map,
+                                 const double resolution);
+
 }; // End class FastWaypointMap.
 
 } // End namespace utils.
@@ -15,6 +15,8 @@
 #pragma once
 
 #include <cmath>
+#include <cstddef>
+#include <algorithm>
 #include <boost/optional.hpp>
 
 namespace planner {
@@ -127,8 +129,78 @@ public:
     return saturateAccel(accel);
   }
 
+  /**
+   * \brief Compute the accelerations for a batch of vehicles.
+   *
+   * The function gives the same results as calling \c idm() for each of
+   * the vehicles, but avoids the virtual call and the branches per vehicle.
+   * A vehicle without a lead should have NaN at its entries in \c lead_v
+   * and \c s.
+   *
+   * \param[in] num The number of vehicles.
+   * \param[in] ego_v Speeds of the vehicles.
+   * \param[in] ego_v0 Desired speeds of the vehicles.
+   * \param[in] lead_v Speeds of the lead vehicles, NaN if there is no lead.
+   * \param[in] s Distances to the lead vehicles, NaN if there is no lead.
+   * \param[out] accel Accelerations of the vehicles.
+   */
+  virtual void idmBatch(
+      const size_t num,
+      const double* ego_v,
+      const double* ego_v0,
+      const double* lead_v,
+      const double* s,
+      double* accel) const {
+
+    // Store the speed terms into the output first.
+    speedTerms(num, ego_v, ego_v0, accel);
+
+    const double braking_coeff = 2.0 * std::sqrt(comfort_accel_ * comfort_decel_);
+    for (size_t i = 0; i < num; ++i) {
+      // Vehicles without a lead are given a dummy lead, whose
+      // interaction term is masked out.
+      const bool lead = !std::isnan(lead_v[i]) && !std::isnan(s[i]);
+      const double lead_speed = lead ? lead_v[i] : ego_v[i];
+      const double distance = lead ? s[i] : 1.0;
+
+      const double s_star = distance_gap_ + std::max(0.0,
+          ego_v[i] * time_gap_ + (ego_v[i] * (ego_v[i]-lead_speed)) / braking_coeff);
+      const double s_ratio = s_star / distance;
+      const double interaction = lead ? s_ratio*s_ratio : 0.0;
+
+      accel[i] = saturateAccel(comfort_accel_ * (1.0 - accel[i] - interaction));
+    }
+
+    return;
+  }
+
 protected:
 
+  /**
+   * \brief Compute <tt>(ego_v/ego_v0)^accel_exp_</tt> for a batch of vehicles.
+   *
+   * The default exponent 4 is computed with multiplications only.
+   */
+  void speedTerms(
+      const size_t num,
+      const double* ego_v,
+      const double* ego_v0,
+      double* terms) const {
+
+    if (accel_exp_ == 4.0) {
+      for (size_t i = 0; i < num; ++i) {
+        const double v_ratio = ego_v[i] / ego_v0[i];
+        const double v_ratio_sq = v_ratio * v_ratio;
+        terms[i] = v_ratio_sq * v_ratio_sq;
+      }
+    } else {
+      for (size_t i = 0; i < num; ++i)
+        terms[i] = std::pow(ego_v[i]/ego_v0[i], accel_exp_);
+    }
+
+    return;
+  }
+
   /**
    * \brief Compute the desired following distance between the ego and lead vehicle.
    * \param[in] ego_v Speed of the ego vehicle.
@@ -205,8 +277,72 @@ public:
     return saturateAccel(accel);
   }
 
+  virtual void idmBatch(
+      const size_t num,
+      const double* ego_v,
+      const double* ego_v0,
+      const double* lead_v,
+      const double* s,
+      double* accel) const override {
+
+    // Store the free accelerations into the output first.
+    freeAccelBatch(num, ego_v, ego_v0, accel);
+
+    const double braking_coeff = 2.0 * std::sqrt(comfort_accel_ * comfort_decel_);
+    for (size_t i = 0; i < num; ++i) {
+      const double accel_free = accel[i];
+
+      const bool lead = !std::isnan(lead_v[i]) && !std::isnan(s[i]);
+      const double lead_speed = lead ? lead_v[i] : ego_v[i];
+      const double distance = lead ? s[i] : 1.0;
+
+      const double s_star = distance_gap_ + std::max(0.0,
+          ego_v[i] * time_gap_ + (ego_v[i] * (ego_v[i]-lead_speed)) / braking_coeff);
+      const double s_ratio = s_star / distance;
+
+      const bool slow = ego_v[i] < ego_v0[i];
+      const bool close = s_ratio >= 1.0;
+      const double interaction = comfort_accel_ * (1.0 - s_ratio*s_ratio);
+
+      // Only the case of a slow vehicle far from its lead requires a power
+      // with a varying exponent.
+      const double damped = (lead && slow && !close) ?
+        accel_free * (1.0 - std::pow(s_ratio, (2.0 * comfort_accel_) / accel_free)) :
+        accel_free;
+
+      double iidm_accel = close ? (slow ? interaction : accel_free + interaction) : damped;
+      iidm_accel = lead ? iidm_accel : accel_free;
+      accel[i] = saturateAccel(iidm_accel);
+    }
+
+    return;
+  }
+
 protected:
 
+  /// Compute the free accelerations, see \c freeAccel(), for a batch of vehicles.
+  void freeAccelBatch(
+      const size_t num,
+      const double* ego_v,
+      const double* ego_v0,
+      double* accel) const {
+
+    speedTerms(num, ego_v, ego_v0, accel);
+
+    // Vehicles faster than the desired speeds are rare,
+    // the power is only computed for those.
+    const double decel_exp = comfort_accel_ * accel_exp_ / comfort_decel_;
+    for (size_t i = 0; i < num; ++i) {
+      const bool fast = ego_v[i] > ego_v0[i];
+      const double decel_term = fast ? std::pow(ego_v0[i]/ego_v[i], decel_exp) : 0.0;
+      accel[i] = fast ?
+        -comfort_decel_ * (1.0 - decel_term) :
+        comfort_accel_ * (1.0 - accel[i]);
+    }
+
+    return;
+  }
+
   double freeAccel(const double ego_v, const double ego_v0) const {
     // There is no lead vehicle, thus we use the free acceleration model. Eq 11.22
     double accel{0.0};
@@ -284,6 +420,46 @@ public:
     return saturateAccel(accel);
   }
 
+  virtual void idmBatch(
+      const size_t num,
+      const double* ego_v,
+      const double* ego_v0,
+      const double* lead_v,
+      const double* s,
+      double* accel) const override {
+
+    // Store the IIDM accelerations into the output first.
+    ImprovedIntelligentDriverModel::idmBatch(num, ego_v, ego_v0, lead_v, s, accel);
+
+    // The lead vehicles are assumed to have no acceleration,
+    // same as in \c idm().
+    const double lead_v_dot = 0.0;
+    const double a_tilde = std::min(lead_v_dot, comfort_accel_);
+
+    for (size_t i = 0; i < num; ++i) {
+      const double a_iidm = accel[i];
+
+      const bool lead = !std::isnan(lead_v[i]) && !std::isnan(s[i]);
+      const double lead_speed = lead ? lead_v[i] : ego_v[i];
+      const double distance = lead ? s[i] : 1.0;
+
+      // Same with \c constAccelHeuristic().
+      const double v_diff = ego_v[i] - lead_speed;
+      const double acah =
+        (lead_speed * v_diff < -2 * distance * a_tilde) ?
+        ego_v[i] * ego_v[i] * a_tilde / (lead_speed * lead_speed - 2 * distance * a_tilde) :
+        a_tilde - v_diff * v_diff * (v_diff >= 0 ? 1.0 : 0.0) / (2 * distance);
+
+      const double acc_accel = (a_iidm >= acah) ? a_iidm :
+        (1-coolness_factor_) * a_iidm +
+        coolness_factor_ * (acah + comfort_decel_ * std::tanh((a_iidm - acah)/comfort_decel_));
+
+      accel[i] = lead ? saturateAccel(acc_accel) : a_iidm;
+    }
+
+    return;
+  }
+
 protected:
 
   /**
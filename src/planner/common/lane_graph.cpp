@@ -0,0 +1,303 @@
+/*
+ * Copyright 2020 Ke Sun
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <numeric>
+#include <stdexcept>
+
+#include <carla/road/Road.h>
+
+#include <planner/common/lane_graph.h>
+
+namespace utils {
+
+constexpr LaneGraph::Handle LaneGraph::kInvalidHandle;
+
+LaneGraph::LaneGraph(
+    const FastWaypointMap& fast_map,
+    const boost::shared_ptr<const router::Router>& router) :
+  fast_map_(&fast_map),
+  router_(router) {
+
+  const FastWaypointMap::WaypointRecord* records = fast_map_->records_;
+  const size_t record_num = fast_map_->size();
+
+  // Sort the records by lanes, and by the distance along the road on each lane.
+  sample_records_.resize(record_num);
+  std::iota(sample_records_.begin(), sample_records_.end(), 0);
+  std::sort(sample_records_.begin(), sample_records_.end(),
+      [records](const uint32_t i, const uint32_t j)->bool{
+        return std::tie(records[i].road, records[i].section, records[i].lane, records[i].s) <
+               std::tie(records[j].road, records[j].section, records[j].lane, records[j].s);
+      });
+
+  // Group the sorted records into lanes.
+  sample_s_.resize(record_num);
+  record_positions_.resize(record_num);
+
+  for (uint32_t i = 0; i < record_num; ++i) {
+    const FastWaypointMap::WaypointRecord& record = records[sample_records_[i]];
+
+    if (lanes_.empty() ||
+        lanes_.back().road != record.road ||
+        lanes_.back().section != record.section ||
+        lanes_.back().lane != record.lane) {
+      Lane lane;
+      lane.road = record.road;
+      lane.section = record.section;
+      lane.lane = record.lane;
+      lane.s_begin = record.s;
+      lane.s_end = record.s;
+      lane.sample_begin = i;
+      lane.sample_end = i;
+      lane.successor_begin = 0;
+      lane.successor_end = 0;
+      lane.left = kInvalidHandle;
+      lane.right = kInvalidHandle;
+      lanes_.push_back(lane);
+    }
+
+    lanes_.back().sample_end = i + 1;
+    sample_s_[i] = record.s;
+    record_positions_[sample_records_[i]] = Position{
+      static_cast<Handle>(lanes_.size()-1), i};
+  }
+
+  // Connect the left and right lanes within the same lane section.
+  // The lane IDs follow carla::road::Map::GetLeft() and GetRight(), i.e. the
+  // right lane is further away from the center line, and the left lane of
+  // lane -1 (1) is lane 1 (-1).
+  for (Lane& lane : lanes_) {
+    const int32_t right = lane.lane > 0 ? lane.lane+1 : lane.lane-1;
+    int32_t left = lane.lane > 0 ? lane.lane-1 : lane.lane+1;
+    if (std::abs(lane.lane) == 1) left = -lane.lane;
+
+    lane.right = handle(std::make_tuple(lane.road, lane.section, right));
+    lane.left = handle(std::make_tuple(lane.road, lane.section, left));
+  }
+
+  buildSectionRanges();
+  buildSuccessors();
+  return;
+}
+
+void LaneGraph::buildSectionRanges() {
+
+  // A lane section starts at the first sample of its lanes, and ends where
+  // the next section on the same road starts. The first (last) section starts
+  // (ends) at the start (end) of the road. The lanes are sorted by roads and
+  // sections already.
+  size_t road_begin = 0;
+  while (road_begin < lanes_.size()) {
+    const uint32_t road = lanes_[road_begin].road;
+    size_t road_end = road_begin;
+    while (road_end < lanes_.size() && lanes_[road_end].road == road) ++road_end;
+
+    // Start of each section on this road, in the order of the lanes.
+    std::vector<float> section_starts(road_end-road_begin);
+    for (size_t i = road_begin; i < road_end; ++i) {
+      float start = sample_s_[lanes_[i].sample_begin];
+      for (size_t j = road_begin; j < road_end; ++j) {
+        if (lanes_[j].section != lanes_[i].section) continue;
+        start = std::min(start, sample_s_[lanes_[j].sample_begin]);
+      }
+      section_starts[i-road_begin] = start;
+    }
+
+    const float road_length = fast_map_->map_->GetMap().GetMap().GetRoad(road).GetLength();
+    for (size_t i = road_begin; i < road_end; ++i) {
+      Lane& lane = lanes_[i];
+      const bool first_section = lanes_[road_begin].section == lane.section;
+      const bool last_section = lanes_[road_end-1].section == lane.section;
+
+      lane.s_begin = first_section ? 0.0f : section_starts[i-road_begin];
+      lane.s_end = road_length;
+      if (!last_section) {
+        // The start of the next section on this road.
+        size_t next = i;
+        while (lanes_[next].section == lane.section) ++next;
+        lane.s_end = section_starts[next-road_begin];
+      }
+    }
+
+    road_begin = road_end;
+  }
+
+  return;
+}
+
+void LaneGraph::buildSuccessors() {
+
+  // The successors are found by looking slightly beyond the last sample of
+  // each lane, which is at most one resolution away from the end of the lane.
+  const double lookahead = 2.0 * fast_map_->resolution();
+
+  for (Handle handle = 0; handle < lanes_.size(); ++handle) {
+    Lane& lane = lanes_[handle];
+    lane.successor_begin = successors_.size();
+
+    // Vehicles on lanes with negative IDs drive along the increasing s.
+    const uint32_t exit = lane.lane < 0 ? lane.sample_end-1 : lane.sample_begin;
+    // The lanes leaving or entering the route are not on the roads of the
+    // route, for which the router cannot tell the next road.
+    const boost::optional<size_t> next_road = router_->hasRoad(lane.road) ?
+      router_->nextRoad(lane.road) : boost::none;
+
+    std::vector<boost::shared_ptr<CarlaWaypoint>> candidates;
+    try {
+      candidates = fast_map_->recordWaypoint(sample_records_[exit])->GetNext(lookahead);
+    } catch (const std::runtime_error&) {
+      // The lane is left without successors if the exit waypoint cannot be
+      // recovered, in which case the graph simply ends on this lane.
+    }
+
+    std::vector<Handle> same_road_successors;
+    std::vector<Handle> next_road_successors;
+
+    for (const auto& candidate : candidates) {
+      const Handle successor = this->handle(std::make_tuple(
+            static_cast<uint32_t>(candidate->GetRoadId()),
+            static_cast<uint32_t>(candidate->GetSectionId()),
+            static_cast<int32_t>(candidate->GetLaneId())));
+
+      // The candidate may still be on the same lane if the lane is not
+      // indexed until its end, e.g. a lane leaving a restricted route.
+      if (successor == kInvalidHandle || successor == handle) continue;
+
+      std::vector<Handle>* successors = nullptr;
+      if (candidate->GetRoadId() == lane.road) successors = &same_road_successors;
+      else if (next_road && candidate->GetRoadId() == *next_road) successors = &next_road_successors;
+      else continue;
+
+      if (std::find(successors->begin(), successors->end(), successor) == successors->end())
+        successors->push_back(successor);
+    }
+
+    successors_.insert(successors_.end(),
+        same_road_successors.begin(), same_road_successors.end());
+    successors_.insert(successors_.end(),
+        next_road_successors.begin(), next_road_successors.end());
+    lane.successor_end = successors_.size();
+  }
+
+  return;
+}
+
+boost::optional<LaneGraph::Position> LaneGraph::position(
+    const boost::shared_ptr<const CarlaWaypoint>& waypoint) const {
+  const boost::optional<size_t> index = fast_map_->waypointRecord(waypoint);
+  if (!index) return boost::none;
+  return record_positions_[*index];
+}
+
+boost::optional<LaneGraph::Position> LaneGraph::front(
+    const Position& position, const double distance) const {
+
+  Handle handle = position.lane;
+  double target = lanes_[handle].lane < 0 ?
+    sample_s_[position.sample] + distance :
+    sample_s_[position.sample] - distance;
+
+  uint32_t sample = 0;
+  if (!advance(handle, target, sample)) return boost::none;
+  return Position{handle, sample};
+}
+
+boost::optional<LaneGraph::Coordinate> LaneGraph::front(
+    const Coordinate& coordinate, const double distance) const {
+
+  Handle handle = coordinate.lane;
+  double target = lanes_[handle].lane < 0 ?
+    coordinate.s + distance :
+    coordinate.s - distance;
+
+  // Most of the time, the target is still within the samples of the lane.
+  const Lane& lane = lanes_[handle];
+  if (lane.sample_begin != lane.sample_end &&
+      target >= sample_s_[lane.sample_begin] &&
+      target <= sample_s_[lane.sample_end-1])
+    return Coordinate{handle, target};
+
+  uint32_t sample = 0;
+  if (!advance(handle, target, sample)) return boost::none;
+  return Coordinate{handle, target};
+}
+
+bool LaneGraph::advance(Handle& handle, double& target, uint32_t& sample) const {
+
+  // Every lane is visited at most once, unless the successors form a loop
+  // shorter than the distance, which is not expected on a sane map.
+  for (size_t hops = 0; hops <= lanes_.size(); ++hops) {
+    const Lane& lane = lanes_[handle];
+
+    // The target is on this lane section. The lane may not be indexed until
+    // its end if the fast map is restricted to a route, in which case the
+    // closest sample can be far away from the target.
+    if (lane.lane < 0 ? target <= lane.s_end : target >= lane.s_begin) {
+      sample = closestSample(lane, target);
+      return std::fabs(sample_s_[sample]-target) <= 2.0*fast_map_->resolution();
+    }
+
+    // Otherwise, move on to the (preferred) successor.
+    if (lane.successor_begin == lane.successor_end) return false;
+    const Handle successor = successors_[lane.successor_begin];
+    const Lane& successor_lane = lanes_[successor];
+
+    // The next lane section on the same road shares the s coordinate with
+    // this one. On a different road, the remaining distance is carried over
+    // to the entry of the successor lane.
+    if (successor_lane.road != lane.road) {
+      const double remaining = lane.lane < 0 ? target-lane.s_end : lane.s_begin-target;
+      target = successor_lane.lane < 0 ?
+        successor_lane.s_begin + remaining :
+        successor_lane.s_end - remaining;
+    }
+
+    handle = successor;
+  }
+
+  return false;
+}
+
+const LaneGraph::Handle LaneGraph::handle(const LaneKey& key) const {
+  std::vector<Lane>::const_iterator iter = std::lower_bound(
+      lanes_.begin(), lanes_.end(), key,
+      [](const Lane& lane, const LaneKey& key)->bool{
+        return std::make_tuple(lane.road, lane.section, lane.lane) < key;
+      });
+
+  if (iter == lanes_.end() ||
+      std::make_tuple(iter->road, iter->section, iter->lane) != key)
+    return kInvalidHandle;
+  return static_cast<Handle>(iter - lanes_.begin());
+}
+
+boost::optional<LaneGraph::Position> LaneGraph::neighbor(
+    const Handle handle, const float s) const {
+  if (handle == kInvalidHandle) return boost::none;
+  return Position{handle, closestSample(lanes_[handle], s)};
+}
+
+const uint32_t LaneGraph::closestSample(const Lane& lane, const float s) const {
+  const std::vector<float>::const_iterator begin = sample_s_.begin() + lane.sample_begin;
+  const std::vector<float>::const_iterator end = sample_s_.begin() + lane.sample_end;
+  std::vector<float>::const_iterator iter = std::lower_bound(begin, end, s);
+
+  if (iter == end || (iter != begin && s-*(iter-1) < *iter-s)) --iter;
+  return static_cast<uint32_t>(iter - sample_s_.begin());
+}
+
+} // End namespace utils.
@@ -0,0 +1,243 @@
+/*
+ * Copyright 2020 Ke Sun
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <tuple>
+#include <vector>
+#include <boost/optional.hpp>
+#include <boost/smart_ptr.hpp>
+#include <boost/core/noncopyable.hpp>
+
+#include <carla/client/Waypoint.h>
+
+#include <router/common/router.h>
+#include <planner/common/fast_waypoint_map.h>
+
+namespace utils {
+
+/**
+ * \brief LaneGraph is a compact, in-memory copy of the routed lane topology.
+ *
+ * Each lane in a lane section, i.e. (road, section, lane), is given an integer
+ * handle. The graph keeps, in compressed sparse row form,
+ * - the waypoint records of the \c FastWaypointMap on each lane, sorted by
+ *   the distance along the road (s),
+ * - the successors of each lane, restricted to the ones on the same road or
+ *   on the next road of the route (successors on the same road come first).
+ * The s-range of the lane section, and the left and right lanes are kept
+ * with each lane as well.
+ *
+ * Positions on the graph are (lane, sample) pairs. Moving forward, left, or
+ * right only looks into the arrays, and the carla waypoint at a position is
+ * the (cached) waypoint of the record, so that repeated queries at the same
+ * position always return the same waypoint object.
+ *
+ * Since the positions snap to the records, the graph has the same resolution
+ * as the fast map. Only driving lanes are indexed by the fast map, which is
+ * why there is no lane type stored in the graph. If the fast map is restricted
+ * to a route, the lanes leaving the route are only kept up to the longitudinal
+ * margin of the map, and the graph ends there.
+ *
+ * The graph is constructed by \c FastWaypointMap::laneGraph(), and is owned
+ * by the fast map it is constructed from.
+ */
+class LaneGraph : private boost::noncopyable {
+
+private:
+
+  using CarlaWaypoint = carla::client::Waypoint;
+  using LaneKey       = std::tuple<uint32_t, uint32_t, int32_t>;
+
+public:
+
+  /// Handle of a lane in a lane section.
+  using Handle = uint32_t;
+
+  /// Indicating a missing lane.
+  static constexpr Handle kInvalidHandle = std::numeric_limits<Handle>::max();
+
+  /// A position on the graph.
+  struct Position {
+    /// The lane handle.
+    Handle lane;
+    /// Index into the samples of the graph (not into the samples of the lane).
+    uint32_t sample;
+  };
+
+  /// A continuous position on the graph, i.e. the distance along the road (s)
+  /// on a lane, which is not snapped to the samples.
+  struct Coordinate {
+    /// The lane handle.
+    Handle lane;
+    /// The distance along the road.
+    double s;
+  };
+
+  /// A lane in a lane section.
+  struct Lane {
+    uint32_t road;
+    uint32_t section;
+    int32_t lane;
+    /// The s-range of the lane section.
+    float s_begin;
+    float s_end;
+    /// Range of the samples [begin, end) of the lane.
+    uint32_t sample_begin;
+    uint32_t sample_end;
+    /// Range of the successors [begin, end) of the lane.
+    uint32_t successor_begin;
+    uint32_t successor_end;
+    /// Handles of the left and right lanes.
+    Handle left;
+    Handle right;
+  };
+
+private:
+
+  /// The fast map providing the records and the carla waypoints.
+  const FastWaypointMap* fast_map_;
+
+  /// The router telling the next roads.
+  boost::shared_ptr<const router::Router> router_;
+
+  /// Lanes sorted by (road, section, lane).
+  std::vector<Lane> lanes_;
+
+  /// Record indices of the samples, grouped by lanes and sorted by s.
+  std::vector<uint32_t> sample_records_;
+
+  /// The distance along the road of the samples.
+  std::vector<float> sample_s_;
+
+  /// Successor handles of the lanes.
+  std::vector<Handle> successors_;
+
+  /// The position of each record of the fast map.
+  std::vector<Position> record_positions_;
+
+public:
+
+  /**
+   * \brief Construct the graph with the records of the fast map.
+   * \param[in] fast_map The fast map, which should outlive the graph.
+   * \param[in] router The router used to restrict the successors.
+   */
+  LaneGraph(const FastWaypointMap& fast_map,
+            const boost::shared_ptr<const router::Router>& router);
+
+  /// Get the number of lanes in the graph.
+  const size_t laneNum() const { return lanes_.size(); }
+
+  /// Get the lane with the given handle.
+  const Lane& lane(const Handle handle) const { return lanes_[handle]; }
+
+  /// Get the router used to construct the graph.
+  const boost::shared_ptr<const router::Router>& router() const { return router_; }
+
+  /// Get the distance along the road at a position.
+  const float s(const Position& position) const { return sample_s_[position.sample]; }
+
+  /**
+   * \brief Find the position of a carla waypoint.
+   * \param[in] waypoint The query waypoint.
+   * \return The position of the closest record on the same lane. If the
+   *         lane is not indexed around the waypoint, \c boost::none is returned.
+   */
+  boost::optional<Position> position(
+      const boost::shared_ptr<const CarlaWaypoint>& waypoint) const;
+
+  /**
+   * \brief Find the position at a distance ahead along the lanes.
+   *
+   * Same with \c router::Router::frontWaypoint(), successors on the same road
+   * are preferred over the ones on the next road of the route.
+   *
+   * \param[in] position The query position.
+   * \param[in] distance The distance to move forward.
+   * \return The front position, or \c boost::none if the lanes end.
+   */
+  boost::optional<Position> front(const Position& position, const double distance) const;
+
+  /**
+   * \brief Find the coordinate at a distance ahead along the lanes.
+   *
+   * Same with \c front(const Position&, const double), except that the
+   * result is not snapped to the samples. Within the indexed part of a lane,
+   * moving forward is only an addition on s.
+   *
+   * \param[in] coordinate The query coordinate.
+   * \param[in] distance The distance to move forward.
+   * \return The front coordinate, or \c boost::none if the lanes end.
+   */
+  boost::optional<Coordinate> front(const Coordinate& coordinate, const double distance) const;
+
+  /// Get the coordinate of a position.
+  Coordinate coordinate(const Position& position) const {
+    return Coordinate{position.lane, sample_s_[position.sample]};
+  }
+
+  /// Get the position with the closest s to a coordinate.
+  Position position(const Coordinate& coordinate) const {
+    return Position{coordinate.lane, closestSample(lanes_[coordinate.lane], coordinate.s)};
+  }
+
+  /// Find the position on the left lane, same with \c carla::client::Waypoint::GetLeft().
+  boost::optional<Position> left(const Position& position) const {
+    return neighbor(lanes_[position.lane].left, sample_s_[position.sample]);
+  }
+
+  /// Find the position on the right lane, same with \c carla::client::Waypoint::GetRight().
+  boost::optional<Position> right(const Position& position) const {
+    return neighbor(lanes_[position.lane].right, sample_s_[position.sample]);
+  }
+
+  /// Get the carla waypoint at a position.
+  boost::shared_ptr<CarlaWaypoint> waypoint(const Position& position) const {
+    return fast_map_->recordWaypoint(sample_records_[position.sample]);
+  }
+
+private:
+
+  /// Find the handle of a lane, \c kInvalidHandle if it is not in the graph.
+  const Handle handle(const LaneKey& key) const;
+
+  /**
+   * \brief Move forward along the lanes.
+   * \param[in,out] handle The lane to start from, and the lane reached.
+   * \param[in,out] target The s to move to on the start lane, and the s
+   *                       on the lane reached.
+   * \param[out] sample The sample closest to the target on the lane reached.
+   * \return False if the lanes end before the target.
+   */
+  bool advance(Handle& handle, double& target, uint32_t& sample) const;
+
+  /// Find the position on a lane with the closest s.
+  boost::optional<Position> neighbor(const Handle handle, const float s) const;
+
+  /// The index of the sample on a lane with the closest s.
+  const uint32_t closestSample(const Lane& lane, const float s) const;
+
+  /// Set the s-range of the lane sections.
+  void buildSectionRanges();
+
+  /// Collect the successors of the lanes, which requires the carla waypoints
+  /// at the end of each lane.
+  void buildSuccessors();
+
+}; // End class LaneGraph.
+
+} // End namespace utils.
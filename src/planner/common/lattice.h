@@ -18,6 +18,7 @@
 #include <queue>
 #include <unordered_map>
 #include <string>
+#include <cmath>
 
 #include <boost/smart_ptr.hpp>
 #include <boost/pointer_cast.hpp>
@@ -30,6 +31,9 @@
 #include <carla/road/Lane.h>
 
 #include <router/common/router.h>
+#include <planner/common/fast_waypoint_map.h>
+#include <planner/common/lane_graph.h>
+#include <planner/common/node_arena.h>
 
 namespace planner {
 
@@ -38,7 +42,8 @@ namespace planner {
  *        to be used with the the Lattice class.
  *
  * This class provides the interface for accessing and setting the
- * nodes around a node object.
+ * nodes around a node object. Nodes are stored in a \c NodeArena, and
+ * the neighbors of a node are kept as indices into the same arena.
  */
 template<typename Derived>
 class LatticeNode {
@@ -58,20 +63,35 @@ protected:
    *
    * Note this is different than the \c s attribute of a carla waypoint,
    * which is the distance of the waypoint on the road it belongs to.
+   *
+   * The distance is stored relative to a fixed reference, which does not
+   * move as the lattice is shifted. \c distance() subtracts the distance
+   * offset of the arena to get the distance in the current lattice.
    */
   double distance_ = 0.0;
 
-  /// Front node.
-  boost::weak_ptr<Derived> front_;
+  /// Index of the front node.
+  NodeIndex front_ = kInvalidNodeIndex;
+
+  /// Index of the back node.
+  NodeIndex back_ = kInvalidNodeIndex;
+
+  /// Index of the left node.
+  NodeIndex left_ = kInvalidNodeIndex;
+
+  /// Index of the right node.
+  NodeIndex right_ = kInvalidNodeIndex;
 
-  /// Back node.
-  boost::weak_ptr<Derived> back_;
+  /// Index of this node in the arena.
+  NodeIndex index_ = kInvalidNodeIndex;
 
-  /// Left node.
-  boost::weak_ptr<Derived> left_;
+  /// Generation of this node in its arena slot, see \c NodeArena::valid().
+  uint32_t generation_ = 0;
 
-  /// Right node.
-  boost::weak_ptr<Derived> right_;
+  /// The arena holding this node, used to resolve the neighbor indices.
+  const NodeArena<Derived>* arena_ = nullptr;
+
+  template<typename Node> friend class NodeArena;
 
 public:
 
@@ -102,63 +122,65 @@ public:
   }
 
   /// Get the curvature at the node.
-  const double curvature(const boost::shared_ptr<CarlaMap>& map) const {
-    return utils::curvatureAtWaypoint(waypoint_, map);
+  const double curvature(const boost::shared_ptr<const utils::FastWaypointMap>& fast_map) const {
+    return fast_map->curvature(waypoint_);
+  }
+
+  /// Get the distance of the node. The distance is set
+  /// when the node is added into an arena.
+  const double distance() const {
+    return arena_ ? distance_ - arena_->distanceOffset() : distance_;
   }
 
-  /// Get or set the distance of the node.
-  double& distance() { return distance_; }
+  /// Get the index of the node in the arena.
+  const NodeIndex index() const { return index_; }
 
-  // Get the distance of the node.
-  const double distance() const { return distance_; }
+  /// Get the generation of the node in its arena slot.
+  const uint32_t generation() const { return generation_; }
 
-  /** @name Accessors
+  /** @name Index Accessors
    *
-   * front(), back(), left(), right() returns reference
-   * of the boost weak pointers stored in the object, so that one can
-   * update the weak pointers directly.
+   * frontIndex(), backIndex(), leftIndex(), rightIndex() returns
+   * the arena indices of the neighbor nodes, which are \c kInvalidNodeIndex
+   * if the neighbor does not exist. The non-const versions return references,
+   * so that one can update the links directly.
    */
   /// @{
 
-  boost::weak_ptr<Derived>& front() {
-    return front_;
-  }
-
-  boost::weak_ptr<Derived>& back() {
-    return back_;
-  }
-
-  boost::weak_ptr<Derived>& left() {
-    return left_;
-  }
+  NodeIndex& frontIndex() { return front_; }
+  NodeIndex& backIndex()  { return back_; }
+  NodeIndex& leftIndex()  { return left_; }
+  NodeIndex& rightIndex() { return right_; }
 
-  boost::weak_ptr<Derived>& right() {
-    return right_;
-  }
+  const NodeIndex frontIndex() const { return front_; }
+  const NodeIndex backIndex()  const { return back_; }
+  const NodeIndex leftIndex()  const { return left_; }
+  const NodeIndex rightIndex() const { return right_; }
 
   /// @}
 
   /** @name const Accessors
    *
    * front(), back(), left(), right() returns boost shared pointers
-   * pointering to const LatticeNode objects.
+   * pointering to const LatticeNode objects. The pointers share the
+   * ownership of the arena holding the nodes.
    */
   /// @{
 
   boost::shared_ptr<const Derived> front() const {
-    return boost::const_pointer_cast<const Derived>(front_.lock());
+    return arena_ ? arena_->node(front_) : nullptr;
   }
 
   boost::shared_ptr<const Derived> back() const {
-    return boost::const_pointer_cast<const Derived>(back_.lock());
+    return arena_ ? arena_->node(back_) : nullptr;
   }
 
   boost::shared_ptr<const Derived> left() const {
-    return boost::const_pointer_cast<const Derived>(left_.lock());
+    return arena_ ? arena_->node(left_) : nullptr;
   }
 
   boost::shared_ptr<const Derived> right() const {
-    return boost::const_pointer_cast<const Derived>(right_.lock());
+    return arena_ ? arena_->node(right_) : nullptr;
   }
 
   /// @}
@@ -186,30 +208,93 @@ protected:
   using CarlaLane      = carla::road::Lane;
   using CarlaTransform = carla::geom::Transform;
   using CarlaVector3D  = carla::geom::Vector3D;
+  using CarlaLocation  = carla::geom::Location;
 
 protected:
 
   /// Router used to query the roads and front waypoints.
   boost::shared_ptr<router::Router> router_;
 
-  /// Entry nodes of the lattice (nodes that do not have back nodes).
-  std::vector<boost::weak_ptr<Node>> lattice_entries_;
-
-  /// Exit nodes of the lattice (nodes that do not have front nodes).
-  std::vector<boost::weak_ptr<Node>> lattice_exits_;
-
-  /// A mapping from carla waypoint ID to the corresponding node in the lattice.
-  std::unordered_map<size_t, boost::shared_ptr<Node>> waypoint_to_node_table_;
+  /// Lane graph used to find the front, left, and right waypoints.
+  /// The carla client (and \c router_) is only used for the waypoints
+  /// not indexed by the graph, or if the graph is not available.
+  boost::shared_ptr<const utils::LaneGraph> lane_graph_;
 
   /**
-   * A mapping from road+lane IDs to the carla waypoint IDs on this road+lane.
-   *
-   * This variable is used to quickly find the closest node given a carla waypoint.
+   * \brief Topology of the lattice, i.e. the nodes, the links between them,
+   *        and the tables used to look them up.
    *
-   * For each element in the map, the key is the hash value combining the road
-   * ID and the lane ID, the value is the waypoints on this road and lane.
+   * The topology is shared by the copies of a lattice until one of them
+   * modifies it, see \c detachTopology().
    */
-  std::unordered_map<size_t, std::vector<size_t>> roadlane_to_waypoints_table_;
+  struct Topology {
+    /// Storage of all nodes in the lattice. Nodes are linked
+    /// with each other through their indices in the arena.
+    boost::shared_ptr<NodeArena<Node>> node_arena =
+      boost::make_shared<NodeArena<Node>>();
+
+    /// Entry nodes of the lattice (nodes that do not have back nodes).
+    std::vector<NodeIndex> lattice_entries;
+
+    /// Exit nodes of the lattice (nodes that do not have front nodes).
+    std::vector<NodeIndex> lattice_exits;
+
+    /// A mapping from carla waypoint ID to the corresponding node in the lattice.
+    NodeIndexTable waypoint_to_node_table;
+
+    /**
+     * A mapping from road+lane IDs to the nodes on this road+lane.
+     *
+     * This variable is used to quickly find the closest node given a carla waypoint.
+     *
+     * For each element in the map, the key is the hash value combining the road
+     * ID and the lane ID, the value is the \c s of the waypoints and the indices
+     * of the nodes on this road and lane, sorted by \c s.
+     */
+    std::unordered_map<size_t, std::vector<std::pair<double, NodeIndex>>>
+      roadlane_to_nodes_table;
+
+    /**
+     * A mapping from grid cells on the x-y plane to the nodes within the cells.
+     *
+     * This variable is used to find the closest node given a carla waypoint
+     * if the waypoint is not on the same road+lane with any node. The size of
+     * the cells is the longitudinal resolution.
+     */
+    std::unordered_map<size_t, std::vector<NodeIndex>> grid_to_nodes_table;
+
+    /**
+     * Nodes of the lattice bucketed into columns by their distances.
+     *
+     * As the lattice is shifted, columns are added at the front and dropped
+     * at the back, so that only the nodes at the two ends are visited.
+     */
+    NodeColumns node_columns;
+
+    /**
+     * Nodes of the lattice grouped into lane segments.
+     *
+     * This variable is used to find the front and back nodes at a distance
+     * without following the links of the nodes one by one.
+     */
+    NodeSegments node_segments;
+
+    Topology() = default;
+
+    /// The copied nodes are stored in a new arena.
+    Topology(const Topology& other) :
+      node_arena(boost::make_shared<NodeArena<Node>>(*(other.node_arena))),
+      lattice_entries(other.lattice_entries),
+      lattice_exits(other.lattice_exits),
+      waypoint_to_node_table(other.waypoint_to_node_table),
+      roadlane_to_nodes_table(other.roadlane_to_nodes_table),
+      grid_to_nodes_table(other.grid_to_nodes_table),
+      node_columns(other.node_columns),
+      node_segments(other.node_segments) {}
+  };
+
+  /// Topology of the lattice, which may be shared with the copies of the lattice.
+  boost::shared_ptr<Topology> topology_ = boost::make_shared<Topology>();
 
   /// Range resolution (distance between two connected nodes) in the
   /// longitudinal direction.
@@ -225,11 +310,14 @@ public:
    * \param[in] longitudinal_resolution
    *            The distance between two consecutive nodes of the lattice on the same lane.
    * \param[in] router Used to tell roads and waypoints.
+   * \param[in] lane_graph Used to find the neighbor waypoints, which should
+   *                       be constructed with the same router.
    */
   Lattice(const boost::shared_ptr<const CarlaWaypoint>& start,
           const double range,
           const double longitudinal_resolution,
-          const boost::shared_ptr<router::Router>& router);
+          const boost::shared_ptr<router::Router>& router,
+          const boost::shared_ptr<const utils::LaneGraph>& lane_graph = nullptr);
 
   /// Copy constructor.
   Lattice(const Lattice& other);
@@ -242,23 +330,42 @@ public:
 
   const double longitudinalResolution() const { return longitudinal_resolution_; }
 
+  /// Get the lane graph used to construct the lattice, which may be \c nullptr.
+  const boost::shared_ptr<const utils::LaneGraph>& laneGraph() const { return lane_graph_; }
+
   /// Get the entry nodes of the lattice.
   std::vector<boost::shared_ptr<const Node>> latticeEntries() const {
     std::vector<boost::shared_ptr<const Node>> output;
-    for (const auto& node : lattice_entries_) output.push_back(node.lock());
+    for (const NodeIndex node : topology_->lattice_entries)
+      output.push_back(topology_->node_arena->node(node));
     return output;
   }
 
   /// Get the exit nodes of the lattice.
   std::vector<boost::shared_ptr<const Node>> latticeExits() const {
     std::vector<boost::shared_ptr<const Node>> output;
-    for (const auto& node : lattice_exits_) output.push_back(node.lock());
+    for (const NodeIndex node : topology_->lattice_exits)
+      output.push_back(topology_->node_arena->node(node));
     return output;
   }
 
   /// Return all nodes maintained by the lattice.
   std::unordered_map<size_t, boost::shared_ptr<const Node>> nodes() const;
 
+  /**
+   * \brief Check if a node pointer obtained from the lattice is still valid.
+   *
+   * The pointers are invalidated once their nodes are removed, e.g. by
+   * \c shift(). See \c NodeArena::valid() for the details.
+   *
+   * \param[in] node The node pointer.
+   * \param[in] generation The generation of the node, read when the
+   *            pointer is obtained.
+   */
+  bool hasNode(const boost::shared_ptr<const Node>& node, const uint32_t generation) const {
+    return topology_->node_arena->valid(node, generation);
+  }
+
   /** \brief Return all edges maintained by the lattice.
    *
    * The returned edges are directed. For example edge <1, 2> and <2, 1>
@@ -278,7 +385,8 @@ public:
    * \brief Extend the range of the lattice.
    *
    * The lattice will always be extended in the forward direction, which
-   * is defined by the road sequence given by the router.
+   * is defined by the road sequence given by the router. Only the new
+   * nodes and the current exits of the lattice are visited.
    *
    * \param[in] range The new range of the lattice. If this is less than
    *                  the current range, no operation is performed.
@@ -288,7 +396,10 @@ public:
   /**
    * \brief Shorten the range of the current lattice.
    *
-   * The lattice will always be shortened from the back.
+   * The lattice will always be shortened from the back. The columns
+   * of nodes behind the new range are dropped. The distances of the
+   * remaining nodes are updated through the distance offset of the
+   * arena, instead of one by one.
    *
    * \param[in] range The new range of the lattice. If this is more than
    *                  the current range, no operation is performed.
@@ -299,6 +410,8 @@ public:
    * \brief Shift the lattice forward by some distance.
    *
    * The forward direction is defined by the road sequence in the router.
+   * The cost of shifting only depends on the number of nodes added and
+   * dropped, not the size of the lattice.
    *
    * \param[in] movement How much distance to shift the lattice forward.
    */
@@ -325,9 +438,8 @@ public:
   boost::shared_ptr<const Node> closestNode(
       const boost::shared_ptr<const CarlaWaypoint>& waypoint,
       const double tolerance) const {
-
-    Lattice* unconst_this = const_cast<Lattice*>(this);
-    return unconst_this->closestNode(waypoint, tolerance);
+    const NodeArena<Node>& arena = *topology_->node_arena;
+    return arena.node(closestNodeIndex(waypoint, tolerance));
   }
 
   /**
@@ -426,40 +538,52 @@ protected:
   void swap(Lattice& other);
 
   /**
-   * \brief Add new element to the \c waypoint_to_node_ table.
-   * \param[in] waypoint_id The id of the carla waypoint.
-   * \param[in] node The node corresponding to the waypoint.
+   * \brief Add a new node to the arena, the lookup tables, and the columns.
+   *
+   * The new node is not linked with any of the existing nodes.
+   *
+   * \param[in] waypoint The waypoint of the new node.
+   * \param[in] distance The distance of the new node.
+   * \return The index of the new node.
    */
-  void augmentWaypointToNodeTable(
-      const size_t waypoint_id,
-      const boost::shared_ptr<Node>& node) {
-    waypoint_to_node_table_[waypoint_id] = node;
-    return;
-  }
+  NodeIndex addNode(
+      const boost::shared_ptr<const CarlaWaypoint>& waypoint,
+      const double distance);
 
   /**
-   * \brief Remove a node from the \c waypoint_to_node table.
-   * \param[in] waypoint_id The ID of the waypoint contained within
-   *                        the node to be removed.
+   * \brief Remove a node from the arena, the lookup tables, and the columns.
+   *
+   * The links of other nodes to the removed one are not reset.
+   *
+   * \param[in] index The index of the node to be removed.
    */
-  void reduceWaypointToNodeTable(const size_t waypoint_id) {
-    waypoint_to_node_table_.erase(waypoint_id);
-    return;
-  }
+  void removeNode(const NodeIndex index);
 
   /**
-   * \brief Add new element to the \c roadlane_to_waypoints_table_.
-   * \param[in] waypoint The waypoint to be added to the table.
+   * \brief Search forward on the same lane from a node.
+   *
+   * The cost is O(1) for each lane segment on the way, instead of
+   * for each node on the way.
+   *
+   * \param[in] start The index of the node to start from.
+   * \param[in] range The distance to search forward.
+   * \return The index of the found node, or \c kInvalidNodeIndex if the
+   *         range exceeds the lattice.
    */
-  void augmentRoadlaneToWaypointsTable(
-      const boost::shared_ptr<const CarlaWaypoint>& waypoint);
+  NodeIndex frontNodeIndex(const NodeIndex start, const double range) const;
 
   /**
-   * \brief Remove a element from the \c roadlane_to_waypoints_table_.
-   * \param[in] waypoint The waypoint to be removed from the table.
+   * \brief Search backwards on the same lane from a node.
+   *
+   * The cost is O(1) for each lane segment on the way, instead of
+   * for each node on the way.
+   *
+   * \param[in] start The index of the node to start from.
+   * \param[in] range The distance to search backwards.
+   * \return The index of the found node, or \c kInvalidNodeIndex if the
+   *         range exceeds the lattice.
    */
-  void reduceRoadlaneToWaypointsTable(
-      const boost::shared_ptr<const CarlaWaypoint>& waypoint);
+  NodeIndex backNodeIndex(const NodeIndex start, const double range) const;
 
   /**
    * \brief Find the closest node on the lattice given a carla waypoint.
@@ -472,14 +596,53 @@ protected:
    * \param[in] waypoint The query carla waypoint.
    * \param[in] tolerance The maximum tolerable distance between
    *                      the waypoint and the found node.
-   * \return The node closest to the query waypoint.
+   * \return The index of the node closest to the query waypoint,
+   *         or \c kInvalidNodeIndex if no node is found.
    */
-  boost::shared_ptr<Node> closestNode(
+  NodeIndex closestNodeIndex(
       const boost::shared_ptr<const CarlaWaypoint>& waypoint,
-      const double tolerance);
+      const double tolerance) const;
+
+  /**
+   * \brief Update the entry and exit nodes on the lattice.
+   *
+   * Besides the current entries and exits, only the given candidates
+   * are checked. The candidates should include all nodes of which the
+   * front or back node is changed.
+   *
+   * \param[in] candidates The nodes that may become entries or exits.
+   */
+  void updateLatticeEntriesAndExits(const std::vector<NodeIndex>& candidates);
 
-  /// Find the entry and exit nodes on the lattice.
-  void findLatticeEntriesAndExits();
+  /// Get the key of a grid cell in the grid-to-nodes table.
+  size_t gridCell(const int64_t x, const int64_t y) const {
+    size_t cell = 0;
+    utils::hashCombine(cell, x, y);
+    return cell;
+  }
+
+  /// Get the grid coordinate of a location coordinate.
+  int64_t gridCoordinate(const double x) const {
+    return static_cast<int64_t>(std::floor(x/longitudinal_resolution_));
+  }
+
+  /// Get the column a node belongs to in the node columns.
+  int64_t nodeColumn(const NodeIndex node) const {
+    const NodeArena<Node>& arena = *(topology_->node_arena);
+    return std::llround(
+        (arena[node].distance() + arena.distanceOffset()) / longitudinal_resolution_);
+  }
+
+  /**
+   * \brief Make sure the topology is not shared with any other lattice.
+   *
+   * The topology is copied if it is shared. This function should be
+   * called before the topology is modified.
+   */
+  void detachTopology() {
+    if (!topology_.unique()) topology_ = boost::make_shared<Topology>(*topology_);
+    return;
+  }
 
   /**
    * \brief Find the front waypoint of the query waypoint.
@@ -488,21 +651,17 @@ protected:
    */
   boost::shared_ptr<CarlaWaypoint> findFrontWaypoint(
       const boost::shared_ptr<const CarlaWaypoint>& waypoint,
-      const double range) const {
-    return router_->frontWaypoint(waypoint, range);
-  }
+      const double range) const;
 
   /// Find the left waypoint of the query one.
+  /// \c nullptr is returned if the left lane is not drivable.
   boost::shared_ptr<CarlaWaypoint> findLeftWaypoint(
-      const boost::shared_ptr<const CarlaWaypoint>& waypoint) const {
-    return waypoint->GetLeft();
-  }
+      const boost::shared_ptr<const CarlaWaypoint>& waypoint) const;
 
   /// Find the right waypoint of the query one.
+  /// \c nullptr is returned if the right lane is not drivable.
   boost::shared_ptr<CarlaWaypoint> findRightWaypoint(
-      const boost::shared_ptr<const CarlaWaypoint>& waypoint) const {
-    return waypoint->GetRight();
-  }
+      const boost::shared_ptr<const CarlaWaypoint>& waypoint) const;
 
   /**
    * \brief Extend the lattice in the forward direction.
@@ -515,9 +674,9 @@ protected:
    *                         the lattice, and this front node is actually a new
    *                         node, it will be pushed into this queue.
    */
-  void extendFront(const boost::shared_ptr<Node>& node,
+  void extendFront(const NodeIndex node,
                    const double range,
-                   std::queue<boost::shared_ptr<Node>>& nodes_queue);
+                   std::queue<NodeIndex>& nodes_queue);
 
   /**
    * \brief Extend the lattice to the left.
@@ -528,8 +687,8 @@ protected:
    * \param[out] nodes_queue If the found left node is new, it will be pushed
    *                         into this queue.
    */
-  void extendLeft(const boost::shared_ptr<Node>& node,
-                  std::queue<boost::shared_ptr<Node>>& nodes_queue);
+  void extendLeft(const NodeIndex node,
+                  std::queue<NodeIndex>& nodes_queue);
 
   /**
    * \brief Extend the lattice to the right.
@@ -540,17 +699,8 @@ protected:
    * \param[out] nodes_queue If the found right node is new, it will be pushed
    *                         into this queue.
    */
-  void extendRight(const boost::shared_ptr<Node>& node,
-                   std::queue<boost::shared_ptr<Node>>& nodes_queue);
-
-  /**
-   * \brief Update the distance of all nodes.
-   *
-   * This function is only used by the \c shorten() function. After which,
-   * the distance of the nodes requires to be updated. After updating, the
-   * minimum distance of all nodes is always 0.
-   */
-  void updateNodeDistance();
+  void extendRight(const NodeIndex node,
+                   std::queue<NodeIndex>& nodes_queue);
 
 }; // End class Lattice.
 } // End namespace planner.
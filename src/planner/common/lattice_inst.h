@@ -17,8 +17,10 @@
 #include <limits>
 #include <utility>
 #include <stdexcept>
+#include <cstdint>
 #include <unordered_set>
 #include <algorithm>
+#include <iterator>
 #include <string>
 #include <boost/format.hpp>
 
@@ -31,8 +33,10 @@ Lattice<Node>::Lattice(
   const boost::shared_ptr<const CarlaWaypoint>& start,
   const double range,
   const double longitudinal_resolution,
-  const boost::shared_ptr<router::Router>& router) :
+  const boost::shared_ptr<router::Router>& router,
+  const boost::shared_ptr<const utils::LaneGraph>& lane_graph) :
     router_(router),
+    lane_graph_(lane_graph),
     longitudinal_resolution_(longitudinal_resolution) {
 
   if (range <= longitudinal_resolution_) {
@@ -45,12 +49,7 @@ Lattice<Node>::Lattice(
   }
 
   // Create the start node.
-  boost::shared_ptr<Node> start_node = boost::make_shared<Node>(start);
-  start_node->distance() = 0.0;
-  lattice_exits_.push_back(start_node);
-
-  augmentWaypointToNodeTable(start->GetId(), start_node);
-  augmentRoadlaneToWaypointsTable(start);
+  topology_->lattice_exits.push_back(addNode(start, 0.0));
 
   // Construct the lattice.
   extend(range);
@@ -61,97 +60,87 @@ Lattice<Node>::Lattice(
 template<typename Node>
 Lattice<Node>::Lattice(const Lattice<Node>& other) :
   router_(other.router_),
-  lattice_entries_(other.lattice_entries_),
-  lattice_exits_(other.lattice_exits_),
-  roadlane_to_waypoints_table_(other.roadlane_to_waypoints_table_),
+  lane_graph_(other.lane_graph_),
+  topology_(other.topology_),
   longitudinal_resolution_(other.longitudinal_resolution_) {
 
-  // Copy the \c waypoint_to_node_table_. Make sure this object
-  // owns its own copy of the nodes pointed by shared pointers.
-  for (const auto& item : other.waypoint_to_node_table_) {
-    waypoint_to_node_table_[item.first] = boost::make_shared<Node>(*(item.second));
-  }
-
-  // For each node in the table, make sure the connected nodes are pointing
-  // to the copy stored within this object.
-  for (auto& item : waypoint_to_node_table_) {
-    if (item.second->front().lock()) {
-      const size_t front_node = item.second->front().lock()->waypoint()->GetId();
-      item.second->front() = waypoint_to_node_table_[front_node];
-    }
-    if (item.second->back().lock()) {
-      const size_t back_node = item.second->back().lock()->waypoint()->GetId();
-      item.second->back() = waypoint_to_node_table_[back_node];
-    }
-    if (item.second->left().lock()) {
-      const size_t left_node = item.second->left().lock()->waypoint()->GetId();
-      item.second->left() = waypoint_to_node_table_[left_node];
-    }
-    if (item.second->right().lock()) {
-      const size_t right_node = item.second->right().lock()->waypoint()->GetId();
-      item.second->right() = waypoint_to_node_table_[right_node];
-    }
-  }
-
-  // Redirect the entry and exit pointers.
-  for (auto& entry : lattice_entries_)
-    entry = waypoint_to_node_table_[entry.lock()->waypoint()->GetId()];
-  for (auto& exit : lattice_exits_)
-    exit = waypoint_to_node_table_[exit.lock()->waypoint()->GetId()];
-
+  // The topology is shared with the other lattice, and will only be
+  // copied once either of the lattices modifies it.
   return;
 }
 
 template<typename Node>
 void Lattice<Node>::swap(Lattice<Node>& other) {
 
-  std::swap(lattice_entries_, other.lattice_entries_);
-  std::swap(lattice_exits_, other.lattice_exits_);
-  std::swap(waypoint_to_node_table_, other.waypoint_to_node_table_);
-  std::swap(roadlane_to_waypoints_table_, other.roadlane_to_waypoints_table_);
+  std::swap(topology_, other.topology_);
   std::swap(longitudinal_resolution_, other.longitudinal_resolution_);
   std::swap(router_, other.router_);
+  std::swap(lane_graph_, other.lane_graph_);
 
   return;
 }
 
 template<typename Node>
-void Lattice<Node>::augmentRoadlaneToWaypointsTable(
-    const boost::shared_ptr<const CarlaWaypoint>& waypoint) {
+NodeIndex Lattice<Node>::addNode(
+    const boost::shared_ptr<const CarlaWaypoint>& waypoint,
+    const double distance) {
+
+  const NodeIndex index = topology_->node_arena->add(Node(waypoint), distance);
+  topology_->node_columns.insert(nodeColumn(index), index);
+  topology_->node_segments.add(index, nodeColumn(index));
 
-  //const size_t roadlane_id = hashRoadLaneIds(
-  //    waypoint->GetRoadId(), waypoint->GetLaneId());
+  topology_->waypoint_to_node_table.insert(waypoint->GetId(), index);
+
+  // Keep the nodes on the same road+lane sorted by s.
   size_t roadlane_id = 0;
   utils::hashCombine(roadlane_id, waypoint->GetRoadId(), waypoint->GetLaneId());
+  std::vector<std::pair<double, NodeIndex>>& roadlane_nodes =
+    topology_->roadlane_to_nodes_table[roadlane_id];
+  const std::pair<double, NodeIndex> roadlane_node(waypoint->GetDistance(), index);
+  roadlane_nodes.insert(std::upper_bound(
+        roadlane_nodes.begin(), roadlane_nodes.end(), roadlane_node), roadlane_node);
 
-  // Initialize this entry in the table.
-  if (roadlane_to_waypoints_table_.find(roadlane_id) ==
-      roadlane_to_waypoints_table_.end())
-    roadlane_to_waypoints_table_[roadlane_id] = std::vector<size_t>();
+  const CarlaLocation& location = waypoint->GetTransform().location;
+  topology_->grid_to_nodes_table[gridCell(
+      gridCoordinate(location.x), gridCoordinate(location.y))].push_back(index);
 
-  // Add the waypoint ID to this road+lane.
-  roadlane_to_waypoints_table_[roadlane_id].push_back(waypoint->GetId());
-  return;
+  return index;
 }
 
 template<typename Node>
-void Lattice<Node>::reduceRoadlaneToWaypointsTable(
-    const boost::shared_ptr<const CarlaWaypoint>& waypoint) {
+void Lattice<Node>::removeNode(const NodeIndex index) {
+
+  if (!topology_->node_arena->alive(index)) return;
+  const boost::shared_ptr<const CarlaWaypoint> waypoint =
+    (*topology_->node_arena)[index].waypoint();
+
+  topology_->waypoint_to_node_table.erase(waypoint->GetId());
 
   size_t roadlane_id = 0;
   utils::hashCombine(roadlane_id, waypoint->GetRoadId(), waypoint->GetLaneId());
 
-  if (roadlane_to_waypoints_table_.find(roadlane_id) !=
-      roadlane_to_waypoints_table_.end()) {
-    std::vector<size_t>& waypoints = roadlane_to_waypoints_table_[roadlane_id];
-    std::vector<size_t>::iterator end_iter = std::remove_if(
-        waypoints.begin(), waypoints.end(),
-        [&waypoint](const size_t id)->bool{
-          return (id == waypoint->GetId());
-        });
+  auto roadlane_iter = topology_->roadlane_to_nodes_table.find(roadlane_id);
+  if (roadlane_iter != topology_->roadlane_to_nodes_table.end()) {
+    std::vector<std::pair<double, NodeIndex>>& nodes = roadlane_iter->second;
+    auto node_iter = std::lower_bound(nodes.begin(), nodes.end(),
+        std::make_pair(waypoint->GetDistance(), index));
+    if (node_iter != nodes.end() && node_iter->second == index)
+      nodes.erase(node_iter);
+    if (nodes.empty()) topology_->roadlane_to_nodes_table.erase(roadlane_iter);
+  }
 
-    waypoints.erase(end_iter, waypoints.end());
+  const CarlaLocation& location = waypoint->GetTransform().location;
+  auto grid_iter = topology_->grid_to_nodes_table.find(gridCell(
+        gridCoordinate(location.x), gridCoordinate(location.y)));
+  if (grid_iter != topology_->grid_to_nodes_table.end()) {
+    std::vector<NodeIndex>& nodes = grid_iter->second;
+    nodes.erase(std::remove(nodes.begin(), nodes.end(), index), nodes.end());
+    if (nodes.empty()) topology_->grid_to_nodes_table.erase(grid_iter);
   }
+
+  topology_->node_columns.erase(nodeColumn(index), index);
+  topology_->node_segments.remove(index, nodeColumn(index));
+  topology_->node_arena->remove(index);
   return;
 }
 
@@ -159,9 +148,13 @@ template<typename Node>
 std::unordered_map<size_t, boost::shared_ptr<const Node>>
   Lattice<Node>::nodes() const {
 
+  const NodeArena<Node>& arena = *topology_->node_arena;
+
   std::unordered_map<size_t, boost::shared_ptr<const Node>> nodes;
-  for (const auto& item : waypoint_to_node_table_)
-    nodes[item.first] = item.second;
+  for (NodeIndex i = 0; i < arena.slots(); ++i) {
+    if (!arena.alive(i)) continue;
+    nodes[arena[i].id()] = arena.node(i);
+  }
 
   return nodes;
 }
@@ -170,30 +163,28 @@ template<typename Node>
 std::vector<std::pair<size_t, size_t>>
   Lattice<Node>::edges() const {
 
+  const NodeArena<Node>& arena = *topology_->node_arena;
   std::vector<std::pair<size_t, size_t>> edges;
 
-  for (const auto& item : waypoint_to_node_table_) {
-    const boost::shared_ptr<const Node> this_node = item.second;
+  for (NodeIndex i = 0; i < arena.slots(); ++i) {
+    if (!arena.alive(i)) continue;
+    const Node& this_node = arena[i];
 
-    if (this_node->front())
+    if (this_node.frontIndex() != kInvalidNodeIndex)
       edges.push_back(std::make_pair(
-            this_node->waypoint()->GetId(),
-            this_node->front()->waypoint()->GetId()));
+            this_node.id(), arena[this_node.frontIndex()].id()));
 
-    if (this_node->left())
+    if (this_node.leftIndex() != kInvalidNodeIndex)
       edges.push_back(std::make_pair(
-            this_node->waypoint()->GetId(),
-            this_node->left()->waypoint()->GetId()));
+            this_node.id(), arena[this_node.leftIndex()].id()));
 
-    if (this_node->right())
+    if (this_node.rightIndex() != kInvalidNodeIndex)
       edges.push_back(std::make_pair(
-            this_node->waypoint()->GetId(),
-            this_node->right()->waypoint()->GetId()));
+            this_node.id(), arena[this_node.rightIndex()].id()));
 
-    if (this_node->back())
+    if (this_node.backIndex() != kInvalidNodeIndex)
       edges.push_back(std::make_pair(
-            this_node->waypoint()->GetId(),
-            this_node->back()->waypoint()->GetId()));
+            this_node.id(), arena[this_node.backIndex()].id()));
   }
 
   return edges;
@@ -202,18 +193,20 @@ std::vector<std::pair<size_t, size_t>>
 template<typename Node>
 double Lattice<Node>::range() const {
 
-  if (lattice_entries_.empty() || lattice_exits_.empty()) return 0.0;
+  if (topology_->lattice_entries.empty() ||
+      topology_->lattice_exits.empty()) return 0.0;
 
+  const NodeArena<Node>& arena = *topology_->node_arena;
   double entry_distance = std::numeric_limits<double>::max();
   double exit_distance = 0.0;
 
-  for (const auto& entry : lattice_entries_) {
-    if (entry.lock()->distance() < entry_distance)
-      entry_distance = entry.lock()->distance();
+  for (const NodeIndex entry : topology_->lattice_entries) {
+    if (arena[entry].distance() < entry_distance)
+      entry_distance = arena[entry].distance();
   }
-  for (const auto& exit : lattice_exits_) {
-    if (exit.lock()->distance() > exit_distance)
-      exit_distance = exit.lock()->distance();
+  for (const NodeIndex exit : topology_->lattice_exits) {
+    if (arena[exit].distance() > exit_distance)
+      exit_distance = arena[exit].distance();
   }
 
   return exit_distance - entry_distance;
@@ -235,15 +228,23 @@ void Lattice<Node>::extend(double range) {
   range = std::ceil(range);
   if (this->range() >= range) return;
 
+  // The topology will be modified, which should not affect other lattices.
+  detachTopology();
+
   // A queue of nodes to be explored.
   // The queue is started from the lattice exits.
-  std::queue<boost::shared_ptr<Node>> nodes_queue;
-  for (auto& exit : lattice_exits_) nodes_queue.push(exit.lock());
+  std::queue<NodeIndex> nodes_queue;
+  for (const NodeIndex exit : topology_->lattice_exits) nodes_queue.push(exit);
+
+  // Nodes that have been explored. Only these nodes may have their
+  // front and back nodes changed.
+  std::vector<NodeIndex> explored_nodes;
 
   while (!nodes_queue.empty()) {
     // Get the next node to explore and remove it from the queue.
-    boost::shared_ptr<Node> node = nodes_queue.front();
+    const NodeIndex node = nodes_queue.front();
     nodes_queue.pop();
+    explored_nodes.push_back(node);
 
     extendFront(node, range, nodes_queue);
     extendLeft(node, nodes_queue);
@@ -251,7 +252,7 @@ void Lattice<Node>::extend(double range) {
   }
 
   // Update lattice entries and exits.
-  findLatticeEntriesAndExits();
+  updateLatticeEntriesAndExits(explored_nodes);
 
   return;
 }
@@ -271,226 +272,204 @@ void Lattice<Node>::shorten(double range) {
   range = std::ceil(range);
   if (this->range() <= range) return;
 
+  // The topology will be modified, which should not affect other lattices.
+  detachTopology();
+
   // The distance before which nodes should be removed.
   const double safe_distance = this->range() - range;
 
-  // Save the ids for the waypoint to be removed.
-  std::unordered_set<size_t> removed_waypoint_ids;
-  // Save the nodes to be processed.
-  std::queue<boost::shared_ptr<Node>> nodes_queue;
-
-  for (auto& entry : lattice_entries_) {
-    if (entry.lock()->distance() >= safe_distance) continue;
-    removed_waypoint_ids.insert(entry.lock()->waypoint()->GetId());
-    nodes_queue.push(entry.lock());
-  }
-
-  while (!nodes_queue.empty()) {
-    // Get the next node to be processed.
-    boost::shared_ptr<Node> node = nodes_queue.front();
-    nodes_queue.pop();
-
-    // Add the left node.
-    if (node->left().lock()) {
-      boost::shared_ptr<Node> left_node = node->left().lock();
-      if (removed_waypoint_ids.count(left_node->waypoint()->GetId()) == 0) {
-        removed_waypoint_ids.insert(left_node->waypoint()->GetId());
-        nodes_queue.push(left_node);
-      }
-    }
+  NodeArena<Node>& arena = *topology_->node_arena;
 
-    // Add the right node.
-    if (node->right().lock()) {
-      boost::shared_ptr<Node> right_node = node->right().lock();
-      if (removed_waypoint_ids.count(right_node->waypoint()->GetId()) == 0) {
-        removed_waypoint_ids.insert(right_node->waypoint()->GetId());
-        nodes_queue.push(right_node);
-      }
-    }
+  // Drop the columns at the back of the lattice, until reaching a column
+  // with nodes that should be kept.
+  while (!topology_->node_columns.empty()) {
+    const int64_t c = topology_->node_columns.firstColumn();
+    const std::vector<NodeIndex> column = topology_->node_columns.column(c);
 
-    // Add the back node.
-    if (node->back().lock()) {
-      boost::shared_ptr<Node> back_node = node->back().lock();
-      if (removed_waypoint_ids.count(back_node->waypoint()->GetId()) == 0) {
-        removed_waypoint_ids.insert(back_node->waypoint()->GetId());
-        nodes_queue.push(back_node);
-      }
+    bool keep_column = false;
+    for (const NodeIndex node : column) {
+      if (arena[node].distance() >= safe_distance) keep_column = true;
+      else removeNode(node);
     }
 
-    // Some special care is required for the front node.
-    // We need to determine when to stop.
-    if (node->front().lock()) {
-      boost::shared_ptr<Node> front_node = node->front().lock();
-      if (front_node->distance() < safe_distance &&
-          removed_waypoint_ids.count(front_node->waypoint()->GetId()) == 0) {
-        removed_waypoint_ids.insert(front_node->waypoint()->GetId());
-        nodes_queue.push(front_node);
-      }
-    }
+    if (keep_column) break;
+    topology_->node_columns.popFront();
   }
 
-  // Removed the nodes that have been recorded.
-  for (const size_t waypoint_id : removed_waypoint_ids) {
-    reduceRoadlaneToWaypointsTable(waypoint_to_node_table_[waypoint_id]->waypoint());
-    reduceWaypointToNodeTable(waypoint_id);
+  // Reset the links of the remaining nodes to the removed ones,
+  // since the slots of the removed nodes will be reused. Nodes are
+  // only linked to the ones in the adjacent columns, therefore only
+  // the first few columns need to be checked.
+  auto unlink = [&arena](NodeIndex& link)->void{
+    if (link != kInvalidNodeIndex && !arena.alive(link)) link = kInvalidNodeIndex;
+  };
+
+  std::vector<NodeIndex> boundary_nodes;
+  const int64_t boundary_end = std::min(
+      topology_->node_columns.firstColumn()+2, topology_->node_columns.endColumn());
+  for (int64_t c = topology_->node_columns.firstColumn(); c < boundary_end; ++c) {
+    for (const NodeIndex i : topology_->node_columns.column(c)) {
+      Node& node = arena[i];
+      unlink(node.frontIndex());
+      unlink(node.backIndex());
+      unlink(node.leftIndex());
+      unlink(node.rightIndex());
+      boundary_nodes.push_back(i);
+    }
   }
 
   // Update the entries and exits of the lattic.
-  findLatticeEntriesAndExits();
+  updateLatticeEntriesAndExits(boundary_nodes);
 
-  // Update the distance of all remaining nodes.
-  updateNodeDistance();
+  // Update the distance of all remaining nodes, so that the minimum
+  // distance of the entries is 0. Instead of visiting every node,
+  // the distance offset of the arena is changed.
+  double shift_distance = std::numeric_limits<double>::max();
+  for (const NodeIndex entry : topology_->lattice_entries)
+    shift_distance = std::min(shift_distance, arena[entry].distance());
+  if (!topology_->lattice_entries.empty()) arena.distanceOffset() += shift_distance;
 
   return;
 }
 
 template<typename Node>
-void Lattice<Node>::updateNodeDistance() {
-
-  // Find the existing lattice entry with the smallest distance.
-  // The distance of all nodes will be reduced by this much.
-  double shift_distance = lattice_entries_[0].lock()->distance();
-  for (auto& entry : lattice_entries_) {
-    if (entry.lock()->distance() >= shift_distance) continue;
-    shift_distance = entry.lock()->distance();
-  }
-
-  // Put all existing entries into the queue.
-  std::unordered_set<size_t> updated_waypoint_ids;
-  std::queue<boost::shared_ptr<Node>> nodes_queue;
+boost::shared_ptr<typename Lattice<Node>::CarlaWaypoint>
+  Lattice<Node>::findFrontWaypoint(
+    const boost::shared_ptr<const CarlaWaypoint>& waypoint,
+    const double range) const {
 
-  for (auto& entry : lattice_entries_) {
-    entry.lock()->distance() -= shift_distance;
-    nodes_queue.push(entry.lock());
-    updated_waypoint_ids.insert(entry.lock()->waypoint()->GetId());
+  // Walk along the lane graph if the waypoint is indexed.
+  if (lane_graph_) {
+    const boost::optional<utils::LaneGraph::Position> position =
+      lane_graph_->position(waypoint);
+    if (position) {
+      const boost::optional<utils::LaneGraph::Position> front =
+        lane_graph_->front(*position, range);
+      if (!front) return nullptr;
+      return lane_graph_->waypoint(*front);
+    }
   }
 
-  while (!nodes_queue.empty()) {
-    // Get the next node to be processed.
-    boost::shared_ptr<Node> node = nodes_queue.front();
-    nodes_queue.pop();
-
-    // Update the left node.
-    if (node->left().lock()) {
-      boost::shared_ptr<Node> left_node = node->left().lock();
-      if (updated_waypoint_ids.count(left_node->waypoint()->GetId()) == 0) {
-        updated_waypoint_ids.insert(left_node->waypoint()->GetId());
-        nodes_queue.push(left_node);
-        left_node->distance() = node->distance();
-      }
-    }
+  return router_->frontWaypoint(waypoint, range);
+}
 
-    // Update the right node.
-    if (node->right().lock()) {
-      boost::shared_ptr<Node> right_node = node->right().lock();
-      if (updated_waypoint_ids.count(right_node->waypoint()->GetId()) == 0) {
-        updated_waypoint_ids.insert(right_node->waypoint()->GetId());
-        nodes_queue.push(right_node);
-        right_node->distance() = node->distance();
-      }
+template<typename Node>
+boost::shared_ptr<typename Lattice<Node>::CarlaWaypoint>
+  Lattice<Node>::findLeftWaypoint(
+    const boost::shared_ptr<const CarlaWaypoint>& waypoint) const {
+
+  // Only driving lanes are indexed by the lane graph.
+  if (lane_graph_) {
+    const boost::optional<utils::LaneGraph::Position> position =
+      lane_graph_->position(waypoint);
+    if (position) {
+      const boost::optional<utils::LaneGraph::Position> left =
+        lane_graph_->left(*position);
+      if (!left) return nullptr;
+      return lane_graph_->waypoint(*left);
     }
+  }
 
-    // Update the front node.
-    if (node->front().lock()) {
-      boost::shared_ptr<Node> front_node = node->front().lock();
-      if (updated_waypoint_ids.count(front_node->waypoint()->GetId()) == 0) {
-        updated_waypoint_ids.insert(front_node->waypoint()->GetId());
-        nodes_queue.push(front_node);
-        front_node->distance() = node->distance() + longitudinal_resolution_;
-      }
-    }
+  boost::shared_ptr<CarlaWaypoint> left_waypoint = waypoint->GetLeft();
+  if (!left_waypoint ||
+      left_waypoint->GetType() != carla::road::Lane::LaneType::Driving)
+    return nullptr;
+  return left_waypoint;
+}
 
-    // Update the back node.
-    if (node->back().lock()) {
-      boost::shared_ptr<Node> back_node = node->back().lock();
-      if (updated_waypoint_ids.count(back_node->waypoint()->GetId()) == 0) {
-        updated_waypoint_ids.insert(back_node->waypoint()->GetId());
-        nodes_queue.push(back_node);
-        back_node->distance() = node->distance() - longitudinal_resolution_;
-      }
+template<typename Node>
+boost::shared_ptr<typename Lattice<Node>::CarlaWaypoint>
+  Lattice<Node>::findRightWaypoint(
+    const boost::shared_ptr<const CarlaWaypoint>& waypoint) const {
+
+  // Only driving lanes are indexed by the lane graph.
+  if (lane_graph_) {
+    const boost::optional<utils::LaneGraph::Position> position =
+      lane_graph_->position(waypoint);
+    if (position) {
+      const boost::optional<utils::LaneGraph::Position> right =
+        lane_graph_->right(*position);
+      if (!right) return nullptr;
+      return lane_graph_->waypoint(*right);
     }
   }
 
-  return;
+  boost::shared_ptr<CarlaWaypoint> right_waypoint = waypoint->GetRight();
+  if (!right_waypoint ||
+      right_waypoint->GetType() != carla::road::Lane::LaneType::Driving)
+    return nullptr;
+  return right_waypoint;
 }
 
 template<typename Node>
 void Lattice<Node>::extendFront(
-    const boost::shared_ptr<Node>& node,
+    const NodeIndex node,
     const double range,
-    std::queue<boost::shared_ptr<Node>>& nodes_queue) {
+    std::queue<NodeIndex>& nodes_queue) {
+
+  NodeArena<Node>& arena = *topology_->node_arena;
 
   // Find the front waypoint.
   boost::shared_ptr<CarlaWaypoint> front_waypoint =
-    findFrontWaypoint(node->waypoint(), longitudinal_resolution_);
-
-  if (front_waypoint) {
-    // Find the front node correspoinding to the front waypoint if it exists.
-    boost::shared_ptr<Node> front_node = closestNode(front_waypoint, 0.2);
-
-    if (!front_node) {
-      // This front node does not exist yet.
-      front_node = boost::make_shared<Node>(front_waypoint);
-      front_node->distance() = node->distance() + longitudinal_resolution_;
-
-      // Add this new node to the queue if it is not beyond the max range.
-      if (front_node->distance() <= range) {
-        // Add the new node to the tables.
-        augmentWaypointToNodeTable(front_waypoint->GetId(), front_node);
-        augmentRoadlaneToWaypointsTable(front_waypoint);
-        // Add the new node to the queue.
-        nodes_queue.push(front_node);
-      }
-    }
+    findFrontWaypoint(arena[node].waypoint(), longitudinal_resolution_);
+  if (!front_waypoint) return;
 
-    // If this front node is added to the graph, it is set to the
-    // front node of the current node.
-    if (waypoint_to_node_table_.find(front_node->waypoint()->GetId()) !=
-        waypoint_to_node_table_.end()) {
-      node->front() = front_node;
-      front_node->back() = node;
-    }
+  // Find the front node correspoinding to the front waypoint if it exists.
+  NodeIndex front_node = closestNodeIndex(front_waypoint, 0.2);
+
+  if (front_node == kInvalidNodeIndex) {
+    // This front node does not exist yet.
+    const double front_distance = arena[node].distance() + longitudinal_resolution_;
+
+    // The new node is not added if it is beyond the max range.
+    if (front_distance > range) return;
+
+    // Add the new node to the lattice and the queue.
+    front_node = addNode(front_waypoint, front_distance);
+    nodes_queue.push(front_node);
   }
 
+  // The front node is on the lattice, set it to the front of the current node.
+  arena[node].frontIndex() = front_node;
+  arena[front_node].backIndex() = node;
+  topology_->node_segments.link(
+      node, nodeColumn(node), front_node, nodeColumn(front_node));
+
   return;
 }
 
 template<typename Node>
 void Lattice<Node>::extendLeft(
-    const boost::shared_ptr<Node>& node,
-    std::queue<boost::shared_ptr<Node>>& nodes_queue) {
+    const NodeIndex node,
+    std::queue<NodeIndex>& nodes_queue) {
+
+  NodeArena<Node>& arena = *topology_->node_arena;
+
   // Find the left waypoint.
   boost::shared_ptr<CarlaWaypoint> left_waypoint =
-    findLeftWaypoint(node->waypoint());
+    findLeftWaypoint(arena[node].waypoint());
 
-  // Return if there is no left waypoint.
+  // Return if there is no (drivable) left waypoint.
   if (!left_waypoint) return;
 
-  // Return if the left waypoint is not drivable.
-  if(left_waypoint->GetType() != carla::road::Lane::LaneType::Driving) return;
-
   // Find the left node corresponds to the waypoint.
-  boost::shared_ptr<Node> left_node = closestNode(left_waypoint, 0.2);
+  NodeIndex left_node = closestNodeIndex(left_waypoint, 0.2);
 
-  if (!left_node) {
-    // This left node does not exist yet, add it to the tables and queue.
-    left_node = boost::make_shared<Node>(left_waypoint);
-    left_node->distance() = node->distance();
-
-    augmentWaypointToNodeTable(left_waypoint->GetId(), left_node);
-    augmentRoadlaneToWaypointsTable(left_waypoint);
+  if (left_node == kInvalidNodeIndex) {
+    // This left node does not exist yet, add it to the lattice and queue.
+    left_node = addNode(left_waypoint, arena[node].distance());
     nodes_queue.push(left_node);
   }
 
   // The left node is set to the left of this node
   // if one can do a left lane change here.
-  if ((node->waypoint()->GetLaneChange() ==
-       carla::road::element::LaneMarking::LaneChange::Left) ||
-      (node->waypoint()->GetLaneChange() ==
-       carla::road::element::LaneMarking::LaneChange::Both)) {
-    node->left() = left_node;
+  const carla::road::element::LaneMarking::LaneChange lane_change =
+    arena[node].waypoint()->GetLaneChange();
+  if ((lane_change == carla::road::element::LaneMarking::LaneChange::Left) ||
+      (lane_change == carla::road::element::LaneMarking::LaneChange::Both)) {
+    arena[node].leftIndex() = left_node;
   } else {
-    node->left().reset();
+    arena[node].leftIndex() = kInvalidNodeIndex;
   }
 
   return;
@@ -498,46 +477,121 @@ void Lattice<Node>::extendLeft(
 
 template<typename Node>
 void Lattice<Node>::extendRight(
-    const boost::shared_ptr<Node>& node,
-    std::queue<boost::shared_ptr<Node>>& nodes_queue) {
+    const NodeIndex node,
+    std::queue<NodeIndex>& nodes_queue) {
+
+  NodeArena<Node>& arena = *topology_->node_arena;
 
   // Find the right waypoint.
   boost::shared_ptr<CarlaWaypoint> right_waypoint =
-    findRightWaypoint(node->waypoint());
+    findRightWaypoint(arena[node].waypoint());
 
-  // Return if there is no right waypoint.
+  // Return if there is no (drivable) right waypoint.
   if (!right_waypoint) return;
 
-  // Return if the right waypoint is not drivable.
-  if(right_waypoint->GetType() != carla::road::Lane::LaneType::Driving) return;
-
   // Find the right node corresponds to the waypoint.
-  boost::shared_ptr<Node> right_node = closestNode(right_waypoint, 0.2);
-
-  if (!right_node) {
-    // This right node does not exist yet, add it to the tables and queue.
-    right_node = boost::make_shared<Node>(right_waypoint);
-    right_node->distance() = node->distance();
+  NodeIndex right_node = closestNodeIndex(right_waypoint, 0.2);
 
-    augmentWaypointToNodeTable(right_waypoint->GetId(), right_node);
-    augmentRoadlaneToWaypointsTable(right_waypoint);
+  if (right_node == kInvalidNodeIndex) {
+    // This right node does not exist yet, add it to the lattice and queue.
+    right_node = addNode(right_waypoint, arena[node].distance());
     nodes_queue.push(right_node);
   }
 
   // The right node is set to the right of this node
   // if one can do a right lane change here.
-  if ((node->waypoint()->GetLaneChange() ==
-       carla::road::element::LaneMarking::LaneChange::Right) ||
-      (node->waypoint()->GetLaneChange() ==
-       carla::road::element::LaneMarking::LaneChange::Both)) {
-    node->right() = right_node;
+  const carla::road::element::LaneMarking::LaneChange lane_change =
+    arena[node].waypoint()->GetLaneChange();
+  if ((lane_change == carla::road::element::LaneMarking::LaneChange::Right) ||
+      (lane_change == carla::road::element::LaneMarking::LaneChange::Both)) {
+    arena[node].rightIndex() = right_node;
   } else {
-    node->right().reset();
+    arena[node].rightIndex() = kInvalidNodeIndex;
   }
 
   return;
 }
 
+template<typename Node>
+NodeIndex Lattice<Node>::frontNodeIndex(
+    const NodeIndex start, const double range) const {
+
+  if (start == kInvalidNodeIndex) return kInvalidNodeIndex;
+  const NodeArena<Node>& arena = *topology_->node_arena;
+
+  // Start from the given node, we search forward until the given range is met.
+  const double start_distance = arena[start].distance();
+  double current_range = 0.0;
+  NodeIndex node = start;
+  while (current_range < range) {
+    const uint32_t segment = topology_->node_segments.segment(node);
+    const int64_t column = nodeColumn(node);
+    const int64_t last_column = topology_->node_segments.lastColumn(segment);
+
+    if (column < last_column) {
+      // Jump to the node at the required range on the same lane segment.
+      // Since the distances of the nodes in a segment increase with
+      // the columns, the estimated column is corrected with a few checks.
+      const double steps = std::ceil((range-current_range) / longitudinal_resolution_);
+      int64_t target = column + static_cast<int64_t>(std::max(1.0,
+            std::min(steps, static_cast<double>(last_column-column))));
+      while (target > column+1 && arena[topology_->node_segments.node(
+            segment, target-1)].distance()-start_distance >= range) --target;
+      while (target < last_column && arena[topology_->node_segments.node(
+            segment, target)].distance()-start_distance < range) ++target;
+      node = topology_->node_segments.node(segment, target);
+    } else {
+      // Move on to the next lane segment.
+      node = arena[node].frontIndex();
+      // There is no futher front node, the given range exceeds the lattice.
+      if (node == kInvalidNodeIndex) return kInvalidNodeIndex;
+    }
+
+    current_range = arena[node].distance() - start_distance;
+  }
+
+  return node;
+}
+
+template<typename Node>
+NodeIndex Lattice<Node>::backNodeIndex(
+    const NodeIndex start, const double range) const {
+
+  if (start == kInvalidNodeIndex) return kInvalidNodeIndex;
+  const NodeArena<Node>& arena = *topology_->node_arena;
+
+  // Start from the given node, we search backwards until the given range is met.
+  const double start_distance = arena[start].distance();
+  double current_range = 0.0;
+  NodeIndex node = start;
+  while (current_range < range) {
+    const uint32_t segment = topology_->node_segments.segment(node);
+    const int64_t column = nodeColumn(node);
+    const int64_t first_column = topology_->node_segments.firstColumn(segment);
+
+    if (column > first_column) {
+      // Jump to the node at the required range on the same lane segment.
+      const double steps = std::ceil((range-current_range) / longitudinal_resolution_);
+      int64_t target = column - static_cast<int64_t>(std::max(1.0,
+            std::min(steps, static_cast<double>(column-first_column))));
+      while (target < column-1 && start_distance-arena[topology_->node_segments.node(
+            segment, target+1)].distance() >= range) ++target;
+      while (target > first_column && start_distance-arena[topology_->node_segments.node(
+            segment, target)].distance() < range) --target;
+      node = topology_->node_segments.node(segment, target);
+    } else {
+      // Move on to the previous lane segment.
+      node = arena[node].backIndex();
+      // There is no futher back node, the given range exceeds the lattice.
+      if (node == kInvalidNodeIndex) return kInvalidNodeIndex;
+    }
+
+    current_range = start_distance - arena[node].distance();
+  }
+
+  return node;
+}
+
 template<typename Node>
 boost::shared_ptr<const Node> Lattice<Node>::front(
     const boost::shared_ptr<const CarlaWaypoint>& query,
@@ -546,20 +600,10 @@ boost::shared_ptr<const Node> Lattice<Node>::front(
   // Find the node on the lattice that is closest to the given way point.
   // If we cannot find node on the lattice that is close enough,
   // the query waypoint is too far from the lattice, and we return nullptr.
-  boost::shared_ptr<const Node> node = closestNode(query, longitudinal_resolution_);
-  if (!node) return nullptr;
-
-  // Start from the found node, we search forward until the given range is met.
-  const double start_distance = node->distance();
-  double current_range = 0.0;
-  while (current_range < range) {
-    node = node->front();
-    // There is no futher front node, the given range exceeds the lattice.
-    if (!node) return nullptr;
-    current_range = node->distance() - start_distance;
-  }
+  const NodeIndex node = closestNodeIndex(query, longitudinal_resolution_);
 
-  return node;
+  const NodeArena<Node>& arena = *topology_->node_arena;
+  return arena.node(frontNodeIndex(node, range));
 }
 
 template<typename Node>
@@ -570,20 +614,10 @@ boost::shared_ptr<const Node> Lattice<Node>::back(
   // Find the node on the lattice that is closest to the given way point.
   // If we cannot find node on the lattice that is close enough,
   // the query waypoint is too far from the lattice, and we return nullptr.
-  boost::shared_ptr<const Node> node = closestNode(query, longitudinal_resolution_);
-  if (!node) return nullptr;
+  const NodeIndex node = closestNodeIndex(query, longitudinal_resolution_);
 
-  // Start from the found node, we search backwards until the given range is met.
-  const double start_distance = node->distance();
-  double current_range = 0.0;
-  while (current_range < range) {
-    node = node->back();
-    // There is no futher back node, the given range exceeds the lattice.
-    if (!node) return nullptr;
-    current_range = start_distance - node->distance();
-  }
-
-  return node;
+  const NodeArena<Node>& arena = *topology_->node_arena;
+  return arena.node(backNodeIndex(node, range));
 }
 
 template<typename Node>
@@ -591,14 +625,12 @@ boost::shared_ptr<const Node> Lattice<Node>::leftFront(
     const boost::shared_ptr<const CarlaWaypoint>& query,
     const double range) const {
 
-  boost::shared_ptr<const Node> node = closestNode(query, longitudinal_resolution_);
-  if (!node) return nullptr;
+  const NodeIndex node = closestNodeIndex(query, longitudinal_resolution_);
+  if (node == kInvalidNodeIndex) return nullptr;
 
   // Get the left node of the founded one, and search forward from that.
-  boost::shared_ptr<const Node> left_node = node->left();
-  if (!left_node) return nullptr;
-
-  return front(left_node->waypoint(), range);
+  const NodeArena<Node>& arena = *topology_->node_arena;
+  return arena.node(frontNodeIndex(arena[node].leftIndex(), range));
 }
 
 template<typename Node>
@@ -606,14 +638,14 @@ boost::shared_ptr<const Node> Lattice<Node>::frontLeft(
     const boost::shared_ptr<const CarlaWaypoint>& query,
     const double range) const {
 
-  boost::shared_ptr<const Node> node = closestNode(query, longitudinal_resolution_);
-  if (!node) return nullptr;
+  const NodeIndex node = closestNodeIndex(query, longitudinal_resolution_);
 
   // Get the front node of the founded one, and return the left of that.
-  boost::shared_ptr<const Node> front_node = front(node->waypoint(), range);
-  if (!front_node) return nullptr;
+  const NodeIndex front_node = frontNodeIndex(node, range);
+  if (front_node == kInvalidNodeIndex) return nullptr;
 
-  return front_node->left();
+  const NodeArena<Node>& arena = *topology_->node_arena;
+  return arena.node(arena[front_node].leftIndex());
 }
 
 template<typename Node>
@@ -621,14 +653,12 @@ boost::shared_ptr<const Node> Lattice<Node>::leftBack(
     const boost::shared_ptr<const CarlaWaypoint>& query,
     const double range) const {
 
-  boost::shared_ptr<const Node> node = closestNode(query, longitudinal_resolution_);
-  if (!node) return nullptr;
+  const NodeIndex node = closestNodeIndex(query, longitudinal_resolution_);
+  if (node == kInvalidNodeIndex) return nullptr;
 
   // Get the left node of the founded one, and search bacwards from that.
-  boost::shared_ptr<const Node> left_node = node->left();
-  if (!left_node) return nullptr;
-
-  return back(left_node->waypoint(), range);
+  const NodeArena<Node>& arena = *topology_->node_arena;
+  return arena.node(backNodeIndex(arena[node].leftIndex(), range));
 }
 
 template<typename Node>
@@ -636,14 +666,14 @@ boost::shared_ptr<const Node> Lattice<Node>::backLeft(
     const boost::shared_ptr<const CarlaWaypoint>& query,
     const double range) const {
 
-  boost::shared_ptr<const Node> node = closestNode(query, longitudinal_resolution_);
-  if (!node) return nullptr;
+  const NodeIndex node = closestNodeIndex(query, longitudinal_resolution_);
 
   // Get the back node of the founded one, and return the left of that.
-  boost::shared_ptr<const Node> back_node = back(node->waypoint(), range);
-  if (!back_node) return nullptr;
+  const NodeIndex back_node = backNodeIndex(node, range);
+  if (back_node == kInvalidNodeIndex) return nullptr;
 
-  return back_node->left();
+  const NodeArena<Node>& arena = *topology_->node_arena;
+  return arena.node(arena[back_node].leftIndex());
 }
 
 template<typename Node>
@@ -651,14 +681,12 @@ boost::shared_ptr<const Node> Lattice<Node>::rightFront(
     const boost::shared_ptr<const CarlaWaypoint>& query,
     const double range) const {
 
-  boost::shared_ptr<const Node> node = closestNode(query, longitudinal_resolution_);
-  if (!node) return nullptr;
+  const NodeIndex node = closestNodeIndex(query, longitudinal_resolution_);
+  if (node == kInvalidNodeIndex) return nullptr;
 
   // Get the right node of the founded one, and search forward from that.
-  boost::shared_ptr<const Node> right_node = node->right();
-  if (!right_node) return nullptr;
-
-  return front(right_node->waypoint(), range);
+  const NodeArena<Node>& arena = *topology_->node_arena;
+  return arena.node(frontNodeIndex(arena[node].rightIndex(), range));
 }
 
 template<typename Node>
@@ -666,14 +694,14 @@ boost::shared_ptr<const Node> Lattice<Node>::frontRight(
     const boost::shared_ptr<const CarlaWaypoint>& query,
     const double range) const {
 
-  boost::shared_ptr<const Node> node = closestNode(query, longitudinal_resolution_);
-  if (!node) return nullptr;
+  const NodeIndex node = closestNodeIndex(query, longitudinal_resolution_);
 
   // Get the front node of the found one, and return the right of that.
-  boost::shared_ptr<const Node> front_node = front(node->waypoint(), range);
-  if (!front_node) return nullptr;
+  const NodeIndex front_node = frontNodeIndex(node, range);
+  if (front_node == kInvalidNodeIndex) return nullptr;
 
-  return front_node->right();
+  const NodeArena<Node>& arena = *topology_->node_arena;
+  return arena.node(arena[front_node].rightIndex());
 }
 
 template<typename Node>
@@ -681,14 +709,12 @@ boost::shared_ptr<const Node> Lattice<Node>::rightBack(
     const boost::shared_ptr<const CarlaWaypoint>& query,
     const double range) const {
 
-  boost::shared_ptr<const Node> node = closestNode(query, longitudinal_resolution_);
-  if (!node) return nullptr;
+  const NodeIndex node = closestNodeIndex(query, longitudinal_resolution_);
+  if (node == kInvalidNodeIndex) return nullptr;
 
   // Get the right node of the founded one, and search backwards from that.
-  boost::shared_ptr<const Node> right_node = node->right();
-  if (!right_node) return nullptr;
-
-  return back(right_node->waypoint(), range);
+  const NodeArena<Node>& arena = *topology_->node_arena;
+  return arena.node(backNodeIndex(arena[node].rightIndex(), range));
 }
 
 template<typename Node>
@@ -696,44 +722,60 @@ boost::shared_ptr<const Node> Lattice<Node>::backRight(
     const boost::shared_ptr<const CarlaWaypoint>& query,
     const double range) const {
 
-  boost::shared_ptr<const Node> node = closestNode(query, longitudinal_resolution_);
-  if (!node) return nullptr;
+  const NodeIndex node = closestNodeIndex(query, longitudinal_resolution_);
 
   // Get the back node of the found one, and return the right of that.
-  boost::shared_ptr<const Node> back_node = back(node->waypoint(), range);
-  if (!back_node) return nullptr;
+  const NodeIndex back_node = backNodeIndex(node, range);
+  if (back_node == kInvalidNodeIndex) return nullptr;
 
-  return back_node->right();
+  const NodeArena<Node>& arena = *topology_->node_arena;
+  return arena.node(arena[back_node].rightIndex());
 }
 
 template<typename Node>
-void Lattice<Node>::findLatticeEntriesAndExits() {
+void Lattice<Node>::updateLatticeEntriesAndExits(
+    const std::vector<NodeIndex>& candidates) {
 
-  lattice_entries_.clear();
-  lattice_exits_.clear();
+  const NodeArena<Node>& arena = *topology_->node_arena;
 
-  for (auto& item : waypoint_to_node_table_) {
-    if (!(item.second->back().lock())) lattice_entries_.push_back(item.second);
-    if (!(item.second->front().lock())) lattice_exits_.push_back(item.second);
-  }
+  std::vector<NodeIndex> entries;
+  std::vector<NodeIndex> exits;
+
+  auto check = [&arena, &entries, &exits](const NodeIndex i)->void{
+    if (!arena.alive(i)) return;
+    if (arena[i].backIndex() == kInvalidNodeIndex) entries.push_back(i);
+    if (arena[i].frontIndex() == kInvalidNodeIndex) exits.push_back(i);
+  };
 
+  for (const NodeIndex i : topology_->lattice_entries) check(i);
+  for (const NodeIndex i : topology_->lattice_exits) check(i);
+  for (const NodeIndex i : candidates) check(i);
+
+  // Keep the entries and exits in the order of the node indices.
+  std::sort(entries.begin(), entries.end());
+  entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+  std::sort(exits.begin(), exits.end());
+  exits.erase(std::unique(exits.begin(), exits.end()), exits.end());
+
+  topology_->lattice_entries.swap(entries);
+  topology_->lattice_exits.swap(exits);
   return;
 }
 
 template<typename Node>
-boost::shared_ptr<Node> Lattice<Node>::closestNode(
+NodeIndex Lattice<Node>::closestNodeIndex(
     const boost::shared_ptr<const CarlaWaypoint>& waypoint,
-    const double tolerance) {
+    const double tolerance) const {
 
-  // Return nullptr is the input waypoint is invalid.
-  if (!waypoint) return nullptr;
+  // Return an invalid index if the input waypoint is invalid.
+  if (!waypoint) return kInvalidNodeIndex;
 
   // If there is a node in the lattice exactly matches the given waypoint,
   // just return the node.
-  if (waypoint_to_node_table_.find(waypoint->GetId()) !=
-      waypoint_to_node_table_.end()) {
-    return waypoint_to_node_table_.find(waypoint->GetId())->second;
-  }
+  const NodeIndex exact_node = topology_->waypoint_to_node_table.find(waypoint->GetId());
+  if (exact_node != kInvalidNodeIndex) return exact_node;
+
+  const NodeArena<Node>& arena = *topology_->node_arena;
 
   // Otherwise, we have to do a bit more work.
   // Compare the given waypoint with the waypoints on the same road+lane.
@@ -741,25 +783,25 @@ boost::shared_ptr<Node> Lattice<Node>::closestNode(
   size_t roadlane_id = 0;
   utils::hashCombine(roadlane_id, waypoint->GetRoadId(), waypoint->GetLaneId());
 
-  if (roadlane_to_waypoints_table_.find(roadlane_id) !=
-      roadlane_to_waypoints_table_.end()) {
+  auto roadlane_iter = topology_->roadlane_to_nodes_table.find(roadlane_id);
+  if (roadlane_iter != topology_->roadlane_to_nodes_table.end()) {
 
-    // Candidate waypoints on the same road and lane.
-    const std::vector<size_t>& candidate_waypoint_ids =
-      roadlane_to_waypoints_table_.find(roadlane_id)->second;
+    // Find the closest node on the same road and lane. Since the nodes
+    // are sorted by s, only the two nodes around the query are checked.
+    const std::vector<std::pair<double, NodeIndex>>& nodes = roadlane_iter->second;
+    const double s = waypoint->GetDistance();
+    auto iter = std::lower_bound(nodes.begin(), nodes.end(),
+        std::make_pair(s, static_cast<NodeIndex>(0)));
 
-    // Find the closest waypoint node.
     double closest_distance = std::numeric_limits<double>::max();
-    boost::shared_ptr<Node> closest_node = nullptr;
-    for (const size_t id : candidate_waypoint_ids) {
-      const boost::shared_ptr<Node> node = waypoint_to_node_table_.find(id)->second;
-      const double distance = std::fabs(
-          node->waypoint()->GetDistance() - waypoint->GetDistance());
-
-      if (distance < closest_distance) {
-        closest_distance = distance;
-        closest_node = node;
-      }
+    NodeIndex closest_node = kInvalidNodeIndex;
+    if (iter != nodes.begin()) {
+      closest_distance = s - std::prev(iter)->first;
+      closest_node = std::prev(iter)->second;
+    }
+    if (iter != nodes.end() && iter->first-s < closest_distance) {
+      closest_distance = iter->first - s;
+      closest_node = iter->second;
     }
 
     // Check if the closest distance is within the tolerance.
@@ -767,28 +809,50 @@ boost::shared_ptr<Node> Lattice<Node>::closestNode(
     //else return nullptr;
   }
 
-  // Now, we really have to pull out the big gun, searching through all
-  // nodes on the lattice in order to find the closest node.
+  // Now, we really have to pull out the big gun, searching through the
+  // nodes nearby in order to find the closest node. Only the grid cells
+  // within the tolerance are checked.
   double closest_distance = std::numeric_limits<double>::max();
-  boost::shared_ptr<Node> closest_node = nullptr;
+  NodeIndex closest_node = kInvalidNodeIndex;
 
-  for (const auto& item : waypoint_to_node_table_) {
+  const CarlaLocation& location = waypoint->GetTransform().location;
+  const int64_t min_x = gridCoordinate(location.x-tolerance);
+  const int64_t max_x = gridCoordinate(location.x+tolerance);
+  const int64_t min_y = gridCoordinate(location.y-tolerance);
+  const int64_t max_y = gridCoordinate(location.y+tolerance);
 
+  auto checkNode = [&arena, &location, &closest_distance, &closest_node](
+      const NodeIndex node)->void{
     const double distance = (
-        item.second->waypoint()->GetTransform().location -
-        waypoint->GetTransform().location).Length();
-
-    if (distance < closest_distance) {
+        arena[node].waypoint()->GetTransform().location - location).Length();
+    if (distance < closest_distance ||
+        (distance == closest_distance && node < closest_node)) {
       closest_distance = distance;
-      closest_node = item.second;
+      closest_node = node;
+    }
+    return;
+  };
+
+  if (static_cast<double>(max_x-min_x+1) * static_cast<double>(max_y-min_y+1) >
+      static_cast<double>(topology_->grid_to_nodes_table.size())) {
+    // With a large tolerance, it is cheaper to go through all nodes.
+    for (NodeIndex i = 0; i < arena.slots(); ++i) {
+      if (arena.alive(i)) checkNode(i);
+    }
+  } else {
+    for (int64_t x = min_x; x <= max_x; ++x) {
+      for (int64_t y = min_y; y <= max_y; ++y) {
+        auto grid_iter = topology_->grid_to_nodes_table.find(gridCell(x, y));
+        if (grid_iter == topology_->grid_to_nodes_table.end()) continue;
+        for (const NodeIndex node : grid_iter->second) checkNode(node);
+      }
     }
   }
 
   //std::printf("closest distance:%f tolerance:%f\n", closest_distance, tolerance);
 
   if (closest_distance < tolerance) return closest_node;
-  else return nullptr;
-  //return nullptr;
+  else return kInvalidNodeIndex;
 }
 
 template<typename Node>
@@ -798,17 +862,17 @@ std::string Lattice<Node>::string(const std::string& prefix) const {
         "lattice longitudinal resolution: %1%.\n"
         "lattice node #: %2%\n")
       % longitudinal_resolution_
-      % waypoint_to_node_table_.size()).str();
+      % topology_->node_arena->size()).str();
 
   std::string lattice_entries_msg = (boost::format(
-        "%1% lattice entries:\n") % lattice_entries_.size()).str();
-  for (const auto& entry : lattice_entries_)
-    lattice_entries_msg += entry.lock()->string();
+        "%1% lattice entries:\n") % topology_->lattice_entries.size()).str();
+  for (const NodeIndex entry : topology_->lattice_entries)
+    lattice_entries_msg += (*topology_->node_arena)[entry].string();
 
   std::string lattice_exits_msg = (boost::format(
-        "%1% lattice exits:\n") % lattice_exits_.size()).str();
-  for (const auto& exit : lattice_exits_)
-    lattice_exits_msg += exit.lock()->string();
+        "%1% lattice exits:\n") % topology_->lattice_exits.size()).str();
+  for (const NodeIndex exit : topology_->lattice_exits)
+    lattice_exits_msg += (*topology_->node_arena)[exit].string();
 
   return prefix + lattice_msg + lattice_entries_msg + lattice_exits_msg;
 }
@@ -0,0 +1,710 @@
+/*
+ * Copyright 2020 Ke Sun
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/smart_ptr.hpp>
+#include <boost/format.hpp>
+
+namespace planner {
+
+/// Index of a node within a \c NodeArena.
+using NodeIndex = uint32_t;
+
+/// Index used to indicate a node does not exist.
+constexpr NodeIndex kInvalidNodeIndex = std::numeric_limits<NodeIndex>::max();
+
+/**
+ * \brief NodeArena stores the nodes of a lattice in a single pool.
+ *
+ * Nodes refer to each other with 32-bit indices into the arena instead
+ * of smart pointers. Slots of the removed nodes are recycled by the
+ * following additions. Each slot counts the nodes it has held, which is
+ * the generation of the node in the slot, see \c valid(). The storage
+ * never moves a node once it is added, so that references and aliasing
+ * pointers to the nodes stay valid until the node is removed.
+ *
+ * The arena should always be owned by a \c boost::shared_ptr. Pointers
+ * returned by \c node() share the ownership of the whole arena.
+ *
+ * Distances of the nodes are stored relative to a fixed reference, and
+ * reported relative to \c distanceOffset(). Changing the offset shifts
+ * the distances of all nodes at once without touching any of them.
+ *
+ * \note Copying an arena copies all nodes. Since the links between the
+ *       nodes are indices, the copied nodes refer to each other without
+ *       any fix-up.
+ */
+template<typename Node>
+class NodeArena : public boost::enable_shared_from_this<NodeArena<Node>> {
+
+private:
+
+  /// Slots of the nodes. A slot is free if the node index is invalid.
+  std::deque<Node> nodes_;
+
+  /// Indices of the free slots.
+  std::vector<NodeIndex> free_indices_;
+
+  /// Number of the nodes in the arena.
+  size_t size_ = 0;
+
+  /// Offset subtracted from the stored distances of the nodes.
+  double distance_offset_ = 0.0;
+
+public:
+
+  /// Default constructor.
+  NodeArena() = default;
+
+  /// Copy constructor.
+  NodeArena(const NodeArena& other) :
+    boost::enable_shared_from_this<NodeArena<Node>>(),
+    nodes_(other.nodes_),
+    free_indices_(other.free_indices_),
+    size_(other.size_),
+    distance_offset_(other.distance_offset_) {
+    for (Node& node : nodes_) node.arena_ = this;
+    return;
+  }
+
+  /// Disable the copy assignment operator, arenas are copied through
+  /// the copy constructor only.
+  NodeArena& operator=(const NodeArena&) = delete;
+
+  /**
+   * \brief Add a node into the arena.
+   * \param[in] node The node to be added.
+   * \param[in] distance The distance of the node, relative to the current offset.
+   * \return The index of the added node.
+   */
+  NodeIndex add(const Node& node, const double distance) {
+    NodeIndex index = kInvalidNodeIndex;
+    if (!free_indices_.empty()) {
+      index = free_indices_.back();
+      free_indices_.pop_back();
+      // The free slot keeps the generation of the next node.
+      const uint32_t generation = nodes_[index].generation_;
+      nodes_[index] = node;
+      nodes_[index].generation_ = generation;
+    } else {
+      if (nodes_.size() >= kInvalidNodeIndex) {
+        std::string error_msg = (boost::format(
+              "NodeArena::add(): "
+              "cannot hold more than %1% nodes.\n") % nodes_.size()).str();
+        throw std::runtime_error(error_msg);
+      }
+      index = static_cast<NodeIndex>(nodes_.size());
+      nodes_.push_back(node);
+      nodes_[index].generation_ = 0;
+    }
+
+    nodes_[index].arena_ = this;
+    nodes_[index].index_ = index;
+    nodes_[index].distance_ = distance + distance_offset_;
+    ++size_;
+    return index;
+  }
+
+  /**
+   * \brief Remove a node from the arena.
+   *
+   * The links of other nodes to the removed one are left untouched.
+   * It is the caller's responsibility to reset them. The pointers to
+   * the removed node are invalidated, see \c node().
+   *
+   * \param[in] index The index of the node to be removed.
+   */
+  void remove(const NodeIndex index) {
+    if (!alive(index)) return;
+    const uint32_t generation = nodes_[index].generation_;
+    nodes_[index] = Node();
+    nodes_[index].generation_ = generation + 1;
+    free_indices_.push_back(index);
+    --size_;
+    return;
+  }
+
+  /// Remove all nodes in the arena.
+  /// The memory of the nodes is released. All pointers to the nodes dangle.
+  void clear() {
+    nodes_.clear();
+    free_indices_.clear();
+    size_ = 0;
+    distance_offset_ = 0.0;
+    return;
+  }
+
+  /// Get or set the offset subtracted from the stored node distances.
+  double& distanceOffset() { return distance_offset_; }
+
+  /// Get the offset subtracted from the stored node distances.
+  const double distanceOffset() const { return distance_offset_; }
+
+  /// Check if the slot at the given index holds a node.
+  bool alive(const NodeIndex index) const {
+    return index < nodes_.size() && nodes_[index].index() != kInvalidNodeIndex;
+  }
+
+  /// Number of the nodes in the arena.
+  size_t size() const { return size_; }
+
+  /// Number of slots in the arena, including the free ones.
+  /// All valid node indices are less than this.
+  size_t slots() const { return nodes_.size(); }
+
+  /// Access the node at the given index without checking.
+  Node& operator[](const NodeIndex index) { return nodes_[index]; }
+
+  /// Access the node at the given index without checking.
+  const Node& operator[](const NodeIndex index) const { return nodes_[index]; }
+
+  /**
+   * \brief Get a pointer to the node at the given index.
+   *
+   * The returned pointer shares the ownership of the arena, which keeps
+   * the memory of the node alive but not the node itself. The pointer is
+   * invalidated once the node is removed. Since the slot of a removed node
+   * is recycled, an invalidated pointer may silently refer to another node
+   * added afterwards. The pointers held across the modifications of the
+   * arena, e.g. shifting a lattice, should be kept together with the
+   * generation of the node, and checked with \c valid().
+   *
+   * \param[in] index The index of the node.
+   * \return \c nullptr if the index does not refer to a node.
+   */
+  boost::shared_ptr<const Node> node(const NodeIndex index) const {
+    if (!alive(index)) return nullptr;
+    return boost::shared_ptr<const Node>(this->shared_from_this(), &nodes_[index]);
+  }
+
+  /**
+   * \brief Get a pointer to the node at the given index.
+   *
+   * The returned pointer shares the ownership of the arena.
+   *
+   * \param[in] index The index of the node.
+   * \return \c nullptr if the index does not refer to a node.
+   */
+  boost::shared_ptr<Node> node(const NodeIndex index) {
+    if (!alive(index)) return nullptr;
+    return boost::shared_ptr<Node>(this->shared_from_this(), &nodes_[index]);
+  }
+
+  /**
+   * \brief Check if a pointer returned by \c node() is still valid.
+   *
+   * Once the slot of a removed node is recycled, the pointer refers to the
+   * new node in the slot, whose generation differs from the removed one.
+   *
+   * \param[in] node The pointer to be checked.
+   * \param[in] generation The generation of the node, read when the
+   *            pointer is obtained.
+   * \return False if the pointer is \c nullptr, invalidated, or refers
+   *         to a node in another arena.
+   */
+  bool valid(const boost::shared_ptr<const Node>& node, const uint32_t generation) const {
+    if (!node) return false;
+    const NodeIndex index = node->index();
+    return alive(index) && &nodes_[index] == node.get() &&
+           nodes_[index].generation_ == generation;
+  }
+
+}; // End class NodeArena.
+
+/**
+ * \brief NodeColumns buckets the nodes of a lattice by their distances.
+ *
+ * Column \c c holds the nodes at distance <tt>c * resolution</tt>, i.e.
+ * one node for each lane at that distance. The columns are kept in a ring
+ * buffer, so that adding columns at the front and dropping columns at the
+ * back of a lattice reuse the same storage.
+ */
+class NodeColumns {
+
+private:
+
+  /// Storage of the columns. The size is always 0 or a power of 2.
+  std::vector<std::vector<NodeIndex>> columns_;
+
+  /// Slot of the first column in \c columns_.
+  size_t head_ = 0;
+
+  /// Number of the columns in use.
+  size_t size_ = 0;
+
+  /// Column number of the first column.
+  int64_t first_ = 0;
+
+public:
+
+  /// Number of the columns.
+  size_t size() const { return size_; }
+
+  /// Check if there is any column.
+  bool empty() const { return size_ == 0; }
+
+  /// Column number of the first column.
+  int64_t firstColumn() const { return first_; }
+
+  /// Column number after the last column.
+  int64_t endColumn() const { return first_ + static_cast<int64_t>(size_); }
+
+  /// Get the nodes in a column. The column must be within
+  /// [\c firstColumn(), \c endColumn()).
+  const std::vector<NodeIndex>& column(const int64_t c) const {
+    return columns_[slot(c)];
+  }
+
+  /// Remove all columns.
+  void clear() {
+    for (std::vector<NodeIndex>& column : columns_) column.clear();
+    head_ = 0;
+    size_ = 0;
+    first_ = 0;
+    return;
+  }
+
+  /**
+   * \brief Add a node into a column.
+   *
+   * Empty columns are created in between if the column is beyond
+   * the current first or last column.
+   *
+   * \param[in] c The column number.
+   * \param[in] node The index of the node.
+   */
+  void insert(const int64_t c, const NodeIndex node) {
+    if (size_ == 0) {
+      reserve(1);
+      first_ = c;
+      size_ = 1;
+    } else if (c < first_) {
+      const size_t num = static_cast<size_t>(first_ - c);
+      reserve(size_ + num);
+      head_ = (head_ + columns_.size() - num) & (columns_.size()-1);
+      first_ = c;
+      size_ += num;
+    } else if (c >= endColumn()) {
+      const size_t num = static_cast<size_t>(c - endColumn() + 1);
+      reserve(size_ + num);
+      size_ += num;
+    }
+
+    columns_[slot(c)].push_back(node);
+    return;
+  }
+
+  /**
+   * \brief Remove a node from a column.
+   * \param[in] c The column number.
+   * \param[in] node The index of the node.
+   */
+  void erase(const int64_t c, const NodeIndex node) {
+    if (c < first_ || c >= endColumn()) return;
+    std::vector<NodeIndex>& column = columns_[slot(c)];
+    column.erase(std::remove(column.begin(), column.end(), node), column.end());
+    return;
+  }
+
+  /// Drop the first column. The nodes in the column are left untouched.
+  void popFront() {
+    if (size_ == 0) return;
+    columns_[head_].clear();
+    head_ = (head_+1) & (columns_.size()-1);
+    ++first_;
+    --size_;
+    return;
+  }
+
+private:
+
+  /// Slot of a column in \c columns_.
+  size_t slot(const int64_t c) const {
+    return (head_ + static_cast<size_t>(c-first_)) & (columns_.size()-1);
+  }
+
+  /// Make sure the ring buffer can hold the given number of columns.
+  void reserve(const size_t column_num) {
+    if (column_num <= columns_.size()) return;
+
+    size_t capacity = columns_.empty() ? 64 : columns_.size();
+    while (capacity < column_num) capacity *= 2;
+
+    std::vector<std::vector<NodeIndex>> columns(capacity);
+    for (size_t i = 0; i < size_; ++i)
+      columns[i].swap(columns_[(head_+i) & (columns_.size()-1)]);
+    columns_.swap(columns);
+    head_ = 0;
+    return;
+  }
+
+}; // End class NodeColumns.
+
+/**
+ * \brief NodeSegments groups the nodes of a lattice into lane segments.
+ *
+ * A lane segment is a sequence of nodes in consecutive columns, where each
+ * node is the back of the next one, and the next node is the front of the
+ * previous one. Within a segment, the node at a given column is located
+ * with an index computation instead of following the links one by one.
+ *
+ * Segments are broken where lanes merge or split, and are extended as
+ * nodes are linked at the end of a segment.
+ */
+class NodeSegments {
+
+private:
+
+  struct Segment {
+    /// Column of the first node in the segment.
+    int64_t first_column = 0;
+
+    /// Position of the first node in \c nodes.
+    /// Nodes before this position have been removed.
+    size_t head = 0;
+
+    /// Nodes in the segment.
+    std::vector<NodeIndex> nodes;
+  };
+
+  /// Storage of the segments.
+  std::vector<Segment> segments_;
+
+  /// Segments in \c segments_ that are not used.
+  std::vector<uint32_t> free_segments_;
+
+  /// The segment each node belongs to, indexed by the node index.
+  std::vector<uint32_t> node_to_segment_;
+
+public:
+
+  /// Number of the segments.
+  size_t size() const { return segments_.size() - free_segments_.size(); }
+
+  /// Get the segment a node belongs to.
+  uint32_t segment(const NodeIndex node) const { return node_to_segment_[node]; }
+
+  /// Column of the first node in a segment.
+  int64_t firstColumn(const uint32_t segment) const {
+    return segments_[segment].first_column;
+  }
+
+  /// Column of the last node in a segment.
+  int64_t lastColumn(const uint32_t segment) const {
+    const Segment& s = segments_[segment];
+    return s.first_column + static_cast<int64_t>(s.nodes.size()-s.head) - 1;
+  }
+
+  /// Get the node at a column of a segment. The column must be within
+  /// [\c firstColumn(), \c lastColumn()].
+  NodeIndex node(const uint32_t segment, const int64_t column) const {
+    const Segment& s = segments_[segment];
+    return s.nodes[s.head + static_cast<size_t>(column-s.first_column)];
+  }
+
+  /// Remove all segments.
+  void clear() {
+    segments_.clear();
+    free_segments_.clear();
+    node_to_segment_.clear();
+    return;
+  }
+
+  /**
+   * \brief Add a node, which is not linked with any other node yet.
+   * \param[in] node The index of the node.
+   * \param[in] column The column of the node.
+   */
+  void add(const NodeIndex node, const int64_t column) {
+    const uint32_t segment = create(column);
+    segments_[segment].nodes.push_back(node);
+    if (node_to_segment_.size() <= node) node_to_segment_.resize(node+1);
+    node_to_segment_[node] = segment;
+    return;
+  }
+
+  /**
+   * \brief Remove a node.
+   *
+   * Removing the first or the last node of a segment costs O(1). Otherwise,
+   * the segment is split at the node.
+   *
+   * \param[in] node The index of the node.
+   * \param[in] column The column of the node.
+   */
+  void remove(const NodeIndex node, const int64_t column) {
+    const uint32_t segment = node_to_segment_[node];
+
+    // Make the node the first one of its segment.
+    if (column > firstColumn(segment)) {
+      split(segment, column);
+      return remove(node, column);
+    }
+
+    Segment& s = segments_[segment];
+    ++s.head;
+    ++s.first_column;
+    // Compact the storage once most of it is taken by removed nodes.
+    if (s.head >= 32 && s.head*2 >= s.nodes.size()) {
+      s.nodes.erase(s.nodes.begin(), s.nodes.begin()+s.head);
+      s.head = 0;
+    }
+
+    if (s.head == s.nodes.size()) release(segment);
+    return;
+  }
+
+  /**
+   * \brief Update the segments after linking two nodes.
+   *
+   * The function should be called after \c front is set to the front of
+   * \c back, and \c back is set to the back of \c front.
+   *
+   * \param[in] back The index of the back node.
+   * \param[in] back_column The column of the back node.
+   * \param[in] front The index of the front node.
+   * \param[in] front_column The column of the front node.
+   */
+  void link(const NodeIndex back, const int64_t back_column,
+            const NodeIndex front, const int64_t front_column) {
+
+    // The back node no longer reaches the rest of its segment.
+    uint32_t back_segment = node_to_segment_[back];
+    if (back_column < lastColumn(back_segment) &&
+        node(back_segment, back_column+1) != front)
+      split(back_segment, back_column+1);
+
+    // The front node is no longer reached from the rest of its segment.
+    uint32_t front_segment = node_to_segment_[front];
+    if (front_column > firstColumn(front_segment) &&
+        node(front_segment, front_column-1) != back)
+      split(front_segment, front_column);
+
+    // Join the two segments if the front one can be appended to the back one.
+    back_segment = node_to_segment_[back];
+    front_segment = node_to_segment_[front];
+    if (back_segment == front_segment) return;
+    if (back_column != lastColumn(back_segment)) return;
+    if (front_column != firstColumn(front_segment)) return;
+    if (front_column != back_column+1) return;
+
+    Segment& s = segments_[front_segment];
+    for (size_t i = s.head; i < s.nodes.size(); ++i) {
+      segments_[back_segment].nodes.push_back(s.nodes[i]);
+      node_to_segment_[s.nodes[i]] = back_segment;
+    }
+    release(front_segment);
+
+    return;
+  }
+
+private:
+
+  /// Get an empty segment starting at the given column.
+  uint32_t create(const int64_t first_column) {
+    uint32_t segment = 0;
+    if (free_segments_.empty()) {
+      segment = static_cast<uint32_t>(segments_.size());
+      segments_.emplace_back();
+    } else {
+      segment = free_segments_.back();
+      free_segments_.pop_back();
+    }
+    segments_[segment].first_column = first_column;
+    return segment;
+  }
+
+  /// Release a segment so that it can be reused.
+  void release(const uint32_t segment) {
+    segments_[segment].nodes.clear();
+    segments_[segment].head = 0;
+    free_segments_.push_back(segment);
+    return;
+  }
+
+  /// Move the nodes from the given column on to a new segment.
+  void split(const uint32_t segment, const int64_t column) {
+    const uint32_t new_segment = create(column);
+    const size_t begin = segments_[segment].head +
+      static_cast<size_t>(column-segments_[segment].first_column);
+
+    Segment& s = segments_[segment];
+    Segment& new_s = segments_[new_segment];
+    for (size_t i = begin; i < s.nodes.size(); ++i) {
+      new_s.nodes.push_back(s.nodes[i]);
+      node_to_segment_[s.nodes[i]] = new_segment;
+    }
+    s.nodes.resize(begin);
+
+    return;
+  }
+
+}; // End class NodeSegments.
+
+/**
+ * \brief NodeIndexTable maps carla waypoint IDs to node indices.
+ *
+ * The table uses open addressing with linear probing on a flat array,
+ * which avoids the per-element allocations of \c std::unordered_map.
+ * Erasing uses backward shift deletion so that no tombstone is left.
+ */
+class NodeIndexTable {
+
+private:
+
+  struct Slot {
+    size_t key = 0;
+    NodeIndex value = kInvalidNodeIndex;
+  };
+
+  /// Slots of the table. The number of slots is always a power of 2.
+  /// A slot is empty if its value is \c kInvalidNodeIndex.
+  std::vector<Slot> slots_;
+
+  /// Number of the elements in the table.
+  size_t size_ = 0;
+
+public:
+
+  /// Number of the elements in the table.
+  size_t size() const { return size_; }
+
+  /// Check if the table is empty.
+  bool empty() const { return size_ == 0; }
+
+  /// Remove all elements in the table.
+  void clear() {
+    slots_.clear();
+    size_ = 0;
+    return;
+  }
+
+  /**
+   * \brief Find the node index of a waypoint.
+   * \param[in] key The waypoint ID.
+   * \return \c kInvalidNodeIndex if the waypoint is not in the table.
+   */
+  NodeIndex find(const size_t key) const {
+    if (slots_.empty()) return kInvalidNodeIndex;
+    const size_t mask = slots_.size() - 1;
+    for (size_t i = home(key); ; i = (i+1) & mask) {
+      const Slot& slot = slots_[i];
+      if (slot.value == kInvalidNodeIndex) return kInvalidNodeIndex;
+      if (slot.key == key) return slot.value;
+    }
+  }
+
+  /// Check if a waypoint is in the table.
+  bool contains(const size_t key) const {
+    return find(key) != kInvalidNodeIndex;
+  }
+
+  /**
+   * \brief Add or update an element in the table.
+   * \param[in] key The waypoint ID.
+   * \param[in] value The index of the node. Should not be \c kInvalidNodeIndex.
+   */
+  void insert(const size_t key, const NodeIndex value) {
+    if ((size_+1)*4 > slots_.size()*3)
+      rehash(slots_.empty() ? 64 : slots_.size()*2);
+
+    const size_t mask = slots_.size() - 1;
+    for (size_t i = home(key); ; i = (i+1) & mask) {
+      Slot& slot = slots_[i];
+      if (slot.value == kInvalidNodeIndex) {
+        slot.key = key;
+        slot.value = value;
+        ++size_;
+        return;
+      }
+      if (slot.key == key) {
+        slot.value = value;
+        return;
+      }
+    }
+  }
+
+  /**
+   * \brief Remove an element from the table.
+   * \param[in] key The waypoint ID.
+   * \return True if the element exists and is removed.
+   */
+  bool erase(const size_t key) {
+    if (slots_.empty()) return false;
+    const size_t mask = slots_.size() - 1;
+
+    // Find the slot of the key.
+    size_t i = home(key);
+    while (true) {
+      if (slots_[i].value == kInvalidNodeIndex) return false;
+      if (slots_[i].key == key) break;
+      i = (i+1) & mask;
+    }
+
+    // Shift the following elements of the same probe sequence backwards,
+    // so that the lookups never stop at the hole early.
+    size_t j = i;
+    while (true) {
+      j = (j+1) & mask;
+      if (slots_[j].value == kInvalidNodeIndex) break;
+      const size_t k = home(slots_[j].key);
+      // Skip the element if its home slot is cyclically within (i, j].
+      if (i <= j ? (i < k && k <= j) : (i < k || k <= j)) continue;
+      slots_[i] = slots_[j];
+      i = j;
+    }
+
+    slots_[i] = Slot();
+    --size_;
+    return true;
+  }
+
+private:
+
+  /// The slot where the probing of a key starts.
+  size_t home(size_t key) const {
+    // Finalizer of the 64-bit murmur hash. Carla waypoint IDs are
+    // themselves hashes, but the mixing is cheap and guards against
+    // IDs with poor low bits.
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key & (slots_.size()-1);
+  }
+
+  /// Resize the table to the given number of slots.
+  void rehash(const size_t slot_num) {
+    std::vector<Slot> slots(slot_num);
+    slots.swap(slots_);
+    size_ = 0;
+    for (const Slot& slot : slots) {
+      if (slot.value == kInvalidNodeIndex) continue;
+      insert(slot.key, slot.value);
+    }
+    return;
+  }
+
+}; // End class NodeIndexTable.
+
+} // End namespace planner.
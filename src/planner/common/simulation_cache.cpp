@@ -0,0 +1,132 @@
+/*
+ * Copyright 2020 Ke Sun
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cmath>
+#include <algorithm>
+
+#include <planner/common/utils.h>
+#include <planner/common/simulation_cache.h>
+
+namespace planner {
+
+size_t SimulationCache::KeyHash::operator()(const Key& key) const {
+  size_t seed = 0;
+  utils::hashCombine(seed,
+                     key.target,
+                     static_cast<int>(key.lane_change_type),
+                     key.accel);
+  for (const int64_t value : key.snapshot) utils::hashCombine(seed, value);
+  return seed;
+}
+
+SimulationCache::SimulationCache(
+    const size_t capacity,
+    const double position_resolution,
+    const double speed_resolution) :
+  capacity_(std::max<size_t>(capacity, 1)),
+  position_resolution_(position_resolution),
+  speed_resolution_(speed_resolution) {}
+
+SimulationCache::Key SimulationCache::key(
+    const Snapshot& snapshot,
+    const size_t target,
+    const VehiclePath::LaneChangeType lane_change_type,
+    const double accel) const {
+
+  auto quantise = [](const double value, const double resolution)->int64_t{
+    return static_cast<int64_t>(std::floor(value/resolution));
+  };
+
+  // Every vehicle is stored as its ID, position, speed and acceleration.
+  auto addVehicle = [this, &quantise](
+      const Vehicle& vehicle, std::vector<int64_t>& values)->void{
+    values.push_back(static_cast<int64_t>(vehicle.id()));
+    values.push_back(quantise(vehicle.transform().location.x, position_resolution_));
+    values.push_back(quantise(vehicle.transform().location.y, position_resolution_));
+    values.push_back(quantise(vehicle.speed(), speed_resolution_));
+    values.push_back(quantise(vehicle.acceleration(), speed_resolution_));
+    return;
+  };
+
+  Key key;
+  key.target = target;
+  key.lane_change_type = lane_change_type;
+  key.accel = accel;
+
+  // The ego goes first. Its acceleration is replaced by \c accel, while its
+  // policy speed affects the cost of the simulation.
+  addVehicle(snapshot.ego(), key.snapshot);
+  key.snapshot.back() = quantise(snapshot.ego().policySpeed(), speed_resolution_);
+
+  // The agents are sorted by their IDs, since their order in the snapshot
+  // is not guaranteed.
+  std::vector<size_t> agents;
+  agents.reserve(snapshot.agents().size());
+  for (const auto& agent : snapshot.agents()) agents.push_back(agent.first);
+  std::sort(agents.begin(), agents.end());
+
+  key.snapshot.reserve(key.snapshot.size() + 5*agents.size());
+  for (const size_t agent : agents) addVehicle(snapshot.agent(agent), key.snapshot);
+
+  return key;
+}
+
+boost::shared_ptr<const SimulationCache::Result>
+  SimulationCache::find(const Key& key) {
+
+  std::unordered_map<Key, std::list<Entry>::iterator, KeyHash>::iterator
+    iter = key_to_entry_table_.find(key);
+
+  if (iter == key_to_entry_table_.end()) {
+    ++misses_;
+    return nullptr;
+  }
+
+  // Move the entry to the front of the list.
+  ++hits_;
+  entries_.splice(entries_.begin(), entries_, iter->second);
+  return iter->second->second;
+}
+
+void SimulationCache::insert(
+    const Key& key, const boost::shared_ptr<const Result>& result) {
+
+  std::unordered_map<Key, std::list<Entry>::iterator, KeyHash>::iterator
+    iter = key_to_entry_table_.find(key);
+
+  // Replace the existing entry.
+  if (iter != key_to_entry_table_.end()) {
+    iter->second->second = result;
+    entries_.splice(entries_.begin(), entries_, iter->second);
+    return;
+  }
+
+  // Evict the least recently used entry.
+  if (entries_.size() >= capacity_) {
+    key_to_entry_table_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+
+  entries_.emplace_front(key, result);
+  key_to_entry_table_[key] = entries_.begin();
+  return;
+}
+
+void SimulationCache::clear() {
+  entries_.clear();
+  key_to_entry_table_.clear();
+  return;
+}
+
+} // End namespace planner.
@@ -0,0 +1,195 @@
+/*
+ * Copyright 2020 Ke Sun
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <boost/smart_ptr.hpp>
+#include <boost/core/noncopyable.hpp>
+
+#include <planner/common/snapshot.h>
+#include <planner/common/vehicle_path.h>
+
+namespace planner {
+
+/**
+ * \brief SimulationCache memoizes the results of traffic simulations.
+ *
+ * Between consecutive planning cycles, the planners often simulate the same
+ * traffic with the ego following the same path to the same target node.
+ * The cache stores the results of such simulations with a bounded size.
+ * Once the cache is full, the least recently used entry is evicted.
+ *
+ * The start snapshot of a simulation is identified with a fingerprint,
+ * where the position, speed, and acceleration of the vehicles are quantised.
+ * Snapshots with the same fingerprint are treated as the same. The cached
+ * results are therefore approximations of what a new simulation returns.
+ */
+class SimulationCache : private boost::noncopyable {
+
+public:
+
+  /**
+   * \brief Key stores the identity of a simulation.
+   *
+   * The ego path is not stored directly. It is determined by the ego
+   * transform in the start snapshot, the target node, and the lane change type.
+   */
+  struct Key {
+    /// The quantised vehicles in the start snapshot.
+    std::vector<int64_t> snapshot;
+    /// The ID of the target node of the ego path.
+    size_t target;
+    /// The lane change type of the ego path.
+    VehiclePath::LaneChangeType lane_change_type;
+    /// The acceleration applied by the ego.
+    double accel;
+
+    bool operator==(const Key& other) const {
+      return target == other.target &&
+             lane_change_type == other.lane_change_type &&
+             accel == other.accel &&
+             snapshot == other.snapshot;
+    }
+  };
+
+  /// Hash function of \c Key.
+  struct KeyHash {
+    size_t operator()(const Key& key) const;
+  };
+
+  /// Result stores the outputs of a simulation.
+  struct Result {
+    /// The snapshot at the end of the simulation.
+    Snapshot snapshot;
+    /// The actual simulation duration.
+    double time;
+    /// The accumulated cost during the simulation.
+    double cost;
+    /// False if collision is detected during the simulation.
+    bool no_collision;
+  };
+
+protected:
+
+  using Entry = std::pair<Key, boost::shared_ptr<const Result>>;
+
+protected:
+
+  /// The maximum number of entries in the cache.
+  size_t capacity_;
+
+  /// The resolution used to quantise the vehicle positions.
+  double position_resolution_;
+
+  /// The resolution used to quantise the vehicle speeds and accelerations.
+  double speed_resolution_;
+
+  /// The entries, with the most recently used one at the front.
+  std::list<Entry> entries_;
+
+  /// Map from the key to the entry in \c entries_.
+  std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> key_to_entry_table_;
+
+  /// Number of the lookups that found an entry.
+  size_t hits_ = 0;
+
+  /// Number of the lookups that found no entry.
+  size_t misses_ = 0;
+
+public:
+
+  /**
+   * \brief Class constructor.
+   * \param[in] capacity The maximum number of entries.
+   * \param[in] position_resolution The resolution of the vehicle positions in meter.
+   * \param[in] speed_resolution The resolution of the vehicle speeds in m/s,
+   *            which is also used for the accelerations in m/s^2.
+   */
+  SimulationCache(const size_t capacity = 4096,
+                  const double position_resolution = 1.0,
+                  const double speed_resolution = 0.5);
+
+  /**
+   * \brief Create the key of a simulation.
+   *
+   * The acceleration of the ego in \c snapshot is ignored, \c accel is
+   * used instead.
+   *
+   * \param[in] snapshot The start snapshot of the simulation.
+   * \param[in] target The ID of the target node of the ego path.
+   * \param[in] lane_change_type The lane change type of the ego path.
+   * \param[in] accel The acceleration applied by the ego.
+   */
+  Key key(const Snapshot& snapshot,
+          const size_t target,
+          const VehiclePath::LaneChangeType lane_change_type,
+          const double accel) const;
+
+  /**
+   * \brief Look up the result of a simulation.
+   *
+   * The entry found is marked as the most recently used one.
+   *
+   * \return The cached result, or \c nullptr if there is no such entry.
+   */
+  boost::shared_ptr<const Result> find(const Key& key);
+
+  /**
+   * \brief Check if there is an entry for a simulation.
+   *
+   * Different from \c find(), neither the order of the entries nor the
+   * counters are changed. Therefore, it is safe to call the function from
+   * multiple threads as long as the cache is not modified at the same time.
+   */
+  bool contains(const Key& key) const {
+    return key_to_entry_table_.count(key) != 0;
+  }
+
+  /**
+   * \brief Store the result of a simulation.
+   *
+   * An existing entry with the same key is replaced. The least recently
+   * used entry is evicted if the cache is full.
+   */
+  void insert(const Key& key, const boost::shared_ptr<const Result>& result);
+
+  /// Remove all entries. The hit and miss counters are not reset.
+  void clear();
+
+  /// Get the number of entries in the cache.
+  const size_t size() const { return entries_.size(); }
+
+  /// Get the maximum number of entries in the cache.
+  const size_t capacity() const { return capacity_; }
+
+  /// Get the number of lookups that found an entry.
+  const size_t hits() const { return hits_; }
+
+  /// Get the number of lookups that found no entry.
+  const size_t misses() const { return misses_; }
+
+  /// Reset the hit and miss counters.
+  void resetCounters() {
+    hits_ = 0;
+    misses_ = 0;
+    return;
+  }
+
+}; // End class SimulationCache.
+
+} // End namespace planner.
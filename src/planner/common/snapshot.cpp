@@ -52,6 +52,7 @@ Snapshot::Snapshot(
   for (const size_t agent : disappear_vehicles)
     agents_.erase(agent);
 
+  updateWaypointHints();
   return;
 }
 
@@ -158,6 +159,14 @@ bool Snapshot::updateTraffic(
   for (const size_t disappear_vehicle : disappear_vehicles)
     agents_.erase(disappear_vehicle);
 
+  updateWaypointHints();
   return no_collision;
 }
+
+void Snapshot::updateWaypointHints() {
+  ego_.waypointHint() = traffic_lattice_->waypointHint(ego_.id());
+  for (auto& agent : agents_)
+    agent.second.waypointHint() = traffic_lattice_->waypointHint(agent.first);
+  return;
+}
 } // End namespace planner.
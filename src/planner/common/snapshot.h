@@ -97,6 +97,12 @@ public:
     return output;
   }
 
+protected:
+
+  /// Keep the waypoints matched by the traffic lattice as the hints
+  /// for the next match of each vehicle.
+  void updateWaypointHints();
+
 };
 } // End namespace planner.
 
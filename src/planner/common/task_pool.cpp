@@ -0,0 +1,167 @@
+/*
+ * Copyright 2020 Ke Sun
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <algorithm>
+#include <planner/common/task_pool.h>
+
+namespace utils {
+
+namespace {
+/// The pool whose tasks are being run by the current thread.
+thread_local const TaskPool* running_pool = nullptr;
+} // End anonymous namespace.
+
+TaskPool::TaskPool(const size_t threads) {
+
+  const size_t num = std::max<size_t>(threads, 1);
+  for (size_t i = 0; i < num; ++i)
+    queues_.push_back(std::unique_ptr<TaskQueue>(new TaskQueue()));
+
+  // The calling thread takes the last queue.
+  for (size_t i = 0; i+1 < num; ++i)
+    workers_.emplace_back(&TaskPool::workerLoop, this, i);
+
+  return;
+}
+
+TaskPool::~TaskPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  batch_cv_.notify_all();
+  for (std::thread& worker : workers_) worker.join();
+  return;
+}
+
+void TaskPool::parallelFor(
+    const size_t num, const std::function<void(const size_t)>& task) {
+
+  if (num == 0) return;
+
+  // Run the tasks in place if there is no other thread, or if this is
+  // called from within a task of the pool.
+  if (workers_.empty() || running_pool == this) {
+    std::exception_ptr exception = nullptr;
+    for (size_t i = 0; i < num; ++i) {
+      try {
+        task(i);
+      } catch (...) {
+        if (!exception) exception = std::current_exception();
+      }
+    }
+    if (exception) std::rethrow_exception(exception);
+    return;
+  }
+
+  std::lock_guard<std::mutex> batch_lock(batch_mutex_);
+
+  task_ = &task;
+  remaining_tasks_ = num;
+  exception_ = nullptr;
+
+  // Distribute the tasks evenly among the queues.
+  for (size_t i = 0; i < queues_.size(); ++i) {
+    std::lock_guard<std::mutex> lock(queues_[i]->mutex);
+    for (size_t j = i; j < num; j += queues_.size())
+      queues_[i]->tasks.push_back(j);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++batch_;
+  }
+  batch_cv_.notify_all();
+
+  // Work on the tasks as well, and wait for the ones taken by the workers.
+  runTasks(queues_.size()-1);
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this]{ return remaining_tasks_ == 0; });
+  }
+
+  task_ = nullptr;
+  if (exception_) std::rethrow_exception(exception_);
+  return;
+}
+
+void TaskPool::workerLoop(const size_t thread) {
+
+  size_t batch = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      batch_cv_.wait(lock, [this, batch]{ return stop_ || batch_ != batch; });
+      if (stop_) return;
+      batch = batch_;
+    }
+    runTasks(thread);
+  }
+
+  return;
+}
+
+void TaskPool::runTasks(const size_t thread) {
+
+  const TaskPool* outer_pool = running_pool;
+  running_pool = this;
+
+  size_t task = 0;
+  while (nextTask(thread, task)) {
+    try {
+      (*task_)(task);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!exception_) exception_ = std::current_exception();
+    }
+
+    // The last task wakes up the thread waiting in \c parallelFor().
+    if (--remaining_tasks_ == 0) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      done_cv_.notify_all();
+    }
+  }
+
+  running_pool = outer_pool;
+  return;
+}
+
+bool TaskPool::nextTask(const size_t thread, size_t& task) {
+
+  // Take the most recently added task from the own queue.
+  {
+    TaskQueue& queue = *(queues_[thread]);
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      task = queue.tasks.back();
+      queue.tasks.pop_back();
+      return true;
+    }
+  }
+
+  // Steal the oldest task from the other queues.
+  for (size_t i = 1; i < queues_.size(); ++i) {
+    TaskQueue& queue = *(queues_[(thread+i) % queues_.size()]);
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.tasks.empty()) {
+      task = queue.tasks.front();
+      queue.tasks.pop_front();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+} // End namespace utils.
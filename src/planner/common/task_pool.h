@@ -0,0 +1,134 @@
+/*
+ * Copyright 2020 Ke Sun
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+#include <boost/core/noncopyable.hpp>
+
+namespace utils {
+
+/**
+ * \brief TaskPool runs batches of independent tasks on a fixed set of threads.
+ *
+ * A batch of tasks is submitted with \c parallelFor(), which returns once all
+ * tasks in the batch are done. The tasks are distributed evenly among the
+ * threads at the start. Each thread works on its own queue, and steals from
+ * the queues of the other threads once its own queue is empty, so that a few
+ * expensive tasks do not keep the other threads idle.
+ *
+ * The thread calling \c parallelFor() works on the tasks as well. The order
+ * in which the tasks are executed is not deterministic. The callers should
+ * therefore write the output of every task into its own slot, and merge the
+ * outputs afterwards.
+ */
+class TaskPool : private boost::noncopyable {
+
+protected:
+
+  /// Queue of task indices owned by one thread.
+  struct TaskQueue {
+    std::mutex mutex;
+    std::deque<size_t> tasks;
+  };
+
+protected:
+
+  /// Queues of the threads. The last one belongs to the calling thread.
+  std::vector<std::unique_ptr<TaskQueue>> queues_;
+
+  /// Worker threads.
+  std::vector<std::thread> workers_;
+
+  /// The task of the current batch.
+  const std::function<void(const size_t)>* task_ = nullptr;
+
+  /// Number of tasks in the current batch which are not done yet.
+  std::atomic<size_t> remaining_tasks_{0};
+
+  /// The first exception thrown by the tasks in the current batch.
+  std::exception_ptr exception_ = nullptr;
+
+  /// Incremented for every batch to wake up the workers.
+  size_t batch_ = 0;
+
+  /// Set to stop the workers.
+  bool stop_ = false;
+
+  /// Guards \c batch_, \c stop_, and \c exception_.
+  std::mutex mutex_;
+
+  /// Held by the thread running a batch, so that concurrent
+  /// calls of \c parallelFor() run one after another.
+  std::mutex batch_mutex_;
+
+  /// Notified when a new batch is available or the pool is stopped.
+  std::condition_variable batch_cv_;
+
+  /// Notified when all tasks of the current batch are done.
+  std::condition_variable done_cv_;
+
+public:
+
+  /**
+   * \brief Class constructor.
+   * \param[in] threads The number of threads to run the tasks,
+   *            including the one calling \c parallelFor().
+   */
+  TaskPool(const size_t threads = std::thread::hardware_concurrency());
+
+  /// Class destructor, which joins the worker threads.
+  ~TaskPool();
+
+  /// Get the number of threads running the tasks.
+  const size_t threads() const { return queues_.size(); }
+
+  /**
+   * \brief Run \c task(i) for every i in [0, num), and wait for all of them.
+   *
+   * If any of the tasks throws, the first exception is rethrown once
+   * all tasks are done.
+   *
+   * The function can be called concurrently from different threads, in which
+   * case the batches are run one after another. If it is called from within
+   * a task of the pool, the nested tasks are run in place by the calling
+   * thread, since the other threads are busy with the outer batch.
+   *
+   * \param[in] num The number of tasks.
+   * \param[in] task The task to run, with the task index as the argument.
+   */
+  void parallelFor(const size_t num, const std::function<void(const size_t)>& task);
+
+protected:
+
+  /// The loop of a worker thread.
+  void workerLoop(const size_t thread);
+
+  /// Run the tasks in the queues until all of them are empty.
+  void runTasks(const size_t thread);
+
+  /// Pop a task from the queue of the thread, or steal one from other queues.
+  bool nextTask(const size_t thread, size_t& task);
+
+}; // End class TaskPool.
+
+} // End namespace utils.
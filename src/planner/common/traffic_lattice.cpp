@@ -14,6 +14,7 @@
 
 #pragma once
 
+#include <limits>
 #include <cmath>
 #include <deque>
 #include <unordered_map>
@@ -145,15 +146,14 @@ TrafficLattice::TrafficLattice(
 TrafficLattice::TrafficLattice(const TrafficLattice& other) :
   Base(other) {
 
-  // Make sure the weak pointers point to the stuff within this object.
+  // The topology of the lattice is shared with the other object by the base
+  // class. Only the vehicles on the lattice are copied, whose nodes are
+  // referred with indices into the shared topology.
   vehicle_to_nodes_table_ = other.vehicle_to_nodes_table_;
-
-  for (auto& vehicle : vehicle_to_nodes_table_) {
-    for (auto& node : vehicle.second) {
-      const size_t id = node.lock()->waypoint()->GetId();
-      node = this->waypoint_to_node_table_[id];
-    }
-  }
+  lane_occupancy_ = other.lane_occupancy_;
+  vehicle_to_waypoint_nodes_table_ = other.vehicle_to_waypoint_nodes_table_;
+  vehicle_to_neighbors_table_ = other.vehicle_to_neighbors_table_;
+  vehicle_to_hints_table_ = other.vehicle_to_hints_table_;
 
   // Carla map and fast map won't be copied. \c map_ of different objects point to the
   // same piece of memory.
@@ -167,6 +167,10 @@ void TrafficLattice::swap(TrafficLattice& other) {
 
   Base::swap(other);
   std::swap(vehicle_to_nodes_table_, other.vehicle_to_nodes_table_);
+  std::swap(lane_occupancy_, other.lane_occupancy_);
+  std::swap(vehicle_to_waypoint_nodes_table_, other.vehicle_to_waypoint_nodes_table_);
+  std::swap(vehicle_to_neighbors_table_, other.vehicle_to_neighbors_table_);
+  std::swap(vehicle_to_hints_table_, other.vehicle_to_hints_table_);
   std::swap(map_, other.map_);
   std::swap(fast_map_, other.fast_map_);
 
@@ -176,6 +180,10 @@ void TrafficLattice::swap(TrafficLattice& other) {
 boost::optional<std::pair<size_t, double>>
   TrafficLattice::front(const size_t vehicle) const {
 
+  // The vehicles around the query vehicle may have been found already.
+  const auto neighbors = vehicle_to_neighbors_table_.find(vehicle);
+  if (neighbors != vehicle_to_neighbors_table_.end()) return neighbors->second[0];
+
   if (vehicle_to_nodes_table_.count(vehicle) == 0) {
     std::string error_msg = (boost::format(
           "TrafficLattice::front(): "
@@ -185,13 +193,16 @@ boost::optional<std::pair<size_t, double>>
 
   // Find the node in the lattice which corresponds to the
   // head of the vehicle.
-  boost::shared_ptr<const Node> start = vehicleHeadNode(vehicle);
+  const NodeIndex start = vehicleHeadNode(vehicle);
   return frontVehicle(start);
 }
 
 boost::optional<std::pair<size_t, double>>
   TrafficLattice::back(const size_t vehicle) const {
 
+  const auto neighbors = vehicle_to_neighbors_table_.find(vehicle);
+  if (neighbors != vehicle_to_neighbors_table_.end()) return neighbors->second[1];
+
   if (vehicle_to_nodes_table_.count(vehicle) == 0) {
     std::string error_msg = (boost::format(
           "TrafficLattice::back(): "
@@ -201,13 +212,16 @@ boost::optional<std::pair<size_t, double>>
 
   // Find the node in the lattice which corresponds to the
   // back of the vehicle.
-  boost::shared_ptr<const Node> start = vehicleRearNode(vehicle);
+  const NodeIndex start = vehicleRearNode(vehicle);
   return backVehicle(start);
 }
 
 boost::optional<std::pair<size_t, double>>
   TrafficLattice::leftFront(const size_t vehicle) const {
 
+  const auto neighbors = vehicle_to_neighbors_table_.find(vehicle);
+  if (neighbors != vehicle_to_neighbors_table_.end()) return neighbors->second[2];
+
   if (vehicle_to_nodes_table_.count(vehicle) == 0) {
     std::string error_msg = (boost::format(
           "TrafficLattice::leftFront(): "
@@ -217,8 +231,8 @@ boost::optional<std::pair<size_t, double>>
 
   // Find the node in the lattice which corresponds to the
   // head of the vehicle.
-  boost::shared_ptr<const Node> start = vehicleHeadNode(vehicle);
-  if (!start) {
+  const NodeIndex start = vehicleHeadNode(vehicle);
+  if (start == kInvalidNodeIndex) {
     std::string error_msg = (boost::format(
           "TrafficLattice::leftFront(): "
           "head of vehicle [%1%] is not on lattice.\n") % vehicle).str();
@@ -227,10 +241,11 @@ boost::optional<std::pair<size_t, double>>
 
   // Find the left node of the start.
   // If there is no left node, there is no left front vehicle.
-  boost::shared_ptr<const Node> left = start->left();
-  if (!left) return boost::none;
+  const NodeArena<Node>& arena = *(this->topology_->node_arena);
+  const NodeIndex left = arena[start].leftIndex();
+  if (left == kInvalidNodeIndex) return boost::none;
 
-  if (!left->vehicle()) {
+  if (!nodeVehicle(left)) {
     // If there is no vehicle at the left node, the case is easy.
     // Just search forward from this left node to find the front vehicle.
     return frontVehicle(left);
@@ -238,9 +253,9 @@ boost::optional<std::pair<size_t, double>>
     // If there is a vehicle at the left node, this is the left front vehicle,
     // since the head of this vehicle must be at least the same distance with
     // the head of the query vehicle.
-    const size_t left_vehicle = *(left->vehicle());
-    const double distance = vehicleRearNode(left_vehicle)->distance() -
-                            start->distance();
+    const size_t left_vehicle = *(nodeVehicle(left));
+    const double distance = arena[vehicleRearNode(left_vehicle)].distance() -
+                            arena[start].distance();
     return std::make_pair(left_vehicle, distance);
   }
 }
@@ -248,6 +263,9 @@ boost::optional<std::pair<size_t, double>>
 boost::optional<std::pair<size_t, double>>
   TrafficLattice::leftBack(const size_t vehicle) const {
 
+  const auto neighbors = vehicle_to_neighbors_table_.find(vehicle);
+  if (neighbors != vehicle_to_neighbors_table_.end()) return neighbors->second[3];
+
   if (vehicle_to_nodes_table_.count(vehicle) == 0) {
     std::string error_msg = (boost::format(
           "TrafficLattice::leftBack(): "
@@ -257,8 +275,8 @@ boost::optional<std::pair<size_t, double>>
 
   // Find the node in the lattice which corresponds to the
   // rear of the vehicle.
-  boost::shared_ptr<const Node> start = vehicleRearNode(vehicle);
-  if (!start) {
+  const NodeIndex start = vehicleRearNode(vehicle);
+  if (start == kInvalidNodeIndex) {
     std::string error_msg = (boost::format(
           "TrafficLattice::leftBack(): "
           "rear of vehicle [%1%] is not on lattice.\n") % vehicle).str();
@@ -267,10 +285,11 @@ boost::optional<std::pair<size_t, double>>
 
   // Find the left node of the start.
   // If there is no left node, there is no left back vehicle.
-  boost::shared_ptr<const Node> left = start->left();
-  if (!left) return boost::none;
+  const NodeArena<Node>& arena = *(this->topology_->node_arena);
+  const NodeIndex left = arena[start].leftIndex();
+  if (left == kInvalidNodeIndex) return boost::none;
 
-  if (!left->vehicle()) {
+  if (!nodeVehicle(left)) {
     // If there is no vehicle at the left node, the case is easy.
     // Just search backward from this left node to find the back vehicle.
     return backVehicle(left);
@@ -278,9 +297,9 @@ boost::optional<std::pair<size_t, double>>
     // If there is a vehicle at the left node, this is the left back vehicle,
     // since the rear of this vehicle must be at least the same distance with
     // the rear of the query vehicle.
-    const size_t left_vehicle = *(left->vehicle());
-    const double distance = start->distance() -
-                            vehicleHeadNode(left_vehicle)->distance();
+    const size_t left_vehicle = *(nodeVehicle(left));
+    const double distance = arena[start].distance() -
+                            arena[vehicleHeadNode(left_vehicle)].distance();
     return std::make_pair(left_vehicle, distance);
   }
 }
@@ -288,6 +307,9 @@ boost::optional<std::pair<size_t, double>>
 boost::optional<std::pair<size_t, double>>
   TrafficLattice::rightFront(const size_t vehicle) const {
 
+  const auto neighbors = vehicle_to_neighbors_table_.find(vehicle);
+  if (neighbors != vehicle_to_neighbors_table_.end()) return neighbors->second[4];
+
   if (vehicle_to_nodes_table_.count(vehicle) == 0) {
     std::string error_msg = (boost::format(
           "TrafficLattice::rightFront(): "
@@ -297,8 +319,8 @@ boost::optional<std::pair<size_t, double>>
 
   // Find the node in the lattice which corresponds to the
   // head of the vehicle.
-  boost::shared_ptr<const Node> start = vehicleHeadNode(vehicle);
-  if (!start) {
+  const NodeIndex start = vehicleHeadNode(vehicle);
+  if (start == kInvalidNodeIndex) {
     std::string error_msg = (boost::format(
           "TrafficLattice::rightFront(): "
           "head of vehicle [%1%] is not on lattice.\n") % vehicle).str();
@@ -307,10 +329,11 @@ boost::optional<std::pair<size_t, double>>
 
   // Find the right node of the start.
   // If there is no right node, there is no right front vehicle.
-  boost::shared_ptr<const Node> right = start->right();
-  if (!right) return boost::none;
+  const NodeArena<Node>& arena = *(this->topology_->node_arena);
+  const NodeIndex right = arena[start].rightIndex();
+  if (right == kInvalidNodeIndex) return boost::none;
 
-  if (!right->vehicle()) {
+  if (!nodeVehicle(right)) {
     // If there is no vehicle at the right node, the case is easy.
     // Just search forward from this right node to find the front vehicle.
     return frontVehicle(right);
@@ -318,9 +341,9 @@ boost::optional<std::pair<size_t, double>>
     // If there is a vehicle at the right node, this is the right front vehicle,
     // since the head of this vehicle must be at least the same distance with
     // the head of the query vehicle.
-    const size_t right_vehicle = *(right->vehicle());
-    const double distance = vehicleRearNode(right_vehicle)->distance() -
-                            start->distance();
+    const size_t right_vehicle = *(nodeVehicle(right));
+    const double distance = arena[vehicleRearNode(right_vehicle)].distance() -
+                            arena[start].distance();
     return std::make_pair(right_vehicle, distance);
   }
 }
@@ -328,6 +351,9 @@ boost::optional<std::pair<size_t, double>>
 boost::optional<std::pair<size_t, double>>
   TrafficLattice::rightBack(const size_t vehicle) const {
 
+  const auto neighbors = vehicle_to_neighbors_table_.find(vehicle);
+  if (neighbors != vehicle_to_neighbors_table_.end()) return neighbors->second[5];
+
   if (vehicle_to_nodes_table_.count(vehicle) == 0) {
     std::string error_msg = (boost::format(
           "TrafficLattice::rightBack(): "
@@ -337,8 +363,8 @@ boost::optional<std::pair<size_t, double>>
 
   // Find the node in the lattice which corresponds to the
   // rear of the vehicle.
-  boost::shared_ptr<const Node> start = vehicleRearNode(vehicle);
-  if (!start) {
+  const NodeIndex start = vehicleRearNode(vehicle);
+  if (start == kInvalidNodeIndex) {
     std::string error_msg = (boost::format(
           "TrafficLattice::rightBack(): "
           "rear of vehicle [%1%] is not on lattice.\n") % vehicle).str();
@@ -347,10 +373,11 @@ boost::optional<std::pair<size_t, double>>
 
   // Find the right node of the start.
   // If there is no right node, there is no right back vehicle.
-  boost::shared_ptr<const Node> right = start->right();
-  if (!right) return boost::none;
+  const NodeArena<Node>& arena = *(this->topology_->node_arena);
+  const NodeIndex right = arena[start].rightIndex();
+  if (right == kInvalidNodeIndex) return boost::none;
 
-  if (!right->vehicle()) {
+  if (!nodeVehicle(right)) {
     // If there is no vehicle at the right node, the case is easy.
     // Just search backward from this right node to find the back vehicle.
     return backVehicle(right);
@@ -358,9 +385,9 @@ boost::optional<std::pair<size_t, double>>
     // If there is a vehicle at the right node, this is the right back vehicle,
     // since the rear of this vehicle must be at least the same distance with
     // the rear of the query vehicle.
-    const size_t right_vehicle = *(right->vehicle());
-    const double distance = start->distance() -
-                            vehicleHeadNode(right_vehicle)->distance();
+    const size_t right_vehicle = *(nodeVehicle(right));
+    const double distance = arena[start].distance() -
+                            arena[vehicleHeadNode(right_vehicle)].distance();
     return std::make_pair(right_vehicle, distance);
   }
 }
@@ -381,17 +408,18 @@ int32_t TrafficLattice::isChangingLane(const size_t vehicle) const {
     throw std::runtime_error(error_msg);
   }
 
-  boost::shared_ptr<const Node> rear_node = vehicleRearNode(vehicle);
-  boost::shared_ptr<const Node> head_node = vehicleHeadNode(vehicle);
+  const NodeArena<Node>& arena = *(this->topology_->node_arena);
+  const Node& rear_node = arena[vehicleRearNode(vehicle)];
+  const Node& head_node = arena[vehicleHeadNode(vehicle)];
   const int length = vehicle_to_nodes_table_.find(vehicle)->second.size();
 
   // Find the \c front_node on the same lane of the \c read_node, which is
   // also at the same distance of the \c head_node.
   // FIXME: We assume there the \c front_node is always available.
-  boost::shared_ptr<const Node> front_node = rear_node;
+  NodeIndex front_node = rear_node.index();
   for (int i = 0; i < length; ++i) {
-    front_node = front_node->front();
-    if (!front_node) {
+    front_node = arena[front_node].frontIndex();
+    if (front_node == kInvalidNodeIndex) {
       std::string error_msg = (boost::format(
             "TrafficLattice::isChangingLane(): "
             "Cannot find a front node %1% steps ahead of the rear node on vehicle [%2%].\n")
@@ -399,21 +427,21 @@ int32_t TrafficLattice::isChangingLane(const size_t vehicle) const {
           % vehicle).str();
       throw std::runtime_error(
           error_msg +
-          rear_node->string("rear node: ") +
-          head_node->string("head node: "));
+          rear_node.string("rear node: ") +
+          head_node.string("head node: "));
     }
   }
 
-  if (front_node->id() == head_node->id()) return 0;
-  if (front_node->left() && front_node->left()->id() == head_node->id()) return -1;
-  if (front_node->right() && front_node->right()->id() == head_node->id()) return 1;
+  if (front_node == head_node.index()) return 0;
+  if (arena[front_node].leftIndex() == head_node.index()) return -1;
+  if (arena[front_node].rightIndex() == head_node.index()) return 1;
 
   std::string error_msg("Cannot match front node to the head node.\n");
   throw std::runtime_error(
       error_msg +
-      front_node->string("front node: ") +
-      head_node->string("head node: ") +
-      rear_node->string("rear node: "));
+      arena[front_node].string("front node: ") +
+      head_node.string("head node: ") +
+      rear_node.string("rear node: "));
 }
 
 int32_t TrafficLattice::deleteVehicle(const size_t vehicle) {
@@ -422,10 +450,11 @@ int32_t TrafficLattice::deleteVehicle(const size_t vehicle) {
 
   // Otherwise, we have to first unregister the vehicle at the
   // corresponding nodes. Then remove the vehicle from the table.
-  for (auto& node : vehicle_to_nodes_table_[vehicle])
-    if (node.lock()) node.lock()->vehicle() = boost::none;
+  vacateNodes(vehicle_to_nodes_table_[vehicle]);
 
   vehicle_to_nodes_table_.erase(vehicle);
+  vehicle_to_waypoint_nodes_table_.erase(vehicle);
+  vehicle_to_hints_table_.erase(vehicle);
   return 1;
 }
 
@@ -433,12 +462,27 @@ int32_t TrafficLattice::addVehicle(const VehicleTuple& vehicle) {
   size_t id; CarlaTransform transform; CarlaBoundingBox bounding_box;
   std::tie(id, transform, bounding_box) = vehicle;
 
+  // Do not mess up the hints of an existing vehicle.
+  if (vehicle_to_nodes_table_.count(id) != 0) return 0;
+
+  VehicleWaypointHints& vehicle_hints = vehicle_to_hints_table_[id];
+  std::vector<boost::optional<size_t>> hints(
+      vehicle_hints.begin(), vehicle_hints.end());
+  const std::vector<CarlaLocation> locations {
+    vehicleRearLocation(transform, bounding_box),
+    transform.location,
+    vehicleHeadLocation(transform, bounding_box),
+  };
+
+  const std::vector<boost::shared_ptr<CarlaWaypoint>> matches =
+    fast_map_->waypoints(locations, hints);
   VehicleWaypoints waypoints;
-  waypoints[0] = vehicleRearWaypoint(transform, bounding_box);
-  waypoints[1] = vehicleWaypoint(transform);
-  waypoints[2] = vehicleHeadWaypoint(transform, bounding_box);
+  std::copy(matches.begin(), matches.end(), waypoints.begin());
+  std::copy(hints.begin(), hints.end(), vehicle_hints.begin());
 
-  return addVehicle(vehicle, waypoints);
+  const int32_t added = addVehicle(vehicle, waypoints);
+  if (added != 1) vehicle_to_hints_table_.erase(id);
+  return added;
 }
 
 int32_t TrafficLattice::addVehicle(
@@ -469,15 +513,17 @@ int32_t TrafficLattice::addVehicle(
   boost::shared_ptr<const CarlaWaypoint> mid_waypoint  = waypoints[1];
 
   // Find the nodes occupied by this vehicle.
-  boost::shared_ptr<Node> head_node = this->closestNode(
+  const NodeIndex head_node = this->closestNodeIndex(
       head_waypoint, this->longitudinal_resolution_);
-  boost::shared_ptr<Node> rear_node = this->closestNode(
+  const NodeIndex rear_node = this->closestNodeIndex(
       rear_waypoint, this->longitudinal_resolution_);
-  boost::shared_ptr<Node> mid_node = this->closestNode(
+  const NodeIndex mid_node = this->closestNodeIndex(
       mid_waypoint, this->longitudinal_resolution_);
 
   // If we can not add the whole vehicle onto the lattice, we won't add it.
-  if (!head_node || !rear_node || !mid_node) {
+  if (head_node == kInvalidNodeIndex ||
+      rear_node == kInvalidNodeIndex ||
+      mid_node  == kInvalidNodeIndex) {
     //if (!head_node) std::printf("Cannot find vehicle head.\n");
     //if (!rear_node) std::printf("Cannot find vehicle rear.\n");
     //if (!mid_node)  std::printf("Cannot find vehicle mid.\n");
@@ -501,65 +547,173 @@ int32_t TrafficLattice::addVehicle(
   // case, two portions, separated by the mid node, of the vehicles are
   // on different lanes.
 
-  std::vector<boost::weak_ptr<Node>> rear_node_forward;
-  boost::shared_ptr<Node> next_node = rear_node;
+  const NodeArena<Node>& arena = *(this->topology_->node_arena);
+  const NodeIndex mid_left = arena[mid_node].leftIndex();
+  const NodeIndex mid_right = arena[mid_node].rightIndex();
+
+  std::vector<NodeIndex> rear_node_forward;
+  NodeIndex next_node = rear_node;
   while (true) {
-    if (next_node->id() == mid_node->id()) break;
-    if (mid_node->left().lock() &&
-        next_node->id() == mid_node->left().lock()->id()) break;
-    if (mid_node->right().lock() &&
-        next_node->id() == mid_node->right().lock()->id()) break;
-
-    rear_node_forward.emplace_back(next_node);
-    if (!next_node->front().lock()) break;
-    next_node = next_node->front().lock();
+    if (next_node == mid_node) break;
+    if (mid_left != kInvalidNodeIndex && next_node == mid_left) break;
+    if (mid_right != kInvalidNodeIndex && next_node == mid_right) break;
+
+    rear_node_forward.push_back(next_node);
+    if (arena[next_node].frontIndex() == kInvalidNodeIndex) break;
+    next_node = arena[next_node].frontIndex();
   }
 
-  std::vector<boost::weak_ptr<Node>> head_node_backward;
+  std::vector<NodeIndex> head_node_backward;
   next_node = head_node;
   while (true) {
-    if (next_node->id() == mid_node->id()) break;
-    if (mid_node->left().lock() &&
-        next_node->id() == mid_node->left().lock()->id()) break;
-    if (mid_node->right().lock() &&
-        next_node->id() == mid_node->right().lock()->id()) break;
-
-    head_node_backward.emplace_back(next_node);
-    if (!next_node->back().lock()) break;
-    next_node = next_node->back().lock();
+    if (next_node == mid_node) break;
+    if (mid_left != kInvalidNodeIndex && next_node == mid_left) break;
+    if (mid_right != kInvalidNodeIndex && next_node == mid_right) break;
+
+    head_node_backward.push_back(next_node);
+    if (arena[next_node].backIndex() == kInvalidNodeIndex) break;
+    next_node = arena[next_node].backIndex();
   }
   std::reverse(head_node_backward.begin(), head_node_backward.end());
 
-  std::vector<boost::weak_ptr<Node>> nodes;
+  std::vector<NodeIndex> nodes;
   nodes.insert(nodes.end(), rear_node_forward.begin(), rear_node_forward.end());
-  nodes.emplace_back(mid_node);
+  nodes.push_back(mid_node);
   nodes.insert(nodes.end(), head_node_backward.begin(), head_node_backward.end());
 
   // If there is already a vehicle on any of the found nodes,
-  // it indicates there is a collision.
-  bool collision_flag = false;
-  for (auto& node : nodes) {
-    if (node.lock()->vehicle()) {
-      collision_flag = true;
-      break;
+  // it indicates there is a collision. In which case, the occupancy
+  // is left unchanged.
+  if (!occupyNodes(nodes, id)) return -1;
+
+  // If there is no collision, we can add the vehicle successfully.
+  vehicle_to_nodes_table_[id] = nodes;
+  vehicle_to_waypoint_nodes_table_[id] = VehicleNodes{rear_node, mid_node, head_node};
+  return 1;
+}
+
+bool TrafficLattice::occupyNodes(
+    const std::vector<NodeIndex>& nodes, const size_t vehicle) {
+
+  vehicle_to_neighbors_table_.clear();
+
+  size_t begin = 0;
+  while (begin < nodes.size()) {
+    uint32_t segment = 0;
+    int64_t column = 0;
+    const size_t end = nodeRun(nodes, begin, segment, column);
+    const int64_t last_column = column + static_cast<int64_t>(end-begin) - 1;
+
+    LaneOccupancy& lane = laneOccupancy(segment, column, last_column);
+    const int64_t first_bit = column - lane.base;
+    const int64_t last_bit = last_column - lane.base;
+
+    // Check all words covered by the run before marking any of them.
+    // The nodes of a previous run, which are marked already, may show up
+    // again in the current run, which is a collision as well.
+    bool collision = false;
+    for (int64_t word = first_bit>>6; word <= (last_bit>>6); ++word) {
+      if (lane.bits[word] & occupancyMask(first_bit, last_bit, word)) {
+        collision = true;
+        break;
+      }
     }
-    else node.lock()->vehicle() = id;
+
+    if (collision) {
+      vacateNodes(std::vector<NodeIndex>(nodes.begin(), nodes.begin()+begin));
+      return false;
+    }
+
+    for (int64_t word = first_bit>>6; word <= (last_bit>>6); ++word) {
+      lane.bits[word] |= occupancyMask(first_bit, last_bit, word);
+    }
+    std::fill(lane.vehicles.begin()+first_bit,
+              lane.vehicles.begin()+last_bit+1, vehicle);
+
+    begin = end;
   }
 
-  if (!collision_flag) {
-    // If there is no collision, we can add the vehicle successfully.
-    vehicle_to_nodes_table_[id] = nodes;
-    return 1;
-  } else {
-    // If there is a collision, we should erase the vehicle on the touched nodes,
-    // and leave the object in a valid state.
-    for (auto& node : nodes) {
-      if (!(node.lock()->vehicle())) continue;
-      if (*(node.lock()->vehicle()) != id) continue;
-      node.lock()->vehicle() = boost::none;
+  return true;
+}
+
+void TrafficLattice::vacateNodes(const std::vector<NodeIndex>& nodes) {
+
+  vehicle_to_neighbors_table_.clear();
+
+  size_t begin = 0;
+  while (begin < nodes.size()) {
+    uint32_t segment = 0;
+    int64_t column = 0;
+    const size_t end = nodeRun(nodes, begin, segment, column);
+    const int64_t last_column = column + static_cast<int64_t>(end-begin) - 1;
+
+    LaneOccupancy& lane = laneOccupancy(segment, column, last_column);
+    const int64_t first_bit = column - lane.base;
+    const int64_t last_bit = last_column - lane.base;
+
+    for (int64_t word = first_bit>>6; word <= (last_bit>>6); ++word) {
+      lane.bits[word] &= ~occupancyMask(first_bit, last_bit, word);
     }
-    return -1;
+
+    begin = end;
+  }
+
+  return;
+}
+
+size_t TrafficLattice::nodeRun(
+    const std::vector<NodeIndex>& nodes,
+    const size_t begin,
+    uint32_t& segment,
+    int64_t& column) const {
+
+  const NodeSegments& segments = this->topology_->node_segments;
+  segment = segments.segment(nodes[begin]);
+  column = this->nodeColumn(nodes[begin]);
+
+  // Within a segment, the node at a column is known without following
+  // the links. So the run can be checked without computing the columns.
+  const int64_t last_column = segments.lastColumn(segment);
+  size_t end = begin + 1;
+  while (end < nodes.size()) {
+    const int64_t next_column = column + static_cast<int64_t>(end-begin);
+    if (next_column > last_column) break;
+    if (segments.node(segment, next_column) != nodes[end]) break;
+    ++end;
+  }
+
+  return end;
+}
+
+TrafficLattice::LaneOccupancy& TrafficLattice::laneOccupancy(
+    const uint32_t segment,
+    const int64_t first_column,
+    const int64_t last_column) {
+
+  if (lane_occupancy_.size() <= segment) lane_occupancy_.resize(segment+1);
+  LaneOccupancy& lane = lane_occupancy_[segment];
+
+  // Columns are grouped into words starting from multiples of 64.
+  const auto word_column = [](const int64_t column)->int64_t{
+    return column >= 0 ? column/64*64 : -((-column+63)/64*64);
+  };
+
+  if (lane.bits.empty()) lane.base = word_column(first_column);
+
+  if (first_column < lane.base) {
+    const int64_t base = word_column(first_column);
+    lane.bits.insert(lane.bits.begin(), (lane.base-base)/64, 0);
+    lane.vehicles.insert(lane.vehicles.begin(), lane.base-base, 0);
+    lane.base = base;
   }
+
+  const size_t word_num = (word_column(last_column)-lane.base)/64 + 1;
+  if (lane.bits.size() < word_num) {
+    lane.bits.resize(word_num, 0);
+    lane.vehicles.resize(word_num*64, 0);
+  }
+
+  return lane;
 }
 
 bool TrafficLattice::moveTrafficForward(
@@ -594,28 +748,35 @@ bool TrafficLattice::moveTrafficForward(
     throw std::runtime_error(error_msg + existing_vehicles_msg + update_vehicles_msg);
   }
 
-  // Clear all vehicles for the moment, will add them back later.
-  for (auto& item : vehicle_to_nodes_table_) {
-    for (auto& node : item.second) {
-      if (node.lock()) node.lock()->vehicle() = boost::none;
-    }
-  }
-  vehicle_to_nodes_table_.clear();
-
   // Find waypoints for each of the input vehicle.
   std::unordered_map<size_t, VehicleWaypoints>
     vehicle_waypoints = vehicleWaypoints(vehicles);
 
+  // Most of the time, the vehicles move less than a node between two
+  // updates, and the lattice does not have to be modified. In which case,
+  // only the vehicles moved onto other nodes are registered again.
+  bool moved_valid = true;
+  if (moveVehiclesOnLattice(vehicles, vehicle_waypoints, moved_valid)) {
+    if (disappear_vehicles) disappear_vehicles->clear();
+    return moved_valid;
+  }
+
+  // Clear all vehicles for the moment, will add them back later.
+  lane_occupancy_.clear();
+  vehicle_to_neighbors_table_.clear();
+  vehicle_to_nodes_table_.clear();
+  vehicle_to_waypoint_nodes_table_.clear();
+
   // Re-search for the start and range of the lattice.
   boost::shared_ptr<CarlaWaypoint> update_start = nullptr;
   double update_range = 0.0;
   latticeStartAndRange(vehicles, vehicle_waypoints, update_start, update_range);
 
   // Modify the lattice to agree with the new start and range.
-  boost::shared_ptr<Node> update_start_node = this->closestNode(
+  const NodeIndex update_start_node = this->closestNodeIndex(
       update_start, this->longitudinal_resolution_);
 
-  if (!update_start_node) {
+  if (update_start_node == kInvalidNodeIndex) {
     std::string error_msg(
         "TrafficLattice::moveTrafficForward(): "
         "cannot find the new start waypoint on the existing lattice.\n");
@@ -635,7 +796,8 @@ bool TrafficLattice::moveTrafficForward(
     throw std::runtime_error(error_msg + new_start_msg + this->string());
   }
 
-  this->shorten(this->range()-update_start_node->distance());
+  const NodeArena<Node>& arena = *(this->topology_->node_arena);
+  this->shorten(this->range()-arena[update_start_node].distance());
   this->extend(update_range);
 
   // Register the vehicles onto the lattice.
@@ -674,6 +836,7 @@ void TrafficLattice::baseConstructor(
 
   this->longitudinal_resolution_ = longitudinal_resolution;
   this->router_ = router;
+  this->lane_graph_ = fast_map_->laneGraph(router);
 
   if (range <= this->longitudinal_resolution_) {
     std::string error_msg = (boost::format(
@@ -685,12 +848,7 @@ void TrafficLattice::baseConstructor(
   }
 
   // Create the start node.
-  boost::shared_ptr<Node> start_node = boost::make_shared<Node>(start);
-  start_node->distance() = 0.0;
-  this->lattice_exits_.push_back(start_node);
-
-  this->augmentWaypointToNodeTable(start->GetId(), start_node);
-  this->augmentRoadlaneToWaypointsTable(start);
+  this->topology_->lattice_exits.push_back(this->addNode(start, 0.0));
 
   // Construct the lattice.
   this->extend(range);
@@ -846,6 +1004,7 @@ bool TrafficLattice::registerVehicles(
 
   // Clear the \c vehicle_to_node_table_.
   vehicle_to_nodes_table_.clear();
+  vehicle_to_waypoint_nodes_table_.clear();
 
   // Add vehicles onto the lattice, keep track of the disappearred/removed vehicles as well.
   std::unordered_set<size_t> removed_vehicles;
@@ -878,6 +1037,82 @@ bool TrafficLattice::registerVehicles(
   }
 
   if (disappear_vehicles) *disappear_vehicles = removed_vehicles;
+  updateNeighbors();
+  return true;
+}
+
+bool TrafficLattice::moveVehiclesOnLattice(
+    const std::vector<VehicleTuple>& vehicles,
+    const std::unordered_map<size_t, VehicleWaypoints>& vehicle_waypoints,
+    bool& valid) {
+
+  const NodeArena<Node>& arena = *(this->topology_->node_arena);
+
+  // Find the new nodes of all vehicles. Keep track of the rearmost node
+  // of all vehicles as well.
+  std::vector<VehicleNodes> vehicle_nodes(vehicles.size());
+  double rear_distance = std::numeric_limits<double>::max();
+
+  for (size_t i = 0; i < vehicles.size(); ++i) {
+    const size_t id = std::get<0>(vehicles[i]);
+    const auto waypoints_iter = vehicle_waypoints.find(id);
+    if (waypoints_iter == vehicle_waypoints.end()) return false;
+
+    for (size_t j = 0; j < 3; ++j) {
+      const boost::shared_ptr<const CarlaWaypoint>& waypoint = waypoints_iter->second[j];
+      const NodeIndex node = this->closestNodeIndex(
+          waypoint, this->longitudinal_resolution_);
+
+      // The vehicle is not on the lattice anymore.
+      if (node == kInvalidNodeIndex) return false;
+
+      // The lattice should be extended if the waypoint is ahead of an exit,
+      // since a new node may be closer to the waypoint.
+      if (arena[node].frontIndex() == kInvalidNodeIndex) {
+        const boost::shared_ptr<const CarlaWaypoint>& node_waypoint = arena[node].waypoint();
+        if (node_waypoint->GetRoadId() != waypoint->GetRoadId()) return false;
+        const double ahead = waypoint->GetDistance() - node_waypoint->GetDistance();
+        if ((waypoint->GetLaneId() < 0 ? ahead : -ahead) > 0.0) return false;
+      }
+
+      vehicle_nodes[i][j] = node;
+      rear_distance = std::min(rear_distance, arena[node].distance());
+    }
+  }
+
+  // The rearmost vehicle has moved beyond the first node,
+  // the lattice should be shortened.
+  if (rear_distance > 0.0) return false;
+
+  // Unregister the vehicles whose nodes are changed.
+  std::vector<size_t> moved_vehicles;
+  for (size_t i = 0; i < vehicles.size(); ++i) {
+    const size_t id = std::get<0>(vehicles[i]);
+    const auto nodes_iter = vehicle_to_waypoint_nodes_table_.find(id);
+    if (nodes_iter != vehicle_to_waypoint_nodes_table_.end() &&
+        nodes_iter->second == vehicle_nodes[i]) continue;
+
+    vacateNodes(vehicle_to_nodes_table_[id]);
+    vehicle_to_nodes_table_.erase(id);
+    vehicle_to_waypoint_nodes_table_.erase(id);
+    moved_vehicles.push_back(i);
+  }
+
+  // Register the moved vehicles again at the new nodes. The vehicles
+  // which are not moved cannot collide with each other.
+  valid = true;
+  for (const size_t i : moved_vehicles) {
+    const int32_t added = addVehicle(
+        vehicles[i], vehicle_waypoints.find(std::get<0>(vehicles[i]))->second);
+    if (added == -1) {
+      valid = false;
+      return true;
+    }
+  }
+
+  // The table is left untouched if no vehicle is moved.
+  if (vehicle_to_neighbors_table_.size() != vehicle_to_nodes_table_.size())
+    updateNeighbors();
   return true;
 }
 
@@ -947,8 +1182,8 @@ std::deque<size_t> TrafficLattice::sortRoads(
   return sorted_roads;
 }
 
-boost::shared_ptr<typename TrafficLattice::CarlaWaypoint>
-  TrafficLattice::vehicleHeadWaypoint(
+typename TrafficLattice::CarlaLocation
+  TrafficLattice::vehicleHeadLocation(
     const CarlaTransform& transform,
     const CarlaBoundingBox& bounding_box) const {
 
@@ -967,31 +1202,55 @@ boost::shared_ptr<typename TrafficLattice::CarlaWaypoint>
   //std::printf("head waypoint location: x:%f y:%f z:%f\n",
   //    waypoint_location.x, waypoint_location.y, waypoint_location.z);
 
-  //return map_->GetWaypoint(waypoint_location);
-  return fast_map_->waypoint(waypoint_location);
+  return waypoint_location;
 }
 
 std::unordered_map<size_t, typename TrafficLattice::VehicleWaypoints>
   TrafficLattice::vehicleWaypoints(
-    const std::vector<VehicleTuple>& vehicles) const {
+    const std::vector<VehicleTuple>& vehicles) {
 
-  std::unordered_map<size_t, VehicleWaypoints> vehicle_waypoints;
+  // Collect the rear, center, and head locations of all vehicles so that
+  // they can be matched with one batch query.
+  std::vector<CarlaLocation> locations;
+  std::vector<boost::optional<size_t>> hints;
+  locations.reserve(vehicles.size()*3);
+  hints.reserve(vehicles.size()*3);
 
   for (const auto& vehicle : vehicles) {
     size_t id; CarlaTransform transform; CarlaBoundingBox bounding_box;
     std::tie(id, transform, bounding_box) = vehicle;
 
-    vehicle_waypoints[id] = VehicleWaypoints();
-    vehicle_waypoints[id][0] = vehicleRearWaypoint(transform, bounding_box);
-    vehicle_waypoints[id][1] = vehicleWaypoint(transform);
-    vehicle_waypoints[id][2] = vehicleHeadWaypoint(transform, bounding_box);
+    locations.push_back(vehicleRearLocation(transform, bounding_box));
+    locations.push_back(transform.location);
+    locations.push_back(vehicleHeadLocation(transform, bounding_box));
+
+    // Start from the hints of the last match if there is any.
+    VehicleWaypointHints vehicle_hints;
+    const auto hints_iter = vehicle_to_hints_table_.find(id);
+    if (hints_iter != vehicle_to_hints_table_.end()) vehicle_hints = hints_iter->second;
+    hints.insert(hints.end(), vehicle_hints.begin(), vehicle_hints.end());
+  }
+
+  const std::vector<boost::shared_ptr<CarlaWaypoint>> waypoints =
+    fast_map_->waypoints(locations, hints);
+
+  std::unordered_map<size_t, VehicleWaypoints> vehicle_waypoints;
+  std::unordered_map<size_t, VehicleWaypointHints> vehicle_hints;
+
+  for (size_t i = 0; i < vehicles.size(); ++i) {
+    const size_t id = std::get<0>(vehicles[i]);
+    for (size_t j = 0; j < 3; ++j) {
+      vehicle_waypoints[id][j] = waypoints[3*i+j];
+      vehicle_hints[id][j] = hints[3*i+j];
+    }
   }
 
+  vehicle_to_hints_table_.swap(vehicle_hints);
   return vehicle_waypoints;
 }
 
-boost::shared_ptr<typename TrafficLattice::CarlaWaypoint>
-  TrafficLattice::vehicleRearWaypoint(
+typename TrafficLattice::CarlaLocation
+  TrafficLattice::vehicleRearLocation(
     const CarlaTransform& transform,
     const CarlaBoundingBox& bounding_box) const {
 
@@ -1009,28 +1268,42 @@ boost::shared_ptr<typename TrafficLattice::CarlaWaypoint>
   //    transform.location.x, transform.location.y, transform.location.z);
   //std::printf("rear waypoint location: x:%f y:%f z:%f\n",
   //    waypoint_location.x, waypoint_location.y, waypoint_location.z);
-  //return map_->GetWaypoint(waypoint_location);
-  return fast_map_->waypoint(waypoint_location);
+  return waypoint_location;
 }
 
 boost::optional<std::pair<size_t, double>>
-  TrafficLattice::frontVehicle(
-      const boost::shared_ptr<const Node>& start) const {
+  TrafficLattice::frontVehicle(const NodeIndex start) const {
 
-  if (!start) {
+  const NodeArena<Node>& arena = *(this->topology_->node_arena);
+  if (!arena.alive(start)) {
     std::string error_msg(
         "TrafficLattice::frontVehicle(): "
         "the input start node does not exist on lattice.\n");
     throw std::runtime_error(error_msg);
   }
 
-  boost::shared_ptr<const Node> front = start->front();
-  while (front) {
-    // If we found a vehicle at the front node, this is it.
-    if (front->vehicle())
-      return std::make_pair(*(front->vehicle()), front->distance()-start->distance());
-    // Otherwise, keep moving forward.
-    front = front->front();
+  // Search the occupancy bitmaps segment by segment, instead of
+  // following the front nodes one by one.
+  const NodeSegments& segments = this->topology_->node_segments;
+  uint32_t segment = segments.segment(start);
+  int64_t column = this->nodeColumn(start) + 1;
+
+  while (true) {
+    // If we found a vehicle on the rest of the segment, this is it.
+    const boost::optional<int64_t> occupied = occupiedColumn(
+        segment, column, segments.lastColumn(segment), true);
+    if (occupied) {
+      const NodeIndex front = segments.node(segment, *occupied);
+      return std::make_pair(*(nodeVehicle(front)),
+                            arena[front].distance()-arena[start].distance());
+    }
+
+    // Otherwise, keep moving forward to the next segment.
+    const NodeIndex last = segments.node(segment, segments.lastColumn(segment));
+    const NodeIndex front = arena[last].frontIndex();
+    if (front == kInvalidNodeIndex) break;
+    segment = segments.segment(front);
+    column = this->nodeColumn(front);
   }
 
   // There is no front vehicle from the given node.
@@ -1038,29 +1311,91 @@ boost::optional<std::pair<size_t, double>>
 }
 
 boost::optional<std::pair<size_t, double>>
-  TrafficLattice::backVehicle(
-      const boost::shared_ptr<const Node>& start) const {
+  TrafficLattice::backVehicle(const NodeIndex start) const {
 
-  if (!start) {
+  const NodeArena<Node>& arena = *(this->topology_->node_arena);
+  if (!arena.alive(start)) {
     std::string error_msg(
         "TrafficLattice::backVehicle(): "
         "the input start node does not exist on lattice.\n");
     throw std::runtime_error(error_msg);
   }
 
-  boost::shared_ptr<const Node> back = start->back();
-  while (back) {
-    // If we found a vehicle at the front node, this is it.
-    if (back->vehicle())
-      return std::make_pair(*(back->vehicle()), start->distance()-back->distance());
-    // Otherwise, keep moving backward.
-    back = back->back();
+  // Search the occupancy bitmaps segment by segment, instead of
+  // following the back nodes one by one.
+  const NodeSegments& segments = this->topology_->node_segments;
+  uint32_t segment = segments.segment(start);
+  int64_t column = this->nodeColumn(start) - 1;
+
+  while (true) {
+    // If we found a vehicle on the rest of the segment, this is it.
+    const boost::optional<int64_t> occupied = occupiedColumn(
+        segment, segments.firstColumn(segment), column, false);
+    if (occupied) {
+      const NodeIndex back = segments.node(segment, *occupied);
+      return std::make_pair(*(nodeVehicle(back)),
+                            arena[start].distance()-arena[back].distance());
+    }
+
+    // Otherwise, keep moving backward to the previous segment.
+    const NodeIndex first = segments.node(segment, segments.firstColumn(segment));
+    const NodeIndex back = arena[first].backIndex();
+    if (back == kInvalidNodeIndex) break;
+    segment = segments.segment(back);
+    column = this->nodeColumn(back);
   }
 
   // There is no back vehicle from the given node.
   return boost::none;
 }
 
+boost::optional<int64_t> TrafficLattice::occupiedColumn(
+    const uint32_t segment,
+    const int64_t first_column,
+    const int64_t last_column,
+    const bool forward) const {
+
+  if (segment >= lane_occupancy_.size()) return boost::none;
+  const LaneOccupancy& lane = lane_occupancy_[segment];
+
+  // Clip the range to the columns covered by the bitmap.
+  const int64_t first_bit = std::max(first_column-lane.base, int64_t(0));
+  const int64_t last_bit = std::min(
+      last_column-lane.base, static_cast<int64_t>(lane.vehicles.size())-1);
+  if (first_bit > last_bit) return boost::none;
+
+  if (forward) {
+    for (int64_t word = first_bit>>6; word <= (last_bit>>6); ++word) {
+      const uint64_t bits = lane.bits[word] & occupancyMask(first_bit, last_bit, word);
+      if (bits) return lane.base + word*64 + __builtin_ctzll(bits);
+    }
+  } else {
+    for (int64_t word = last_bit>>6; word >= (first_bit>>6); --word) {
+      const uint64_t bits = lane.bits[word] & occupancyMask(first_bit, last_bit, word);
+      if (bits) return lane.base + word*64 + 63 - __builtin_clzll(bits);
+    }
+  }
+
+  return boost::none;
+}
+
+void TrafficLattice::updateNeighbors() {
+
+  // The queries search the lattice for the vehicles not in the table yet.
+  vehicle_to_neighbors_table_.clear();
+  for (const auto& item : vehicle_to_nodes_table_) {
+    const size_t vehicle = item.first;
+    const VehicleNeighbors neighbors {
+      front(vehicle), back(vehicle),
+      leftFront(vehicle), leftBack(vehicle),
+      rightFront(vehicle), rightBack(vehicle),
+    };
+    vehicle_to_neighbors_table_[vehicle] = neighbors;
+  }
+
+  return;
+}
+
 std::string TrafficLattice::string(const std::string& prefix) const {
 
   std::string lattice_msg = Base::string(prefix);
@@ -1068,8 +1403,8 @@ std::string TrafficLattice::string(const std::string& prefix) const {
   std::string vehicles_msg;
   for (const auto& vehicle : vehicle_to_nodes_table_) {
     std::string vehicle_msg = (boost::format("vehicle %1%:\n") % vehicle.first).str();
-    for (const auto& node : vehicle.second)
-      vehicle_msg += node.lock()->string();
+    for (const NodeIndex node : vehicle.second)
+      vehicle_msg += (*(this->topology_->node_arena))[node].string();
     vehicles_msg += vehicle_msg;
   }
 
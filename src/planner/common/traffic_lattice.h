@@ -15,6 +15,7 @@
 #pragma once
 
 #include <cstdint>
+#include <algorithm>
 #include <tuple>
 #include <array>
 #include <string>
@@ -33,10 +34,12 @@
 namespace planner {
 
 /**
- * \brief WaypointNodeWithVehicle is similar to WaypointNode, but also keeps
- *        tracks of the vehicle at this node.
+ * \brief WaypointNodeWithVehicle is the node used by \c TrafficLattice.
  *
- * Each node is at most associated with one vehicle.
+ * Each node is at most associated with one vehicle. The vehicle at a node
+ * is tracked by the traffic lattice instead of the node (see
+ * \c TrafficLattice::nodeVehicle()), so that the nodes can be shared by
+ * the copies of a traffic lattice.
  */
 class WaypointNodeWithVehicle : public LatticeNode<WaypointNodeWithVehicle> {
 
@@ -49,11 +52,6 @@ protected:
   using Base = LatticeNode<WaypointNodeWithVehicle>;
   using This = WaypointNodeWithVehicle;
 
-protected:
-
-  /// ID of the vehicle that occupies this node.
-  boost::optional<size_t> vehicle_ = boost::none;
-
 public:
 
   /// Default constructor.
@@ -66,12 +64,6 @@ public:
   WaypointNodeWithVehicle(const boost::shared_ptr<const CarlaWaypoint>& waypoint) :
     Base(waypoint) {}
 
-  /// Get the vehicle ID registered at this node.
-  boost::optional<size_t> vehicle() const { return vehicle_; }
-
-  /// Get or set the vehicle ID at this node.
-  boost::optional<size_t>& vehicle() { return vehicle_; }
-
   // Get the string describing the node.
   std::string string(const std::string& prefix="") const {
     boost::format waypoint_format(
@@ -87,15 +79,9 @@ public:
         % this->waypoint_->GetRoadId()
         % this->waypoint_->GetLaneId()).str();
 
-    std::string distance_msg = (boost::format("node distance: %1%\n") % this->distance_).str();
-
-    std::string vehicle_msg;
-    if (!vehicle_)
-      vehicle_msg = "vehicle at this node: \n";
-    else
-      vehicle_msg = (boost::format("vehicle at this node: %1%\n") % (*vehicle_)).str();
+    std::string distance_msg = (boost::format("node distance: %1%\n") % this->distance()).str();
 
-    return prefix + waypoint_msg + distance_msg + vehicle_msg;
+    return prefix + waypoint_msg + distance_msg;
     // TODO: Add the info for neighbor waypoints as well.
   }
 
@@ -120,6 +106,7 @@ protected:
   using CarlaWaypoint    = carla::client::Waypoint;
   using CarlaBoundingBox = carla::geom::BoundingBox;
   using CarlaTransform   = carla::geom::Transform;
+  using CarlaLocation    = carla::geom::Location;
   using CarlaRoad        = carla::road::Road;
   using CarlaLane        = carla::road::Lane;
   using CarlaRoadMap     = carla::road::Map;
@@ -136,6 +123,19 @@ protected:
   /// entry.
   using VehicleWaypoints = std::array<boost::shared_ptr<CarlaWaypoint>, 3>;
 
+  /// Stores the hints used to match the three waypoints for a vehicle,
+  /// i.e. the record indices of the last matched waypoints in the fast map.
+  using VehicleWaypointHints = std::array<boost::optional<size_t>, 3>;
+
+  /// Stores the nodes matched with the rear, middle, and head waypoints
+  /// of a vehicle.
+  using VehicleNodes = std::array<NodeIndex, 3>;
+
+  /// Stores the vehicles around a vehicle, in the order of front, back,
+  /// left front, left back, right front, and right back. Each entry is
+  /// the same as what is returned by the corresponding query function.
+  using VehicleNeighbors = std::array<boost::optional<std::pair<size_t, double>>, 6>;
+
 private:
 
   using Base = Lattice<WaypointNodeWithVehicle>;
@@ -148,7 +148,65 @@ protected:
    * For each entry, the key is the vehicle ID, the value is the nodes
    * occupied by the vehicle. The nodes are sorted from the vehicle rear to head.
    */
-  std::unordered_map<size_t, std::vector<boost::weak_ptr<Node>>> vehicle_to_nodes_table_;
+  std::unordered_map<size_t, std::vector<NodeIndex>> vehicle_to_nodes_table_;
+
+  /**
+   * \brief LaneOccupancy tracks the nodes occupied by vehicles on a lane
+   *        segment of the lattice.
+   *
+   * Bit \c i of \c bits is set if the node at column <tt>base+i</tt> is
+   * occupied, in which case \c vehicles[i] is the ID of the vehicle. \c base
+   * is always a multiple of 64, so that a word in \c bits covers the same
+   * columns on every lane.
+   */
+  struct LaneOccupancy {
+    /// Column of the first bit.
+    int64_t base = 0;
+
+    /// Occupancy bitmap of the columns.
+    std::vector<uint64_t> bits;
+
+    /// IDs of the vehicles at the columns, valid only where the bit is set.
+    std::vector<size_t> vehicles;
+  };
+
+  /**
+   * Occupancy of the nodes by vehicles, indexed by the lane segments
+   * of the lattice.
+   *
+   * The occupancy is kept out of the nodes, so that copies of the lattice
+   * share the topology and only duplicate these bitmaps. Since the segments
+   * are changed as the lattice is modified, all vehicles have to be removed
+   * before the lattice is modified.
+   */
+  std::vector<LaneOccupancy> lane_occupancy_;
+
+  /**
+   * A mapping from vehicle ID to the nodes matched with its rear, middle,
+   * and head waypoints.
+   *
+   * When the traffic moves forward, a vehicle has to be registered again
+   * only if any of these nodes is changed.
+   */
+  std::unordered_map<size_t, VehicleNodes> vehicle_to_waypoint_nodes_table_;
+
+  /**
+   * A mapping from vehicle ID to the vehicles around it.
+   *
+   * The table is filled for all vehicles whenever the vehicles are registered
+   * onto the lattice, and is cleared as soon as any vehicle is changed. The
+   * vehicle queries fall back to searching the lattice if a vehicle is not
+   * in the table.
+   */
+  std::unordered_map<size_t, VehicleNeighbors> vehicle_to_neighbors_table_;
+
+  /**
+   * A mapping from vehicle ID to the hints used to match its waypoints.
+   *
+   * Vehicles move only a little between two updates of the lattice. Matching
+   * the waypoints from the last matches is much cheaper than a global search.
+   */
+  std::unordered_map<size_t, VehicleWaypointHints> vehicle_to_hints_table_;
 
   /// Carla map, used to road and lanes.
   boost::shared_ptr<CarlaMap> map_;
@@ -229,6 +287,35 @@ public:
   /// Return the IDs of the vehicles that are currently being tracked.
   std::unordered_set<size_t> vehicles() const;
 
+  /**
+   * \brief Get the vehicle at a node.
+   * \param[in] node The index of the query node.
+   * \return The ID of the vehicle occupying the node, or \c boost::none
+   *         if there is no vehicle at the node.
+   */
+  boost::optional<size_t> nodeVehicle(const NodeIndex node) const {
+    const uint32_t segment = this->topology_->node_segments.segment(node);
+    if (segment >= lane_occupancy_.size()) return boost::none;
+
+    const LaneOccupancy& lane = lane_occupancy_[segment];
+    const int64_t bit = this->nodeColumn(node) - lane.base;
+    if (bit < 0 || bit >= static_cast<int64_t>(lane.vehicles.size())) return boost::none;
+    if (!((lane.bits[bit>>6] >> (bit&63)) & 1)) return boost::none;
+    return lane.vehicles[bit];
+  }
+
+  /**
+   * \brief Get the hint of the waypoint matched at the center of a vehicle.
+   * \param[in] vehicle The ID of the query vehicle.
+   * \return The record index of the waypoint in the fast map, or \c boost::none
+   *         if the vehicle has not been matched.
+   */
+  boost::optional<size_t> waypointHint(const size_t vehicle) const {
+    const auto iter = vehicle_to_hints_table_.find(vehicle);
+    if (iter == vehicle_to_hints_table_.end()) return boost::none;
+    return iter->second[1];
+  }
+
   /**
    * \brief Check if a vehicle is in the process of lane changing.
    *
@@ -386,46 +473,41 @@ protected:
   std::deque<size_t> sortRoads(const std::unordered_set<size_t>& roads) const;
 
   /**
-   * \brief Find the waypoint at the center of the vehicle.
-   * \param[in] transform The carla transform at the center of the vehicle.
-   * \return The carla waypoint at the location of the transform.
-   */
-  boost::shared_ptr<CarlaWaypoint> vehicleWaypoint(
-      const CarlaTransform& transform) const {
-    //return map_->GetWaypoint(transform.location);
-    return fast_map_->waypoint(transform.location);
-  }
-
-  /**
-   * \brief Find the waypoint at the head of the vehicle.
+   * \brief Find the location at the head of the vehicle.
    * \param[in] transform The carla transform of the vehicle.
    * \param[in] bounding_box The bounding box of the vehicle used to
    *                         identify the head.
-   * \return the carla waypoint at the head of the vehicle.
+   * \return the location at the head of the vehicle.
    */
-  boost::shared_ptr<CarlaWaypoint> vehicleHeadWaypoint(
+  CarlaLocation vehicleHeadLocation(
       const CarlaTransform& transform,
       const CarlaBoundingBox& bounding_box) const;
 
   /**
-   * \brief Find the waypoint at the rear of the vehicle.
+   * \brief Find the location at the rear of the vehicle.
    * \param[in] transform The carla transform of the vehicle.
    * \param[in] bounding_box The bounding box of the vehicle used to
-   *                         identify the head.
-   * \return the carla waypoint at the rear of the vehicle.
+   *                         identify the rear.
+   * \return the location at the rear of the vehicle.
    */
-  boost::shared_ptr<CarlaWaypoint> vehicleRearWaypoint(
+  CarlaLocation vehicleRearLocation(
       const CarlaTransform& transform,
       const CarlaBoundingBox& bounding_box) const;
 
   /**
    * \brief Find the three waypoints for each of the input vehicle.
+   *
+   * The waypoints of all vehicles are matched with a single batch query
+   * on the fast waypoint map, using the hints in \c vehicle_to_hints_table_.
+   * The table is updated with the new matches. Hints of the vehicles not
+   * in the input are dropped.
+   *
    * \param[in] vechiles The vehicles to find waypoints for.
    * \return An unordered map with keys as vehicle IDs, and values as the
    *         waypoints for the correspoinding vehicle from rear to head.
    */
   std::unordered_map<size_t, VehicleWaypoints> vehicleWaypoints(
-      const std::vector<VehicleTuple>& vehicles) const;
+      const std::vector<VehicleTuple>& vehicles);
 
   /**
    * \brief Register vehicles onto nodes of the lattice.
@@ -447,6 +529,113 @@ protected:
       const std::unordered_map<size_t, VehicleWaypoints>& vehicle_waypoints,
       boost::optional<std::unordered_set<size_t>&> disappear_vehicles);
 
+  /**
+   * \brief Move the vehicles to their new nodes without modifying the lattice.
+   *
+   * Only the vehicles whose rear, middle, or head node is changed are
+   * registered again. The vehicles are not moved if the lattice should be
+   * modified instead, i.e. any of the vehicles cannot be found on the
+   * lattice, reaches the exits of the lattice, or the rearmost vehicle has
+   * moved beyond the entries of the lattice. In which case, the object is
+   * left untouched.
+   *
+   * \note If collision is detected, it will leave the object at an invalid
+   *       state. One should not use the object anymore.
+   *
+   * \param[in] vehicles The vehicles with the updated states.
+   * \param[in] vehicle_waypoints Waypoints for the vehicles.
+   * \param[out] valid False if there is collision detected after moving
+   *                   the vehicles.
+   * \return True if the vehicles are moved.
+   */
+  bool moveVehiclesOnLattice(
+      const std::vector<VehicleTuple>& vehicles,
+      const std::unordered_map<size_t, VehicleWaypoints>& vehicle_waypoints,
+      bool& valid);
+
+  /**
+   * \brief Find the vehicles around every vehicle on the lattice, and
+   *        store them in \c vehicle_to_neighbors_table_.
+   */
+  void updateNeighbors();
+
+  /**
+   * \brief Find the closest occupied column within a range of a lane segment.
+   * \param[in] segment The lane segment.
+   * \param[in] first_column The first column of the range.
+   * \param[in] last_column The last column of the range.
+   * \param[in] forward True to find the first occupied column in the range,
+   *                    false to find the last one.
+   * \return The occupied column, or \c boost::none if no column in the range
+   *         is occupied.
+   */
+  boost::optional<int64_t> occupiedColumn(
+      const uint32_t segment,
+      const int64_t first_column,
+      const int64_t last_column,
+      const bool forward) const;
+
+  /**
+   * \brief Mark the given nodes as occupied by a vehicle.
+   *
+   * The nodes are split into runs of consecutive columns on the same lane
+   * segment. Each run is checked and marked with a masked AND and OR on
+   * the words of the occupancy bitmap of the segment.
+   *
+   * \param[in] nodes The nodes occupied by the vehicle.
+   * \param[in] vehicle The ID of the vehicle.
+   * \return False if any of the nodes is already occupied. In this case,
+   *         the occupancy is left unchanged.
+   */
+  bool occupyNodes(const std::vector<NodeIndex>& nodes, const size_t vehicle);
+
+  /**
+   * \brief Mark the given nodes as not occupied.
+   * \param[in] nodes The nodes to be cleared.
+   */
+  void vacateNodes(const std::vector<NodeIndex>& nodes);
+
+  /**
+   * \brief Find a run of nodes in consecutive columns on the same lane segment.
+   * \param[in] nodes The nodes to be split into runs.
+   * \param[in] begin The position in \c nodes where the run starts.
+   * \param[out] segment The lane segment of the run.
+   * \param[out] column The column of the first node in the run.
+   * \return The position in \c nodes after the end of the run.
+   */
+  size_t nodeRun(const std::vector<NodeIndex>& nodes,
+                 const size_t begin,
+                 uint32_t& segment,
+                 int64_t& column) const;
+
+  /**
+   * \brief Get the mask of the bits in [\c first_bit, \c last_bit] within a word.
+   * \param[in] first_bit The first bit of the range.
+   * \param[in] last_bit The last bit of the range.
+   * \param[in] word The index of the word, which should overlap with the range.
+   * \return The mask of the range in the word.
+   */
+  static uint64_t occupancyMask(
+      const int64_t first_bit, const int64_t last_bit, const int64_t word) {
+    const int64_t lo = std::max(first_bit, word*64) - word*64;
+    const int64_t hi = std::min(last_bit, word*64+63) - word*64;
+    return (~uint64_t(0) >> (63-hi+lo)) << lo;
+  }
+
+  /**
+   * \brief Get the occupancy of a lane segment covering the given columns.
+   *
+   * The bitmap of the segment is grown if necessary.
+   *
+   * \param[in] segment The lane segment.
+   * \param[in] first_column The first column to be covered.
+   * \param[in] last_column The last column to be covered.
+   * \return The occupancy of the lane segment.
+   */
+  LaneOccupancy& laneOccupancy(const uint32_t segment,
+                               const int64_t first_column,
+                               const int64_t last_column);
+
   /**
    * \brief Compute the distance of the waypoint to the start of the road.
    *
@@ -486,36 +675,36 @@ protected:
 
   /**
    * \brief Find a front vehicle starting from a given node.
-   * \param[in] start The query node
+   * \param[in] start The index of the query node.
    * \return \c nullptr if a front vehicle does not exist on the lattice.
    */
   boost::optional<std::pair<size_t, double>>
-    frontVehicle(const boost::shared_ptr<const Node>& start) const;
+    frontVehicle(const NodeIndex start) const;
 
   /**
    * \brief Find a back vehicle starting from a given node.
-   * \param[in] start The query node
+   * \param[in] start The index of the query node.
    * \return \c nullptr if a back vehicle does not exist on the lattice.
    */
   boost::optional<std::pair<size_t, double>>
-    backVehicle(const boost::shared_ptr<const Node>& start) const;
+    backVehicle(const NodeIndex start) const;
 
   /**
    * \brief Find the head node of a vehicle.
    * \param[in] vehicle The query vehicle ID.
-   * \return The node on the lattice corresponds to the head of the vehicle.
+   * \return The index of the node on the lattice corresponds to the head of the vehicle.
    */
-  boost::shared_ptr<const Node> vehicleHeadNode(const size_t vehicle) const {
-    return vehicle_to_nodes_table_.find(vehicle)->second.back().lock();
+  NodeIndex vehicleHeadNode(const size_t vehicle) const {
+    return vehicle_to_nodes_table_.find(vehicle)->second.back();
   }
 
   /**
    * \brief Find the rear node of a vehicle.
    * \param[in] vehicle The query vehicle ID.
-   * \return The node on the lattice corresponds to the rear of the vehicle.
+   * \return The index of the node on the lattice corresponds to the rear of the vehicle.
    */
-  boost::shared_ptr<const Node> vehicleRearNode(const size_t vehicle) const {
-    return vehicle_to_nodes_table_.find(vehicle)->second.front().lock();
+  NodeIndex vehicleRearNode(const size_t vehicle) const {
+    return vehicle_to_nodes_table_.find(vehicle)->second.front();
   }
 
 }; // End class TrafficLattice.
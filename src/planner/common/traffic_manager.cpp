@@ -69,12 +69,10 @@ bool TrafficManager::moveTrafficForward(
   }
 
   // Clear all vehicles for the moment, will add them back later.
-  for (auto& item : this->vehicle_to_nodes_table_) {
-    for (auto& node : item.second) {
-      if (node.lock()) node.lock()->vehicle() = boost::none;
-    }
-  }
+  this->lane_occupancy_.clear();
+  this->vehicle_to_neighbors_table_.clear();
   this->vehicle_to_nodes_table_.clear();
+  this->vehicle_to_waypoint_nodes_table_.clear();
 
   // Shift the whole lattice forward by the given distance.
   this->shift(shift_distance);
@@ -119,20 +117,19 @@ boost::optional<std::pair<
   TrafficManager::frontSpawnWaypoint(const double min_range) const {
 
   // All lattice exits are candidates where we can spawn new vehicles.
-  std::vector<boost::shared_ptr<const Node>> candidates;
-  for (auto& exit : this->lattice_exits_)
-    candidates.push_back(exit.lock());
+  const std::vector<NodeIndex>& candidates = this->topology_->lattice_exits;
+  const NodeArena<Node>& arena = *(this->topology_->node_arena);
 
   // Collect candidates that meet the requirement.
   std::vector<std::pair<double, boost::shared_ptr<const CarlaWaypoint>>> valid_candidates;
-  for (const auto& candidate : candidates) {
+  for (const NodeIndex candidate : candidates) {
     boost::optional<std::pair<size_t, double>> back = this->backVehicle(candidate);
     if (back && back->second < min_range) continue;
 
     if (!back) valid_candidates.push_back(
-        std::make_pair(this->range(), candidate->waypoint()));
+        std::make_pair(this->range(), arena[candidate].waypoint()));
     else       valid_candidates.push_back(
-        std::make_pair(back->second, candidate->waypoint()));
+        std::make_pair(back->second, arena[candidate].waypoint()));
   }
 
   // Return \c boost::none if there is no valid candidate.
@@ -153,20 +150,19 @@ boost::optional<std::pair<
   TrafficManager::backSpawnWaypoint(const double min_range) const {
 
   // All lattice entries are candidates where we can spawn new vehicles.
-  std::vector<boost::shared_ptr<const Node>> candidates;
-  for (auto& entry : this->lattice_entries_)
-    candidates.push_back(entry.lock());
+  const std::vector<NodeIndex>& candidates = this->topology_->lattice_entries;
+  const NodeArena<Node>& arena = *(this->topology_->node_arena);
 
   // Collect candidates that meet the requirement.
   std::vector<std::pair<double, boost::shared_ptr<const CarlaWaypoint>>> valid_candidates;
-  for (const auto& candidate : candidates) {
+  for (const NodeIndex candidate : candidates) {
     boost::optional<std::pair<size_t, double>> front = this->frontVehicle(candidate);
     if (front && front->second < min_range) continue;
 
     if (!front) valid_candidates.push_back(
-        std::make_pair(this->range(), candidate->waypoint()));
+        std::make_pair(this->range(), arena[candidate].waypoint()));
     else       valid_candidates.push_back(
-        std::make_pair(front->second, candidate->waypoint()));
+        std::make_pair(front->second, arena[candidate].waypoint()));
   }
 
   // Return \c boost::none if there is no valid candidate.
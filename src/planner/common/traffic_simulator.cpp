@@ -13,6 +13,7 @@
 */
 
 #include <cmath>
+#include <algorithm>
 #include <limits>
 #include <string>
 #include <boost/format.hpp>
@@ -22,7 +23,7 @@
 
 namespace planner {
 
-const std::tuple<size_t, typename TrafficSimulator::CarlaTransform, double, double, double>
+utils::Expected<std::tuple<size_t, typename TrafficSimulator::CarlaTransform, double, double, double>>
   TrafficSimulator::updatedAgentTuple(
       const size_t id, const double accel, const double dt) const {
 
@@ -37,61 +38,37 @@ const std::tuple<size_t, typename TrafficSimulator::CarlaTransform, double, doub
     //    this is what we preferred.
     // 2) If we cannot, this implies the agent is leaving the route.
     //    we will use the carla map API to find an accessible next waypoint.
+    // The agent is usually still at the waypoint matched by the traffic
+    // lattice, in which case the hinted query is almost free.
+    boost::optional<size_t> hint = agent.waypointHint();
     boost::shared_ptr<CarlaWaypoint> waypoint =
-      fast_map_->waypoint(agent.transform().location);
+      fast_map_->waypoint(agent.transform().location, hint);
     const double movement = agent.speed()*dt + 0.5*accel*dt*dt;
 
-    boost::shared_ptr<CarlaWaypoint> next_waypoint = nullptr;
-
     //std::printf("agent:%lu speed:%f accel:%f dt:%f movement:%f\n",
     //    agent.id(), agent.speed(), accel, dt, movement);
 
-    try {
-      // Prefer the next waypoint on the route.
-      if (movement == 0.0) next_waypoint = waypoint;
-      else next_waypoint = router_->frontWaypoint(waypoint, movement);
-      // It is normal that we cannot find the next waypoint on the route.
-      // It is treated as an exception so that, all exceptions (together with
-      // the ones thrown by \c frontWayoint) can be handed by the following
-      // \c catch.
-      if (!next_waypoint) {
-        throw std::runtime_error(
-          "TrafficSimulator::updateAgentTupel(): "
-          "next waypoint is not available.\n");
-      }
-    } catch (...) {
-      // Otherwise, we have to settle with some waypoints outside the route.
-      // Find the next waypoint candidates.
-      std::vector<boost::shared_ptr<CarlaWaypoint>> next_waypoints;
+    // Prefer the next waypoint on the route.
+    // The router only accepts positive distances, and the waypoints on
+    // the roads of the route.
+    boost::shared_ptr<CarlaWaypoint> next_waypoint = nullptr;
+    if (movement == 0.0) {
+      next_waypoint = waypoint;
+    } else if (movement > 0.0 && router_->hasRoad(waypoint->GetRoadId())) {
+      next_waypoint = router_->frontWaypoint(waypoint, movement);
+    }
 
-      if (movement == 0.0) next_waypoints.push_back(waypoint);
-      else next_waypoints = waypoint->GetNext(movement);
+    // It is normal that we cannot find the next waypoint on the route.
+    // Otherwise, we have to settle with some waypoints outside the route.
+    if (!next_waypoint) {
+      // Find the next waypoint candidates.
+      const std::vector<boost::shared_ptr<CarlaWaypoint>> next_waypoints =
+        waypoint->GetNext(movement);
 
       if (next_waypoints.size() == 0) {
-        std::string error_msg(
+        return utils::Expected<std::tuple<size_t, CarlaTransform, double, double, double>>::failure(
             "TrafficSimulator::updatedAgentTuple(): "
             "cannot find a next waypoint for an agent.\n");
-        std::string agent_msg =
-          (boost::format("agent %1%: x:%2% y:%3% z:%4% speed:%5% accel:%6% movement:%7%\n")
-            % agent.id()
-            % agent.transform().location.x
-            % agent.transform().location.y
-            % agent.transform().location.z
-            % agent.speed()
-            % accel
-            % movement).str();
-        std::string waypoint_msg =
-          (boost::format("waypoint %1% x:%2% y:%3% z:%4% r:%5% p:%6% y:%7% road:%8% lane:%9%.\n")
-           % waypoint->GetId()
-           % waypoint->GetTransform().location.x
-           % waypoint->GetTransform().location.y
-           % waypoint->GetTransform().location.z
-           % waypoint->GetTransform().rotation.roll
-           % waypoint->GetTransform().rotation.pitch
-           % waypoint->GetTransform().rotation.yaw
-           % waypoint->GetRoadId()
-           % waypoint->GetLaneId()).str();
-        throw std::runtime_error(error_msg + agent_msg + waypoint_msg);
       }
 
       // Select the one with the least angle difference.
@@ -113,11 +90,77 @@ const std::tuple<size_t, typename TrafficSimulator::CarlaTransform, double, doub
     CarlaTransform update_transform;
 
     update_transform = next_waypoint->GetTransform();
-    update_curvature = utils::curvatureAtWaypoint(next_waypoint, map_);
+    update_curvature = fast_map_->curvature(next_waypoint);
 
     return std::make_tuple(id, update_transform, updated_speed, accel, update_curvature);
 }
 
+boost::optional<std::tuple<size_t, typename TrafficSimulator::CarlaTransform, double, double, double>>
+  TrafficSimulator::frenetAgentTuple(
+      const size_t id, const double accel, const double dt) {
+
+  const boost::shared_ptr<const utils::LaneGraph>& lane_graph =
+    snapshot_.trafficLattice()->laneGraph();
+  if (!lane_graph) return boost::none;
+
+  const Vehicle& agent = snapshot_.vehicle(id);
+
+  // The lane graph only moves the agents forward. The agents with negative
+  // movements are left to \c updatedAgentTuple(), and are matched onto the
+  // graph again at their next updates.
+  const double movement = agent.speed()*dt + 0.5*accel*dt*dt;
+  if (movement < 0.0) {
+    agent_coordinates_.erase(id);
+    return boost::none;
+  }
+
+  // Match the agent onto the lane graph if it is not there yet.
+  std::unordered_map<size_t, utils::LaneGraph::Coordinate>::iterator
+    coordinate = agent_coordinates_.find(id);
+  if (coordinate == agent_coordinates_.end()) {
+    boost::optional<size_t> hint = agent.waypointHint();
+    boost::shared_ptr<CarlaWaypoint> waypoint =
+      fast_map_->waypoint(agent.transform().location, hint);
+    if (!waypoint) return boost::none;
+
+    boost::optional<utils::LaneGraph::Position> position =
+      lane_graph->position(waypoint);
+    if (!position) return boost::none;
+
+    coordinate = agent_coordinates_.emplace(
+        id, lane_graph->coordinate(*position)).first;
+  }
+
+  // Move the agent forward along the lanes. Once the agent leaves the
+  // lane graph, it is left to \c updatedAgentTuple().
+  boost::optional<utils::LaneGraph::Coordinate> next_coordinate =
+    lane_graph->front(coordinate->second, movement);
+  if (!next_coordinate) {
+    agent_coordinates_.erase(coordinate);
+    return boost::none;
+  }
+  coordinate->second = *next_coordinate;
+
+  // The transform and curvature are only needed at the resolution of the
+  // waypoints, which are cached by the fast map.
+  boost::shared_ptr<CarlaWaypoint> next_waypoint =
+    lane_graph->waypoint(lane_graph->position(*next_coordinate));
+
+  return std::make_tuple(id,
+                         next_waypoint->GetTransform(),
+                         agent.speed() + accel*dt,
+                         accel,
+                         fast_map_->curvature(next_waypoint));
+}
+
+std::vector<double> TrafficSimulator::agentAccelerations() const {
+  std::vector<double> accels;
+  accels.reserve(snapshot_.agents().size());
+  for (const auto& item : snapshot_.agents())
+    accels.push_back(agentAcceleration(item.first));
+  return accels;
+}
+
 const double TrafficSimulator::remainingTime(
     const double speed, const double accel, const double distance) const {
 
@@ -216,104 +259,238 @@ const double TrafficSimulator::accelCost() const {
 
 const bool TrafficSimulator::simulate(
     const ContinuousPath& path, const double default_dt, const double max_time,
-    double& time, double& cost) {
+    double& time, double& cost,
+    const boost::optional<double>& cost_bound) {
+  return trySimulate(path, default_dt, max_time, time, cost, cost_bound).value();
+}
+
+utils::Expected<bool> TrafficSimulator::trySimulate(
+    const ContinuousPath& path, const double default_dt, const double max_time,
+    double& time, double& cost,
+    const boost::optional<double>& cost_bound) {
 
   //std::printf("simulate(): \n");
 
-  // Reset the output to 0.
-  time = 0.0;
-  cost = 0.0;
-
-  // The actual simulation time step, which may vary for different iterations.
-  double dt = default_dt;
-  // The distance that ego has travelled on the input path.
-  double ego_distance = 0.0;
-
-  // FIXME: This is just a trial for defining the stage costs.
-  std::vector<double> ttc_cost;
-  std::vector<double> brake_cost;
-
-  while (time < max_time && dt >= default_dt) {
-
-    // Used to store the updated status of all vehicles.
-    std::vector<std::tuple<size_t, CarlaTransform, double, double, double>> updated_tuples;
-
-    // The acceleration to be applied by the ego vehicle.
-    const double ego_accel = egoAcceleration();
-
-    // Compute the actual time step.
-    const double remaining_time = remainingTime(
-        snapshot_.ego().speed(), ego_accel, path.range()-ego_distance);
-    dt = default_dt;
-    dt = dt <= remaining_time ? dt : remaining_time;
-    dt = dt <= max_time-time  ? dt : max_time-time;
-
-    //std::printf("============================================\n");
-    //std::cout << snapshot_.string("start snapshot:\n");
-    //std::printf("ego accel:%f\n", ego_accel);
-    //std::printf("default dt:%f max time:%f remaining time:%f\n",
-    //    default_dt, max_time, remaining_time);
-    //std::printf("time:%f dt:%f\n", time, dt);
-
-    // Update the distance of the ego on the path.
-    ego_distance += snapshot_.ego().speed()*dt + 0.5*ego_accel*dt*dt;
-    if (ego_distance > path.range()) ego_distance = path.range();
-    //std::printf("ego distance:%f path range:%f\n", ego_distance, path.range());
-
-    // Store the updated status of the ego.
-    std::pair<CarlaTransform, double> ego_transform = path.transformAt(ego_distance);
-    updated_tuples.push_back(std::make_tuple(
-          snapshot_.ego().id(),
-          ego_transform.first,
-          snapshot_.ego().speed()+ego_accel*dt,
-          ego_accel,
-          ego_transform.second));
-
-    // Take care of the agents.
-    for (const auto& item : snapshot_.agents()) {
-      const Vehicle& agent = item.second;
-      const double agent_accel = agentAcceleration(agent.id());
-      updated_tuples.push_back(updatedAgentTuple(agent.id(), agent_accel, dt));
-      //std::printf("agent %lu accel: %f\n", agent.id(), agent_accel);
+  cost_lower_bound_ = -std::numeric_limits<double>::infinity();
+
+  Rollout rollout(path, default_dt, max_time, cost_bound);
+  boost::optional<utils::Expected<bool>> no_collision = boost::none;
+  while (!no_collision) no_collision = step(rollout);
+
+  time = rollout.time;
+  cost = rollout.cost;
+  return *no_collision;
+}
+
+std::vector<utils::Expected<bool>> TrafficSimulator::trySimulateLockstep(
+    const std::vector<boost::shared_ptr<TrafficSimulator>>& simulators,
+    const ContinuousPath& path, const double default_dt, const double max_time,
+    std::vector<double>& times, std::vector<double>& costs,
+    std::vector<std::string>& warnings) {
+
+  for (const auto& simulator : simulators)
+    simulator->cost_lower_bound_ = -std::numeric_limits<double>::infinity();
+
+  std::vector<Rollout> rollouts(
+      simulators.size(), Rollout(path, default_dt, max_time, boost::none));
+  std::vector<boost::optional<utils::Expected<bool>>> outputs(simulators.size(), boost::none);
+  warnings.assign(simulators.size(), std::string());
+
+  // The agent updates shared by the simulators within a step.
+  std::unordered_map<size_t, AgentUpdate> agent_updates;
+
+  size_t running = simulators.size();
+  while (running > 0) {
+    agent_updates.clear();
+
+    for (size_t i = 0; i < simulators.size(); ++i) {
+      if (outputs[i]) continue;
+
+      try {
+        outputs[i] = simulators[i]->step(rollouts[i], &agent_updates);
+      } catch (std::exception& e) {
+        warnings[i] = e.what();
+        outputs[i] = utils::Expected<bool>::failure(
+            "TrafficSimulator::trySimulateLockstep(): "
+            "an exception is thrown in the simulation.\n");
+      }
+
+      if (outputs[i]) --running;
     }
+  }
+
+  times.clear(); costs.clear();
+  std::vector<utils::Expected<bool>> no_collisions;
+  for (size_t i = 0; i < simulators.size(); ++i) {
+    times.push_back(rollouts[i].time);
+    costs.push_back(rollouts[i].cost);
+    no_collisions.push_back(*(outputs[i]));
+  }
+
+  return no_collisions;
+}
 
-    // Update the snapshot.
-    if (!snapshot_.updateTraffic(updated_tuples)) {
-      //std::printf("Collision detected in the simulation.\n");
-      return false;
+utils::Expected<std::tuple<size_t, typename TrafficSimulator::CarlaTransform, double, double, double>>
+  TrafficSimulator::nextAgentTuple(
+      const size_t id, const double accel, const double dt,
+      std::unordered_map<size_t, AgentUpdate>* agent_updates) {
+
+  const Vehicle& agent = snapshot_.vehicle(id);
+
+  AgentUpdate update;
+  update.x = agent.transform().location.x;
+  update.y = agent.transform().location.y;
+  update.z = agent.transform().location.z;
+  update.speed = agent.speed();
+  update.accel = accel;
+  update.dt = dt;
+
+  std::unordered_map<size_t, utils::LaneGraph::Coordinate>::const_iterator
+    coordinate = agent_coordinates_.find(id);
+  if (coordinate != agent_coordinates_.end()) update.coordinate = coordinate->second;
+
+  // Reuse the update from another simulator in lockstep if the agent starts
+  // from the same state, in which case the update would be the same.
+  if (agent_updates) {
+    std::unordered_map<size_t, AgentUpdate>::const_iterator
+      shared_update = agent_updates->find(id);
+    if (shared_update != agent_updates->end() &&
+        shared_update->second.sameStart(update)) {
+      if (shared_update->second.next_coordinate)
+        agent_coordinates_[id] = *(shared_update->second.next_coordinate);
+      else
+        agent_coordinates_.erase(id);
+      return *(shared_update->second.tuple);
     }
+  }
 
-    //std::cout << snapshot_.string("end simulation snapshot:\n");
+  // Move the agent forward by itself.
+  boost::optional<std::tuple<size_t, CarlaTransform, double, double, double>>
+    frenet_tuple = boost::none;
+  if (frenet_agents_) frenet_tuple = frenetAgentTuple(id, accel, dt);
 
-    // TODO: Accumulate the cost.
-    ttc_cost.push_back(ttcCost());
-    brake_cost.push_back(accelCost());
+  if (frenet_tuple) update.tuple = utils::Expected<
+    std::tuple<size_t, CarlaTransform, double, double, double>>(*frenet_tuple);
+  else update.tuple = updatedAgentTuple(id, accel, dt);
 
-    //std::printf("ttc cost: %f\n", ttcCost());
-    //std::printf("brake cost: %f\n", accelCost());
+  coordinate = agent_coordinates_.find(id);
+  if (coordinate != agent_coordinates_.end()) update.next_coordinate = coordinate->second;
 
-    // Tick the time.
-    time += dt;
-  }
+  // The first update within the step is kept, if there are agents
+  // starting from different states.
+  if (agent_updates) agent_updates->emplace(id, update);
+  return *(update.tuple);
+}
 
-  // TODO: Should I use mean or max?
-  double average_ttc_cost = 0.0;
-  for (const auto c : ttc_cost) average_ttc_cost += c;
-  average_ttc_cost /= ttc_cost.size();
+boost::optional<utils::Expected<bool>> TrafficSimulator::step(
+    Rollout& rollout,
+    std::unordered_map<size_t, AgentUpdate>* agent_updates) {
+
+  const ContinuousPath& path = rollout.path;
+  const double default_dt = rollout.default_dt;
+  const double max_time = rollout.max_time;
+  double& time = rollout.time;
+  double& dt = rollout.dt;
+
+  // The simulation terminates if the maximum duration is reached,
+  // or the ego reaches the end of the path with the last step.
+  if (time >= max_time || dt < default_dt) {
+    // TODO: Should I use mean or max?
+    const double average_ttc_cost = rollout.ttc_cost / rollout.steps;
+    const double average_brake_cost = rollout.brake_cost / rollout.steps;
+
+    //std::printf("average ttc cost: %f\n", average_ttc_cost);
+    //std::printf("average brake cost: %f\n", average_brake_cost);
+    //std::printf("\n");
+
+    rollout.cost = average_ttc_cost + average_brake_cost + rollout.lane_change_cost;
+    return utils::Expected<bool>(true);
+  }
 
-  double average_brake_cost = 0.0;
-  for (const auto c : brake_cost) average_brake_cost += c;
-  average_brake_cost /= brake_cost.size();
+  // Used to store the updated status of all vehicles.
+  std::vector<std::tuple<size_t, CarlaTransform, double, double, double>> updated_tuples;
+
+  // The acceleration to be applied by the ego vehicle.
+  const double ego_accel = egoAcceleration();
+
+  // Compute the actual time step.
+  const double remaining_time = remainingTime(
+      snapshot_.ego().speed(), ego_accel, path.range()-rollout.ego_distance);
+  dt = default_dt;
+  dt = dt <= remaining_time ? dt : remaining_time;
+  dt = dt <= max_time-time  ? dt : max_time-time;
+
+  //std::printf("============================================\n");
+  //std::cout << snapshot_.string("start snapshot:\n");
+  //std::printf("ego accel:%f\n", ego_accel);
+  //std::printf("default dt:%f max time:%f remaining time:%f\n",
+  //    default_dt, max_time, remaining_time);
+  //std::printf("time:%f dt:%f\n", time, dt);
+
+  // Update the distance of the ego on the path.
+  rollout.ego_distance += snapshot_.ego().speed()*dt + 0.5*ego_accel*dt*dt;
+  if (rollout.ego_distance > path.range()) rollout.ego_distance = path.range();
+  //std::printf("ego distance:%f path range:%f\n", rollout.ego_distance, path.range());
+
+  // Store the updated status of the ego.
+  std::pair<CarlaTransform, double> ego_transform = path.transformAt(rollout.ego_distance);
+  updated_tuples.push_back(std::make_tuple(
+        snapshot_.ego().id(),
+        ego_transform.first,
+        snapshot_.ego().speed()+ego_accel*dt,
+        ego_accel,
+        ego_transform.second));
+
+  // Take care of the agents.
+  const std::vector<double> agent_accels = agentAccelerations();
+  std::vector<double>::const_iterator agent_accel_iter = agent_accels.begin();
+  for (const auto& item : snapshot_.agents()) {
+    const Vehicle& agent = item.second;
+    const double agent_accel = *(agent_accel_iter++);
+
+    const utils::Expected<std::tuple<size_t, CarlaTransform, double, double, double>>
+      agent_tuple = nextAgentTuple(agent.id(), agent_accel, dt, agent_updates);
+    if (!agent_tuple) return utils::Expected<bool>::failure(agent_tuple.error());
+    updated_tuples.push_back(*agent_tuple);
+    //std::printf("agent %lu accel: %f\n", agent.id(), agent_accel);
+  }
 
-  //std::printf("average ttc cost: %f\n", average_ttc_cost);
-  //std::printf("average brake cost: %f\n", average_brake_cost);
-  //std::printf("\n");
+  // Update the snapshot.
+  if (!snapshot_.updateTraffic(updated_tuples)) {
+    //std::printf("Collision detected in the simulation.\n");
+    return utils::Expected<bool>(false);
+  }
 
-  cost = average_ttc_cost + average_brake_cost;
-  if (path.laneChangeType() != VehiclePath::LaneChangeType::KeepLane)
-    cost += 1.0;
+  //std::cout << snapshot_.string("end simulation snapshot:\n");
+
+  // TODO: Accumulate the cost.
+  rollout.ttc_cost += ttcCost();
+  rollout.brake_cost += accelCost();
+  ++rollout.steps;
+
+  //std::printf("ttc cost: %f\n", ttcCost());
+  //std::printf("brake cost: %f\n", accelCost());
+
+  // Tick the time.
+  time += dt;
+
+  // Stop if the cost is guaranteed to exceed the bound. Every following
+  // step, except the last one, takes \c default_dt. The mean cost is
+  // therefore at least what it is if all of the (at most) remaining steps
+  // cost \c minStepCost().
+  if (time < max_time && dt >= default_dt) {
+    const double remaining_steps = std::ceil((max_time-time)/default_dt) + 1.0;
+    const double min_cost =
+      (rollout.ttc_cost+rollout.brake_cost+minStepCost()*remaining_steps) /
+      (static_cast<double>(rollout.steps)+remaining_steps) + rollout.lane_change_cost;
+    cost_lower_bound_ = std::max(cost_lower_bound_, min_cost);
+    if (rollout.cost_bound && min_cost > *(rollout.cost_bound)) {
+      rollout.cost = std::numeric_limits<double>::infinity();
+      return utils::Expected<bool>(true);
+    }
+  }
 
-  return true;
+  return boost::none;
 }
 
 } // End namespace planner.
@@ -14,6 +14,11 @@
 
 #pragma once
 
+#include <vector>
+#include <string>
+#include <tuple>
+#include <limits>
+#include <unordered_map>
 #include <boost/smart_ptr.hpp>
 #include <boost/core/noncopyable.hpp>
 #include <boost/optional.hpp>
@@ -23,7 +28,9 @@
 
 #include <router/common/router.h>
 #include <router/loop_router/loop_router.h>
+#include <planner/common/lane_graph.h>
 #include <planner/common/vehicle_path.h>
+#include <planner/common/expected.h>
 #include <planner/common/snapshot.h>
 
 namespace planner {
@@ -60,6 +67,17 @@ protected:
   /// Fast waypoint map.
   boost::shared_ptr<utils::FastWaypointMap> fast_map_ = nullptr;
 
+  /// Whether the agents are propagated with their lane coordinates,
+  /// see \c frenetAgentTuple().
+  bool frenet_agents_ = false;
+
+  /// Lane coordinates of the agents on the lane graph of the traffic lattice.
+  std::unordered_map<size_t, utils::LaneGraph::Coordinate> agent_coordinates_;
+
+  /// The largest lower bound of the final cost found during the last simulation.
+  /// See \c costLowerBound().
+  double cost_lower_bound_ = -std::numeric_limits<double>::infinity();
+
 public:
 
   TrafficSimulator(const Snapshot& snapshot,
@@ -84,6 +102,21 @@ public:
   const boost::shared_ptr<const router::Router> router() const { return router_; }
   boost::shared_ptr<router::Router>& router() { return router_; }
 
+  /// Whether the agents are propagated with their lane coordinates.
+  const bool frenetAgents() const { return frenet_agents_; }
+  bool& frenetAgents() { return frenet_agents_; }
+
+  /**
+   * \brief The largest lower bound of the final cost found during the last simulation.
+   *
+   * The lower bound is checked after every simulation step except the last
+   * one, and before the simulation terminates for whatever reason. A
+   * simulation with a cost bound smaller than this value would have stopped
+   * early. This allows a simulation done without a bound to tell whether a
+   * bound, only known afterwards, would have stopped it.
+   */
+  const double costLowerBound() const { return cost_lower_bound_; }
+
   /**
    * \brief Simulate the traffic.
    *
@@ -96,28 +129,213 @@ public:
    * the output \c time and \c cost are invalid. Once the function returns false,
    * the object should not be used anymore.
    *
+   * If \c cost_bound is given, the simulation is stopped as soon as the
+   * final cost is guaranteed to be greater than the bound, see \c minStepCost().
+   * In which case, \c cost is set to infinity, and the snapshot should not
+   * be used.
+   *
    * \param[in] path The path to be executed by the ego vehicle.
    * \param[in] default_dt The default simulation time step.
    * \param[in] max_time The maximum duration to simulate.
    * \param[out] time The actual simulation duration.
    * \param[out] cost The accumulated cost during the simulation.
+   * \param[in] cost_bound The upper bound of the cost of interest.
    * \return false If collision detected during the simulation.
    */
   virtual const bool simulate(
       const ContinuousPath& path, const double default_dt, const double max_time,
-      double& time, double& cost);
+      double& time, double& cost,
+      const boost::optional<double>& cost_bound = boost::none);
+
+  /**
+   * \brief Simulate the traffic, reporting expected failures without exceptions.
+   *
+   * Same with \c simulate(), except that an agent which cannot be moved
+   * forward on the map is returned as a failure instead of thrown as an
+   * exception. Such failures are expected while evaluating many candidate
+   * paths, and are much cheaper to be handled this way.
+   *
+   * \return false If collision detected during the simulation, or the
+   *         failure if an agent cannot be updated.
+   */
+  utils::Expected<bool> trySimulate(
+      const ContinuousPath& path, const double default_dt, const double max_time,
+      double& time, double& cost,
+      const boost::optional<double>& cost_bound = boost::none);
+
+  /**
+   * \brief Simulate the traffic with a number of simulators in lockstep.
+   *
+   * All simulators are moved forward by one step before any of them takes
+   * the next one. An agent in the same state in more than one simulator is
+   * only moved forward once within a step, and the update is shared by the
+   * other simulators. An agent is moved forward by a simulator itself only
+   * if it is in a different state, or it has been removed from the snapshot
+   * of the simulator. Therefore, the lockstep saves time only if the agents
+   * do not react to the ego, e.g. if the agents keep constant accelerations.
+   *
+   * The outputs are the same with calling \c trySimulate() of the
+   * simulators one by one.
+   *
+   * \param[in] simulators The simulators, with ego following the same path.
+   * \param[in] path The path to be executed by the ego vehicle.
+   * \param[in] default_dt The default simulation time step.
+   * \param[in] max_time The maximum duration to simulate.
+   * \param[out] times The actual simulation durations.
+   * \param[out] costs The accumulated costs during the simulations.
+   * \param[out] warnings The error messages of the simulators which throw,
+   *             empty for the others. The outputs of such simulators are failures.
+   * \return The outputs of the simulators, see \c trySimulate().
+   */
+  static std::vector<utils::Expected<bool>> trySimulateLockstep(
+      const std::vector<boost::shared_ptr<TrafficSimulator>>& simulators,
+      const ContinuousPath& path, const double default_dt, const double max_time,
+      std::vector<double>& times, std::vector<double>& costs,
+      std::vector<std::string>& warnings);
 
 protected:
 
+  /// The state of a simulation in progress, see \c step().
+  struct Rollout {
+    /// The path to be executed by the ego vehicle.
+    const ContinuousPath& path;
+    /// The default simulation time step.
+    double default_dt;
+    /// The maximum duration to simulate.
+    double max_time;
+    /// The upper bound of the cost of interest.
+    boost::optional<double> cost_bound;
+
+    /// The simulated duration.
+    double time = 0.0;
+    /// The actual simulation time step of the last step.
+    double dt;
+    /// The distance that ego has travelled on the path.
+    double ego_distance = 0.0;
+    /// The accumulated cost, only set when the simulation terminates.
+    double cost = 0.0;
+
+    /// The costs of the steps accumulated for the running means.
+    double ttc_cost = 0.0;
+    double brake_cost = 0.0;
+    size_t steps = 0;
+
+    /// The cost added for lane changes.
+    double lane_change_cost;
+
+    Rollout(const ContinuousPath& path,
+            const double default_dt,
+            const double max_time,
+            const boost::optional<double>& cost_bound) :
+      path(path),
+      default_dt(default_dt),
+      max_time(max_time),
+      cost_bound(cost_bound),
+      dt(default_dt),
+      lane_change_cost(
+          path.laneChangeType() != VehiclePath::LaneChangeType::KeepLane ? 1.0 : 0.0) {}
+  };
+
+  /**
+   * \brief AgentUpdate stores how an agent is moved forward within a step,
+   *        so that the update can be shared by the simulators in lockstep.
+   */
+  struct AgentUpdate {
+    /// The state of the agent before the update.
+    double x, y, z;
+    double speed;
+    double accel;
+    double dt;
+    boost::optional<utils::LaneGraph::Coordinate> coordinate;
+
+    /// The updated agent, or the failure.
+    boost::optional<utils::Expected<std::tuple<size_t, CarlaTransform, double, double, double>>> tuple;
+    /// The lane coordinate of the agent after the update.
+    boost::optional<utils::LaneGraph::Coordinate> next_coordinate;
+
+    /// Check if the agent starts from the same state as the other update.
+    bool sameStart(const AgentUpdate& other) const {
+      if (x != other.x || y != other.y || z != other.z) return false;
+      if (speed != other.speed || accel != other.accel || dt != other.dt) return false;
+      if (static_cast<bool>(coordinate) != static_cast<bool>(other.coordinate)) return false;
+      if (coordinate && (coordinate->lane != other.coordinate->lane ||
+                         coordinate->s    != other.coordinate->s)) return false;
+      return true;
+    }
+  };
+
+  /**
+   * \brief Simulate the traffic forward by one step.
+   *
+   * \param[in,out] rollout The state of the simulation.
+   * \param[in,out] agent_updates The agent updates within the step shared
+   *                by the simulators in lockstep, \c nullptr if not in lockstep.
+   * \return \c boost::none if the simulation continues. Otherwise, the output
+   *         of the simulation, see \c trySimulate().
+   */
+  boost::optional<utils::Expected<bool>> step(
+      Rollout& rollout,
+      std::unordered_map<size_t, AgentUpdate>* agent_updates = nullptr);
+
+  /**
+   * \brief Move an agent forward by a time step.
+   *
+   * The update in \c agent_updates is used if the agent starts from the same
+   * state. Otherwise, the agent is moved with \c frenetAgentTuple() or
+   * \c updatedAgentTuple(), and the update is added to \c agent_updates.
+   */
+  utils::Expected<std::tuple<size_t, CarlaTransform, double, double, double>>
+    nextAgentTuple(const size_t id, const double accel, const double dt,
+                   std::unordered_map<size_t, AgentUpdate>* agent_updates);
+
   /// Compute the acceleration of the ego vehicle given the current traffic scenario.
   virtual const double egoAcceleration() const = 0;
 
   /// Compute the acceleration of the agent vehicle given the current traffic scenario.
   virtual const double agentAcceleration(const size_t agent) const = 0;
 
-  virtual const std::tuple<size_t, CarlaTransform, double, double, double>
+  /**
+   * \brief Compute the accelerations of all agents given the current traffic scenario.
+   *
+   * By default, \c agentAcceleration() is called for each of the agents.
+   * Simulators may override this to compute the accelerations in a batch.
+   *
+   * \return The accelerations in the same order as \c snapshot_.agents().
+   */
+  virtual std::vector<double> agentAccelerations() const;
+
+  /**
+   * \brief Update an agent on the map.
+   *
+   * The waypoint on the route is preferred. If there is none, the
+   * agent is leaving the route and the successor waypoint with the
+   * least yaw difference is used.
+   *
+   * \return The updated agent, or the failure if no next waypoint is found.
+   */
+  virtual utils::Expected<std::tuple<size_t, CarlaTransform, double, double, double>>
     updatedAgentTuple(const size_t id, const double accel, const double dt) const;
 
+  /**
+   * \brief Update an agent with its lane coordinate.
+   *
+   * An agent is represented by its lane and distance (s) on the lane graph
+   * of the traffic lattice. The agent is matched onto the graph at the
+   * first update, moving it forward afterwards is mostly an addition on s.
+   * The transform of the agent is taken from the waypoint closest to the
+   * updated coordinate, instead of matching the agent onto the map again.
+   *
+   * \param[in] id The ID of the agent.
+   * \param[in] accel The acceleration of the agent.
+   * \param[in] dt The simulation time step.
+   * \return The updated agent, or \c boost::none if the agent cannot be
+   *         found on the lane graph, is leaving the graph, or is moving
+   *         backwards. In which case,
+   *         \c updatedAgentTuple() should be used instead.
+   */
+  boost::optional<std::tuple<size_t, CarlaTransform, double, double, double>>
+    frenetAgentTuple(const size_t id, const double accel, const double dt);
+
   /// Compute the ttc cost based on the input ttc.
   virtual const double ttcCost(const double ttc) const;
 
@@ -130,6 +348,16 @@ protected:
   /// Compute the accel cost based on the accel of the vehicles in the snapshot.
   virtual const double accelCost() const;
 
+  /**
+   * \brief The lower bound of the cost of a simulation step,
+   *        i.e. \c ttcCost() + \c accelCost().
+   *
+   * The bound is used to terminate a simulation early once its cost is
+   * guaranteed to exceed the given upper bound. Simulators which override
+   * the cost functions should override this accordingly.
+   */
+  virtual const double minStepCost() const { return 0.0; }
+
   /**
    * \brief This function is used to determine how much longer a vehicle can travel.
    *
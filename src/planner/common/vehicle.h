@@ -16,6 +16,7 @@
 
 #include <string>
 #include <boost/format.hpp>
+#include <boost/optional.hpp>
 #include <carla/client/Vehicle.h>
 #include <carla/geom/Transform.h>
 
@@ -56,6 +57,10 @@ protected:
   /// Compatible with carla.
   double curvature_ = 0.0;
 
+  /// The record index (in \c utils::FastWaypointMap) of the waypoint
+  /// last matched to the vehicle, used as the hint for the next match.
+  boost::optional<size_t> waypoint_hint_ = boost::none;
+
 public:
 
   Vehicle() = default;
@@ -124,6 +129,9 @@ public:
   const double curvature() const { return curvature_; }
   double& curvature() { return curvature_; }
 
+  const boost::optional<size_t> waypointHint() const { return waypoint_hint_; }
+  boost::optional<size_t>& waypointHint() { return waypoint_hint_; }
+
   /**
    * \brief Update the vehicle in the simulator server.
    *
@@ -98,65 +98,60 @@ ContinuousPath::ContinuousPath(
     const std::pair<CarlaTransform, double>& start,
     const std::pair<CarlaTransform, double>& end,
     const LaneChangeType& lane_change_type) :
-  Base  (lane_change_type),
-  start_(start),
-  end_  (end) {
-
-  // Convert the start and end to right handed coordinate system.
-  const NonHolonomicPath::State start_state = carlaTransformToPathState(start_);
-  const NonHolonomicPath::State end_state = carlaTransformToPathState(end_);
-  const bool success = path_.optimizePath(start_state, end_state);
-
-  if (!success) {
-    std::string error_msg("ContinuousPath::ContinuousPath(): path optimization diverges.\n");
-    std::string start_transform_msg = (boost::format(
-        "start transform x:%1% y:%2% yaw:%3% curvature:%4%\n")
-        % start_.first.location.x
-        % start_.first.location.y
-        % start_.first.rotation.yaw
-        % start_.second).str();
-    std::string end_transform_msg = (boost::format(
-        "end transform x:%1% y:%2% yaw:%3% curvature:%4%\n")
-        % end_.first.location.x
-        % end_.first.location.y
-        % end_.first.rotation.yaw
-        % end_.second).str();
-    throw std::runtime_error(error_msg +
-        start_transform_msg + start_state.string("start state ") +
-        end_transform_msg + end_state.string("end state "));
-  }
+  ContinuousPath(start, end, lane_change_type, Unoptimized()) {
+  if (!optimizePath()) throwDivergence();
   return;
 }
 
 ContinuousPath::ContinuousPath(const DiscretePath& discrete_path) :
-  Base  (discrete_path.laneChangeType()),
-  start_(discrete_path.startTransform()),
-  end_  (discrete_path.endTransform()) {
+  ContinuousPath(discrete_path.startTransform(),
+                 discrete_path.endTransform(),
+                 discrete_path.laneChangeType(),
+                 Unoptimized()) {
+  if (!optimizePath()) throwDivergence();
+  return;
+}
+
+utils::Expected<ContinuousPath> ContinuousPath::create(
+    const std::pair<CarlaTransform, double>& start,
+    const std::pair<CarlaTransform, double>& end,
+    const LaneChangeType& lane_change_type) {
 
+  ContinuousPath path(start, end, lane_change_type, Unoptimized());
+  if (!path.optimizePath()) {
+    return utils::Expected<ContinuousPath>::failure(
+        "ContinuousPath::create(): path optimization diverges.\n");
+  }
+  return path;
+}
+
+bool ContinuousPath::optimizePath() {
   // Convert the start and end to right handed coordinate system.
   const NonHolonomicPath::State start_state = carlaTransformToPathState(start_);
   const NonHolonomicPath::State end_state = carlaTransformToPathState(end_);
-  const bool success = path_.optimizePath(start_state, end_state);
+  return path_.optimizePath(start_state, end_state);
+}
 
-  if (!success) {
-    std::string error_msg("ContinuousPath::ContinuousPath(): path optimization diverges.\n");
-    std::string start_transform_msg = (boost::format(
-        "start transform x:%1% y:%2% yaw:%3% curvature:%4%\n")
-        % start_.first.location.x
-        % start_.first.location.y
-        % start_.first.rotation.yaw
-        % start_.second).str();
-    std::string end_transform_msg = (boost::format(
-        "end transform x:%1% y:%2% yaw:%3% curvature:%4%\n")
-        % end_.first.location.x
-        % end_.first.location.y
-        % end_.first.rotation.yaw
-        % end_.second).str();
-    throw std::runtime_error(error_msg +
-        start_transform_msg + start_state.string("start state ") +
-        end_transform_msg + end_state.string("end state "));
-  }
-  return;
+void ContinuousPath::throwDivergence() const {
+  const NonHolonomicPath::State start_state = carlaTransformToPathState(start_);
+  const NonHolonomicPath::State end_state = carlaTransformToPathState(end_);
+
+  std::string error_msg("ContinuousPath::ContinuousPath(): path optimization diverges.\n");
+  std::string start_transform_msg = (boost::format(
+      "start transform x:%1% y:%2% yaw:%3% curvature:%4%\n")
+      % start_.first.location.x
+      % start_.first.location.y
+      % start_.first.rotation.yaw
+      % start_.second).str();
+  std::string end_transform_msg = (boost::format(
+      "end transform x:%1% y:%2% yaw:%3% curvature:%4%\n")
+      % end_.first.location.x
+      % end_.first.location.y
+      % end_.first.rotation.yaw
+      % end_.second).str();
+  throw std::runtime_error(error_msg +
+      start_transform_msg + start_state.string("start state ") +
+      end_transform_msg + end_state.string("end state "));
 }
 
 const std::pair<ContinuousPath::CarlaTransform, double>
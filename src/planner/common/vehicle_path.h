@@ -20,6 +20,7 @@
 #include <carla/geom/Transform.h>
 
 #include <planner/common/kn_path_gen.h>
+#include <planner/common/expected.h>
 
 namespace planner {
 
@@ -117,6 +118,18 @@ public:
 
   virtual ~ContinuousPath() {}
 
+  /**
+   * \brief Create a path between the given start and end.
+   *
+   * Same with the constructor, except that the failure of the path
+   * optimization is returned instead of thrown as an exception.
+   * Planners try many paths, some of which are expected to fail.
+   */
+  static utils::Expected<ContinuousPath> create(
+      const std::pair<CarlaTransform, double>& start,
+      const std::pair<CarlaTransform, double>& end,
+      const LaneChangeType& lane_change_type);
+
   virtual const std::pair<CarlaTransform, double>
     startTransform() const override { return start_; }
 
@@ -130,6 +143,26 @@ public:
 
   std::string string(const std::string& prefix="") const;
 
+protected:
+
+  /// Tag of the constructor leaving the path unoptimized.
+  struct Unoptimized {};
+
+  ContinuousPath(const std::pair<CarlaTransform, double>& start,
+                 const std::pair<CarlaTransform, double>& end,
+                 const LaneChangeType& lane_change_type,
+                 Unoptimized) :
+    Base  (lane_change_type),
+    start_(start),
+    end_  (end) {}
+
+  /// Optimize the path between \c start_ and \c end_.
+  /// \return False if the optimization diverges.
+  bool optimizePath();
+
+  /// Throw the exception for a diverging path optimization.
+  void throwDivergence() const;
+
 }; // End class ContinuousPath.
 
 /**
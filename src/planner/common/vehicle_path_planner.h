@@ -14,12 +14,15 @@
 
 #pragma once
 
+#include <chrono>
 #include <boost/smart_ptr.hpp>
+#include <boost/optional.hpp>
 #include <carla/client/Map.h>
 
 #include <planner/common/snapshot.h>
 #include <planner/common/fast_waypoint_map.h>
 #include <planner/common/vehicle_path.h>
+#include <planner/common/task_pool.h>
 
 namespace planner {
 
@@ -40,6 +43,24 @@ protected:
   /// Fast waypoint map.
   boost::shared_ptr<utils::FastWaypointMap> fast_map_ = nullptr;
 
+  /// Task pool used to evaluate path options concurrently.
+  /// The path options are evaluated serially if not set.
+  boost::shared_ptr<utils::TaskPool> task_pool_ = nullptr;
+
+  /// The wall-clock time budget (s) of a planning cycle.
+  /// The planner always completes the graph if not set.
+  boost::optional<double> time_budget_ = boost::none;
+
+  /// Whether the agents are propagated with their lane coordinates
+  /// in the traffic simulations, see \c TrafficSimulator::frenetAgents().
+  bool frenet_agents_ = false;
+
+  /// The deadline of the current planning cycle, see \c startPlanningCycle().
+  boost::optional<std::chrono::steady_clock::time_point> deadline_ = boost::none;
+
+  /// The ratio of the spatial horizon covered by the last planning cycle.
+  double horizon_coverage_ = 0.0;
+
 public:
 
   /**
@@ -68,6 +89,34 @@ public:
   boost::shared_ptr<utils::FastWaypointMap>&
     fastWaypointMap() { return fast_map_; }
 
+  /// Get the task pool.
+  const boost::shared_ptr<const utils::TaskPool>
+    taskPool() const { return task_pool_; }
+
+  /// Get or set the task pool.
+  boost::shared_ptr<utils::TaskPool>& taskPool() { return task_pool_; }
+
+  /// Get the time budget of a planning cycle.
+  const boost::optional<double> timeBudget() const { return time_budget_; }
+
+  /// Get or set the time budget of a planning cycle.
+  boost::optional<double>& timeBudget() { return time_budget_; }
+
+  /// Get whether the agents are propagated with their lane coordinates.
+  const bool frenetAgents() const { return frenet_agents_; }
+
+  /// Get or set whether the agents are propagated with their lane coordinates.
+  bool& frenetAgents() { return frenet_agents_; }
+
+  /**
+   * \brief Get the ratio of the spatial horizon covered by the last planning cycle.
+   *
+   * The ratio is less than 1 if the planning cycle is stopped by the time
+   * budget before the graph reaches the spatial horizon, or the spatial
+   * horizon cannot be reached at all, e.g. all options are blocked.
+   */
+  const double horizonCoverage() const { return horizon_coverage_; }
+
   /**
    * \brief The main interface of the path planner.
    *
@@ -88,6 +137,25 @@ public:
     path = planPath(target, snapshot);
     return;
   }
+
+protected:
+
+  /// Start a planning cycle, setting the deadline according to the time budget.
+  void startPlanningCycle() {
+    if (time_budget_) {
+      deadline_ = std::chrono::steady_clock::now() +
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(*time_budget_));
+    } else {
+      deadline_ = boost::none;
+    }
+    return;
+  }
+
+  /// Check whether the deadline of the current planning cycle has passed.
+  const bool deadlinePassed() const {
+    return deadline_ && std::chrono::steady_clock::now() >= *deadline_;
+  }
 };
 
 } // End namespace planner.
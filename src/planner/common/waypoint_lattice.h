@@ -30,11 +30,9 @@ namespace planner {
  * form the WaypointLattice class template.
  *
  * \note The copy constructor of this class performs a shallow copy,
- *       i.e. only the shared and weak pointers are copied. This makes
- *       sense since the class copy constructor won't know which piece
- *       of memory the pointers should point to. In case one would like
- *       to redirect the pointers in the class to other objects, use
- *       the accessor interfaces.
+ *       i.e. the carla waypoint is shared, and the neighbor indices
+ *       are copied as they are. The indices are only meaningful
+ *       within the arena holding the node.
  */
 class WaypointNode : public LatticeNode<WaypointNode> {
 
@@ -72,7 +70,7 @@ public:
         % this->waypoint_->GetTransform().rotation.yaw
         % this->waypoint_->GetRoadId()
         % this->waypoint_->GetLaneId()).str();
-    std::string distance_msg = (boost::format("node distance: %1%\n") % this->distance_).str();
+    std::string distance_msg = (boost::format("node distance: %1%\n") % this->distance()).str();
     return prefix + waypoint_msg + distance_msg;
     // TODO: Add the info for neighbor waypoints as well.
   }
@@ -12,7 +12,11 @@
  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <cmath>
 #include <list>
+#include <limits>
+#include <unordered_set>
+#include <algorithm>
 #include <planner/idm_lattice_planner/idm_lattice_planner.h>
 
 namespace planner {
@@ -69,6 +73,36 @@ const double IDMTrafficSimulator::agentAcceleration(const size_t agent) const {
   return accel;
 }
 
+std::vector<double> IDMTrafficSimulator::agentAccelerations() const {
+
+  // Collect the states of all agents and their lead vehicles, so that
+  // the accelerations are computed with a single batch call.
+  const size_t num = snapshot_.agents().size();
+  std::vector<double> ego_v(num), ego_v0(num), lead_v(num), s(num);
+
+  size_t i = 0;
+  for (const auto& item : snapshot_.agents()) {
+    const Vehicle& agent = item.second;
+    ego_v[i] = agent.speed();
+    ego_v0[i] = agent.policySpeed();
+
+    boost::optional<std::pair<size_t, double>> lead =
+      snapshot_.trafficLattice()->front(agent.id());
+    if (lead) {
+      lead_v[i] = snapshot_.vehicle(lead->first).speed();
+      s[i] = lead->second;
+    } else {
+      lead_v[i] = std::numeric_limits<double>::quiet_NaN();
+      s[i] = std::numeric_limits<double>::quiet_NaN();
+    }
+    ++i;
+  }
+
+  std::vector<double> accels(num);
+  idm_->idmBatch(num, ego_v.data(), ego_v0.data(), lead_v.data(), s.data(), accels.data());
+  return accels;
+}
+
 void Station::updateOptimalParent() {
 
   // Set the \c optimal_parent_ to an existing parent. It does not
@@ -250,6 +284,10 @@ DiscretePath IDMLatticePlanner::planPath(
     throw std::runtime_error(error_msg + id_msg);
   }
 
+  // Start the planning cycle, the deadline of which is set if there is
+  // a time budget.
+  startPlanningCycle();
+
   // Update the waypoint lattice.
   updateWaypointLattice(snapshot);
 
@@ -275,6 +313,7 @@ DiscretePath IDMLatticePlanner::planPath(
 
   // Construct the station graph.
   constructStationGraph(station_queue);
+  updateHorizonCoverage();
 
   // Select the optimal path sequence from the station graph.
   std::list<ContinuousPath> optimal_path_seq;
@@ -286,6 +325,8 @@ DiscretePath IDMLatticePlanner::planPath(
 
   // Update the cached next station.
   cached_next_station_ = *(++optimal_station_seq.begin());
+  cached_next_node_generation_ =
+    cached_next_station_.lock()->node().lock()->generation();
 
   return optimal_path;
 }
@@ -325,7 +366,7 @@ void IDMLatticePlanner::updateWaypointLattice(const Snapshot& snapshot) {
     boost::shared_ptr<CarlaWaypoint> ego_waypoint =
       fast_map_->waypoint(snapshot.ego().transform().location);
     waypoint_lattice_ = boost::make_shared<WaypointLattice>(
-        ego_waypoint, spatial_horizon_+30.0, 1.0, router_);
+        ego_waypoint, spatial_horizon_+30.0, 1.0, router_, fast_map_->laneGraph(router_));
     return;
   }
 
@@ -382,6 +423,13 @@ std::deque<boost::shared_ptr<Station>>
   // Read the immedinate next waypoint node to be reached.
   boost::shared_ptr<const WaypointNode> next_node =
     cached_next_station_.lock()->node().lock();
+  // The node is kept from the last planning cycle. It should still be on
+  // the waypoint lattice, which is not shifted before the next station is reached.
+  if (!waypoint_lattice_->hasNode(next_node, cached_next_node_generation_)) {
+    throw std::runtime_error(
+        "IDMLatticePlanner::pruneStationGraph(): "
+        "the node of the next station is removed from the waypoint lattice.\n");
+  }
   const double distance_to_next_node =
     next_node->distance() - new_root->node().lock()->distance();
 
@@ -437,44 +485,91 @@ void IDMLatticePlanner::constructStationGraph(
 
   //std::printf("constructStationGraph(): \n");
 
-  auto addStationToTableAndQueue = [this, &station_queue](
-      const boost::shared_ptr<Station>& station,
-      const boost::shared_ptr<const WaypointNode>& node)->void{
-    if ((!station) || (!node)) return;
-
-    if (node_to_station_table_.count(station->id()) == 0) {
-      node_to_station_table_[station->id()] = station;
-      if (station->id() == node->id()) station_queue.push_back(station);
-    }
+  BestFirstQueue<Station> frontier;
+  auto priority = [this](const boost::shared_ptr<Station>& station)->double{
+    return expansionPriority(station);
   };
 
-  while (!station_queue.empty()) {
-    boost::shared_ptr<Station> station = station_queue.front();
-    station_queue.pop_front();
-
-    // Try to connect to the front node.
-    boost::shared_ptr<const WaypointNode> front_node =
-      waypoint_lattice_->front(station->node().lock()->waypoint(), 50.0);
-    boost::shared_ptr<Station> front_station =
-      connectStationToFrontNode(station, front_node);
-
-    addStationToTableAndQueue(front_station, front_node);
-
-    // Try to connect to the left front node.
-    boost::shared_ptr<const WaypointNode> left_front_node =
-      waypoint_lattice_->frontLeft(station->node().lock()->waypoint(), 50.0);
-    boost::shared_ptr<Station> left_front_station =
-      connectStationToLeftFrontNode(station, left_front_node);
-
-    addStationToTableAndQueue(left_front_station, left_front_node);
+  for (const boost::shared_ptr<Station>& station : station_queue)
+    frontier.push(station, priority(station));
+  station_queue.clear();
+
+  // The smallest cost from root to the terminals which are known so far.
+  double incumbent_cost = std::numeric_limits<double>::infinity();
+
+  // The stations are expanded in the A* order, until the deadline if there
+  // is one, as long as there is already a path in the graph, i.e. the root
+  // has a child. Since the stage costs are non-negative and the cost-to-go
+  // bound never decreases along an option, the cost-to-come of a station
+  // cannot be improved once it is popped.
+  while (!root_.lock()->hasChild() || !deadlinePassed()) {
+
+    // With the task pool, the options of the best stations in the queue are
+    // simulated together, without the cost bounds, which depend on the
+    // stations created by the options merged before. \c connectEdge()
+    // checks whether the bounds would have stopped the simulations, so that
+    // the graph is the same either way.
+    const std::vector<boost::shared_ptr<Station>> stations =
+      frontier.top(task_pool_ ? task_pool_->threads() : 1);
+    if (stations.empty()) break;
+
+    std::vector<std::vector<Edge>> station_edges;
+    std::vector<Edge*> edges;
+    for (const boost::shared_ptr<Station>& station : stations)
+      station_edges.push_back(stationEdges(station));
+    for (std::vector<Edge>& station_edge : station_edges)
+      for (Edge& edge : station_edge) edges.push_back(&edge);
+
+    if (task_pool_) {
+      task_pool_->parallelFor(edges.size(), [this, &edges](const size_t i)->void{
+          evaluateEdge(*(edges[i]), false);
+        });
+    }
 
-    // Try to connect to the right front node.
-    boost::shared_ptr<const WaypointNode> right_front_node =
-      waypoint_lattice_->frontRight(station->node().lock()->waypoint(), 50.0);
-    boost::shared_ptr<Station> right_front_station =
-      connectStationToRightFrontNode(station, right_front_node);
+    // The stations are expanded one by one as long as each is still the next
+    // one to be popped, and is not updated by the options merged before,
+    // which would invalidate the simulations from it. Otherwise, the rest of
+    // the stations are left in the queue to be simulated again.
+    std::unordered_set<const Station*> updated_stations;
+    bool incumbent_reached = false;
+
+    for (size_t i = 0; i < stations.size(); ++i) {
+      const boost::shared_ptr<Station>& station = stations[i];
+      if (i > 0) {
+        if (root_.lock()->hasChild() && deadlinePassed()) break;
+        if (updated_stations.count(station.get()) != 0) break;
+        if (frontier.top(1).front() != station) break;
+      }
+      frontier.pop();
+
+      // Neither this station nor the ones left in the queue can lead to a
+      // terminal better than the incumbent. They are left as terminals, whose
+      // costs are no less than their priorities.
+      if (priority(station) > incumbent_cost) {
+        incumbent_reached = true;
+        break;
+      }
+
+      for (Edge& edge : station_edges[i]) {
+        if (!task_pool_) evaluateEdge(edge, true);
+        boost::shared_ptr<Station> next_station = connectEdge(edge);
+        if (!next_station) continue;
+        updated_stations.insert(next_station.get());
+
+        if (node_to_station_table_.count(next_station->id()) == 0)
+          node_to_station_table_[next_station->id()] = next_station;
+
+        // The station is pushed again if its cost-to-come is improved.
+        if (next_station->id() == edge.target_node->id())
+          frontier.push(next_station, priority(next_station));
+      }
+
+      // The station is a terminal whose cost will not change any more.
+      if (station->hasParent() && !station->hasChild())
+        incumbent_cost = std::min(incumbent_cost, costFromRootToTerminal(station));
+    }
 
-    addStationToTableAndQueue(right_front_station, right_front_node);
+    if (incumbent_reached) break;
   }
 
   //std::printf("station #: %lu\n", node_to_station_table_.size());
@@ -487,255 +582,297 @@ void IDMLatticePlanner::constructStationGraph(
   return;
 }
 
-boost::shared_ptr<Station> IDMLatticePlanner::connectStationToFrontNode(
-    const boost::shared_ptr<Station>& station,
-    const boost::shared_ptr<const WaypointNode>& target_node) {
+std::vector<IDMLatticePlanner::Edge> IDMLatticePlanner::stationEdges(
+    const boost::shared_ptr<Station>& station) const {
 
-  //std::printf("connectStationToFrontNode(): \n");
+  std::vector<Edge> edges;
+  // Try to connect to the front node.
+  edges.emplace_back(
+      station,
+      waypoint_lattice_->front(station->node().lock()->waypoint(), 50.0),
+      ContinuousPath::LaneChangeType::KeepLane);
+  // Try to connect to the left front node.
+  edges.emplace_back(
+      station,
+      waypoint_lattice_->frontLeft(station->node().lock()->waypoint(), 50.0),
+      ContinuousPath::LaneChangeType::LeftLaneChange);
+  // Try to connect to the right front node.
+  edges.emplace_back(
+      station,
+      waypoint_lattice_->frontRight(station->node().lock()->waypoint(), 50.0),
+      ContinuousPath::LaneChangeType::RightLaneChange);
+  return edges;
+}
 
-  // Return directly if the target node does not exist.
-  if (!target_node) return nullptr;
+const double IDMLatticePlanner::expansionPriority(
+    const boost::shared_ptr<Station>& station) const {
+  // The root is always expanded first.
+  if (!station->hasParent()) return 0.0;
+  return station->costToCome() + costToGoBound(station);
+}
 
-  // Plan a path between the node at the current station to the target node.
-  //std::printf("Compute Kelly-Nagy path.\n");
-  boost::shared_ptr<ContinuousPath> path = nullptr;
-  try {
-    path = boost::make_shared<ContinuousPath>(
-        std::make_pair(station->snapshot().ego().transform(),
-                       station->snapshot().ego().curvature()),
-        std::make_pair(target_node->waypoint()->GetTransform(),
-                       target_node->curvature(map_)),
-        ContinuousPath::LaneChangeType::KeepLane);
-  } catch (std::exception& e) {
-    // If for whatever reason, the path cannot be created, the station
-    // cannot be created either.
-    std::printf("%s", e.what());
-    return nullptr;
-  }
+const double IDMLatticePlanner::costToGoBound(
+    const boost::shared_ptr<Station>& station) const {
 
-  // Now, simulate the traffic forward with ego following the created path.
-  //std::printf("Simulate the traffic.\n");
-  IDMTrafficSimulator simulator(station->snapshot(), map_, fast_map_);
-  double simulation_time = 0.0; double stage_cost = 0.0;
-  try {
-    const bool no_collision = simulator.simulate(
-        *path, sim_time_step_, 5.0, simulation_time, stage_cost);
-    // There a collision is detected in the simulation, this option is ignored.
-    if (!no_collision) return nullptr;
-  } catch(std::exception& e) {
-    std::printf("IDMLatticePlanner::connectStationToFrontNode(): WARNING\n"
-                "%s", e.what());
-    return nullptr;
-  }
+  // The station is a terminal if no option can be created from it.
+  bool has_target_node = false;
+  for (const Edge& edge : stationEdges(station))
+    if (edge.target_node) has_target_node = true;
 
-  // Either create a new station or used the one has been already created.
-  //std::printf("Create child station.\n");
-  boost::shared_ptr<Station> next_station = boost::make_shared<Station>(
-      simulator.snapshot(), waypoint_lattice_, fast_map_);
-  if (node_to_station_table_.count(next_station->id()) != 0)
-    next_station = node_to_station_table_[next_station->id()];
+  if (!has_target_node)
+    return terminalSpeedCost(station) + terminalDistanceCost(station);
 
-  // Set the child station of the parent station.
-  //std::printf("Update the child station of the input station.\n");
-  station->updateFrontChild(*path, stage_cost, next_station);
+  // Otherwise, the speed of a terminal may reach the policy speed, while the
+  // distance of a terminal is at most the largest distance reachable with
+  // the 50m options within the waypoint lattice.
+  double lattice_distance = 0.0;
+  for (const auto& exit : waypoint_lattice_->latticeExits())
+    lattice_distance = std::max(lattice_distance, exit->distance());
 
-  // Set the parent station of the child station.
-  //std::printf("Update the parent station of the new station.\n");
-  if (station->hasParent()) {
-    next_station->updateBackParent(
-        simulator.snapshot(), station->costToCome()+stage_cost, station);
-  } else {
-    next_station->updateBackParent(
-        simulator.snapshot(), stage_cost, station);
-  }
+  const double station_distance = station->node().lock()->distance();
+  const double reachable_distance = station_distance + 50.0 * std::floor(
+      (lattice_distance - station_distance +
+       waypoint_lattice_->longitudinalResolution()) / 50.0);
 
-  return next_station;
+  return terminalDistanceCost(
+      reachable_distance - root_.lock()->node().lock()->distance());
 }
 
-boost::shared_ptr<Station> IDMLatticePlanner::connectStationToLeftFrontNode(
-    const boost::shared_ptr<Station>& station,
-    const boost::shared_ptr<const WaypointNode>& target_node) {
+const double IDMLatticePlanner::spatialHorizon() const {
 
-  //std::printf("connectStationToLeftFrontNode(): \n");
-
-  // Return directly if the target node does not exisit.
-  if (!target_node) return nullptr;
-
-  // Return directly if the target node is already very close to the station.
-  // It is not reasonable to change lane with this short distance.
-  if (target_node->distance()-station->node().lock()->distance() < 20.0)
-    return nullptr;
+  // Find the current spatial planning horizon.
+  boost::shared_ptr<const Station> root_child;
+  if (root_.lock()->hasFrontChild())
+    root_child = std::get<2>(*(root_.lock()->frontChild())).lock();
+  else if (root_.lock()->hasLeftChild())
+    root_child = std::get<2>(*(root_.lock()->leftChild())).lock();
+  else if (root_.lock()->hasRightChild())
+    root_child = std::get<2>(*(root_.lock()->rightChild())).lock();
 
-  // If the ego is on the right of the lane center, connecting to the
-  // left lane is forbidden.
-  if (utils::distanceToLaneCenter(
-        station->snapshot().ego().transform().location,
-        station->node().lock()->waypoint()) > 0.5)
-    return nullptr;
+  // The root is not expanded, e.g. all options are blocked or the deadline
+  // passes before the first expansion.
+  if (!root_child) return spatial_horizon_;
 
-  // Check the left front and left back vehicles.
-  //
-  // If there are vehicles at the left front or left back of the ego,
-  // meanwhile those vehicles has non-positive distance to the ego, we will
-  // ignore this path option.
-  //
-  // TODO: Should we increase the margin of the check?
-  boost::optional<std::pair<size_t, double>> left_front =
-    station->snapshot().trafficLattice()->leftFront(station->snapshot().ego().id());
-  boost::optional<std::pair<size_t, double>> left_back =
-    station->snapshot().trafficLattice()->leftBack(station->snapshot().ego().id());
+  return spatial_horizon_ - 50.0 +
+         root_child->node()->distance() -
+         root_.lock()->node().lock()->distance();
+}
 
-  if (left_front && left_front->second <= 0.0) return nullptr;
-  if (left_back  && left_back->second  <= 0.0) return nullptr;
+void IDMLatticePlanner::updateHorizonCoverage() {
 
-  // Plan a path between the node at the current station to the target node.
-  //std::printf("Compute Kelly-Nagy path.\n");
-  boost::shared_ptr<ContinuousPath> path = nullptr;
-  try {
-    path = boost::make_shared<ContinuousPath>(
-        std::make_pair(station->snapshot().ego().transform(),
-                       station->snapshot().ego().curvature()),
-        std::make_pair(target_node->waypoint()->GetTransform(),
-                       target_node->curvature(map_)),
-        ContinuousPath::LaneChangeType::LeftLaneChange);
-  } catch (const std::exception& e) {
-    // If for whatever reason, the path cannot be created,
-    // just ignore this option.
-    std::printf("%s", e.what());
-    return nullptr;
+  // Nothing is covered if the root has no children.
+  if (!root_.lock()->hasChild()) {
+    horizon_coverage_ = 0.0;
+    return;
   }
 
-  // Now, simulate the traffic forward with ego following the created path.
-  //std::printf("Simulate the traffic.\n");
-  IDMTrafficSimulator simulator(station->snapshot(), map_, fast_map_);
-  double simulation_time = 0.0; double stage_cost = 0.0;
-  try {
-    const bool no_collision = simulator.simulate(
-        *path, sim_time_step_, 5.0, simulation_time, stage_cost);
-    // There a collision is detected in the simulation, this option is ignored.
-    if (!no_collision) return nullptr;
-  } catch (std::exception& e) {
-    std::printf("IDMLatticePlanner::connectStationToLeftFrontNode(): WARNING\n"
-                "%s", e.what());
-    return nullptr;
+  double max_distance = 0.0;
+  for (const auto& item : node_to_station_table_) {
+    const double distance = item.second->node().lock()->distance() -
+                            root_.lock()->node().lock()->distance();
+    max_distance = std::max(max_distance, distance);
   }
 
-  // Either create a new station or used the one has been already created.
-  //std::printf("Create child station.\n");
-  boost::shared_ptr<Station> next_station = boost::make_shared<Station>(
-      simulator.snapshot(), waypoint_lattice_, fast_map_);
-  if (node_to_station_table_.count(next_station->id()) != 0)
-    next_station = node_to_station_table_[next_station->id()];
+  horizon_coverage_ = std::min(max_distance/spatialHorizon(), 1.0);
+  return;
+}
 
-  // Set the child station of the parent station.
-  //std::printf("Update the child station of the input station.\n");
-  station->updateLeftChild(*path, stage_cost, next_station);
+boost::optional<double> IDMLatticePlanner::stageCostBound(
+    const boost::shared_ptr<Station>& station,
+    const boost::shared_ptr<const WaypointNode>& target_node,
+    const ContinuousPath& path,
+    const double max_accel,
+    const double max_time) const {
 
-  // Set the parent station of the child station.
-  //std::printf("Update the parent station of the new station.\n");
-  if (station->hasParent()) {
-    next_station->updateRightParent(
-        simulator.snapshot(), station->costToCome()+stage_cost, station);
-  } else {
-    next_station->updateRightParent(
-        simulator.snapshot(), stage_cost, station);
-  }
+  // There is nothing to compare with if the target station is not created yet.
+  std::unordered_map<size_t, boost::shared_ptr<Station>>::const_iterator iter =
+    node_to_station_table_.find(target_node->id());
+  if (iter == node_to_station_table_.end()) return boost::none;
+  if (!(iter->second->hasParent())) return boost::none;
 
-  return next_station;
-}
+  // The ego cannot reach the end of the path even with the maximum acceleration.
+  const double ego_speed = station->snapshot().ego().speed();
+  if (ego_speed*max_time + 0.5*max_accel*max_time*max_time < path.range())
+    return boost::none;
 
-boost::shared_ptr<Station> IDMLatticePlanner::connectStationToRightFrontNode(
-    const boost::shared_ptr<Station>& station,
-    const boost::shared_ptr<const WaypointNode>& target_node) {
+  if (station->hasParent())
+    return iter->second->costToCome() - station->costToCome();
+  else
+    return iter->second->costToCome();
+}
 
-  //std::printf("connectStationToRightFrontNode(): \n");
+void IDMLatticePlanner::evaluateEdge(Edge& edge, const bool bounded) const {
 
-  // Return directly if the target node does not exisit.
-  if (!target_node) return nullptr;
+  const boost::shared_ptr<Station>& station = edge.station;
+  const boost::shared_ptr<const WaypointNode>& target_node = edge.target_node;
 
-  // Return directly if the target node is already very close to the station.
-  // It is not reasonable to change lane with this short distance.
-  if (target_node->distance()-station->node().lock()->distance() < 20.0)
-    return nullptr;
+  // Return directly if the target node does not exist.
+  if (!target_node) return;
 
-  // If the ego is on the left of the lane center, connecting to the
-  // right lane is forbidden.
-  if (utils::distanceToLaneCenter(
-        station->snapshot().ego().transform().location,
-        station->node().lock()->waypoint()) < -0.5)
-    return nullptr;
+  if (edge.lane_change_type != ContinuousPath::LaneChangeType::KeepLane) {
+    const bool left = edge.lane_change_type == ContinuousPath::LaneChangeType::LeftLaneChange;
 
-  // Check the right front and right back vehicles.
-  //
-  // If there are vehicles at the right front or right back of the ego,
-  // meanwhile those vehicles has non-positive distance to the ego, we will
-  // ignore this path option.
-  //
-  // TODO: Should we increase the margin of the check?
-  boost::optional<std::pair<size_t, double>> right_front =
-    station->snapshot().trafficLattice()->rightFront(station->snapshot().ego().id());
-  boost::optional<std::pair<size_t, double>> right_back =
-    station->snapshot().trafficLattice()->rightBack(station->snapshot().ego().id());
+    // Return directly if the target node is already very close to the station.
+    // It is not reasonable to change lane with this short distance.
+    if (target_node->distance()-station->node().lock()->distance() < 20.0)
+      return;
 
-  if (right_front && right_front->second <= 0.0) return nullptr;
-  if (right_back  && right_back->second  <= 0.0) return nullptr;
+    // If the ego is on the right (left) of the lane center, connecting to the
+    // left (right) lane is forbidden.
+    const double distance_to_lane_center = utils::distanceToLaneCenter(
+        station->snapshot().ego().transform().location,
+        station->node().lock()->waypoint());
+    if (left && distance_to_lane_center > 0.5) return;
+    if (!left && distance_to_lane_center < -0.5) return;
+
+    // Check the front and back vehicles on the target lane.
+    //
+    // If there are vehicles at the front or back of the ego on the target lane,
+    // meanwhile those vehicles has non-positive distance to the ego, we will
+    // ignore this path option.
+    //
+    // TODO: Should we increase the margin of the check?
+    const size_t ego = station->snapshot().ego().id();
+    boost::shared_ptr<const TrafficLattice> traffic_lattice =
+      station->snapshot().trafficLattice();
+    boost::optional<std::pair<size_t, double>> side_front =
+      left ? traffic_lattice->leftFront(ego) : traffic_lattice->rightFront(ego);
+    boost::optional<std::pair<size_t, double>> side_back =
+      left ? traffic_lattice->leftBack(ego) : traffic_lattice->rightBack(ego);
+
+    if (side_front && side_front->second <= 0.0) return;
+    if (side_back  && side_back->second  <= 0.0) return;
+  }
 
   // Plan a path between the node at the current station to the target node.
   //std::printf("Compute Kelly-Nagy path.\n");
-  boost::shared_ptr<ContinuousPath> path = nullptr;
-  try {
-    path = boost::make_shared<ContinuousPath>(
-        std::make_pair(station->snapshot().ego().transform(),
-                       station->snapshot().ego().curvature()),
-        std::make_pair(target_node->waypoint()->GetTransform(),
-                       target_node->curvature(map_)),
-        ContinuousPath::LaneChangeType::RightLaneChange);
-  } catch (std::exception& e) {
-    // If for whatever reason, the path cannot be created,
-    // just ignore this option.
-    std::printf("%s", e.what());
-    return nullptr;
-  }
+  utils::Expected<ContinuousPath> path = ContinuousPath::create(
+      std::make_pair(station->snapshot().ego().transform(),
+                     station->snapshot().ego().curvature()),
+      std::make_pair(target_node->waypoint()->GetTransform(),
+                     target_node->curvature(fast_map_)),
+      edge.lane_change_type);
+  // If for whatever reason, the path cannot be created,
+  // just ignore this option.
+  if (!path) return;
+  edge.path = std::move(*path);
 
-  // Now, simulate the traffic forward with the ego following the created path.
+  // Now, simulate the traffic forward with ego following the created path.
   //std::printf("Simulate the traffic.\n");
-  IDMTrafficSimulator simulator(station->snapshot(), map_, fast_map_);
-  double simulation_time = 0.0; double stage_cost = 0.0;
+  edge.simulator = boost::make_shared<IDMTrafficSimulator>(
+      station->snapshot(), map_, fast_map_);
+  edge.simulator->frenetAgents() = frenet_agents_;
+  boost::optional<double> cost_bound = boost::none;
+  if (bounded) {
+    cost_bound = stageCostBound(
+        station, target_node, *(edge.path), edge.simulator->idm()->maxAccel(), 5.0);
+  }
+
   try {
-    const bool no_collision = simulator.simulate(
-        *path, sim_time_step_, 5.0, simulation_time, stage_cost);
-    // There a collision is detected in the simulation, this option is ignored.
-    if (!no_collision) return nullptr;
+    const utils::Expected<bool> no_collision = edge.simulator->trySimulate(
+        *(edge.path), sim_time_step_, 5.0, edge.time, edge.cost, cost_bound);
+    // The simulation fails if an agent cannot be moved forward on the map.
+    edge.no_collision = no_collision && *no_collision;
   } catch (std::exception& e) {
-    std::printf("IDMLatticePlanner::connectStationToRightFrontNode(): WARNING\n"
-                "%s", e.what());
+    edge.warning = e.what();
+  }
+
+  return;
+}
+
+boost::shared_ptr<Station> IDMLatticePlanner::connectEdge(const Edge& edge) {
+
+  // The option is rejected before the simulation.
+  if (!edge.path) return nullptr;
+
+  const boost::shared_ptr<Station>& station = edge.station;
+  const ContinuousPath& path = *(edge.path);
+  const double stage_cost = edge.cost;
+
+  // The simulation is (or would have been) stopped early since the option
+  // cannot improve the station at the target node. The target station is
+  // still set as the child, but its parent is left as it is.
+  const boost::optional<double> cost_bound = stageCostBound(
+      station, edge.target_node, path, edge.simulator->idm()->maxAccel(), 5.0);
+  if (cost_bound && edge.simulator->costLowerBound() > *cost_bound) {
+    boost::shared_ptr<Station> next_station = node_to_station_table_[edge.target_node->id()];
+    const double inf = std::numeric_limits<double>::infinity();
+    switch (edge.lane_change_type) {
+      case ContinuousPath::LaneChangeType::LeftLaneChange:
+        station->updateLeftChild(path, inf, next_station); break;
+      case ContinuousPath::LaneChangeType::RightLaneChange:
+        station->updateRightChild(path, inf, next_station); break;
+      default:
+        station->updateFrontChild(path, inf, next_station); break;
+    }
+    return next_station;
+  }
+
+  if (!edge.warning.empty()) {
+    std::printf("IDMLatticePlanner::connectEdge(): WARNING\n"
+                "%s", edge.warning.c_str());
     return nullptr;
   }
 
+  // There a collision is detected in the simulation, this option is ignored.
+  if (!edge.no_collision) return nullptr;
+
   // Either create a new station or used the one has been already created.
   //std::printf("Create child station.\n");
+  const Snapshot& snapshot = edge.simulator->snapshot();
   boost::shared_ptr<Station> next_station = boost::make_shared<Station>(
-      simulator.snapshot(), waypoint_lattice_, fast_map_);
+      snapshot, waypoint_lattice_, fast_map_);
   if (node_to_station_table_.count(next_station->id()) != 0)
     next_station = node_to_station_table_[next_station->id()];
 
-  // Set the child station of the parent station.
+  // Set the child station of the parent station, and the parent station
+  // of the child station.
   //std::printf("Update the child station of the input station.\n");
-  station->updateRightChild(*path, stage_cost, next_station);
-
-  // Set the parent station of the child station.
-  //std::printf("Update the parent station of the new station.\n");
-  if (station->hasParent()) {
-    next_station->updateLeftParent(
-        simulator.snapshot(), station->costToCome()+stage_cost, station);
-  } else {
-    next_station->updateLeftParent(
-        simulator.snapshot(), stage_cost, station);
+  const double cost_to_come = station->hasParent() ?
+    station->costToCome()+stage_cost : stage_cost;
+
+  switch (edge.lane_change_type) {
+    case ContinuousPath::LaneChangeType::LeftLaneChange:
+      station->updateLeftChild(path, stage_cost, next_station);
+      next_station->updateRightParent(snapshot, cost_to_come, station);
+      break;
+    case ContinuousPath::LaneChangeType::RightLaneChange:
+      station->updateRightChild(path, stage_cost, next_station);
+      next_station->updateLeftParent(snapshot, cost_to_come, station);
+      break;
+    default:
+      station->updateFrontChild(path, stage_cost, next_station);
+      next_station->updateBackParent(snapshot, cost_to_come, station);
+      break;
   }
 
   return next_station;
 }
 
+boost::shared_ptr<Station> IDMLatticePlanner::connectStationToFrontNode(
+    const boost::shared_ptr<Station>& station,
+    const boost::shared_ptr<const WaypointNode>& target_node) {
+  Edge edge(station, target_node, ContinuousPath::LaneChangeType::KeepLane);
+  evaluateEdge(edge, true);
+  return connectEdge(edge);
+}
+
+boost::shared_ptr<Station> IDMLatticePlanner::connectStationToLeftFrontNode(
+    const boost::shared_ptr<Station>& station,
+    const boost::shared_ptr<const WaypointNode>& target_node) {
+  Edge edge(station, target_node, ContinuousPath::LaneChangeType::LeftLaneChange);
+  evaluateEdge(edge, true);
+  return connectEdge(edge);
+}
+
+boost::shared_ptr<Station> IDMLatticePlanner::connectStationToRightFrontNode(
+    const boost::shared_ptr<Station>& station,
+    const boost::shared_ptr<const WaypointNode>& target_node) {
+  Edge edge(station, target_node, ContinuousPath::LaneChangeType::RightLaneChange);
+  evaluateEdge(edge, true);
+  return connectEdge(edge);
+}
+
 const double IDMLatticePlanner::terminalSpeedCost(
     const boost::shared_ptr<Station>& station) const {
 
@@ -786,6 +923,13 @@ const double IDMLatticePlanner::terminalDistanceCost(
     throw std::runtime_error(error_msg + station->string());
   }
 
+  const double distance = station->node().lock()->distance() -
+                          root_.lock()->node().lock()->distance();
+  return terminalDistanceCost(distance);
+}
+
+const double IDMLatticePlanner::terminalDistanceCost(const double distance) const {
+
   static std::unordered_map<int, double> cost_map {
     {0, 20.0}, {1, 20.0}, {2, 20.0}, {3, 20.0}, {4, 20.0},
     {5, 20.0}, {6, 20.0}, {7, 20.0}, {8, 10.0},  {9, 5.0},
@@ -796,21 +940,7 @@ const double IDMLatticePlanner::terminalDistanceCost(
   //};
 
   // Find the current spatial planning horizon.
-  boost::shared_ptr<const Station> root_child;
-  if (root_.lock()->hasFrontChild())
-    root_child = std::get<2>(*(root_.lock()->frontChild())).lock();
-  else if (root_.lock()->hasLeftChild())
-    root_child = std::get<2>(*(root_.lock()->leftChild())).lock();
-  else if (root_.lock()->hasRightChild())
-    root_child = std::get<2>(*(root_.lock()->rightChild())).lock();
-
-  const double spatial_horizon =
-    spatial_horizon_ - 50.0 +
-    root_child->node()->distance() -
-    root_.lock()->node().lock()->distance();
-
-  const double distance = station->node().lock()->distance() -
-                          root_.lock()->node().lock()->distance();
+  const double spatial_horizon = spatialHorizon();
 
   const double distance_ratio = distance / spatial_horizon;
   //std::printf("station distance:%f spatial horizon:%f distance ratio: %f\n",
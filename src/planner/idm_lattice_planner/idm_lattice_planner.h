@@ -17,6 +17,7 @@
 #include <tuple>
 #include <deque>
 #include <string>
+#include <vector>
 #include <unordered_map>
 #include <boost/optional.hpp>
 #include <boost/core/noncopyable.hpp>
@@ -28,6 +29,7 @@
 #include <planner/common/vehicle_path.h>
 #include <planner/common/utils.h>
 #include <planner/common/vehicle_path_planner.h>
+#include <planner/common/best_first_queue.h>
 #include <planner/common/traffic_simulator.h>
 #include <planner/common/intelligent_driver_model.h>
 
@@ -72,6 +74,8 @@ protected:
 
   virtual const double agentAcceleration(const size_t agent) const override;
 
+  virtual std::vector<double> agentAccelerations() const override;
+
 }; // End class IDMTrafficSimulator.
 
 /**
@@ -153,8 +157,10 @@ public:
           const boost::shared_ptr<const WaypointLattice>& waypoint_lattice,
           const boost::shared_ptr<utils::FastWaypointMap>& fast_map) :
     snapshot_(snapshot) {
+    // The ego waypoint matched by the traffic lattice is a good hint.
+    boost::optional<size_t> hint = snapshot.ego().waypointHint();
     boost::shared_ptr<const WaypointNode> node = waypoint_lattice->closestNode(
-        fast_map->waypoint(snapshot.ego().transform().location),
+        fast_map->waypoint(snapshot.ego().transform().location, hint),
         waypoint_lattice->longitudinalResolution());
     if (!node) {
       std::string error_msg(
@@ -309,6 +315,9 @@ protected:
    */
   boost::weak_ptr<Station> cached_next_station_;
 
+  /// Generation of the node of \c cached_next_station_, see \c WaypointLattice::hasNode().
+  uint32_t cached_next_node_generation_ = 0;
+
 public:
 
   /// Constructor of the class.
@@ -360,9 +369,114 @@ protected:
   /// Prune/update the station graph of last step.
   std::deque<boost::shared_ptr<Station>> pruneStationGraph(const Snapshot& snapshot);
 
-  /// Construct the station graph.
+  /**
+   * \brief Construct the station graph.
+   *
+   * The stations are expanded in the ascending order of \c expansionPriority().
+   * The expansion stops once no station left can lead to a terminal better
+   * than the best one found so far, or the deadline of the planning cycle
+   * is reached.
+   */
   void constructStationGraph(std::deque<boost::shared_ptr<Station>>& station_queue);
 
+  /**
+   * \brief The upper bound of the stage cost for connecting a station to the target node.
+   *
+   * Connecting to the target node is of no use if the stage cost is
+   * greater than this bound, since the station already created at the
+   * target node has a lower cost-to-come. The bound is not available if
+   * there is no station at the target node yet, or if the ego may not reach
+   * the target node within \c max_time, in which case the simulation
+   * ends at a different station.
+   *
+   * \param[in] station The station to start from.
+   * \param[in] target_node The node to be connected.
+   * \param[in] path The path from the station to the target node.
+   * \param[in] max_accel The maximum acceleration of the ego.
+   * \param[in] max_time The maximum duration of the simulation.
+   */
+  boost::optional<double> stageCostBound(
+      const boost::shared_ptr<Station>& station,
+      const boost::shared_ptr<const WaypointNode>& target_node,
+      const ContinuousPath& path,
+      const double max_accel,
+      const double max_time) const;
+
+  /**
+   * \brief The priority of a station to be expanded in \c constructStationGraph(),
+   *        i.e. the cost-to-come plus \c costToGoBound().
+   */
+  const double expansionPriority(const boost::shared_ptr<Station>& station) const;
+
+  /**
+   * \brief A lower bound of the cost from a station to the terminals after it,
+   *        including the terminal costs.
+   *
+   * The bound is derived from \c terminalSpeedCost() and \c terminalDistanceCost().
+   * It never decreases along an option, so that the expansion in the
+   * order of \c expansionPriority() is A* with a consistent heuristic.
+   */
+  const double costToGoBound(const boost::shared_ptr<Station>& station) const;
+
+  /// Compute the spatial horizon of the current station graph.
+  const double spatialHorizon() const;
+
+  /// Update the ratio of the spatial horizon covered by the station graph.
+  void updateHorizonCoverage();
+
+  /**
+   * \brief Edge stores an option connecting a station to a target node,
+   *        together with the outcome of its evaluation.
+   */
+  struct Edge {
+    /// The station to start from.
+    boost::shared_ptr<Station> station;
+    /// The target node, which may not exist.
+    boost::shared_ptr<const WaypointNode> target_node;
+    /// The lane change type of the option.
+    ContinuousPath::LaneChangeType lane_change_type;
+
+    /// The path from the station to the target node, \c boost::none if
+    /// the option is rejected before the simulation.
+    boost::optional<ContinuousPath> path = boost::none;
+    /// The simulator holding the snapshot at the end of the simulation.
+    boost::shared_ptr<IDMTrafficSimulator> simulator = nullptr;
+    /// The outputs of the simulation.
+    double time = 0.0;
+    double cost = 0.0;
+    bool no_collision = false;
+    /// The error message if the simulation throws.
+    std::string warning;
+
+    Edge(const boost::shared_ptr<Station>& station,
+         const boost::shared_ptr<const WaypointNode>& target_node,
+         const ContinuousPath::LaneChangeType lane_change_type) :
+      station(station),
+      target_node(target_node),
+      lane_change_type(lane_change_type) {}
+  };
+
+  /**
+   * \brief Create the path and simulate the traffic for an option.
+   *
+   * The function does not modify the station graph, and can be called
+   * for different options concurrently if \c bounded is false.
+   *
+   * \param[in,out] edge The option to be evaluated.
+   * \param[in] bounded Whether the simulation is stopped early with the
+   *            bound from \c stageCostBound(), which reads the station table.
+   */
+  void evaluateEdge(Edge& edge, const bool bounded) const;
+
+  /// Create the options from a station to the front, left front, and right front nodes.
+  std::vector<Edge> stationEdges(const boost::shared_ptr<Station>& station) const;
+
+  /**
+   * \brief Merge an evaluated option into the station graph.
+   * \return The child station, or \c nullptr if the option is not available.
+   */
+  boost::shared_ptr<Station> connectEdge(const Edge& edge);
+
   boost::shared_ptr<Station> connectStationToFrontNode(
       const boost::shared_ptr<Station>& station,
       const boost::shared_ptr<const WaypointNode>& target_node);
@@ -379,6 +493,9 @@ protected:
   /// Compute the distance cost for a terminal station.
   const double terminalDistanceCost(const boost::shared_ptr<Station>& station) const;
 
+  /// Compute the distance cost for a terminal at the given distance from the root.
+  const double terminalDistanceCost(const double distance) const;
+
   /// Compute the cost from root to this terminal, including the terminal costs.
   const double costFromRootToTerminal(const boost::shared_ptr<Station>& terminal) const;
 
@@ -65,7 +65,7 @@ public:
                const boost::shared_ptr<router::Router>& router) :
     Base(map, fast_map),
     waypoint_lattice_(boost::make_shared<WaypointLattice>(
-          lattice_start, lattice_range, 5.0, router)),
+          lattice_start, lattice_range, 5.0, router, fast_map->laneGraph(router))),
     router_(router) {}
 
   /// Get the waypoint lattice maintained in the object.
@@ -150,10 +150,10 @@ public:
     //        However this can cause drifting of the vehile. Planning from the closest
     //        waypoint seems to be the easiest fix.
     const CarlaTransform current_transform = target_waypoint->GetTransform();
-    const double current_curvature = utils::curvatureAtWaypoint(target_waypoint, map_);
+    const double current_curvature = fast_map_->curvature(target_waypoint);
 
     const CarlaTransform reference_transform = front_waypoint->GetTransform();
-    const double reference_curvature = utils::curvatureAtWaypoint(front_waypoint, map_);
+    const double reference_curvature = fast_map_->curvature(front_waypoint);
 
     // Generate the path.
     return DiscretePath(
@@ -13,7 +13,10 @@
 */
 
 #include <set>
+#include <cmath>
 #include <list>
+#include <limits>
+#include <algorithm>
 #include <planner/common/utils.h>
 #include <planner/slc_lattice_planner/slc_lattice_planner.h>
 
@@ -71,6 +74,36 @@ const double SLCTrafficSimulator::agentAcceleration(const size_t agent) const {
   return accel;
 }
 
+std::vector<double> SLCTrafficSimulator::agentAccelerations() const {
+
+  // Collect the states of all agents and their lead vehicles, so that
+  // the accelerations are computed with a single batch call.
+  const size_t num = snapshot_.agents().size();
+  std::vector<double> ego_v(num), ego_v0(num), lead_v(num), s(num);
+
+  size_t i = 0;
+  for (const auto& item : snapshot_.agents()) {
+    const Vehicle& agent = item.second;
+    ego_v[i] = agent.speed();
+    ego_v0[i] = agent.policySpeed();
+
+    boost::optional<std::pair<size_t, double>> lead =
+      snapshot_.trafficLattice()->front(agent.id());
+    if (lead) {
+      lead_v[i] = snapshot_.vehicle(lead->first).speed();
+      s[i] = lead->second;
+    } else {
+      lead_v[i] = std::numeric_limits<double>::quiet_NaN();
+      s[i] = std::numeric_limits<double>::quiet_NaN();
+    }
+    ++i;
+  }
+
+  std::vector<double> accels(num);
+  idm_->idmBatch(num, ego_v.data(), ego_v0.data(), lead_v.data(), s.data(), accels.data());
+  return accels;
+}
+
 void Vertex::updateParent(
     const Snapshot& snapshot,
     const double cost_to_come,
@@ -256,6 +289,10 @@ DiscretePath SLCLatticePlanner::planPath(
     throw std::runtime_error(error_msg + id_msg);
   }
 
+  // Start the planning cycle, the deadline of which is set if there is
+  // a time budget.
+  startPlanningCycle();
+
   // Update the waypoint lattice.
   updateWaypointLattice(snapshot);
 
@@ -281,6 +318,7 @@ DiscretePath SLCLatticePlanner::planPath(
 
   // Construct the vertex graph.
   constructVertexGraph(vertex_queue);
+  updateHorizonCoverage();
 
   // Select the optimal path sequence from the vertex graph.
   std::list<ContinuousPath> optimal_path_seq;
@@ -292,6 +330,8 @@ DiscretePath SLCLatticePlanner::planPath(
 
   // Update the cached next vertex.
   cached_next_vertex_ = *(++optimal_vertex_seq.begin());
+  cached_next_node_generation_ =
+    cached_next_vertex_.lock()->node().lock()->generation();
 
   return optimal_path;
 }
@@ -331,7 +371,7 @@ void SLCLatticePlanner::updateWaypointLattice(const Snapshot& snapshot) {
     boost::shared_ptr<CarlaWaypoint> ego_waypoint =
       fast_map_->waypoint(snapshot.ego().transform().location);
     waypoint_lattice_ = boost::make_shared<WaypointLattice>(
-        ego_waypoint, spatial_horizon_+30.0, 1.0, router_);
+        ego_waypoint, spatial_horizon_+30.0, 1.0, router_, fast_map_->laneGraph(router_));
     return;
   }
 
@@ -388,6 +428,13 @@ std::deque<boost::shared_ptr<Vertex>>
   // Read the immedinate next waypoint node to be reached.
   boost::shared_ptr<const WaypointNode> next_node =
     cached_next_vertex_.lock()->node().lock();
+  // The node is kept from the last planning cycle. It should still be on
+  // the waypoint lattice, which is not shifted before the next vertex is reached.
+  if (!waypoint_lattice_->hasNode(next_node, cached_next_node_generation_)) {
+    throw std::runtime_error(
+        "SLCLatticePlanner::pruneVertexGraph(): "
+        "the node of the next vertex is removed from the waypoint lattice.\n");
+  }
   const double distance_to_next_node =
     next_node->distance() - new_root->node().lock()->distance();
 
@@ -443,280 +490,328 @@ void SLCLatticePlanner::constructVertexGraph(
 
   //std::printf("constructVertexGraph(): \n");
 
-  auto addVertexToGraphAndQueue = [this, &vertex_queue](
-      const boost::shared_ptr<Vertex>& vertex,
-      const boost::shared_ptr<const WaypointNode>& node)->void{
-    if ((!vertex) || (!node)) return;
-
-    all_vertices_.push_back(vertex);
-    if (vertex->node().lock()->id() == node->id())
-      vertex_queue.push_back(vertex);
+  BestFirstQueue<Vertex> frontier;
+  auto priority = [this](const boost::shared_ptr<Vertex>& vertex)->double{
+    return expansionPriority(vertex);
   };
 
-  while (!vertex_queue.empty()) {
-    boost::shared_ptr<Vertex> vertex = vertex_queue.front();
-    vertex_queue.pop_front();
-
-    // Try to connect to the front node.
-    boost::shared_ptr<const WaypointNode> front_node =
-      waypoint_lattice_->front(vertex->node().lock()->waypoint(), 50.0);
-    boost::shared_ptr<Vertex> front_vertex =
-      connectVertexToFrontNode(vertex, front_node);
-
-    addVertexToGraphAndQueue(front_vertex, front_node);
-
-    // Check if the vertex is on the same lane with the root.
-    // If not, no lane change options will be allowed further.
-    if (!(vertex->sameLaneWith(root_.lock()))) continue;
-
-    // Try to connect to the left front node.
-    boost::shared_ptr<const WaypointNode> left_front_node =
-      waypoint_lattice_->frontLeft(vertex->node().lock()->waypoint(), 50.0);
-    boost::shared_ptr<Vertex> left_front_vertex =
-      connectVertexToLeftFrontNode(vertex, left_front_node);
-
-    addVertexToGraphAndQueue(left_front_vertex, left_front_node);
+  for (const boost::shared_ptr<Vertex>& vertex : vertex_queue)
+    frontier.push(vertex, priority(vertex));
+  vertex_queue.clear();
+
+  // The smallest cost from root to the terminals which are known so far.
+  double incumbent_cost = std::numeric_limits<double>::infinity();
+
+  // The vertices are expanded in the A* order, until the deadline if there
+  // is one, as long as there is already a path in the graph, i.e. the root
+  // has a child. The vertex graph is a tree, so that the cost of a vertex
+  // never changes once it is created.
+  while (!root_.lock()->hasChild() || !deadlinePassed()) {
+
+    // With the task pool, the options of the best vertices in the queue
+    // are simulated together.
+    const std::vector<boost::shared_ptr<Vertex>> vertices =
+      frontier.top(task_pool_ ? task_pool_->threads() : 1);
+    if (vertices.empty()) break;
+
+    std::vector<std::vector<Edge>> vertex_edges;
+    std::vector<Edge*> edges;
+    for (const boost::shared_ptr<Vertex>& vertex : vertices)
+      vertex_edges.push_back(vertexEdges(vertex));
+    for (std::vector<Edge>& vertex_edge : vertex_edges)
+      for (Edge& edge : vertex_edge) edges.push_back(&edge);
+
+    if (task_pool_) {
+      task_pool_->parallelFor(edges.size(), [this, &edges](const size_t i)->void{
+          evaluateEdge(*(edges[i]));
+        });
+    } else {
+      for (Edge* edge : edges) evaluateEdge(*edge);
+    }
 
-    // Try to connect to the right front node.
-    boost::shared_ptr<const WaypointNode> right_front_node =
-      waypoint_lattice_->frontRight(vertex->node().lock()->waypoint(), 50.0);
-    boost::shared_ptr<Vertex> right_front_vertex =
-      connectVertexToRightFrontNode(vertex, right_front_node);
+    // The vertices are expanded one by one as long as each is still the
+    // next one to be popped. Otherwise, the rest of the vertices are left
+    // in the queue to be simulated again.
+    bool incumbent_reached = false;
+
+    for (size_t i = 0; i < vertices.size(); ++i) {
+      const boost::shared_ptr<Vertex>& vertex = vertices[i];
+      if (i > 0) {
+        if (root_.lock()->hasChild() && deadlinePassed()) break;
+        if (frontier.top(1).front() != vertex) break;
+      }
+      frontier.pop();
+
+      // Neither this vertex nor the ones left in the queue can lead to a
+      // terminal better than the incumbent. They are left as terminals, whose
+      // costs are no less than their priorities.
+      if (priority(vertex) > incumbent_cost) {
+        incumbent_reached = true;
+        break;
+      }
+
+      for (const Edge& edge : vertex_edges[i]) {
+        boost::shared_ptr<Vertex> next_vertex = connectEdge(edge);
+        if (!next_vertex) continue;
+
+        all_vertices_.push_back(next_vertex);
+        if (next_vertex->node().lock()->id() == edge.target_node->id()) {
+          frontier.push(next_vertex, priority(next_vertex));
+        } else {
+          // The vertex not reaching the target node is never expanded.
+          incumbent_cost = std::min(incumbent_cost, costFromRootToTerminal(next_vertex));
+        }
+      }
+
+      if (vertex->hasParent() && !vertex->hasChild())
+        incumbent_cost = std::min(incumbent_cost, costFromRootToTerminal(vertex));
+    }
 
-    addVertexToGraphAndQueue(right_front_vertex, right_front_node);
+    if (incumbent_reached) break;
   }
 
   return;
 }
 
-boost::shared_ptr<Vertex> SLCLatticePlanner::connectVertexToFrontNode(
-    const boost::shared_ptr<Vertex>& vertex,
-    const boost::shared_ptr<const WaypointNode>& target_node) {
+std::vector<SLCLatticePlanner::Edge> SLCLatticePlanner::vertexEdges(
+    const boost::shared_ptr<Vertex>& vertex) const {
 
-  //std::printf("connectVertexToFrontNode(): \n");
+  std::vector<Edge> edges;
+  // Try to connect to the front node.
+  edges.emplace_back(
+      vertex,
+      waypoint_lattice_->front(vertex->node().lock()->waypoint(), 50.0),
+      ContinuousPath::LaneChangeType::KeepLane);
+
+  // Check if the vertex is on the same lane with the root.
+  // If not, no lane change options will be allowed further.
+  if (!(vertex->sameLaneWith(root_.lock()))) return edges;
+
+  // Try to connect to the left front node.
+  edges.emplace_back(
+      vertex,
+      waypoint_lattice_->frontLeft(vertex->node().lock()->waypoint(), 50.0),
+      ContinuousPath::LaneChangeType::LeftLaneChange);
+  // Try to connect to the right front node.
+  edges.emplace_back(
+      vertex,
+      waypoint_lattice_->frontRight(vertex->node().lock()->waypoint(), 50.0),
+      ContinuousPath::LaneChangeType::RightLaneChange);
+  return edges;
+}
 
-  // Return directly if the target node does not exist.
-  if (!target_node) return nullptr;
+const double SLCLatticePlanner::expansionPriority(
+    const boost::shared_ptr<Vertex>& vertex) const {
+  // The root is always expanded first.
+  if (!vertex->hasParent()) return 0.0;
+  return vertex->costToCome() + costToGoBound(vertex);
+}
 
-  // Plan a path between the node at the current vertex to the target node.
-  //std::printf("Compute Kelly-Nagy path.\n");
-  boost::shared_ptr<ContinuousPath> path = nullptr;
-  try {
-    path = boost::make_shared<ContinuousPath>(
-        std::make_pair(vertex->snapshot().ego().transform(),
-                       vertex->snapshot().ego().curvature()),
-        std::make_pair(target_node->waypoint()->GetTransform(),
-                       target_node->curvature(map_)),
-        ContinuousPath::LaneChangeType::KeepLane);
-  } catch (std::exception& e) {
-    // If for whatever reason, the path cannot be created, the vertex
-    // cannot be created either.
-    std::printf("%s", e.what());
-    return nullptr;
-  }
+const double SLCLatticePlanner::costToGoBound(
+    const boost::shared_ptr<Vertex>& vertex) const {
 
-  // Now, simulate the traffic forward with ego following the created path.
-  //std::printf("Simulate the traffic.\n");
-  SLCTrafficSimulator simulator(vertex->snapshot(), map_, fast_map_);
-  double simulation_time = 0.0; double stage_cost = 0.0;
-  try {
-    const bool no_collision = simulator.simulate(
-        *path, sim_time_step_, 5.0, simulation_time, stage_cost);
-    // There a collision is detected in the simulation, this option is ignored.
-    if (!no_collision) return nullptr;
-  } catch(std::exception& e) {
-    std::printf("SLCLatticePlanner::connectVertexToFrontNode(): WARNING\n"
-                "%s", e.what());
-    return nullptr;
-  }
+  // The vertex is a terminal if no option can be created from it.
+  bool has_target_node = false;
+  for (const Edge& edge : vertexEdges(vertex))
+    if (edge.target_node) has_target_node = true;
 
-  // A new vertex should be created.
-  //std::printf("Create child vertex.\n");
-  boost::shared_ptr<Vertex> next_vertex = boost::make_shared<Vertex>(
-      simulator.snapshot(), waypoint_lattice_, fast_map_);
+  if (!has_target_node)
+    return terminalSpeedCost(vertex) + terminalDistanceCost(vertex);
 
-  // Set the child vertex of the parent vertex.
-  //std::printf("Update the child vertex of the input vertex.\n");
-  vertex->updateFrontChild(*path, stage_cost, next_vertex);
+  // Otherwise, the speed of a terminal may reach the policy speed, while the
+  // distance of a terminal is at most the largest distance reachable with
+  // the 50m options within the waypoint lattice.
+  double lattice_distance = 0.0;
+  for (const auto& exit : waypoint_lattice_->latticeExits())
+    lattice_distance = std::max(lattice_distance, exit->distance());
 
-  // Set the parent vertex of the child vertex.
-  //std::printf("Update the parent vertex of the new vertex.\n");
-  next_vertex->updateParent(
-      simulator.snapshot(), vertex->costToCome()+stage_cost, vertex);
+  const double vertex_distance = vertex->node().lock()->distance();
+  const double reachable_distance = vertex_distance + 50.0 * std::floor(
+      (lattice_distance - vertex_distance +
+       waypoint_lattice_->longitudinalResolution()) / 50.0);
 
-  return next_vertex;
+  return terminalDistanceCost(
+      reachable_distance - root_.lock()->node().lock()->distance());
 }
 
-boost::shared_ptr<Vertex> SLCLatticePlanner::connectVertexToLeftFrontNode(
-    const boost::shared_ptr<Vertex>& vertex,
-    const boost::shared_ptr<const WaypointNode>& target_node) {
-
-  //std::printf("connectVertexToLeftFrontNode(): \n");
+const double SLCLatticePlanner::spatialHorizon() const {
 
-  // Return directly if the target node does not exisit.
-  if (!target_node) return nullptr;
-
-  // Return directly if the target node is already very close to the vertex.
-  // It is not reasonable to change lane with this short distance.
-  if (target_node->distance()-vertex->node().lock()->distance() < 20.0)
-    return nullptr;
+  // Find the current spatial planning horizon.
+  boost::shared_ptr<const Vertex> root_child;
+  if (root_.lock()->hasFrontChild())
+    root_child = std::get<2>(*(root_.lock()->frontChild())).lock();
+  else if (root_.lock()->hasLeftChild())
+    root_child = std::get<2>(*(root_.lock()->leftChild())).lock();
+  else if (root_.lock()->hasRightChild())
+    root_child = std::get<2>(*(root_.lock()->rightChild())).lock();
 
-  // If the ego is on the right of the lane center, connecting to the
-  // left lane is forbidden.
-  if (utils::distanceToLaneCenter(
-        vertex->snapshot().ego().transform().location,
-        vertex->node().lock()->waypoint()) > 0.5)
-    return nullptr;
+  // The root is not expanded, e.g. all options are blocked or the deadline
+  // passes before the first expansion.
+  if (!root_child) return spatial_horizon_;
 
-  // Check the left front and left back vehicles.
-  //
-  // If there are vehicles at the left front or left back of the ego,
-  // and those vehicles has non-positive distance to the ego, we will
-  // ignore this path option.
-  //
-  // TODO: Should we increase the margin of the check?
-  boost::optional<std::pair<size_t, double>> left_front =
-    vertex->snapshot().trafficLattice()->leftFront(vertex->snapshot().ego().id());
-  boost::optional<std::pair<size_t, double>> left_back =
-    vertex->snapshot().trafficLattice()->leftBack(vertex->snapshot().ego().id());
+  return spatial_horizon_ - 50.0 +
+         root_child->node()->distance() -
+         root_.lock()->node().lock()->distance();
+}
 
-  if (left_front && left_front->second <= 0.0) return nullptr;
-  if (left_back  && left_back->second  <= 0.0) return nullptr;
+void SLCLatticePlanner::updateHorizonCoverage() {
 
-  // Plan a path between the node at the current vertex to the target node.
-  //std::printf("Compute Kelly-Nagy path.\n");
-  boost::shared_ptr<ContinuousPath> path = nullptr;
-  try {
-    path = boost::make_shared<ContinuousPath>(
-        std::make_pair(vertex->snapshot().ego().transform(),
-                       vertex->snapshot().ego().curvature()),
-        std::make_pair(target_node->waypoint()->GetTransform(),
-                       target_node->curvature(map_)),
-        ContinuousPath::LaneChangeType::LeftLaneChange);
-  } catch (const std::exception& e) {
-    // If for whatever reason, the path cannot be created,
-    // just ignore this option.
-    std::printf("%s", e.what());
-    return nullptr;
+  // Nothing is covered if the root has no children.
+  if (!root_.lock()->hasChild()) {
+    horizon_coverage_ = 0.0;
+    return;
   }
 
-  // Now, simulate the traffic forward with ego following the created path.
-  //std::printf("Simulate the traffic.\n");
-  SLCTrafficSimulator simulator(vertex->snapshot(), map_, fast_map_);
-  double simulation_time = 0.0; double stage_cost = 0.0;
-  try {
-    const bool no_collision = simulator.simulate(
-        *path, sim_time_step_, 5.0, simulation_time, stage_cost);
-    // There a collision is detected in the simulation, this option is ignored.
-    if (!no_collision) return nullptr;
-  } catch (std::exception& e) {
-    std::printf("SLCLatticePlanner::connectVertexToLeftFrontNode(): WARNING\n"
-                "%s", e.what());
-    return nullptr;
+  double max_distance = 0.0;
+  for (const boost::shared_ptr<Vertex>& vertex : all_vertices_) {
+    const double distance = vertex->node().lock()->distance() -
+                            root_.lock()->node().lock()->distance();
+    max_distance = std::max(max_distance, distance);
   }
 
-  // Create a new vertex.
-  //std::printf("Create child vertex.\n");
-  boost::shared_ptr<Vertex> next_vertex = boost::make_shared<Vertex>(
-      simulator.snapshot(), waypoint_lattice_, fast_map_);
-
-  // Set the child vertex of the parent vertex.
-  //std::printf("Update the child vertex of the input vertex.\n");
-  vertex->updateLeftChild(*path, stage_cost, next_vertex);
-
-  // Set the parent vertex of the child vertex.
-  //std::printf("Update the parent vertex of the new vertex.\n");
-  next_vertex->updateParent(
-      simulator.snapshot(), vertex->costToCome()+stage_cost, vertex);
-
-  return next_vertex;
+  horizon_coverage_ = std::min(max_distance/spatialHorizon(), 1.0);
+  return;
 }
 
-boost::shared_ptr<Vertex> SLCLatticePlanner::connectVertexToRightFrontNode(
-    const boost::shared_ptr<Vertex>& vertex,
-    const boost::shared_ptr<const WaypointNode>& target_node) {
-
-  //std::printf("connectVertexToRightFrontNode(): \n");
+void SLCLatticePlanner::evaluateEdge(Edge& edge) const {
 
-  // Return directly if the target node does not exisit.
-  if (!target_node) return nullptr;
+  const boost::shared_ptr<Vertex>& vertex = edge.vertex;
+  const boost::shared_ptr<const WaypointNode>& target_node = edge.target_node;
 
-  // Return directly if the target node is already very close to the vertex.
-  // It is not reasonable to change lane with this short distance.
-  if (target_node->distance()-vertex->node().lock()->distance() < 20.0)
-    return nullptr;
+  // Return directly if the target node does not exist.
+  if (!target_node) return;
 
-  // If the ego is on the left of the lane center, connecting to the
-  // right lane is forbidden.
-  if (utils::distanceToLaneCenter(
-        vertex->snapshot().ego().transform().location,
-        vertex->node().lock()->waypoint()) < -0.5)
-    return nullptr;
+  if (edge.lane_change_type != ContinuousPath::LaneChangeType::KeepLane) {
+    const bool left = edge.lane_change_type == ContinuousPath::LaneChangeType::LeftLaneChange;
 
-  // Check the right front and right back vehicles.
-  //
-  // If there are vehicles at the right front or right back of the ego,
-  // and those vehicles has non-positive distance to the ego, we will
-  // ignore this path option.
-  //
-  // TODO: Should we increase the margin of the check?
-  boost::optional<std::pair<size_t, double>> right_front =
-    vertex->snapshot().trafficLattice()->rightFront(vertex->snapshot().ego().id());
-  boost::optional<std::pair<size_t, double>> right_back =
-    vertex->snapshot().trafficLattice()->rightBack(vertex->snapshot().ego().id());
+    // Return directly if the target node is already very close to the vertex.
+    // It is not reasonable to change lane with this short distance.
+    if (target_node->distance()-vertex->node().lock()->distance() < 20.0)
+      return;
 
-  if (right_front && right_front->second <= 0.0) return nullptr;
-  if (right_back  && right_back->second  <= 0.0) return nullptr;
+    // If the ego is on the right (left) of the lane center, connecting to the
+    // left (right) lane is forbidden.
+    const double distance_to_lane_center = utils::distanceToLaneCenter(
+        vertex->snapshot().ego().transform().location,
+        vertex->node().lock()->waypoint());
+    if (left && distance_to_lane_center > 0.5) return;
+    if (!left && distance_to_lane_center < -0.5) return;
+
+    // Check the front and back vehicles on the target lane.
+    //
+    // If there are vehicles at the front or back of the ego on the target lane,
+    // and those vehicles has non-positive distance to the ego, we will
+    // ignore this path option.
+    //
+    // TODO: Should we increase the margin of the check?
+    const size_t ego = vertex->snapshot().ego().id();
+    boost::shared_ptr<const TrafficLattice> traffic_lattice =
+      vertex->snapshot().trafficLattice();
+    boost::optional<std::pair<size_t, double>> side_front =
+      left ? traffic_lattice->leftFront(ego) : traffic_lattice->rightFront(ego);
+    boost::optional<std::pair<size_t, double>> side_back =
+      left ? traffic_lattice->leftBack(ego) : traffic_lattice->rightBack(ego);
+
+    if (side_front && side_front->second <= 0.0) return;
+    if (side_back  && side_back->second  <= 0.0) return;
+  }
 
   // Plan a path between the node at the current vertex to the target node.
   //std::printf("Compute Kelly-Nagy path.\n");
-  boost::shared_ptr<ContinuousPath> path = nullptr;
-  try {
-    path = boost::make_shared<ContinuousPath>(
-        std::make_pair(vertex->snapshot().ego().transform(),
-                       vertex->snapshot().ego().curvature()),
-        std::make_pair(target_node->waypoint()->GetTransform(),
-                       target_node->curvature(map_)),
-        ContinuousPath::LaneChangeType::RightLaneChange);
-  } catch (std::exception& e) {
-    // If for whatever reason, the path cannot be created,
-    // just ignore this option.
-    std::printf("%s", e.what());
-    return nullptr;
-  }
+  utils::Expected<ContinuousPath> path = ContinuousPath::create(
+      std::make_pair(vertex->snapshot().ego().transform(),
+                     vertex->snapshot().ego().curvature()),
+      std::make_pair(target_node->waypoint()->GetTransform(),
+                     target_node->curvature(fast_map_)),
+      edge.lane_change_type);
+  // If for whatever reason, the path cannot be created,
+  // just ignore this option.
+  if (!path) return;
+  edge.path = std::move(*path);
 
-  // Now, simulate the traffic forward with the ego following the created path.
+  // Now, simulate the traffic forward with ego following the created path.
   //std::printf("Simulate the traffic.\n");
-  SLCTrafficSimulator simulator(vertex->snapshot(), map_, fast_map_);
-  double simulation_time = 0.0; double stage_cost = 0.0;
+  edge.simulator = boost::make_shared<SLCTrafficSimulator>(
+      vertex->snapshot(), map_, fast_map_);
+  edge.simulator->frenetAgents() = frenet_agents_;
   try {
-    const bool no_collision = simulator.simulate(
-        *path, sim_time_step_, 5.0, simulation_time, stage_cost);
-    // There a collision is detected in the simulation, this option is ignored.
-    if (!no_collision) return nullptr;
+    const utils::Expected<bool> no_collision = edge.simulator->trySimulate(
+        *(edge.path), sim_time_step_, 5.0, edge.time, edge.cost);
+    // The simulation fails if an agent cannot be moved forward on the map.
+    edge.no_collision = no_collision && *no_collision;
   } catch (std::exception& e) {
-    std::printf("SLCLatticePlanner::connectVertexToRightFrontNode(): WARNING\n"
-                "%s", e.what());
+    edge.warning = e.what();
+  }
+
+  return;
+}
+
+boost::shared_ptr<Vertex> SLCLatticePlanner::connectEdge(const Edge& edge) {
+
+  // The option is rejected before the simulation.
+  if (!edge.path) return nullptr;
+
+  if (!edge.warning.empty()) {
+    std::printf("SLCLatticePlanner::connectEdge(): WARNING\n"
+                "%s", edge.warning.c_str());
     return nullptr;
   }
 
-  // Create a new vertex.
+  // There a collision is detected in the simulation, this option is ignored.
+  if (!edge.no_collision) return nullptr;
+
+  const boost::shared_ptr<Vertex>& vertex = edge.vertex;
+  const ContinuousPath& path = *(edge.path);
+  const double stage_cost = edge.cost;
+
+  // A new vertex should be created.
   //std::printf("Create child vertex.\n");
+  const Snapshot& snapshot = edge.simulator->snapshot();
   boost::shared_ptr<Vertex> next_vertex = boost::make_shared<Vertex>(
-      simulator.snapshot(), waypoint_lattice_, fast_map_);
+      snapshot, waypoint_lattice_, fast_map_);
 
   // Set the child vertex of the parent vertex.
   //std::printf("Update the child vertex of the input vertex.\n");
-  vertex->updateRightChild(*path, stage_cost, next_vertex);
+  switch (edge.lane_change_type) {
+    case ContinuousPath::LaneChangeType::LeftLaneChange:
+      vertex->updateLeftChild(path, stage_cost, next_vertex); break;
+    case ContinuousPath::LaneChangeType::RightLaneChange:
+      vertex->updateRightChild(path, stage_cost, next_vertex); break;
+    default:
+      vertex->updateFrontChild(path, stage_cost, next_vertex); break;
+  }
 
   // Set the parent vertex of the child vertex.
   //std::printf("Update the parent vertex of the new vertex.\n");
-  next_vertex->updateParent(
-      simulator.snapshot(), vertex->costToCome()+stage_cost, vertex);
+  next_vertex->updateParent(snapshot, vertex->costToCome()+stage_cost, vertex);
 
   return next_vertex;
 }
 
+boost::shared_ptr<Vertex> SLCLatticePlanner::connectVertexToFrontNode(
+    const boost::shared_ptr<Vertex>& vertex,
+    const boost::shared_ptr<const WaypointNode>& target_node) {
+  Edge edge(vertex, target_node, ContinuousPath::LaneChangeType::KeepLane);
+  evaluateEdge(edge);
+  return connectEdge(edge);
+}
+
+boost::shared_ptr<Vertex> SLCLatticePlanner::connectVertexToLeftFrontNode(
+    const boost::shared_ptr<Vertex>& vertex,
+    const boost::shared_ptr<const WaypointNode>& target_node) {
+  Edge edge(vertex, target_node, ContinuousPath::LaneChangeType::LeftLaneChange);
+  evaluateEdge(edge);
+  return connectEdge(edge);
+}
+
+boost::shared_ptr<Vertex> SLCLatticePlanner::connectVertexToRightFrontNode(
+    const boost::shared_ptr<Vertex>& vertex,
+    const boost::shared_ptr<const WaypointNode>& target_node) {
+  Edge edge(vertex, target_node, ContinuousPath::LaneChangeType::RightLaneChange);
+  evaluateEdge(edge);
+  return connectEdge(edge);
+}
+
 const double SLCLatticePlanner::terminalSpeedCost(
     const boost::shared_ptr<Vertex>& vertex) const {
 
@@ -767,27 +862,20 @@ const double SLCLatticePlanner::terminalDistanceCost(
     throw std::runtime_error(error_msg + vertex->string());
   }
 
+  const double distance = vertex->node().lock()->distance() -
+                          root_.lock()->node().lock()->distance();
+  return terminalDistanceCost(distance);
+}
+
+const double SLCLatticePlanner::terminalDistanceCost(const double distance) const {
+
   static std::unordered_map<int, double> cost_map {
     {0, 20.0}, {1, 20.0}, {2, 20.0}, {3, 20.0}, {4, 20.0},
     {5, 20.0}, {6, 20.0}, {7, 20.0}, {8, 10.0},  {9, 5.0},
   };
 
   // Find the current spatial planning horizon.
-  boost::shared_ptr<const Vertex> root_child;
-  if (root_.lock()->hasFrontChild())
-    root_child = std::get<2>(*(root_.lock()->frontChild())).lock();
-  else if (root_.lock()->hasLeftChild())
-    root_child = std::get<2>(*(root_.lock()->leftChild())).lock();
-  else if (root_.lock()->hasRightChild())
-    root_child = std::get<2>(*(root_.lock()->rightChild())).lock();
-
-  const double spatial_horizon =
-    spatial_horizon_ - 50.0 +
-    root_child->node()->distance() -
-    root_.lock()->node().lock()->distance();
-
-  const double distance = vertex->node().lock()->distance() -
-                          root_.lock()->node().lock()->distance();
+  const double spatial_horizon = spatialHorizon();
 
   const double distance_ratio = distance / spatial_horizon;
   //std::printf("vertex distance:%f spatial horizon:%f distance ratio: %f\n",
@@ -17,6 +17,7 @@
 #include <tuple>
 #include <deque>
 #include <string>
+#include <vector>
 #include <unordered_map>
 #include <boost/optional.hpp>
 #include <boost/core/noncopyable.hpp>
@@ -28,6 +29,7 @@
 #include <planner/common/vehicle_path.h>
 #include <planner/common/utils.h>
 #include <planner/common/vehicle_path_planner.h>
+#include <planner/common/best_first_queue.h>
 #include <planner/common/traffic_simulator.h>
 #include <planner/common/intelligent_driver_model.h>
 
@@ -72,6 +74,8 @@ protected:
 
   virtual const double agentAcceleration(const size_t agent) const override;
 
+  virtual std::vector<double> agentAccelerations() const override;
+
 }; // End class IDMTrafficSimulator.
 
 /**
@@ -145,8 +149,10 @@ public:
          const boost::shared_ptr<const WaypointLattice>& waypoint_lattice,
          const boost::shared_ptr<utils::FastWaypointMap>& fast_map) :
     snapshot_(snapshot) {
+    // The ego waypoint matched by the traffic lattice is a good hint.
+    boost::optional<size_t> hint = snapshot.ego().waypointHint();
     boost::shared_ptr<const WaypointNode> node = waypoint_lattice->closestNode(
-        fast_map->waypoint(snapshot.ego().transform().location),
+        fast_map->waypoint(snapshot.ego().transform().location, hint),
         waypoint_lattice->longitudinalResolution());
     if (!node) {
       std::string error_msg(
@@ -272,6 +278,9 @@ protected:
    */
   boost::weak_ptr<Vertex> cached_next_vertex_;
 
+  /// Generation of the node of \c cached_next_vertex_, see \c WaypointLattice::hasNode().
+  uint32_t cached_next_node_generation_ = 0;
+
 public:
 
   /// Constructor of the class.
@@ -319,9 +328,87 @@ protected:
   /// Prune/update the vertex graph of last step.
   std::deque<boost::shared_ptr<Vertex>> pruneVertexGraph(const Snapshot& snapshot);
 
-  /// Construct the vertex graph.
+  /**
+   * \brief Construct the vertex graph.
+   *
+   * The vertices are expanded in the ascending order of \c expansionPriority().
+   * The expansion stops once no vertex left can lead to a terminal better
+   * than the best one found so far, or the deadline of the planning cycle
+   * is reached.
+   */
   void constructVertexGraph(std::deque<boost::shared_ptr<Vertex>>& vertex_queue);
 
+  /**
+   * \brief The priority of a vertex to be expanded in \c constructVertexGraph(),
+   *        i.e. the cost-to-come plus \c costToGoBound().
+   */
+  const double expansionPriority(const boost::shared_ptr<Vertex>& vertex) const;
+
+  /**
+   * \brief A lower bound of the cost from a vertex to the terminals after it,
+   *        including the terminal costs.
+   *
+   * The bound is derived from \c terminalSpeedCost() and \c terminalDistanceCost().
+   * It never decreases along an option, so that the expansion in the
+   * order of \c expansionPriority() is A* with a consistent heuristic.
+   */
+  const double costToGoBound(const boost::shared_ptr<Vertex>& vertex) const;
+
+  /// Compute the spatial horizon of the current vertex graph.
+  const double spatialHorizon() const;
+
+  /// Update the ratio of the spatial horizon covered by the vertex graph.
+  void updateHorizonCoverage();
+
+  /**
+   * \brief Edge stores an option connecting a vertex to a target node,
+   *        together with the outcome of its evaluation.
+   */
+  struct Edge {
+    /// The vertex to start from.
+    boost::shared_ptr<Vertex> vertex;
+    /// The target node, which may not exist.
+    boost::shared_ptr<const WaypointNode> target_node;
+    /// The lane change type of the option.
+    ContinuousPath::LaneChangeType lane_change_type;
+
+    /// The path from the vertex to the target node, \c boost::none if
+    /// the option is rejected before the simulation.
+    boost::optional<ContinuousPath> path = boost::none;
+    /// The simulator holding the snapshot at the end of the simulation.
+    boost::shared_ptr<SLCTrafficSimulator> simulator = nullptr;
+    /// The outputs of the simulation.
+    double time = 0.0;
+    double cost = 0.0;
+    bool no_collision = false;
+    /// The error message if the simulation throws.
+    std::string warning;
+
+    Edge(const boost::shared_ptr<Vertex>& vertex,
+         const boost::shared_ptr<const WaypointNode>& target_node,
+         const ContinuousPath::LaneChangeType lane_change_type) :
+      vertex(vertex),
+      target_node(target_node),
+      lane_change_type(lane_change_type) {}
+  };
+
+  /**
+   * \brief Create the path and simulate the traffic for an option.
+   *
+   * The function does not modify the vertex graph, and can be called
+   * for different options concurrently.
+   */
+  void evaluateEdge(Edge& edge) const;
+
+  /// Create the options from a vertex to the front, left front, and right front nodes.
+  std::vector<Edge> vertexEdges(const boost::shared_ptr<Vertex>& vertex) const;
+
+  /**
+   * \brief Merge an evaluated option into the vertex graph.
+   * \return The child vertex, or \c nullptr if the option is not available.
+   */
+  boost::shared_ptr<Vertex> connectEdge(const Edge& edge);
+
   boost::shared_ptr<Vertex> connectVertexToFrontNode(
       const boost::shared_ptr<Vertex>& vertex,
       const boost::shared_ptr<const WaypointNode>& target_node);
@@ -338,6 +425,9 @@ protected:
   /// Compute the distance cost for a terminal vertex.
   const double terminalDistanceCost(const boost::shared_ptr<Vertex>& vertex) const;
 
+  /// Compute the distance cost for a terminal at the given distance from the root.
+  const double terminalDistanceCost(const double distance) const;
+
   /// Compute the cost from root to this terminal, including the terminal costs.
   const double costFromRootToTerminal(const boost::shared_ptr<Vertex>& terminal) const;
 
@@ -13,6 +13,7 @@
 */
 
 #include <set>
+#include <algorithm>
 #include <planner/common/utils.h>
 #include <planner/spatiotemporal_lattice_planner/spatiotemporal_lattice_planner.h>
 
@@ -423,7 +424,7 @@ void SpatiotemporalLatticePlanner::updateWaypointLattice(const Snapshot& snapsho
     boost::shared_ptr<CarlaWaypoint> ego_waypoint =
       fast_map_->waypoint(snapshot.ego().transform().location);
     waypoint_lattice_ = boost::make_shared<WaypointLattice>(
-        ego_waypoint, spatial_horizon_+30.0, 1.0, router_);
+        ego_waypoint, spatial_horizon_+30.0, 1.0, router_, fast_map_->laneGraph(router_));
     return;
   }
 
@@ -462,6 +463,10 @@ std::list<std::pair<ContinuousPath, double>>
     throw std::runtime_error(error_msg + id_msg);
   }
 
+  // Start the planning cycle, the deadline of which is set if there is
+  // a time budget.
+  startPlanningCycle();
+
   // Update the waypoint lattice.
   updateWaypointLattice(snapshot);
 
@@ -481,6 +486,7 @@ std::list<std::pair<ContinuousPath, double>>
 
   // Construct the vertex graph.
   constructVertexGraph(vertex_queue);
+  updateHorizonCoverage();
 
   // Select the optimal trajectory sequence from the graph.
   std::list<std::pair<ContinuousPath, double>> optimal_traj_seq;
@@ -490,6 +496,8 @@ std::list<std::pair<ContinuousPath, double>>
   // Update the cached next vertex.
   //std::printf("optimal_vertex_seq size:%lu\n", optimal_vertex_seq.size());
   cached_next_vertex_ = *(++optimal_vertex_seq.begin());
+  cached_next_node_generation_ =
+    cached_next_vertex_.lock()->node().lock()->generation();
 
   return optimal_traj_seq;
 }
@@ -550,6 +558,13 @@ std::deque<boost::shared_ptr<Vertex>>
 
   // Find the immedidate waypoint nodes.
   boost::shared_ptr<const WaypointNode> next_node = cached_next_vertex_.lock()->node().lock();
+  // The node is kept from the last planning cycle. It should still be on
+  // the waypoint lattice, which is not shifted before the next vertex is reached.
+  if (!waypoint_lattice_->hasNode(next_node, cached_next_node_generation_)) {
+    throw std::runtime_error(
+        "SpatiotemporalLatticePlanner::pruneVertexGraph(): "
+        "the node of the next vertex is removed from the waypoint lattice.\n");
+  }
   const double distance_to_next_node =
     next_node->distance() - new_root->node().lock()->distance();
 
@@ -604,6 +619,12 @@ void SpatiotemporalLatticePlanner::constructVertexGraph(
 
   //std::printf("SpatiotemporalLatticePlanner::constructVertexGraph()\n");
 
+  // Expand the vertices best-first if the planning cycle has a deadline.
+  if (deadline_) {
+    constructVertexGraphBestFirst(vertex_queue);
+    return;
+  }
+
   auto addVerticesToTableAndQueue = [this, &vertex_queue](
       const std::vector<boost::shared_ptr<Vertex>>& vertices,
       const boost::shared_ptr<const WaypointNode>& node)->void{
@@ -625,219 +646,215 @@ void SpatiotemporalLatticePlanner::constructVertexGraph(
   };
 
   while (!vertex_queue.empty()) {
-    // Get the next vertex to expand.
-    boost::shared_ptr<Vertex> vertex = vertex_queue.front();
-    vertex_queue.pop_front();
-
-    // Try to connect to the front node.
-    boost::shared_ptr<const WaypointNode> front_node =
-      waypoint_lattice_->front(vertex->node().lock()->waypoint(), 50.0);
-    std::vector<boost::shared_ptr<Vertex>> front_vertices =
-      connectVertexToFrontNode(vertex, front_node);
-
-    addVerticesToTableAndQueue(front_vertices, front_node);
-
-    // Try to connect to the left front node.
-    boost::shared_ptr<const WaypointNode> left_front_node =
-      waypoint_lattice_->leftFront(vertex->node().lock()->waypoint(), 50.0);
-    std::vector<boost::shared_ptr<Vertex>> left_front_vertices =
-      connectVertexToLeftFrontNode(vertex, left_front_node);
-
-    addVerticesToTableAndQueue(left_front_vertices, left_front_node);
-
-    // Try to connect to the right front node.
-    boost::shared_ptr<const WaypointNode> right_front_node =
-      waypoint_lattice_->rightFront(vertex->node().lock()->waypoint(), 50.0);
-    std::vector<boost::shared_ptr<Vertex>> right_front_vertices =
-      connectVertexToRightFrontNode(vertex, right_front_node);
+    // The vertices in the queue are at the same distance on the lattice,
+    // since every option moves forward by the same distance. The options of
+    // these vertices never end at one of these vertices. Therefore, all
+    // options can be evaluated at once, and then merged into the graph in
+    // the same order as they were expanded one vertex at a time.
+    std::vector<Edge> edges;
+    edges.reserve(vertex_queue.size()*3);
+
+    for (const boost::shared_ptr<Vertex>& vertex : vertex_queue) {
+      const std::vector<Edge> vertex_edges = vertexEdges(vertex);
+      edges.insert(edges.end(), vertex_edges.begin(), vertex_edges.end());
+    }
+    vertex_queue.clear();
+
+    // With the task pool, the simulations which are not in the cache yet are
+    // run ahead of the merge. The cache is only read while the simulations
+    // are running. The results are added to the cache while merging.
+    if (task_pool_) {
+      task_pool_->parallelFor(edges.size(), [this, &edges](const size_t i)->void{
+          createEdgePath(edges[i]);
+          runSimulations(edges[i]);
+        });
+    } else {
+      for (Edge& edge : edges) createEdgePath(edge);
+    }
 
-    addVerticesToTableAndQueue(right_front_vertices, right_front_node);
+    for (Edge& edge : edges) {
+      if (!task_pool_) runSimulations(edge);
+      addVerticesToTableAndQueue(connectEdge(edge), edge.target_node);
+    }
   }
 
   return;
 }
 
-std::vector<boost::shared_ptr<Vertex>>
-  SpatiotemporalLatticePlanner::connectVertexToFrontNode(
-      const boost::shared_ptr<Vertex>& vertex,
-      const boost::shared_ptr<const WaypointNode>& target_node) {
-
-  //std::printf("SpatiotemporalLatticePlanner::connectVertexToFrontNode()\n");
+void SpatiotemporalLatticePlanner::createEdgePath(Edge& edge) const {
 
-  // Stores the expanded front children of the input vertex.
-  std::array<boost::shared_ptr<Vertex>, Vertex::kSpeedIntervalsPerStation_.size()>
-    front_children;
+  const boost::shared_ptr<Vertex>& vertex = edge.vertex;
+  const boost::shared_ptr<const WaypointNode>& target_node = edge.target_node;
 
   // Return directly if the target node does not exist.
-  if (!target_node) return std::vector<boost::shared_ptr<Vertex>>();
+  if (!target_node) return;
 
-  // Plan a path between the node at the current vertex to the target node.
-  boost::shared_ptr<ContinuousPath> path = nullptr;
-  try {
-    path = boost::make_shared<ContinuousPath>(
-        std::make_pair(vertex->snapshot().ego().transform(),
-                       vertex->snapshot().ego().curvature()),
-        std::make_pair(target_node->waypoint()->GetTransform(),
-                       target_node->curvature(map_)),
-        ContinuousPath::LaneChangeType::KeepLane);
-  } catch (std::exception& e) {
-    // If for whatever reason, the path cannot be created, the front vertices
-    // cannot be created either.
-    std::printf("%s", e.what());
-    return std::vector<boost::shared_ptr<Vertex>>();
-  }
+  if (edge.lane_change_type != ContinuousPath::LaneChangeType::KeepLane) {
+    const bool left = edge.lane_change_type == ContinuousPath::LaneChangeType::LeftLaneChange;
 
-  // Simulate the traffic forward with the ego applying different constant
-  // accelerations over the path created above.
-  for (const double accel : kAccelerationOptions_) {
-    // Prepare the start snapshot.
-    // The acceleration of the ego is set accordingly.
-    Snapshot snapshot = vertex->snapshot();
-    snapshot.ego().acceleration() = accel;
-
-    ConstAccelTrafficSimulator simulator(snapshot, map_, fast_map_);
-    double simulation_time = 0.0; double stage_cost = 0.0;
-
-    try {
-      const bool no_collision = simulator.simulate(
-          *path, sim_time_step_, 5.0, simulation_time, stage_cost);
-      // Continue if this acceleration option leads to collision.
-      if (!no_collision) continue;
-    } catch (std::exception& e) {
-      std::printf("SpatiotemporalLatticePlanner::connectVertexToFrontNode(): WARNING\n"
-                  "%s", e.what());
-      continue;
-    }
+    // Return directly if the target node is already very close to the vertex.
+    // It is not reasonable to change lane with this short distance.
+    if (target_node->distance()-vertex->node().lock()->distance() < 20.0)
+      return;
 
-    // Create a new vertex using the end snapshot of the simulation.
-    boost::shared_ptr<Vertex> next_vertex = boost::make_shared<Vertex>(
-        simulator.snapshot(), waypoint_lattice_, fast_map_);
+    // If the ego is on the right (left) of the lane center, connecting to the
+    // left (right) lane is forbidden.
+    const double distance_to_lane_center = utils::distanceToLaneCenter(
+        vertex->snapshot().ego().transform().location,
+        vertex->node().lock()->waypoint());
+    if (left && distance_to_lane_center > 0.5) return;
+    if (!left && distance_to_lane_center < -0.5) return;
+
+    // Check the front and back vehicles on the target lane.
+    //
+    // If there are vehicles at the front or back of the ego on the target lane,
+    // meanwhile those vehicles has non-positive distance to the ego, we will
+    // ignore this path option.
+    //
+    // TODO: Should we increase the margin of the check?
+    const size_t ego = vertex->snapshot().ego().id();
+    boost::shared_ptr<const TrafficLattice> traffic_lattice =
+      vertex->snapshot().trafficLattice();
+    boost::optional<std::pair<size_t, double>> side_front =
+      left ? traffic_lattice->leftFront(ego) : traffic_lattice->rightFront(ego);
+    boost::optional<std::pair<size_t, double>> side_back =
+      left ? traffic_lattice->leftBack(ego) : traffic_lattice->rightBack(ego);
+
+    if (side_front && side_front->second <= 0.0) return;
+    if (side_back  && side_back->second  <= 0.0) return;
+  }
 
-    // Check if a similar vertex (close in ego velocity) has already been created.
-    // If so, the \c next_vertex is replaced with the existing one in the table.
-    boost::shared_ptr<Vertex> similar_vertex = findVertexInTable(next_vertex);
-    if (similar_vertex) next_vertex = similar_vertex;
+  // Plan a path between the node at the current vertex to the target node.
+  utils::Expected<ContinuousPath> path = ContinuousPath::create(
+      std::make_pair(vertex->snapshot().ego().transform(),
+                     vertex->snapshot().ego().curvature()),
+      std::make_pair(target_node->waypoint()->GetTransform(),
+                     target_node->curvature(fast_map_)),
+      edge.lane_change_type);
+  // If for whatever reason, the path cannot be created, the child vertices
+  // cannot be created either.
+  if (!path) return;
+  edge.path = std::move(*path);
 
-    //// Ignore this option if the target node is not reached under this
-    //// acceleration option.
-    //if (next_vertex->node().lock()->id() != target_node->id())
-    //  continue;
+  return;
+}
 
-    // Update the child of the parent vertex.
-    vertex->updateFrontChild(*path, accel, stage_cost, next_vertex);
+std::vector<SpatiotemporalLatticePlanner::Simulation>
+  SpatiotemporalLatticePlanner::runSimulations(
+      const Edge& edge, const std::vector<size_t>& accel_idxs) const {
+
+  // Prepare the simulators, each starts from a snapshot with the
+  // acceleration of the ego set accordingly.
+  std::vector<boost::shared_ptr<TrafficSimulator>> simulators;
+  for (const size_t accel_idx : accel_idxs) {
+    Snapshot snapshot = edge.vertex->snapshot();
+    snapshot.ego().acceleration() = kAccelerationOptions_[accel_idx];
+    simulators.push_back(boost::make_shared<ConstAccelTrafficSimulator>(
+          snapshot, map_, fast_map_));
+    simulators.back()->frenetAgents() = frenet_agents_;
+  }
 
-    // Update the parent vertex of the child.
-    if (vertex->hasParents()) {
-      next_vertex->updateBackParent(
-          simulator.snapshot(), vertex->costToCome()+stage_cost, vertex);
-    } else {
-      next_vertex->updateBackParent(
-          simulator.snapshot(), stage_cost, vertex);
-    }
+  // The agents do not react to the ego. Therefore, the simulators are run
+  // in lockstep, where the agents are moved forward only once for all
+  // acceleration options as long as they are on the same traffic lattice.
+  std::vector<double> simulation_times;
+  std::vector<double> stage_costs;
+  std::vector<std::string> warnings;
+  const std::vector<utils::Expected<bool>> no_collisions =
+    TrafficSimulator::trySimulateLockstep(
+        simulators, *(edge.path), sim_time_step_, 5.0,
+        simulation_times, stage_costs, warnings);
+
+  std::vector<Simulation> simulations(accel_idxs.size());
+  for (size_t i = 0; i < accel_idxs.size(); ++i) {
+    simulations[i].done = true;
+    simulations[i].warning = warnings[i];
+    // The simulation fails if an agent cannot be moved forward on the map.
+    if (!no_collisions[i]) continue;
+
+    simulations[i].result.reset(new SimulationCache::Result{
+        simulators[i]->snapshot(), simulation_times[i], stage_costs[i], *(no_collisions[i])});
+  }
 
-    // Set the front vertices that are connected with this vertex.
-    auto children = vertex->frontChildren();
-    for (size_t i = 0; i < Vertex::kSpeedIntervalsPerStation_.size(); ++i) {
-      if (!(children[i])) continue;
-      front_children[i] = std::get<3>(*(children[i])).lock();
-    }
+  return simulations;
+}
 
-  } // End for loop for different acceleration options.
+void SpatiotemporalLatticePlanner::runSimulations(Edge& edge) const {
 
-  // Collect all the front child vertices of the input vertex.
-  std::vector<boost::shared_ptr<Vertex>> output_vertices;
-  for (const auto& child : front_children) {
-    if (!child) continue;
-    output_vertices.push_back(child);
-  }
+  if (!edge.path) return;
 
-  return output_vertices;
-}
+  // Find the acceleration options which are not in the cache yet.
+  std::vector<size_t> accel_idxs;
+  for (size_t i = 0; i < kAccelerationOptions_.size(); ++i) {
+    if (edge.simulations[i].done) continue;
+    const SimulationCache::Key key = simulation_cache_.key(
+        edge.vertex->snapshot(), edge.target_node->id(),
+        edge.lane_change_type, kAccelerationOptions_[i]);
+    if (!simulation_cache_.contains(key)) accel_idxs.push_back(i);
+  }
+  if (accel_idxs.empty()) return;
 
-std::vector<boost::shared_ptr<Vertex>>
-  SpatiotemporalLatticePlanner::connectVertexToLeftFrontNode(
-    const boost::shared_ptr<Vertex>& vertex,
-    const boost::shared_ptr<const WaypointNode>& target_node) {
+  const std::vector<Simulation> simulations = runSimulations(edge, accel_idxs);
+  for (size_t i = 0; i < accel_idxs.size(); ++i)
+    edge.simulations[accel_idxs[i]] = simulations[i];
 
-  //std::printf("SpatiotemporalLatticePlanner::connectVertexToLeftFrontNode()\n");
+  return;
+}
 
-  // Stores the expanded left front children of the input vertex.
-  std::array<boost::shared_ptr<Vertex>, Vertex::kSpeedIntervalsPerStation_.size()>
-    left_children;
+boost::shared_ptr<const SimulationCache::Result>
+  SpatiotemporalLatticePlanner::simulateEdge(
+      const Edge& edge, const size_t accel_idx) {
+
+  const SimulationCache::Key key = simulation_cache_.key(
+      edge.vertex->snapshot(), edge.target_node->id(),
+      edge.lane_change_type, kAccelerationOptions_[accel_idx]);
+  boost::shared_ptr<const SimulationCache::Result> cached_result =
+    simulation_cache_.find(key);
+  if (cached_result) return cached_result;
+
+  // Use the simulation run ahead if there is one.
+  const Simulation simulation = edge.simulations[accel_idx].done ?
+    edge.simulations[accel_idx] :
+    runSimulations(edge, std::vector<size_t>{accel_idx}).front();
+
+  if (!simulation.warning.empty()) {
+    std::printf("SpatiotemporalLatticePlanner::simulateEdge(): WARNING\n"
+                "%s", simulation.warning.c_str());
+    return nullptr;
+  }
 
-  // Return directly if the target node does not exist.
-  if (!target_node) return std::vector<boost::shared_ptr<Vertex>>();
+  // Failures of the simulation are not cached.
+  if (simulation.result) simulation_cache_.insert(key, simulation.result);
+  return simulation.result;
+}
 
-  // Return directly if the target node is already very close to the vertex.
-  // It is not reasonable to change lane with this short distance.
-  if (target_node->distance()-vertex->node().lock()->distance() < 20.0)
-    return std::vector<boost::shared_ptr<Vertex>>();
+std::vector<boost::shared_ptr<Vertex>>
+  SpatiotemporalLatticePlanner::connectEdge(const Edge& edge) {
 
-  // If the ego is on the right of the lane center, connecting to the
-  // left lane is forbidden.
-  if (utils::distanceToLaneCenter(
-        vertex->snapshot().ego().transform().location,
-        vertex->node().lock()->waypoint()) > 0.5)
-    return std::vector<boost::shared_ptr<Vertex>>();
-
-  // Check the left front and left back vehicles.
-  //
-  // If there are vehicles at the left front or left back of the ego,
-  // meanwhile those vehicles has non-positive distance to the ego, we will
-  // ignore this path option.
-  //
-  // TODO: Should we increase the margin of the check?
-  boost::optional<std::pair<size_t, double>> left_front =
-    vertex->snapshot().trafficLattice()->leftFront(vertex->snapshot().ego().id());
-  boost::optional<std::pair<size_t, double>> left_back =
-    vertex->snapshot().trafficLattice()->leftBack(vertex->snapshot().ego().id());
+  // Return directly if the option is rejected.
+  if (!edge.path) return std::vector<boost::shared_ptr<Vertex>>();
 
-  if (left_front && left_front->second <= 0.0)
-    return std::vector<boost::shared_ptr<Vertex>>();
-  if (left_back && left_back->second <= 0.0)
-    return std::vector<boost::shared_ptr<Vertex>>();
+  const boost::shared_ptr<Vertex>& vertex = edge.vertex;
+  const ContinuousPath& path = *(edge.path);
 
-  // Plan a path between the node at the current vertex to the target node.
-  boost::shared_ptr<ContinuousPath> path = nullptr;
-  try {
-    path = boost::make_shared<ContinuousPath>(
-        std::make_pair(vertex->snapshot().ego().transform(),
-                       vertex->snapshot().ego().curvature()),
-        std::make_pair(target_node->waypoint()->GetTransform(),
-                       target_node->curvature(map_)),
-        ContinuousPath::LaneChangeType::LeftLaneChange);
-  } catch (std::exception& e) {
-    // If for whatever reason, the path cannot be created, the front vertices
-    // cannot be created either.
-    std::printf("%s", e.what());
-    return std::vector<boost::shared_ptr<Vertex>>();
-  }
+  // Stores the expanded children of the input vertex along the option.
+  std::array<boost::shared_ptr<Vertex>, Vertex::kSpeedIntervalsPerStation_.size()>
+    side_children;
 
   // Simulate the traffic forward with the ego applying different constant
   // accelerations over the path created above.
-  for (const double accel : kAccelerationOptions_) {
-    // Prepare the start snapshot.
-    // The acceleration of the ego is set accordingly.
-    Snapshot snapshot = vertex->snapshot();
-    snapshot.ego().acceleration() = accel;
-
-    ConstAccelTrafficSimulator simulator(snapshot, map_, fast_map_);
-    double simulation_time = 0.0; double stage_cost = 0.0;
-
-    try {
-      const bool no_collision = simulator.simulate(
-          *path, sim_time_step_, 5.0, simulation_time, stage_cost);
-      // Continue if this acceleration option leads to collision.
-      if (!no_collision) continue;
-    } catch (std::exception& e) {
-      std::printf("SpatiotemporalLatticePlanner::connectVertexToLeftFrontNode(): WARNING\n"
-                  "%s", e.what());
-      continue;
-    }
+  for (size_t accel_idx = 0; accel_idx < kAccelerationOptions_.size(); ++accel_idx) {
+    const double accel = kAccelerationOptions_[accel_idx];
+
+    // Simulate the traffic, or reuse the result from previous planning cycles.
+    boost::shared_ptr<const SimulationCache::Result> result = simulateEdge(edge, accel_idx);
+    // Continue if this acceleration option leads to collision.
+    if (!result || !result->no_collision) continue;
+    const double stage_cost = result->cost;
 
     // Create a new vertex using the end snapshot of the simulation.
     boost::shared_ptr<Vertex> next_vertex = boost::make_shared<Vertex>(
-        simulator.snapshot(), waypoint_lattice_, fast_map_);
+        result->snapshot, waypoint_lattice_, fast_map_);
 
     // Check if a similar vertex (close in ego velocity) has already been created.
     // If so, the \c next_vertex is replaced with the existing one in the table.
@@ -849,29 +866,40 @@ std::vector<boost::shared_ptr<Vertex>>
     //if (next_vertex->node().lock()->id() != target_node->id())
     //  continue;
 
-    // Update the child of the parent vertex.
-    vertex->updateLeftChild(*path, accel, stage_cost, next_vertex);
-
-    // Update the parent vertex of the child.
-    if (vertex->hasParents()) {
-      next_vertex->updateRightParent(
-          simulator.snapshot(), vertex->costToCome()+stage_cost, vertex);
-    } else {
-      next_vertex->updateRightParent(
-          simulator.snapshot(), stage_cost, vertex);
+    // Update the child of the parent vertex, and the parent vertex of the child.
+    const double cost_to_come = vertex->hasParents() ?
+      vertex->costToCome()+stage_cost : stage_cost;
+
+    switch (edge.lane_change_type) {
+      case ContinuousPath::LaneChangeType::LeftLaneChange:
+        vertex->updateLeftChild(path, accel, stage_cost, next_vertex);
+        next_vertex->updateRightParent(result->snapshot, cost_to_come, vertex);
+        break;
+      case ContinuousPath::LaneChangeType::RightLaneChange:
+        vertex->updateRightChild(path, accel, stage_cost, next_vertex);
+        next_vertex->updateLeftParent(result->snapshot, cost_to_come, vertex);
+        break;
+      default:
+        vertex->updateFrontChild(path, accel, stage_cost, next_vertex);
+        next_vertex->updateBackParent(result->snapshot, cost_to_come, vertex);
+        break;
     }
 
-    // Set the left front vertices that are connected with this vertex.
-    auto children = vertex->leftChildren();
+    // Set the child vertices that are connected with this vertex.
+    auto children =
+      edge.lane_change_type == ContinuousPath::LaneChangeType::LeftLaneChange ?
+        vertex->leftChildren() :
+      edge.lane_change_type == ContinuousPath::LaneChangeType::RightLaneChange ?
+        vertex->rightChildren() : vertex->frontChildren();
     for (size_t i = 0; i < Vertex::kSpeedIntervalsPerStation_.size(); ++i) {
       if (!(children[i])) continue;
-      left_children[i] = std::get<3>(*(children[i])).lock();
+      side_children[i] = std::get<3>(*(children[i])).lock();
     }
   } // End for loop for different acceleration options.
 
-  // Collect all the left child vertices of the input vertex.
+  // Collect all the child vertices of the input vertex.
   std::vector<boost::shared_ptr<Vertex>> output_vertices;
-  for (const auto& child : left_children) {
+  for (const auto& child : side_children) {
     if (!child) continue;
     output_vertices.push_back(child);
   }
@@ -879,129 +907,166 @@ std::vector<boost::shared_ptr<Vertex>>
   return output_vertices;
 }
 
-std::vector<boost::shared_ptr<Vertex>>
-  SpatiotemporalLatticePlanner::connectVertexToRightFrontNode(
-    const boost::shared_ptr<Vertex>& vertex,
-    const boost::shared_ptr<const WaypointNode>& target_node) {
-
-  //std::printf("SpatiotemporalLatticePlanner::connectVertexToRightFrontNode()\n");
+void SpatiotemporalLatticePlanner::constructVertexGraphBestFirst(
+    std::deque<boost::shared_ptr<Vertex>>& vertex_queue) {
 
-  // Stores the expanded right front children of the input vertex.
-  std::array<boost::shared_ptr<Vertex>, Vertex::kSpeedIntervalsPerStation_.size()>
-    right_children;
+  // The number of options from the root to each of the vertices. Since every
+  // option moves forward by the same distance, the depth of a vertex does not
+  // depend on the path reaching it.
+  std::unordered_map<const Vertex*, size_t> depths;
 
-  // Return directly if the target node does not exist.
-  if (!target_node) return std::vector<boost::shared_ptr<Vertex>>();
+  BestFirstQueue<Vertex> frontier;
+  auto priority = [this, &depths](const boost::shared_ptr<Vertex>& vertex)->double{
+    return expansionPriority(vertex, depths[vertex.get()]);
+  };
 
-  // Return directly if the target node is already very close to the vertex.
-  // It is not reasonable to change lane with this short distance.
-  if (target_node->distance()-vertex->node().lock()->distance() < 20.0)
-    return std::vector<boost::shared_ptr<Vertex>>();
+  for (const boost::shared_ptr<Vertex>& vertex : vertex_queue) {
+    depths[vertex.get()] = vertex->hasParents() ? 1 : 0;
+    frontier.push(vertex, priority(vertex));
+  }
+  vertex_queue.clear();
+
+  // The vertices are expanded until the deadline, as long as there is
+  // already a trajectory in the graph, i.e. the root has a child. With the
+  // depth in the priority, the cost-to-come of a vertex cannot be improved
+  // once it is popped, see \c expansionPriority().
+  while (!root_.lock()->hasChildren() || !deadlinePassed()) {
+    boost::shared_ptr<Vertex> vertex = frontier.pop();
+    if (!vertex) break;
+
+    std::vector<Edge> edges = vertexEdges(vertex);
+    if (task_pool_) {
+      task_pool_->parallelFor(edges.size(), [this, &edges](const size_t i)->void{
+          createEdgePath(edges[i]);
+          runSimulations(edges[i]);
+        });
+    } else {
+      for (Edge& edge : edges) createEdgePath(edge);
+    }
 
-  // If the ego is on the left of the lane center, connecting to the
-  // right lane is forbidden.
-  if (utils::distanceToLaneCenter(
-        vertex->snapshot().ego().transform().location,
-        vertex->node().lock()->waypoint()) < -0.5)
-    return std::vector<boost::shared_ptr<Vertex>>();
-
-  // Check the right front and right back vehicles.
-  //
-  // If there are vehicles at the right front or right back of the ego,
-  // meanwhile those vehicles has non-positive distance to the ego, we will
-  // ignore this path option.
-  //
-  // TODO: Should we increase the margin of the check?
-  boost::optional<std::pair<size_t, double>> right_front =
-    vertex->snapshot().trafficLattice()->rightFront(vertex->snapshot().ego().id());
-  boost::optional<std::pair<size_t, double>> right_back =
-    vertex->snapshot().trafficLattice()->rightBack(vertex->snapshot().ego().id());
+    for (Edge& edge : edges) {
+      if (!task_pool_) runSimulations(edge);
+      if (!edge.target_node) continue;
 
-  if (right_front && right_front->second <= 0.0)
-    return std::vector<boost::shared_ptr<Vertex>>();
-  if (right_back && right_back->second <= 0.0)
-    return std::vector<boost::shared_ptr<Vertex>>();
+      for (const auto& next_vertex : connectEdge(edge)) {
+        // Ignore the vertex if a similar one exists in the table already.
+        boost::shared_ptr<Vertex> similar_vertex = findVertexInTable(next_vertex);
+        if (similar_vertex && similar_vertex != next_vertex) continue;
+        if (!similar_vertex) addVertexToTable(next_vertex);
 
-  // Plan a path between the node at the current vertex to the target node.
-  boost::shared_ptr<ContinuousPath> path = nullptr;
-  try {
-    path = boost::make_shared<ContinuousPath>(
-        std::make_pair(vertex->snapshot().ego().transform(),
-                       vertex->snapshot().ego().curvature()),
-        std::make_pair(target_node->waypoint()->GetTransform(),
-                       target_node->curvature(map_)),
-        ContinuousPath::LaneChangeType::RightLaneChange);
-  } catch (std::exception& e) {
-    // If for whatever reason, the path cannot be created, the front vertices
-    // cannot be created either.
-    std::printf("%s", e.what());
-    return std::vector<boost::shared_ptr<Vertex>>();
+        // The vertex is pushed again if its cost-to-come is improved.
+        if (next_vertex->node().lock()->id() != edge.target_node->id()) continue;
+        depths.emplace(next_vertex.get(), depths[vertex.get()]+1);
+        frontier.push(next_vertex, priority(next_vertex));
+      }
+    }
   }
 
-  // Simulate the traffic forward with the ego applying different constant
-  // accelerations over the path created above.
-  for (const double accel : kAccelerationOptions_) {
-    // Prepare the start snapshot.
-    // The acceleration of the ego is set accordingly.
-    Snapshot snapshot = vertex->snapshot();
-    snapshot.ego().acceleration() = accel;
-
-    ConstAccelTrafficSimulator simulator(snapshot, map_, fast_map_);
-    double simulation_time = 0.0; double stage_cost = 0.0;
-
-    try {
-      const bool no_collision = simulator.simulate(
-          *path, sim_time_step_, 5.0, simulation_time, stage_cost);
-      // Continue if this acceleration option leads to collision.
-      if (!no_collision) continue;
-    } catch (std::exception& e) {
-      std::printf("SpatiotemporalLatticePlanner::connectVertexToRightFrontNode(): WARNING\n"
-                  "%s", e.what());
-      continue;
-    }
+  return;
+}
 
-    // Create a new vertex using the end snapshot of the simulation.
-    boost::shared_ptr<Vertex> next_vertex = boost::make_shared<Vertex>(
-        simulator.snapshot(), waypoint_lattice_, fast_map_);
+std::vector<SpatiotemporalLatticePlanner::Edge>
+  SpatiotemporalLatticePlanner::vertexEdges(
+    const boost::shared_ptr<Vertex>& vertex) const {
 
-    // Check if a similar vertex (close in ego velocity) has already been created.
-    // If so, the \c next_vertex is replaced with the existing one in the table.
-    boost::shared_ptr<Vertex> similar_vertex = findVertexInTable(next_vertex);
-    if (similar_vertex) next_vertex = similar_vertex;
+  std::vector<Edge> edges;
+  // Try to connect to the front node.
+  edges.emplace_back(
+      vertex,
+      waypoint_lattice_->front(vertex->node().lock()->waypoint(), 50.0),
+      ContinuousPath::LaneChangeType::KeepLane);
+  // Try to connect to the left front node.
+  edges.emplace_back(
+      vertex,
+      waypoint_lattice_->leftFront(vertex->node().lock()->waypoint(), 50.0),
+      ContinuousPath::LaneChangeType::LeftLaneChange);
+  // Try to connect to the right front node.
+  edges.emplace_back(
+      vertex,
+      waypoint_lattice_->rightFront(vertex->node().lock()->waypoint(), 50.0),
+      ContinuousPath::LaneChangeType::RightLaneChange);
+  return edges;
+}
 
-    //// Ignore this option if the target node is not reached under this
-    //// acceleration option.
-    //if (next_vertex->node().lock()->id() != target_node->id())
-    //  continue;
+const double SpatiotemporalLatticePlanner::expansionPriority(
+    const boost::shared_ptr<Vertex>& vertex, const size_t depth) const {
+  // The stage cost of an option is at least -1, i.e. the minimum step cost
+  // of the \c ConstAccelTrafficSimulator. Adding the depth to the cost-to-come
+  // results in a priority which never decreases along an option.
+  const double cost_to_come = vertex->hasParents() ? vertex->costToCome() : 0.0;
+  return cost_to_come + static_cast<double>(depth);
+}
 
-    // Update the child of the parent vertex.
-    vertex->updateRightChild(*path, accel, stage_cost, next_vertex);
+const double SpatiotemporalLatticePlanner::spatialHorizon() const {
 
-    // Update the parent vertex of the child.
-    if (vertex->hasParents()) {
-      next_vertex->updateLeftParent(
-          simulator.snapshot(), vertex->costToCome()+stage_cost, vertex);
-    } else {
-      next_vertex->updateLeftParent(
-          simulator.snapshot(), stage_cost, vertex);
-    }
+  // Find the current spatial planning horizon.
+  boost::shared_ptr<const Vertex> root_child;
+  if (root_.lock()->hasFrontChildren())
+    root_child = std::get<3>(root_.lock()->validFrontChildren().front()).lock();
+  else if (root_.lock()->hasLeftChildren())
+    root_child = std::get<3>(root_.lock()->validLeftChildren().front()).lock();
+  else if (root_.lock()->hasRightChildren())
+    root_child = std::get<3>(root_.lock()->validRightChildren().front()).lock();
 
-    // Set the right front vertices that are connected with this vertex.
-    auto children = vertex->rightChildren();
-    for (size_t i = 0; i < Vertex::kSpeedIntervalsPerStation_.size(); ++i) {
-      if (!(children[i])) continue;
-      right_children[i] = std::get<3>(*(children[i])).lock();
-    }
-  } // End for loop for different acceleration options.
+  // The root is not expanded, e.g. all options are blocked or the deadline
+  // passes before the first expansion.
+  if (!root_child) return spatial_horizon_;
 
-  // Collect all the right child vertices of the input vertex.
-  std::vector<boost::shared_ptr<Vertex>> output_vertices;
-  for (const auto& child : right_children) {
-    if (!child) continue;
-    output_vertices.push_back(child);
+  return spatial_horizon_ - 50.0 +
+         root_child->node()->distance() -
+         root_.lock()->node().lock()->distance();
+}
+
+void SpatiotemporalLatticePlanner::updateHorizonCoverage() {
+
+  // Nothing is covered if the root has no children.
+  if (!root_.lock()->hasChildren()) {
+    horizon_coverage_ = 0.0;
+    return;
   }
 
-  return output_vertices;
+  double max_distance = 0.0;
+  for (const auto& item : node_to_vertices_table_) {
+    for (const boost::shared_ptr<Vertex>& vertex : item.second) {
+      if (!vertex) continue;
+      const double distance = vertex->node().lock()->distance() -
+                              root_.lock()->node().lock()->distance();
+      max_distance = std::max(max_distance, distance);
+    }
+  }
+
+  horizon_coverage_ = std::min(max_distance/spatialHorizon(), 1.0);
+  return;
+}
+
+std::vector<boost::shared_ptr<Vertex>>
+  SpatiotemporalLatticePlanner::connectVertexToFrontNode(
+      const boost::shared_ptr<Vertex>& vertex,
+      const boost::shared_ptr<const WaypointNode>& target_node) {
+  Edge edge(vertex, target_node, ContinuousPath::LaneChangeType::KeepLane);
+  createEdgePath(edge);
+  runSimulations(edge);
+  return connectEdge(edge);
+}
+
+std::vector<boost::shared_ptr<Vertex>>
+  SpatiotemporalLatticePlanner::connectVertexToLeftFrontNode(
+      const boost::shared_ptr<Vertex>& vertex,
+      const boost::shared_ptr<const WaypointNode>& target_node) {
+  Edge edge(vertex, target_node, ContinuousPath::LaneChangeType::LeftLaneChange);
+  createEdgePath(edge);
+  runSimulations(edge);
+  return connectEdge(edge);
+}
+
+std::vector<boost::shared_ptr<Vertex>>
+  SpatiotemporalLatticePlanner::connectVertexToRightFrontNode(
+      const boost::shared_ptr<Vertex>& vertex,
+      const boost::shared_ptr<const WaypointNode>& target_node) {
+  Edge edge(vertex, target_node, ContinuousPath::LaneChangeType::RightLaneChange);
+  createEdgePath(edge);
+  runSimulations(edge);
+  return connectEdge(edge);
 }
 
 boost::shared_ptr<Vertex> SpatiotemporalLatticePlanner::findVertexInTable(
@@ -1079,18 +1144,7 @@ const double SpatiotemporalLatticePlanner::terminalDistanceCost(
   };
 
   // Find the current spatial planning horizon.
-  boost::shared_ptr<const Vertex> root_child;
-  if (root_.lock()->hasFrontChildren())
-    root_child = std::get<3>(root_.lock()->validFrontChildren().front()).lock();
-  else if (root_.lock()->hasLeftChildren())
-    root_child = std::get<3>(root_.lock()->validLeftChildren().front()).lock();
-  else if (root_.lock()->hasRightChildren())
-    root_child = std::get<3>(root_.lock()->validRightChildren().front()).lock();
-
-  const double spatial_horizon =
-    spatial_horizon_ - 50.0 +
-    root_child->node()->distance() -
-    root_.lock()->node().lock()->distance();
+  const double spatial_horizon = spatialHorizon();
 
   const double distance = vertex->node().lock()->distance() -
                           root_.lock()->node().lock()->distance();
@@ -19,6 +19,7 @@
 #include <list>
 #include <array>
 #include <string>
+#include <vector>
 #include <unordered_map>
 #include <boost/optional.hpp>
 #include <boost/core/noncopyable.hpp>
@@ -30,7 +31,9 @@
 #include <planner/common/vehicle_path.h>
 #include <planner/common/utils.h>
 #include <planner/common/vehicle_path_planner.h>
+#include <planner/common/best_first_queue.h>
 #include <planner/common/traffic_simulator.h>
+#include <planner/common/simulation_cache.h>
 #include <planner/common/intelligent_driver_model.h>
 
 namespace planner {
@@ -67,6 +70,9 @@ protected:
 
   virtual const double accelCost() const override;
 
+  /// Accelerating below the policy speed is rewarded with -1 for the ego.
+  virtual const double minStepCost() const override { return -1.0; }
+
 }; // End ConstAccelTrafficSimulator.
 
 class Vertex {
@@ -182,8 +188,10 @@ public:
          const boost::shared_ptr<const WaypointLattice>& waypoint_lattice,
          const boost::shared_ptr<utils::FastWaypointMap>& fast_map) :
     snapshot_(snapshot) {
+    // The ego waypoint matched by the traffic lattice is a good hint.
+    boost::optional<size_t> hint = snapshot.ego().waypointHint();
     boost::shared_ptr<const WaypointNode> node = waypoint_lattice->closestNode(
-        fast_map->waypoint(snapshot.ego().transform().location),
+        fast_map->waypoint(snapshot.ego().transform().location, hint),
         waypoint_lattice->longitudinalResolution());
     if (!node) {
       std::string error_msg(
@@ -404,6 +412,12 @@ protected:
   /// The next vertex to be reached.
   boost::weak_ptr<Vertex> cached_next_vertex_;
 
+  /// Generation of the node of \c cached_next_vertex_, see \c WaypointLattice::hasNode().
+  uint32_t cached_next_node_generation_ = 0;
+
+  /// Results of the simulations in the previous planning cycles.
+  SimulationCache simulation_cache_;
+
 public:
 
   /// Constructor of the class.
@@ -432,6 +446,10 @@ public:
   /// Get the router used by the planner.
   boost::shared_ptr<const router::Router> router() const { return router_; }
 
+  /// Get the cache of the simulation results, e.g. to check the hit rate.
+  const SimulationCache& simulationCache() const { return simulation_cache_; }
+  SimulationCache& simulationCache() { return simulation_cache_; }
+
   ///// Get all vertices in the graph.
   //std::vector<boost::shared_ptr<const Vertex>> vertices() const {
   //  std::vector<boost::shared_ptr<const Vertex>> valid_vertices;
@@ -470,6 +488,28 @@ protected:
   /// Construct the vertex graph.
   void constructVertexGraph(std::deque<boost::shared_ptr<Vertex>>& vertex_queue);
 
+  /**
+   * \brief Construct the vertex graph best-first, until either all vertices
+   *        are expanded or the deadline of the planning cycle is reached.
+   *
+   * The vertices are expanded in the ascending order of \c expansionPriority().
+   */
+  void constructVertexGraphBestFirst(std::deque<boost::shared_ptr<Vertex>>& vertex_queue);
+
+  /**
+   * \brief The priority of a vertex to be expanded in \c constructVertexGraphBestFirst().
+   * \param[in] vertex The vertex.
+   * \param[in] depth The number of options from the root to the vertex.
+   */
+  const double expansionPriority(
+      const boost::shared_ptr<Vertex>& vertex, const size_t depth) const;
+
+  /// Compute the spatial horizon of the current vertex graph.
+  const double spatialHorizon() const;
+
+  /// Update the ratio of the spatial horizon covered by the vertex graph.
+  void updateHorizonCoverage();
+
   std::vector<boost::shared_ptr<Vertex>> connectVertexToFrontNode(
         const boost::shared_ptr<Vertex>& vertex,
         const boost::shared_ptr<const WaypointNode>& target_node);
@@ -482,6 +522,102 @@ protected:
       const boost::shared_ptr<Vertex>& vertex,
       const boost::shared_ptr<const WaypointNode>& target_node);
 
+  /**
+   * \brief Simulation stores the outcome of simulating the traffic forward
+   *        with the ego applying one of the acceleration options.
+   */
+  struct Simulation {
+    /// Whether the simulation has been run.
+    bool done = false;
+    /// The result, \c nullptr if the traffic cannot be simulated.
+    boost::shared_ptr<const SimulationCache::Result> result = nullptr;
+    /// The error message if the simulation throws.
+    std::string warning;
+  };
+
+  /**
+   * \brief Edge stores an option connecting a vertex to a target node,
+   *        together with the simulations of the acceleration options.
+   */
+  struct Edge {
+    /// The vertex to start from.
+    boost::shared_ptr<Vertex> vertex;
+    /// The target node, which may not exist.
+    boost::shared_ptr<const WaypointNode> target_node;
+    /// The lane change type of the option.
+    ContinuousPath::LaneChangeType lane_change_type;
+
+    /// The path from the vertex to the target node, \c boost::none if
+    /// the option is rejected.
+    boost::optional<ContinuousPath> path = boost::none;
+    /// Simulations of the acceleration options in \c kAccelerationOptions_.
+    std::array<Simulation, kAccelerationOptions_.size()> simulations;
+
+    Edge(const boost::shared_ptr<Vertex>& vertex,
+         const boost::shared_ptr<const WaypointNode>& target_node,
+         const ContinuousPath::LaneChangeType lane_change_type) :
+      vertex(vertex),
+      target_node(target_node),
+      lane_change_type(lane_change_type) {}
+  };
+
+  /**
+   * \brief Create the path of an option if the option is allowed.
+   *
+   * The function does not modify the vertex graph, and can be called
+   * for different options concurrently.
+   */
+  void createEdgePath(Edge& edge) const;
+
+  /// Create the options from a vertex to the front, left front, and right front nodes.
+  std::vector<Edge> vertexEdges(const boost::shared_ptr<Vertex>& vertex) const;
+
+  /**
+   * \brief Simulate the traffic forward from the vertex of an option, with
+   *        the ego applying a number of constant accelerations over the path.
+   *
+   * The accelerations are simulated in lockstep, see
+   * \c TrafficSimulator::trySimulateLockstep(). The function neither uses
+   * nor modifies \c simulation_cache_, and can be called concurrently.
+   *
+   * \param[in] edge The option whose path has been created.
+   * \param[in] accel_idxs The indices of the accelerations in \c kAccelerationOptions_.
+   * \return The simulations in the same order as \c accel_idxs.
+   */
+  std::vector<Simulation> runSimulations(
+      const Edge& edge, const std::vector<size_t>& accel_idxs) const;
+
+  /**
+   * \brief Run the simulations of an option for the accelerations whose
+   *        results are not in \c simulation_cache_ yet.
+   *
+   * The cache is only read, so that the function can be called concurrently
+   * as long as the cache is not modified at the same time.
+   */
+  void runSimulations(Edge& edge) const;
+
+  /**
+   * \brief Get the simulation of an option under an acceleration.
+   *
+   * The result is taken from \c simulation_cache_ if a simulation with the
+   * same start snapshot (up to quantisation), target node, and acceleration
+   * has been done before. Otherwise, the simulation stored in \c edge is
+   * used, or run if there is none, and the new result is added to the cache.
+   *
+   * \param[in] edge The option whose path has been created.
+   * \param[in] accel_idx The index of the acceleration in \c kAccelerationOptions_.
+   * \return The result of the simulation, or \c nullptr if the traffic
+   *         cannot be simulated.
+   */
+  boost::shared_ptr<const SimulationCache::Result> simulateEdge(
+      const Edge& edge, const size_t accel_idx);
+
+  /**
+   * \brief Merge an option into the vertex graph.
+   * \return The child vertices of the vertex along the option.
+   */
+  std::vector<boost::shared_ptr<Vertex>> connectEdge(const Edge& edge);
+
   /// Compute the speed cost for a terminal vertex.
   const double terminalSpeedCost(const boost::shared_ptr<Vertex>& vertex) const;
 
@@ -0,0 +1,181 @@
+/*
+ * Copyright 2020 Ke Sun
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <unordered_map>
+
+#include <boost/smart_ptr.hpp>
+
+#include <pcl/point_cloud.h>
+#include <pcl/kdtree/kdtree_flann.h>
+
+#include <carla/client/Client.h>
+#include <carla/client/World.h>
+#include <carla/client/Map.h>
+#include <carla/client/Waypoint.h>
+
+#include <planner/common/utils.h>
+#include <planner/common/fast_waypoint_map.h>
+
+/**
+ * Compares the throughput of the grid based FastWaypointMap against the
+ * KD-tree based waypoint query (PCL KdTreeFLANN + location-to-waypoint table)
+ * that was used before.
+ *
+ * A carla server should be running with the map to be tested (e.g. Town04).
+ *
+ * Usage: benchmark_fast_waypoint_map [host] [port] [query number]
+ */
+
+using CarlaClient   = carla::client::Client;
+using CarlaWorld    = carla::client::World;
+using CarlaMap      = carla::client::Map;
+using CarlaWaypoint = carla::client::Waypoint;
+using CarlaLocation = carla::geom::Location;
+using Clock         = std::chrono::steady_clock;
+
+/// The KD-tree based waypoint map as the baseline.
+class KdTreeWaypointMap {
+
+private:
+
+  struct PointXYZHash {
+    size_t operator()(const pcl::PointXYZ& point) const {
+      size_t seed = 0;
+      utils::hashCombine(seed, point.x, point.y, point.z);
+      return seed;
+    }
+  };
+
+  struct PointXYZEqual {
+    bool operator()(const pcl::PointXYZ& p1, const pcl::PointXYZ& p2) const {
+      return (p1.x==p2.x) & (p1.y==p2.y) & (p1.z==p2.z);
+    }
+  };
+
+  std::unordered_map<pcl::PointXYZ,
+                     boost::shared_ptr<CarlaWaypoint>,
+                     PointXYZHash,
+                     PointXYZEqual> xyz_to_waypoint_table_;
+
+  pcl::KdTreeFLANN<pcl::PointXYZ> kdtree_;
+
+  pcl::PointCloud<pcl::PointXYZ>::Ptr cloud_ = nullptr;
+
+public:
+
+  KdTreeWaypointMap(const boost::shared_ptr<const CarlaMap>& map,
+                    const double resolution) {
+    const std::vector<boost::shared_ptr<CarlaWaypoint>>
+      waypoints = map->GenerateWaypoints(resolution);
+
+    cloud_ = boost::make_shared<pcl::PointCloud<pcl::PointXYZ>>();
+    for (const auto& waypoint : waypoints) {
+      const CarlaLocation location = waypoint->GetTransform().location;
+      const pcl::PointXYZ point(location.x, location.y, location.z);
+      xyz_to_waypoint_table_[point] = waypoint;
+      cloud_->push_back(point);
+    }
+
+    kdtree_.setEpsilon(resolution);
+    kdtree_.setInputCloud(cloud_);
+    return;
+  }
+
+  boost::shared_ptr<CarlaWaypoint> waypoint(const CarlaLocation& location) const {
+    const pcl::PointXYZ query_point(location.x, location.y, location.z);
+    std::vector<int> indices(1);
+    std::vector<float> sqr_distance(1);
+    kdtree_.nearestKSearch(query_point, 1, indices, sqr_distance);
+    return xyz_to_waypoint_table_.find(cloud_->at(indices[0]))->second;
+  }
+};
+
+const double seconds(const Clock::time_point& start, const Clock::time_point& end) {
+  return std::chrono::duration<double>(end-start).count();
+}
+
+int main(int argc, char** argv) {
+
+  const std::string host = argc > 1 ? argv[1] : "localhost";
+  const int port = argc > 2 ? std::atoi(argv[2]) : 2000;
+  const size_t query_num = argc > 3 ? std::atol(argv[3]) : 100000;
+  const double resolution = 0.05;
+
+  CarlaClient client(host, port);
+  client.SetTimeout(std::chrono::seconds(10));
+  CarlaWorld world = client.GetWorld();
+  boost::shared_ptr<const CarlaMap> map = world.GetMap();
+  printf("map: %s\n", map->GetName().c_str());
+
+  // Build both maps.
+  Clock::time_point start = Clock::now();
+  const utils::FastWaypointMap grid_map(map, resolution);
+  const double grid_build_time = seconds(start, Clock::now());
+
+  start = Clock::now();
+  const KdTreeWaypointMap kdtree_map(map, resolution);
+  const double kdtree_build_time = seconds(start, Clock::now());
+
+  printf("waypoints: %lu\n", grid_map.size());
+  printf("build time  grid: %.3fs kdtree: %.3fs\n", grid_build_time, kdtree_build_time);
+
+  // Queries are sampled around the waypoints on the map, which resembles
+  // the locations of the vehicles on the roads.
+  const std::vector<boost::shared_ptr<CarlaWaypoint>>
+    waypoints = map->GenerateWaypoints(2.0);
+
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<size_t> waypoint_dist(0, waypoints.size()-1);
+  std::uniform_real_distribution<float> offset_dist(-1.5, 1.5);
+
+  std::vector<CarlaLocation> queries(query_num);
+  for (auto& query : queries) {
+    query = waypoints[waypoint_dist(rng)]->GetTransform().location;
+    query.x += offset_dist(rng);
+    query.y += offset_dist(rng);
+  }
+
+  // Run the queries with both maps.
+  std::vector<boost::shared_ptr<CarlaWaypoint>> grid_results(query_num);
+  std::vector<boost::shared_ptr<CarlaWaypoint>> kdtree_results(query_num);
+
+  start = Clock::now();
+  for (size_t i = 0; i < query_num; ++i) grid_results[i] = grid_map.waypoint(queries[i]);
+  const double grid_query_time = seconds(start, Clock::now());
+
+  start = Clock::now();
+  for (size_t i = 0; i < query_num; ++i) kdtree_results[i] = kdtree_map.waypoint(queries[i]);
+  const double kdtree_query_time = seconds(start, Clock::now());
+
+  // The closest locations should be the same (up to ties).
+  size_t mismatches = 0;
+  for (size_t i = 0; i < query_num; ++i) {
+    const float grid_distance = (grid_results[i]->GetTransform().location-queries[i]).Length();
+    const float kdtree_distance = (kdtree_results[i]->GetTransform().location-queries[i]).Length();
+    if (std::abs(grid_distance-kdtree_distance) > 1e-4) ++mismatches;
+  }
+
+  printf("queries: %lu mismatches: %lu\n", query_num, mismatches);
+  printf("throughput  grid: %.0f queries/s kdtree: %.0f queries/s speedup: %.2fx\n",
+      query_num/grid_query_time, query_num/kdtree_query_time,
+      kdtree_query_time/grid_query_time);
+
+  return 0;
+}
@@ -0,0 +1,109 @@
+/*
+ * Copyright 2020 Ke Sun
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <chrono>
+#include <random>
+#include <vector>
+#include <limits>
+#include <cstdio>
+#include <cstdlib>
+
+#include <planner/common/intelligent_driver_model.h>
+
+/**
+ * Compares the time to compute the accelerations of a batch of vehicles
+ * with \c idm() for each vehicle and with a single \c idmBatch() call.
+ *
+ * About one fifth of the vehicles are generated without a lead vehicle.
+ *
+ * Usage: benchmark_intelligent_driver_model [vehicles] [iterations]
+ */
+
+using namespace planner;
+using Clock = std::chrono::steady_clock;
+
+const double seconds(const Clock::time_point& start, const Clock::time_point& end) {
+  return std::chrono::duration<double>(end-start).count();
+}
+
+void benchmark(const char* name,
+               const BasicIntelligentDriverModel& idm,
+               const std::vector<double>& ego_v,
+               const std::vector<double>& ego_v0,
+               const std::vector<double>& lead_v,
+               const std::vector<double>& s,
+               const size_t iterations) {
+
+  const size_t num = ego_v.size();
+  std::vector<double> accel(num, 0.0);
+
+  // Call the scalar model through the base class,
+  // same as how the simulators use the model.
+  double scalar_sum = 0.0;
+  const Clock::time_point scalar_start = Clock::now();
+  for (size_t k = 0; k < iterations; ++k) {
+    for (size_t i = 0; i < num; ++i) {
+      if (std::isnan(lead_v[i])) accel[i] = idm.idm(ego_v[i], ego_v0[i]);
+      else accel[i] = idm.idm(ego_v[i], ego_v0[i], lead_v[i], s[i]);
+    }
+    scalar_sum += accel[k%num];
+  }
+  const Clock::time_point scalar_end = Clock::now();
+
+  double batch_sum = 0.0;
+  const Clock::time_point batch_start = Clock::now();
+  for (size_t k = 0; k < iterations; ++k) {
+    idm.idmBatch(num, ego_v.data(), ego_v0.data(), lead_v.data(), s.data(), accel.data());
+    batch_sum += accel[k%num];
+  }
+  const Clock::time_point batch_end = Clock::now();
+
+  const double scalar_time = seconds(scalar_start, scalar_end) / (iterations*num) * 1e9;
+  const double batch_time = seconds(batch_start, batch_end) / (iterations*num) * 1e9;
+  std::printf("%-10s scalar: %7.2f ns/vehicle batch: %7.2f ns/vehicle speedup: %5.2fx (checksum %g %g)\n",
+      name, scalar_time, batch_time, scalar_time/batch_time, scalar_sum, batch_sum);
+  return;
+}
+
+int main(int argc, char** argv) {
+
+  const size_t num = argc > 1 ? std::atol(argv[1]) : 64;
+  const size_t iterations = argc > 2 ? std::atol(argv[2]) : 100000;
+
+  std::mt19937 random_engine(0);
+  std::uniform_real_distribution<double> speed(0.0, 35.0);
+  std::uniform_real_distribution<double> policy_speed(20.0, 30.0);
+  std::uniform_real_distribution<double> distance(5.0, 100.0);
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+  std::vector<double> ego_v(num), ego_v0(num), lead_v(num), s(num);
+  for (size_t i = 0; i < num; ++i) {
+    ego_v[i] = speed(random_engine);
+    ego_v0[i] = policy_speed(random_engine);
+    lead_v[i] = speed(random_engine);
+    s[i] = distance(random_engine);
+
+    if (unit(random_engine) < 0.2) {
+      lead_v[i] = std::numeric_limits<double>::quiet_NaN();
+      s[i] = std::numeric_limits<double>::quiet_NaN();
+    }
+  }
+
+  std::printf("vehicles: %lu iterations: %lu\n", num, iterations);
+  benchmark("IDM", BasicIntelligentDriverModel(), ego_v, ego_v0, lead_v, s, iterations);
+  benchmark("IIDM", ImprovedIntelligentDriverModel(), ego_v, ego_v0, lead_v, s, iterations);
+  benchmark("ACC", AdaptiveCruiseControl(), ego_v, ego_v0, lead_v, s, iterations);
+
+  return 0;
+}
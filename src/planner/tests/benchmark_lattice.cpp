@@ -0,0 +1,137 @@
+/*
+ * Copyright 2020 Ke Sun
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+#include <boost/smart_ptr.hpp>
+
+#include <carla/client/Client.h>
+#include <carla/client/World.h>
+#include <carla/client/Map.h>
+#include <carla/client/Waypoint.h>
+
+#include <router/loop_router/loop_router.h>
+#include <planner/common/fast_waypoint_map.h>
+#include <planner/common/waypoint_lattice.h>
+
+/**
+ * Measures the time to build, copy, query, and shift a WaypointLattice
+ * along the route of the loop router.
+ *
+ * A carla server should be running with Town04, which is the map
+ * the loop router is designed for.
+ *
+ * Usage: benchmark_lattice [host] [port] [lattice range] [iterations]
+ */
+
+using CarlaClient   = carla::client::Client;
+using CarlaWorld    = carla::client::World;
+using CarlaMap      = carla::client::Map;
+using CarlaWaypoint = carla::client::Waypoint;
+using Clock         = std::chrono::steady_clock;
+
+const double seconds(const Clock::time_point& start, const Clock::time_point& end) {
+  return std::chrono::duration<double>(end-start).count();
+}
+
+int main(int argc, char** argv) {
+
+  const std::string host = argc > 1 ? argv[1] : "localhost";
+  const int port = argc > 2 ? std::atoi(argv[2]) : 2000;
+  const double range = argc > 3 ? std::atof(argv[3]) : 150.0;
+  const size_t iterations = argc > 4 ? std::atol(argv[4]) : 100;
+  const size_t query_num = 100000;
+
+  CarlaClient client(host, port);
+  client.SetTimeout(std::chrono::seconds(10));
+  CarlaWorld world = client.GetWorld();
+  boost::shared_ptr<const CarlaMap> map = world.GetMap();
+  printf("map: %s\n", map->GetName().c_str());
+
+  boost::shared_ptr<router::LoopRouter> router = boost::make_shared<router::LoopRouter>();
+  boost::shared_ptr<utils::FastWaypointMap> fast_map =
+    boost::make_shared<utils::FastWaypointMap>(map);
+  boost::shared_ptr<const utils::LaneGraph> lane_graph = fast_map->laneGraph(router);
+
+  // Start the lattice on the first road of the route.
+  boost::shared_ptr<CarlaWaypoint> start_waypoint = nullptr;
+  for (const auto& waypoint : map->GenerateWaypoints(5.0)) {
+    if (waypoint->GetRoadId() != router->roadSequence().front()) continue;
+    start_waypoint = fast_map->waypoint(waypoint->GetTransform().location);
+    break;
+  }
+  if (!start_waypoint) {
+    printf("cannot find a start waypoint on the route.\n");
+    return 1;
+  }
+
+  // Build.
+  boost::shared_ptr<planner::WaypointLattice> lattice = nullptr;
+  Clock::time_point start = Clock::now();
+  for (size_t i = 0; i < iterations; ++i) {
+    lattice = boost::make_shared<planner::WaypointLattice>(
+        start_waypoint, range, 1.0, router, lane_graph);
+  }
+  const double build_time = seconds(start, Clock::now()) / iterations;
+
+  // Copy.
+  size_t copied_nodes = 0;
+  start = Clock::now();
+  for (size_t i = 0; i < iterations; ++i) {
+    planner::WaypointLattice copy(*lattice);
+    copied_nodes += copy.latticeExits().size();
+  }
+  const double copy_time = seconds(start, Clock::now()) / iterations;
+
+  // Queries start from the waypoints of random nodes on the lattice.
+  std::vector<boost::shared_ptr<const CarlaWaypoint>> waypoints;
+  for (const auto& node : lattice->nodes()) waypoints.push_back(node.second->waypoint());
+
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<size_t> waypoint_dist(0, waypoints.size()-1);
+  std::uniform_real_distribution<double> range_dist(0.0, range/2.0);
+
+  std::vector<std::pair<boost::shared_ptr<const CarlaWaypoint>, double>> queries(query_num);
+  for (auto& query : queries)
+    query = std::make_pair(waypoints[waypoint_dist(rng)], range_dist(rng));
+
+  size_t found = 0;
+  start = Clock::now();
+  for (const auto& query : queries) {
+    found += static_cast<bool>(lattice->front(query.first, query.second));
+    found += static_cast<bool>(lattice->back(query.first, query.second));
+    found += static_cast<bool>(lattice->leftFront(query.first, query.second));
+    found += static_cast<bool>(lattice->frontRight(query.first, query.second));
+  }
+  const double query_time = seconds(start, Clock::now()) / (4*query_num);
+
+  // Shift.
+  planner::WaypointLattice shifted_lattice(*lattice);
+  start = Clock::now();
+  for (size_t i = 0; i < iterations; ++i) shifted_lattice.shift(2.0);
+  const double shift_time = seconds(start, Clock::now()) / iterations;
+
+  printf("nodes: %lu edges: %lu range: %.1fm\n",
+      lattice->nodes().size(), lattice->edges().size(), lattice->range());
+  printf("queries: %lu found: %lu\n", 4*query_num, found);
+  printf("build: %.3fms copy: %.3fms query: %.3fus shift: %.3fms\n",
+      build_time*1e3, copy_time*1e3, query_time*1e6, shift_time*1e3);
+
+  return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright 2020 Ke Sun
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include <boost/smart_ptr.hpp>
+#include <planner/common/best_first_queue.h>
+
+using namespace planner;
+
+/// Pop all items from the queue.
+std::vector<std::string> popAll(BestFirstQueue<std::string>& queue) {
+  std::vector<std::string> items;
+  while (boost::shared_ptr<std::string> item = queue.pop())
+    items.push_back(*item);
+  return items;
+}
+
+TEST(BestFirstQueue, order) {
+  BestFirstQueue<std::string> queue;
+  EXPECT_FALSE(queue.pop());
+
+  queue.push(boost::make_shared<std::string>("c"), 3.0);
+  queue.push(boost::make_shared<std::string>("a"), 1.0);
+  queue.push(boost::make_shared<std::string>("b"), 2.0);
+  EXPECT_EQ(popAll(queue), std::vector<std::string>({"a", "b", "c"}));
+  EXPECT_FALSE(queue.pop());
+}
+
+TEST(BestFirstQueue, ties) {
+  // Items with the same priority are popped in the order they are pushed.
+  BestFirstQueue<std::string> queue;
+  for (const std::string name : {"d", "b", "a", "e"})
+    queue.push(boost::make_shared<std::string>(name), 1.0);
+  queue.push(boost::make_shared<std::string>("c"), 0.5);
+  EXPECT_EQ(popAll(queue), std::vector<std::string>({"c", "d", "b", "a", "e"}));
+
+  // A re-pushed item is placed after the items pushed before it.
+  boost::shared_ptr<std::string> a = boost::make_shared<std::string>("a");
+  boost::shared_ptr<std::string> b = boost::make_shared<std::string>("b");
+  queue.push(a, 1.0);
+  queue.push(b, 1.0);
+  queue.push(a, 1.0);
+  EXPECT_EQ(popAll(queue), std::vector<std::string>({"b", "a"}));
+}
+
+TEST(BestFirstQueue, repush) {
+  BestFirstQueue<std::string> queue;
+  boost::shared_ptr<std::string> a = boost::make_shared<std::string>("a");
+  boost::shared_ptr<std::string> b = boost::make_shared<std::string>("b");
+  boost::shared_ptr<std::string> c = boost::make_shared<std::string>("c");
+
+  // The priority of an item is the one it is pushed with the last time.
+  queue.push(a, 3.0);
+  queue.push(b, 2.0);
+  queue.push(c, 1.0);
+  queue.push(a, 0.5);
+  queue.push(c, 4.0);
+  EXPECT_EQ(popAll(queue), std::vector<std::string>({"a", "b", "c"}));
+
+  // The outdated entries are skipped even if their priorities are
+  // the same as the latest ones.
+  queue = BestFirstQueue<std::string>();
+  queue.push(a, 1.0);
+  queue.push(b, 2.0);
+  queue.push(a, 3.0);
+  queue.push(a, 1.0);
+  EXPECT_EQ(popAll(queue), std::vector<std::string>({"a", "b"}));
+}
+
+TEST(BestFirstQueue, popOnce) {
+  BestFirstQueue<std::string> queue;
+  boost::shared_ptr<std::string> a = boost::make_shared<std::string>("a");
+  boost::shared_ptr<std::string> b = boost::make_shared<std::string>("b");
+
+  queue.push(a, 1.0);
+  queue.push(b, 2.0);
+  EXPECT_EQ(queue.pop(), a);
+
+  // An item is not pushed again once popped.
+  queue.push(a, 0.0);
+  EXPECT_EQ(queue.pop(), b);
+  EXPECT_FALSE(queue.pop());
+
+  // Items which compare equal are still different items.
+  queue.push(boost::make_shared<std::string>("a"), 0.0);
+  EXPECT_EQ(popAll(queue), std::vector<std::string>({"a"}));
+}
+
+TEST(BestFirstQueue, addressReuse) {
+  // The popped items are released by the caller, and new items may be
+  // allocated at the same addresses. The new items are still pushed.
+  BestFirstQueue<std::string> queue;
+  for (size_t i = 0; i < 100; ++i) {
+    queue.push(boost::make_shared<std::string>(std::to_string(i)), 0.0);
+    boost::shared_ptr<std::string> item = queue.pop();
+    ASSERT_TRUE(item);
+    EXPECT_EQ(*item, std::to_string(i));
+  }
+  EXPECT_FALSE(queue.pop());
+}
+
+TEST(BestFirstQueue, top) {
+  BestFirstQueue<std::string> queue;
+  EXPECT_TRUE(queue.top(2).empty());
+
+  boost::shared_ptr<std::string> a = boost::make_shared<std::string>("a");
+  boost::shared_ptr<std::string> b = boost::make_shared<std::string>("b");
+  boost::shared_ptr<std::string> c = boost::make_shared<std::string>("c");
+  boost::shared_ptr<std::string> d = boost::make_shared<std::string>("d");
+  queue.push(a, 3.0);
+  queue.push(b, 1.0);
+  queue.push(c, 1.0);
+  queue.push(d, 2.0);
+  queue.push(b, 4.0);
+
+  // The outdated entries are not returned, and the queue is not changed.
+  typedef std::vector<boost::shared_ptr<std::string>> Items;
+  EXPECT_EQ(queue.top(2), Items({c, d}));
+  EXPECT_EQ(queue.top(10), Items({c, d, a, b}));
+  EXPECT_EQ(queue.pop(), c);
+
+  // The items pushed in between are popped in the order of the priorities.
+  queue.push(a, 0.5);
+  EXPECT_EQ(queue.top(1), Items({a}));
+  EXPECT_EQ(popAll(queue), std::vector<std::string>({"a", "d", "b"}));
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -12,6 +12,9 @@
  * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#include <cmath>
+#include <limits>
+#include <vector>
 #include <gtest/gtest.h>
 #include <planner/common/intelligent_driver_model.h>
 
@@ -172,6 +175,59 @@ TEST(AdaptiveCruiseControl, idm) {
   }
 }
 
+/// Check \c idmBatch() against \c idm() over a grid of speeds and gaps,
+/// with and without lead vehicles.
+void testIdmBatch(const BasicIntelligentDriverModel& idm) {
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+
+  std::vector<double> ego_v, ego_v0, lead_v, s;
+  for (double v = 0.0; v <= 40.0; v += 2.5) {
+    for (double v0 = 5.0; v0 <= 35.0; v0 += 7.5) {
+      ego_v.push_back(v); ego_v0.push_back(v0);
+      lead_v.push_back(nan); s.push_back(nan);
+
+      for (double lv = 0.0; lv <= 40.0; lv += 5.0) {
+        for (double gap = 1.0; gap <= 150.0; gap *= 1.7) {
+          ego_v.push_back(v); ego_v0.push_back(v0);
+          lead_v.push_back(lv); s.push_back(gap);
+        }
+      }
+    }
+  }
+
+  std::vector<double> accel(ego_v.size(), 0.0);
+  idm.idmBatch(ego_v.size(), ego_v.data(), ego_v0.data(), lead_v.data(), s.data(), accel.data());
+
+  for (size_t i = 0; i < ego_v.size(); ++i) {
+    const double expected = std::isnan(lead_v[i]) ?
+      idm.idm(ego_v[i], ego_v0[i]) :
+      idm.idm(ego_v[i], ego_v0[i], lead_v[i], s[i]);
+    EXPECT_NEAR(accel[i], expected, 1e-12)
+      << "ego_v:" << ego_v[i] << " ego_v0:" << ego_v0[i]
+      << " lead_v:" << lead_v[i] << " s:" << s[i];
+  }
+}
+
+TEST(BasicIntelligentDriverModel, idmBatch) {
+  BasicIntelligentDriverModel idm;
+  testIdmBatch(idm);
+  idm.accelExp() = 3.5;
+  testIdmBatch(idm);
+}
+
+TEST(ImprovedIntelligentDriverModel, idmBatch) {
+  ImprovedIntelligentDriverModel idm;
+  testIdmBatch(idm);
+  idm.accelExp() = 3.5;
+  testIdmBatch(idm);
+}
+
+TEST(AdaptiveCruiseControl, idmBatch) {
+  AdaptiveCruiseControl idm;
+  testIdmBatch(idm);
+  idm.accelExp() = 3.5;
+  testIdmBatch(idm);
+}
 
 int main(int argc, char** argv) {
   testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,357 @@
+/*
+ * Copyright 2020 Ke Sun
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cstdio>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include <boost/smart_ptr.hpp>
+
+#include <carla/client/Client.h>
+#include <carla/client/World.h>
+#include <carla/client/Map.h>
+#include <carla/client/Waypoint.h>
+
+#include <router/loop_router/loop_router.h>
+#include <planner/common/fast_waypoint_map.h>
+#include <planner/common/snapshot.h>
+#include <planner/common/vehicle_path.h>
+#include <planner/common/task_pool.h>
+#include <planner/idm_lattice_planner/idm_lattice_planner.h>
+#include <planner/slc_lattice_planner/slc_lattice_planner.h>
+
+/**
+ * The tests require a carla server running Town04, which is the map
+ * the loop router is designed for. The server is given by the
+ * CARLA_HOST and CARLA_PORT environment variables, localhost:2000
+ * by default. The tests do nothing if the server is not available.
+ */
+
+using namespace planner;
+
+using CarlaClient      = carla::client::Client;
+using CarlaMap         = carla::client::Map;
+using CarlaWaypoint    = carla::client::Waypoint;
+using CarlaBoundingBox = carla::geom::BoundingBox;
+
+/// The nodes of the stations (vertices) on the optimal path, and the cost of the path.
+using OptimalPath = std::pair<std::vector<size_t>, double>;
+
+/// Compares the A* expansion of the IDM lattice planner with the layered one.
+class TestIDMLatticePlanner : public IDMLatticePlanner {
+
+protected:
+
+  using Station = idm_lattice_planner::Station;
+
+public:
+
+  TestIDMLatticePlanner(const double sim_time_step,
+                        const double spatial_horizon,
+                        const boost::shared_ptr<router::Router>& router,
+                        const boost::shared_ptr<CarlaMap>& map,
+                        const boost::shared_ptr<utils::FastWaypointMap>& fast_map) :
+    IDMLatticePlanner(sim_time_step, spatial_horizon, router, map, fast_map) {}
+
+  /// Number of the stations in the graph.
+  const size_t stations() const { return node_to_station_table_.size(); }
+
+  /// Construct the station graph for the snapshot, and select the optimal path.
+  OptimalPath optimalPath(const Snapshot& snapshot, const bool layered) {
+    startPlanningCycle();
+    updateWaypointLattice(snapshot);
+    std::deque<boost::shared_ptr<Station>> station_queue = pruneStationGraph(snapshot);
+    if (layered) constructStationGraphLayered(station_queue);
+    else constructStationGraph(station_queue);
+
+    std::list<ContinuousPath> path_seq;
+    std::list<boost::weak_ptr<Station>> station_seq;
+    selectOptimalPath(path_seq, station_seq);
+
+    OptimalPath path;
+    for (const boost::weak_ptr<Station>& station : station_seq)
+      path.first.push_back(station.lock()->id());
+    path.second = costFromRootToTerminal(station_seq.back().lock());
+    return path;
+  }
+
+protected:
+
+  /// Expand all stations layer by layer, which constructs the full graph.
+  void constructStationGraphLayered(std::deque<boost::shared_ptr<Station>>& station_queue) {
+    while (!station_queue.empty()) {
+      boost::shared_ptr<Station> station = station_queue.front();
+      station_queue.pop_front();
+
+      for (Edge& edge : stationEdges(station)) {
+        evaluateEdge(edge, true);
+        boost::shared_ptr<Station> next_station = connectEdge(edge);
+        if (!next_station) continue;
+        if (node_to_station_table_.count(next_station->id()) != 0) continue;
+
+        node_to_station_table_[next_station->id()] = next_station;
+        if (next_station->id() == edge.target_node->id())
+          station_queue.push_back(next_station);
+      }
+    }
+    return;
+  }
+
+}; // End class TestIDMLatticePlanner.
+
+/// Compares the A* expansion of the SLC lattice planner with the layered one.
+class TestSLCLatticePlanner : public SLCLatticePlanner {
+
+protected:
+
+  using Vertex = slc_lattice_planner::Vertex;
+
+public:
+
+  TestSLCLatticePlanner(const double sim_time_step,
+                        const double spatial_horizon,
+                        const boost::shared_ptr<router::Router>& router,
+                        const boost::shared_ptr<CarlaMap>& map,
+                        const boost::shared_ptr<utils::FastWaypointMap>& fast_map) :
+    SLCLatticePlanner(sim_time_step, spatial_horizon, router, map, fast_map) {}
+
+  /// Number of the vertices in the graph.
+  const size_t vertices() const { return all_vertices_.size(); }
+
+  /// Construct the vertex graph for the snapshot, and select the optimal path.
+  OptimalPath optimalPath(const Snapshot& snapshot, const bool layered) {
+    startPlanningCycle();
+    updateWaypointLattice(snapshot);
+    std::deque<boost::shared_ptr<Vertex>> vertex_queue = pruneVertexGraph(snapshot);
+    if (layered) constructVertexGraphLayered(vertex_queue);
+    else constructVertexGraph(vertex_queue);
+
+    std::list<ContinuousPath> path_seq;
+    std::list<boost::weak_ptr<Vertex>> vertex_seq;
+    selectOptimalPath(path_seq, vertex_seq);
+
+    OptimalPath path;
+    for (const boost::weak_ptr<Vertex>& vertex : vertex_seq) {
+      const boost::shared_ptr<const Vertex> const_vertex = vertex.lock();
+      path.first.push_back(const_vertex->node()->id());
+    }
+    path.second = costFromRootToTerminal(vertex_seq.back().lock());
+    return path;
+  }
+
+protected:
+
+  /// Expand all vertices layer by layer, which constructs the full graph.
+  void constructVertexGraphLayered(std::deque<boost::shared_ptr<Vertex>>& vertex_queue) {
+    while (!vertex_queue.empty()) {
+      boost::shared_ptr<Vertex> vertex = vertex_queue.front();
+      vertex_queue.pop_front();
+
+      for (Edge& edge : vertexEdges(vertex)) {
+        evaluateEdge(edge);
+        boost::shared_ptr<Vertex> next_vertex = connectEdge(edge);
+        if (!next_vertex) continue;
+
+        all_vertices_.push_back(next_vertex);
+        if (next_vertex->node().lock()->id() == edge.target_node->id())
+          vertex_queue.push_back(next_vertex);
+      }
+    }
+    return;
+  }
+
+}; // End class TestSLCLatticePlanner.
+
+class LatticePlannerTest : public ::testing::Test {
+
+protected:
+
+  static boost::shared_ptr<CarlaMap> map_;
+  static boost::shared_ptr<utils::FastWaypointMap> fast_map_;
+  static boost::shared_ptr<router::LoopRouter> router_;
+
+  /// A waypoint on the first road of the route.
+  static boost::shared_ptr<CarlaWaypoint> start_waypoint_;
+
+  static void SetUpTestCase() {
+    const char* host = std::getenv("CARLA_HOST");
+    const char* port = std::getenv("CARLA_PORT");
+
+    try {
+      CarlaClient client(host ? host : "localhost", port ? std::atoi(port) : 2000);
+      client.SetTimeout(std::chrono::seconds(10));
+      map_ = client.GetWorld().GetMap();
+    } catch (const std::exception& e) {
+      std::printf("carla server is not available: %s\n", e.what());
+      map_ = nullptr;
+      return;
+    }
+
+    fast_map_ = boost::make_shared<utils::FastWaypointMap>(map_);
+    router_ = boost::make_shared<router::LoopRouter>();
+
+    for (const auto& waypoint : map_->GenerateWaypoints(5.0)) {
+      if (waypoint->GetRoadId() != router_->roadSequence().front()) continue;
+      start_waypoint_ = fast_map_->waypoint(waypoint->GetTransform().location);
+      break;
+    }
+    return;
+  }
+
+  static void TearDownTestCase() {
+    start_waypoint_ = nullptr;
+    router_ = nullptr;
+    fast_map_ = nullptr;
+    map_ = nullptr;
+    return;
+  }
+
+  /// Whether the carla server is available.
+  const bool available() const { return map_ && start_waypoint_; }
+
+  /// Create a vehicle at the given waypoint.
+  static Vehicle vehicle(const size_t id,
+                         const boost::shared_ptr<const CarlaWaypoint>& waypoint,
+                         const double speed) {
+    CarlaBoundingBox bounding_box;
+    bounding_box.extent = carla::geom::Vector3D(2.3f, 1.0f, 0.8f);
+    return Vehicle(id, bounding_box, waypoint->GetTransform(),
+                   speed, 20.0, 0.0, 0.0);
+  }
+
+  /**
+   * \brief Create the snapshots to be planned for.
+   *
+   * The ego is either alone, or behind a slow agent in its lane, with
+   * another agent in the lane next to it if there is one, so that the
+   * optimal path may keep the lane or change to either side.
+   */
+  static std::vector<Snapshot> snapshots() {
+    std::vector<Snapshot> snapshots;
+    const Vehicle ego = vehicle(0, start_waypoint_, 15.0);
+
+    snapshots.emplace_back(ego, std::unordered_map<size_t, Vehicle>(),
+                           router_, map_, fast_map_);
+
+    for (const double gap : {30.0, 60.0}) {
+      std::unordered_map<size_t, Vehicle> agents;
+      agents.emplace(1, vehicle(1, start_waypoint_->GetNext(gap).front(), 5.0));
+
+      boost::shared_ptr<CarlaWaypoint> side_waypoint = start_waypoint_->GetLeft();
+      if (!side_waypoint) side_waypoint = start_waypoint_->GetRight();
+      if (side_waypoint && side_waypoint->GetType() == carla::road::Lane::LaneType::Driving) {
+        agents.emplace(2, vehicle(2, side_waypoint->GetNext(gap+20.0).front(), 10.0));
+      }
+
+      snapshots.emplace_back(ego, agents, router_, map_, fast_map_);
+    }
+
+    return snapshots;
+  }
+
+}; // End class LatticePlannerTest.
+
+boost::shared_ptr<CarlaMap> LatticePlannerTest::map_ = nullptr;
+boost::shared_ptr<utils::FastWaypointMap> LatticePlannerTest::fast_map_ = nullptr;
+boost::shared_ptr<router::LoopRouter> LatticePlannerTest::router_ = nullptr;
+boost::shared_ptr<CarlaWaypoint> LatticePlannerTest::start_waypoint_ = nullptr;
+
+TEST_F(LatticePlannerTest, idmAStar) {
+  if (!available()) return;
+
+  for (const Snapshot& snapshot : snapshots()) {
+    SCOPED_TRACE(snapshot.string());
+    TestIDMLatticePlanner astar_planner(0.1, 150.0, router_, map_, fast_map_);
+    TestIDMLatticePlanner layered_planner(0.1, 150.0, router_, map_, fast_map_);
+
+    const OptimalPath astar_path = astar_planner.optimalPath(snapshot, false);
+    const OptimalPath layered_path = layered_planner.optimalPath(snapshot, true);
+
+    // The A* expansion selects the same path as the full graph,
+    // while expanding no more stations.
+    EXPECT_EQ(astar_path.first, layered_path.first);
+    EXPECT_NEAR(astar_path.second, layered_path.second, 1e-6);
+    EXPECT_LE(astar_planner.stations(), layered_planner.stations());
+  }
+}
+
+TEST_F(LatticePlannerTest, slcAStar) {
+  if (!available()) return;
+
+  for (const Snapshot& snapshot : snapshots()) {
+    SCOPED_TRACE(snapshot.string());
+    TestSLCLatticePlanner astar_planner(0.1, 150.0, router_, map_, fast_map_);
+    TestSLCLatticePlanner layered_planner(0.1, 150.0, router_, map_, fast_map_);
+
+    const OptimalPath astar_path = astar_planner.optimalPath(snapshot, false);
+    const OptimalPath layered_path = layered_planner.optimalPath(snapshot, true);
+
+    // The A* expansion selects the same path as the full graph,
+    // while expanding no more vertices.
+    EXPECT_EQ(astar_path.first, layered_path.first);
+    EXPECT_NEAR(astar_path.second, layered_path.second, 1e-6);
+    EXPECT_LE(astar_planner.vertices(), layered_planner.vertices());
+  }
+}
+
+TEST_F(LatticePlannerTest, idmTaskPool) {
+  if (!available()) return;
+
+  for (const Snapshot& snapshot : snapshots()) {
+    SCOPED_TRACE(snapshot.string());
+    TestIDMLatticePlanner serial_planner(0.1, 150.0, router_, map_, fast_map_);
+    TestIDMLatticePlanner parallel_planner(0.1, 150.0, router_, map_, fast_map_);
+    parallel_planner.taskPool() = boost::make_shared<utils::TaskPool>(4);
+
+    const OptimalPath serial_path = serial_planner.optimalPath(snapshot, false);
+    const OptimalPath parallel_path = parallel_planner.optimalPath(snapshot, false);
+
+    // The stations expanded in batches with the task pool
+    // result in the same graph as the ones expanded one by one.
+    EXPECT_EQ(serial_path.first, parallel_path.first);
+    EXPECT_NEAR(serial_path.second, parallel_path.second, 1e-6);
+    EXPECT_EQ(serial_planner.stations(), parallel_planner.stations());
+  }
+}
+
+TEST_F(LatticePlannerTest, slcTaskPool) {
+  if (!available()) return;
+
+  for (const Snapshot& snapshot : snapshots()) {
+    SCOPED_TRACE(snapshot.string());
+    TestSLCLatticePlanner serial_planner(0.1, 150.0, router_, map_, fast_map_);
+    TestSLCLatticePlanner parallel_planner(0.1, 150.0, router_, map_, fast_map_);
+    parallel_planner.taskPool() = boost::make_shared<utils::TaskPool>(4);
+
+    const OptimalPath serial_path = serial_planner.optimalPath(snapshot, false);
+    const OptimalPath parallel_path = parallel_planner.optimalPath(snapshot, false);
+
+    // The vertices expanded in batches with the task pool
+    // result in the same graph as the ones expanded one by one.
+    EXPECT_EQ(serial_path.first, parallel_path.first);
+    EXPECT_NEAR(serial_path.second, parallel_path.second, 1e-6);
+    EXPECT_EQ(serial_planner.vertices(), parallel_planner.vertices());
+  }
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,389 @@
+/*
+ * Copyright 2020 Ke Sun
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cstdint>
+#include <random>
+#include <unordered_map>
+#include <vector>
+#include <gtest/gtest.h>
+#include <planner/common/node_arena.h>
+
+using namespace planner;
+
+/// A minimal node type which can be stored in a \c NodeArena.
+class TestNode {
+
+private:
+
+  double distance_ = 0.0;
+  NodeIndex index_ = kInvalidNodeIndex;
+  uint32_t generation_ = 0;
+  const NodeArena<TestNode>* arena_ = nullptr;
+
+  template<typename Node> friend class planner::NodeArena;
+
+public:
+
+  int value = 0;
+
+  TestNode() = default;
+  explicit TestNode(const int value) : value(value) {}
+
+  const NodeIndex index() const { return index_; }
+
+  const uint32_t generation() const { return generation_; }
+
+  const double distance() const {
+    return arena_ ? distance_ - arena_->distanceOffset() : distance_;
+  }
+
+}; // End class TestNode.
+
+TEST(NodeArena, addRemove) {
+  boost::shared_ptr<NodeArena<TestNode>> arena =
+    boost::make_shared<NodeArena<TestNode>>();
+
+  for (int i = 0; i < 3; ++i)
+    EXPECT_EQ(arena->add(TestNode(i), 10.0*i), static_cast<NodeIndex>(i));
+  EXPECT_EQ(arena->size(), 3);
+  EXPECT_EQ(arena->slots(), 3);
+
+  for (NodeIndex i = 0; i < 3; ++i) {
+    ASSERT_TRUE(arena->alive(i));
+    boost::shared_ptr<const TestNode> node = arena->node(i);
+    ASSERT_TRUE(node);
+    EXPECT_EQ(node->value, static_cast<int>(i));
+    EXPECT_EQ(node->index(), i);
+    EXPECT_DOUBLE_EQ(node->distance(), 10.0*i);
+    EXPECT_EQ(node->generation(), 0);
+    EXPECT_TRUE(arena->valid(node, node->generation()));
+  }
+
+  // Shifting the distance offset moves all nodes.
+  arena->distanceOffset() = 5.0;
+  EXPECT_DOUBLE_EQ(arena->node(2)->distance(), 15.0);
+  EXPECT_EQ(arena->add(TestNode(3), 0.0), 3);
+  EXPECT_DOUBLE_EQ(arena->node(3)->distance(), 0.0);
+
+  arena->remove(1);
+  EXPECT_FALSE(arena->alive(1));
+  EXPECT_FALSE(arena->node(1));
+  EXPECT_EQ(arena->size(), 3);
+
+  // Removing a node twice, or a node out of range, does nothing.
+  arena->remove(1);
+  arena->remove(100);
+  EXPECT_EQ(arena->size(), 3);
+  EXPECT_FALSE(arena->alive(kInvalidNodeIndex));
+  EXPECT_FALSE(arena->node(kInvalidNodeIndex));
+
+  arena->clear();
+  EXPECT_EQ(arena->size(), 0);
+  EXPECT_EQ(arena->slots(), 0);
+  EXPECT_DOUBLE_EQ(arena->distanceOffset(), 0.0);
+}
+
+TEST(NodeArena, recycle) {
+  boost::shared_ptr<NodeArena<TestNode>> arena =
+    boost::make_shared<NodeArena<TestNode>>();
+  for (int i = 0; i < 3; ++i) arena->add(TestNode(i), 0.0);
+
+  // The pointer keeps the arena alive, but not the node.
+  boost::shared_ptr<const TestNode> node = arena->node(1);
+  const uint32_t generation = node->generation();
+  boost::weak_ptr<NodeArena<TestNode>> weak_arena = arena;
+  arena->remove(1);
+  EXPECT_FALSE(arena->valid(node, generation));
+  EXPECT_EQ(node->index(), kInvalidNodeIndex);
+
+  // The slot is recycled, and the old pointer refers to the new node,
+  // which is told apart by its generation.
+  const NodeIndex index = arena->add(TestNode(3), 0.0);
+  EXPECT_EQ(index, 1);
+  EXPECT_EQ(arena->size(), 3);
+  EXPECT_EQ(arena->slots(), 3);
+  EXPECT_EQ(node->value, 3);
+  EXPECT_EQ(node->generation(), generation+1);
+  EXPECT_FALSE(arena->valid(node, generation));
+  EXPECT_TRUE(arena->valid(node, node->generation()));
+
+  // The generations of the other slots are not affected.
+  EXPECT_TRUE(arena->valid(arena->node(0), 0));
+  EXPECT_TRUE(arena->valid(arena->node(2), 0));
+
+  // Adding and removing nodes repeatedly reuses the same slots.
+  for (int i = 0; i < 100; ++i) {
+    arena->remove(arena->add(TestNode(i), 0.0));
+  }
+  EXPECT_EQ(arena->slots(), 4);
+  EXPECT_EQ(arena->size(), 3);
+
+  arena.reset();
+  EXPECT_FALSE(weak_arena.expired());
+  node.reset();
+  EXPECT_TRUE(weak_arena.expired());
+}
+
+TEST(NodeArena, copy) {
+  boost::shared_ptr<NodeArena<TestNode>> arena =
+    boost::make_shared<NodeArena<TestNode>>();
+  for (int i = 0; i < 4; ++i) arena->add(TestNode(i), 1.0*i);
+  arena->remove(2);
+  arena->distanceOffset() = 1.0;
+
+  boost::shared_ptr<NodeArena<TestNode>> copy =
+    boost::make_shared<NodeArena<TestNode>>(*arena);
+  EXPECT_EQ(copy->size(), arena->size());
+  EXPECT_EQ(copy->slots(), arena->slots());
+  EXPECT_FALSE(copy->alive(2));
+  EXPECT_DOUBLE_EQ(copy->node(3)->distance(), 2.0);
+
+  // The pointers only belong to the arena they are taken from.
+  EXPECT_TRUE(copy->valid(copy->node(3), 0));
+  EXPECT_FALSE(copy->valid(arena->node(3), 0));
+  EXPECT_FALSE(arena->valid(copy->node(3), 0));
+
+  // Modifying the copy leaves the original arena untouched.
+  copy->distanceOffset() = 0.0;
+  copy->remove(3);
+  EXPECT_TRUE(arena->alive(3));
+  EXPECT_DOUBLE_EQ(arena->node(3)->distance(), 2.0);
+}
+
+TEST(NodeColumns, insertErase) {
+  NodeColumns columns;
+  EXPECT_TRUE(columns.empty());
+
+  columns.insert(5, 0);
+  columns.insert(5, 1);
+  EXPECT_EQ(columns.size(), 1);
+  EXPECT_EQ(columns.firstColumn(), 5);
+  EXPECT_EQ(columns.endColumn(), 6);
+  EXPECT_EQ(columns.column(5), std::vector<NodeIndex>({0, 1}));
+
+  // Empty columns are created in between.
+  columns.insert(2, 2);
+  columns.insert(8, 3);
+  EXPECT_EQ(columns.firstColumn(), 2);
+  EXPECT_EQ(columns.endColumn(), 9);
+  EXPECT_EQ(columns.column(2), std::vector<NodeIndex>({2}));
+  EXPECT_TRUE(columns.column(3).empty());
+  EXPECT_TRUE(columns.column(7).empty());
+  EXPECT_EQ(columns.column(8), std::vector<NodeIndex>({3}));
+
+  columns.erase(5, 0);
+  EXPECT_EQ(columns.column(5), std::vector<NodeIndex>({1}));
+  // Erasing a node out of the columns does nothing.
+  columns.erase(100, 1);
+  columns.erase(5, 100);
+  EXPECT_EQ(columns.column(5), std::vector<NodeIndex>({1}));
+
+  columns.popFront();
+  EXPECT_EQ(columns.firstColumn(), 3);
+  EXPECT_EQ(columns.size(), 6);
+
+  columns.clear();
+  EXPECT_TRUE(columns.empty());
+}
+
+TEST(NodeColumns, ringBuffer) {
+  // Columns are added at the front and dropped at the back like a shifting
+  // lattice, which wraps around and grows the ring buffer.
+  NodeColumns columns;
+  int64_t first = 0;
+  for (int64_t c = 0; c < 1000; ++c) {
+    columns.insert(c, static_cast<NodeIndex>(c));
+    columns.insert(c, static_cast<NodeIndex>(c+1000));
+    if (c % 3 == 0 && c > 0) continue;
+    if (columns.size() > static_cast<size_t>(c/4)) {
+      columns.popFront();
+      ++first;
+    }
+  }
+
+  EXPECT_EQ(columns.firstColumn(), first);
+  EXPECT_EQ(columns.endColumn(), 1000);
+  for (int64_t c = columns.firstColumn(); c < columns.endColumn(); ++c) {
+    EXPECT_EQ(columns.column(c), std::vector<NodeIndex>(
+          {static_cast<NodeIndex>(c), static_cast<NodeIndex>(c+1000)}));
+  }
+
+  // Extending the columns backwards wraps around the ring buffer.
+  columns.insert(first-10, 5000);
+  EXPECT_EQ(columns.firstColumn(), first-10);
+  EXPECT_EQ(columns.column(first-10), std::vector<NodeIndex>({5000}));
+  EXPECT_EQ(columns.column(first), std::vector<NodeIndex>(
+        {static_cast<NodeIndex>(first), static_cast<NodeIndex>(first+1000)}));
+  EXPECT_EQ(columns.column(999), std::vector<NodeIndex>({999, 1999}));
+}
+
+/// Add a lane of nodes from \c first to \c last, each at the column of its index.
+void addLane(NodeSegments& segments, const NodeIndex first, const NodeIndex last) {
+  for (NodeIndex node = first; node <= last; ++node) {
+    segments.add(node, node);
+    if (node > first) segments.link(node-1, node-1, node, node);
+  }
+  return;
+}
+
+TEST(NodeSegments, lookup) {
+  NodeSegments segments;
+  addLane(segments, 0, 9);
+
+  // The nodes linked one after another make up a single segment.
+  EXPECT_EQ(segments.size(), 1);
+  const uint32_t segment = segments.segment(0);
+  EXPECT_EQ(segments.firstColumn(segment), 0);
+  EXPECT_EQ(segments.lastColumn(segment), 9);
+  for (NodeIndex node = 0; node < 10; ++node) {
+    EXPECT_EQ(segments.segment(node), segment);
+    EXPECT_EQ(segments.node(segment, node), node);
+  }
+
+  // Removing the first node shrinks the segment.
+  segments.remove(0, 0);
+  EXPECT_EQ(segments.size(), 1);
+  EXPECT_EQ(segments.firstColumn(segment), 1);
+  EXPECT_EQ(segments.node(segment, 1), 1);
+
+  // Removing a node in the middle splits the segment.
+  segments.remove(5, 5);
+  EXPECT_EQ(segments.size(), 2);
+  const uint32_t back_segment = segments.segment(1);
+  const uint32_t front_segment = segments.segment(6);
+  EXPECT_NE(back_segment, front_segment);
+  EXPECT_EQ(segments.firstColumn(back_segment), 1);
+  EXPECT_EQ(segments.lastColumn(back_segment), 4);
+  EXPECT_EQ(segments.firstColumn(front_segment), 6);
+  EXPECT_EQ(segments.lastColumn(front_segment), 9);
+  for (NodeIndex node = 1; node < 10; ++node) {
+    if (node == 5) continue;
+    EXPECT_EQ(segments.node(segments.segment(node), node), node);
+  }
+
+  // Removing the last nodes releases the segment for reuse.
+  for (NodeIndex node = 9; node >= 6; --node) segments.remove(node, node);
+  EXPECT_EQ(segments.size(), 1);
+  segments.add(20, 20);
+  EXPECT_EQ(segments.size(), 2);
+  EXPECT_EQ(segments.segment(20), front_segment);
+  EXPECT_EQ(segments.node(front_segment, 20), 20);
+
+  segments.clear();
+  EXPECT_EQ(segments.size(), 0);
+}
+
+TEST(NodeSegments, mergeSplit) {
+  NodeSegments segments;
+  addLane(segments, 0, 4);
+  addLane(segments, 10, 14);
+  EXPECT_EQ(segments.size(), 2);
+
+  // Another lane merges into node 3, which is now reached from node 20.
+  // The segment is split in front of node 2, and node 3 is appended to node 20.
+  segments.add(20, 2);
+  segments.link(20, 2, 3, 3);
+  EXPECT_NE(segments.segment(2), segments.segment(3));
+  EXPECT_EQ(segments.segment(20), segments.segment(3));
+  EXPECT_EQ(segments.lastColumn(segments.segment(2)), 2);
+  EXPECT_EQ(segments.firstColumn(segments.segment(3)), 2);
+  EXPECT_EQ(segments.lastColumn(segments.segment(3)), 4);
+
+  // Node 12 now reaches node 21 instead of node 13. The segment is split
+  // after node 12, and node 21 is appended to node 12.
+  segments.add(21, 13);
+  segments.link(12, 12, 21, 13);
+  EXPECT_NE(segments.segment(12), segments.segment(13));
+  EXPECT_EQ(segments.segment(12), segments.segment(21));
+  EXPECT_EQ(segments.lastColumn(segments.segment(12)), 13);
+  EXPECT_EQ(segments.firstColumn(segments.segment(13)), 13);
+  EXPECT_EQ(segments.size(), 4);
+
+  // Every node is still found at its column.
+  const std::vector<std::pair<NodeIndex, int64_t>> nodes {
+    {0, 0}, {1, 1}, {2, 2}, {3, 3}, {4, 4},
+    {10, 10}, {11, 11}, {12, 12}, {13, 13}, {14, 14},
+    {20, 2}, {21, 13}};
+  for (const auto& node : nodes) {
+    const uint32_t segment = segments.segment(node.first);
+    EXPECT_LE(segments.firstColumn(segment), node.second);
+    EXPECT_GE(segments.lastColumn(segment), node.second);
+    EXPECT_EQ(segments.node(segment, node.second), node.first);
+  }
+}
+
+TEST(NodeIndexTable, insertFindErase) {
+  NodeIndexTable table;
+  EXPECT_TRUE(table.empty());
+  EXPECT_EQ(table.find(1), kInvalidNodeIndex);
+  EXPECT_FALSE(table.erase(1));
+
+  table.insert(1, 10);
+  table.insert(2, 20);
+  EXPECT_EQ(table.size(), 2);
+  EXPECT_EQ(table.find(1), 10);
+  EXPECT_EQ(table.find(2), 20);
+  EXPECT_FALSE(table.contains(3));
+
+  // Inserting an existing key updates its value.
+  table.insert(1, 11);
+  EXPECT_EQ(table.size(), 2);
+  EXPECT_EQ(table.find(1), 11);
+
+  EXPECT_TRUE(table.erase(1));
+  EXPECT_FALSE(table.erase(1));
+  EXPECT_FALSE(table.contains(1));
+  EXPECT_EQ(table.find(2), 20);
+  EXPECT_EQ(table.size(), 1);
+
+  table.clear();
+  EXPECT_TRUE(table.empty());
+  EXPECT_FALSE(table.contains(2));
+}
+
+TEST(NodeIndexTable, random) {
+  // Compare with std::unordered_map under random operations, with keys
+  // drawn from a small range so that the keys are often erased and
+  // inserted again, and the table is rehashed several times.
+  NodeIndexTable table;
+  std::unordered_map<size_t, NodeIndex> reference;
+
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<size_t> key_dist(0, 2000);
+  std::uniform_int_distribution<int> op_dist(0, 2);
+
+  for (NodeIndex i = 0; i < 20000; ++i) {
+    // Carla waypoint IDs are hashes, which are spread over 64 bits.
+    const size_t key = key_dist(rng) * 0x9e3779b97f4a7c15ULL;
+    if (op_dist(rng) < 2) {
+      table.insert(key, i);
+      reference[key] = i;
+    } else {
+      EXPECT_EQ(table.erase(key), reference.erase(key) > 0);
+    }
+  }
+
+  EXPECT_EQ(table.size(), reference.size());
+  for (size_t k = 0; k <= 2000; ++k) {
+    const size_t key = k * 0x9e3779b97f4a7c15ULL;
+    std::unordered_map<size_t, NodeIndex>::const_iterator iter = reference.find(key);
+    if (iter == reference.end()) EXPECT_EQ(table.find(key), kInvalidNodeIndex);
+    else EXPECT_EQ(table.find(key), iter->second);
+  }
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
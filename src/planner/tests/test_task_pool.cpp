@@ -0,0 +1,162 @@
+/*
+ * Copyright 2020 Ke Sun
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <gtest/gtest.h>
+#include <planner/common/task_pool.h>
+
+using namespace utils;
+
+/// Run a batch of tasks, and check every task is run exactly once.
+void testBatch(TaskPool& pool, const size_t num) {
+  std::vector<std::atomic<int>> counts(num);
+  for (std::atomic<int>& count : counts) count = 0;
+
+  pool.parallelFor(num, [&counts](const size_t i)->void{ ++counts[i]; });
+  for (size_t i = 0; i < num; ++i) EXPECT_EQ(counts[i], 1) << "task " << i;
+  return;
+}
+
+TEST(TaskPool, threads) {
+  EXPECT_EQ(TaskPool(4).threads(), 4);
+  // There is at least the calling thread.
+  EXPECT_EQ(TaskPool(0).threads(), 1);
+}
+
+TEST(TaskPool, batchSize) {
+  for (const size_t threads : {1, 2, 4}) {
+    TaskPool pool(threads);
+    for (const size_t num : {0, 1, 3, 4, 5, 1000}) {
+      SCOPED_TRACE("threads " + std::to_string(threads) +
+                   " tasks " + std::to_string(num));
+      testBatch(pool, num);
+    }
+  }
+}
+
+TEST(TaskPool, stealing) {
+  // The first tasks are much more expensive than the others,
+  // and all of them are assigned to the first queues at the start.
+  TaskPool pool(4);
+  std::mutex mutex;
+  std::set<std::thread::id> thread_ids;
+  std::vector<int> counts(40, 0);
+
+  pool.parallelFor(counts.size(), [&](const size_t i)->void{
+    if (i < 4) std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::lock_guard<std::mutex> lock(mutex);
+    thread_ids.insert(std::this_thread::get_id());
+    ++counts[i];
+  });
+
+  for (const int count : counts) EXPECT_EQ(count, 1);
+  EXPECT_GT(thread_ids.size(), 1);
+}
+
+TEST(TaskPool, consecutiveBatches) {
+  // Batches are started right after the previous ones are done,
+  // while the workers may still be leaving the previous batches.
+  TaskPool pool(4);
+  for (size_t batch = 0; batch < 2000; ++batch) {
+    std::atomic<size_t> sum(0);
+    pool.parallelFor(batch%16, [&sum](const size_t i)->void{ sum += i+1; });
+    EXPECT_EQ(sum, (batch%16)*(batch%16+1)/2);
+  }
+}
+
+TEST(TaskPool, nestedCalls) {
+  TaskPool pool(4);
+  std::vector<std::atomic<int>> counts(8*10);
+  for (std::atomic<int>& count : counts) count = 0;
+
+  pool.parallelFor(8, [&pool, &counts](const size_t i)->void{
+    pool.parallelFor(10, [&counts, i](const size_t j)->void{ ++counts[i*10+j]; });
+  });
+  for (size_t i = 0; i < counts.size(); ++i) EXPECT_EQ(counts[i], 1) << "task " << i;
+
+  // A nested batch on another pool is run on that pool.
+  TaskPool inner_pool(2);
+  std::vector<std::atomic<int>> inner_counts(8*10);
+  for (std::atomic<int>& count : inner_counts) count = 0;
+  pool.parallelFor(8, [&inner_pool, &inner_counts](const size_t i)->void{
+    inner_pool.parallelFor(10, [&inner_counts, i](const size_t j)->void{
+      ++inner_counts[i*10+j];
+    });
+  });
+  for (size_t i = 0; i < inner_counts.size(); ++i)
+    EXPECT_EQ(inner_counts[i], 1) << "task " << i;
+
+  // The pool still works after the nested calls.
+  testBatch(pool, 100);
+}
+
+TEST(TaskPool, concurrentCalls) {
+  TaskPool pool(4);
+  std::vector<std::thread> callers;
+  std::vector<std::atomic<size_t>> sums(4);
+  for (std::atomic<size_t>& sum : sums) sum = 0;
+
+  for (size_t c = 0; c < sums.size(); ++c) {
+    callers.emplace_back([&pool, &sums, c]()->void{
+      for (size_t batch = 0; batch < 200; ++batch) {
+        pool.parallelFor(50, [&sums, c](const size_t i)->void{ sums[c] += i; });
+      }
+    });
+  }
+  for (std::thread& caller : callers) caller.join();
+
+  for (const std::atomic<size_t>& sum : sums) EXPECT_EQ(sum, 200*(49*50/2));
+}
+
+TEST(TaskPool, exception) {
+  for (const size_t threads : {1, 4}) {
+    SCOPED_TRACE("threads " + std::to_string(threads));
+    TaskPool pool(threads);
+    std::vector<std::atomic<int>> counts(100);
+    for (std::atomic<int>& count : counts) count = 0;
+
+    // The exception is rethrown once all tasks are done.
+    EXPECT_THROW(pool.parallelFor(counts.size(), [&counts](const size_t i)->void{
+      ++counts[i];
+      if (i == 5) throw std::runtime_error("task failed");
+    }), std::runtime_error);
+    for (size_t i = 0; i < counts.size(); ++i) EXPECT_EQ(counts[i], 1) << "task " << i;
+
+    // Only one of the exceptions is rethrown if several tasks throw.
+    EXPECT_THROW(pool.parallelFor(100, [](const size_t i)->void{
+      if (i % 10 == 0) throw std::out_of_range("task failed");
+    }), std::out_of_range);
+
+    // An exception from a nested batch reaches the outer caller.
+    EXPECT_THROW(pool.parallelFor(4, [&pool](const size_t)->void{
+      pool.parallelFor(4, [](const size_t j)->void{
+        if (j == 3) throw std::runtime_error("nested task failed");
+      });
+    }), std::runtime_error);
+
+    // The pool still works after the exceptions.
+    testBatch(pool, 100);
+  }
+}
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,380 @@
+/*
+ * Copyright 2020 Ke Sun
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may be used to endorse or promote products derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <cmath>
+#include <cstdio>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include <boost/smart_ptr.hpp>
+
+#include <carla/client/Client.h>
+#include <carla/client/World.h>
+#include <carla/client/Map.h>
+#include <carla/client/Waypoint.h>
+
+#include <router/loop_router/loop_router.h>
+#include <planner/common/fast_waypoint_map.h>
+#include <planner/common/utils.h>
+#include <planner/common/snapshot.h>
+#include <planner/common/traffic_simulator.h>
+#include <planner/common/vehicle_path.h>
+#include <planner/spatiotemporal_lattice_planner/spatiotemporal_lattice_planner.h>
+
+/**
+ * The tests require a carla server running Town04, which is the map
+ * the loop router is designed for. The server is given by the
+ * CARLA_HOST and CARLA_PORT environment variables, localhost:2000
+ * by default. The tests do nothing if the server is not available.
+ */
+
+using namespace planner;
+using planner::spatiotemporal_lattice_planner::ConstAccelTrafficSimulator;
+
+using CarlaClient      = carla::client::Client;
+using CarlaMap         = carla::client::Map;
+using CarlaWaypoint    = carla::client::Waypoint;
+using CarlaTransform   = carla::geom::Transform;
+using CarlaBoundingBox = carla::geom::BoundingBox;
+
+/// Exposes the agent updates of the traffic simulator.
+class TestTrafficSimulator : public TrafficSimulator {
+
+public:
+
+  TestTrafficSimulator(const Snapshot& snapshot,
+                       const boost::shared_ptr<router::Router>& router,
+                       const boost::shared_ptr<CarlaMap>& map,
+                       const boost::shared_ptr<utils::FastWaypointMap>& fast_map) :
+    TrafficSimulator(snapshot, router, map, fast_map) {}
+
+  using TrafficSimulator::snapshot;
+  Snapshot& snapshot() { return snapshot_; }
+
+  using TrafficSimulator::updatedAgentTuple;
+  using TrafficSimulator::frenetAgentTuple;
+
+protected:
+
+  virtual const double egoAcceleration() const override {
+    return snapshot_.ego().acceleration();
+  }
+
+  virtual const double agentAcceleration(const size_t agent) const override {
+    return snapshot_.agent(agent).acceleration();
+  }
+
+}; // End class TestTrafficSimulator.
+
+class TrafficSimulatorTest : public ::testing::Test {
+
+protected:
+
+  static boost::shared_ptr<CarlaMap> map_;
+  static boost::shared_ptr<utils::FastWaypointMap> fast_map_;
+  static boost::shared_ptr<router::LoopRouter> router_;
+
+  /// A waypoint on the first road of the route.
+  static boost::shared_ptr<CarlaWaypoint> start_waypoint_;
+
+  static void SetUpTestCase() {
+    const char* host = std::getenv("CARLA_HOST");
+    const char* port = std::getenv("CARLA_PORT");
+
+    try {
+      CarlaClient client(host ? host : "localhost", port ? std::atoi(port) : 2000);
+      client.SetTimeout(std::chrono::seconds(10));
+      map_ = client.GetWorld().GetMap();
+    } catch (const std::exception& e) {
+      std::printf("carla server is not available: %s\n", e.what());
+      map_ = nullptr;
+      return;
+    }
+
+    fast_map_ = boost::make_shared<utils::FastWaypointMap>(map_);
+    router_ = boost::make_shared<router::LoopRouter>();
+
+    for (const auto& waypoint : map_->GenerateWaypoints(5.0)) {
+      if (waypoint->GetRoadId() != router_->roadSequence().front()) continue;
+      start_waypoint_ = fast_map_->waypoint(waypoint->GetTransform().location);
+      break;
+    }
+    return;
+  }
+
+  static void TearDownTestCase() {
+    start_waypoint_ = nullptr;
+    router_ = nullptr;
+    fast_map_ = nullptr;
+    map_ = nullptr;
+    return;
+  }
+
+  /// Whether the carla server is available.
+  const bool available() const { return map_ && start_waypoint_; }
+
+  /// Create a vehicle at the given waypoint.
+  static Vehicle vehicle(const size_t id,
+                         const boost::shared_ptr<const CarlaWaypoint>& waypoint,
+                         const double speed,
+                         const double acceleration) {
+    CarlaBoundingBox bounding_box;
+    bounding_box.extent = carla::geom::Vector3D(2.3f, 1.0f, 0.8f);
+    return Vehicle(id, bounding_box, waypoint->GetTransform(),
+                   speed, 20.0, acceleration, 0.0);
+  }
+
+  /// Find a waypoint on a road which is not on the route,
+  /// with a successor on the same road.
+  static boost::shared_ptr<CarlaWaypoint> offRouteWaypoint() {
+    for (const auto& waypoint : map_->GenerateWaypoints(5.0)) {
+      if (router_->hasRoad(waypoint->GetRoadId())) continue;
+      const std::vector<boost::shared_ptr<CarlaWaypoint>> next_waypoints =
+        waypoint->GetNext(1.0);
+      if (next_waypoints.empty()) continue;
+      if (next_waypoints.front()->GetRoadId() != waypoint->GetRoadId()) continue;
+      return fast_map_->waypoint(waypoint->GetTransform().location);
+    }
+    return nullptr;
+  }
+
+}; // End class TrafficSimulatorTest.
+
+boost::shared_ptr<CarlaMap> TrafficSimulatorTest::map_ = nullptr;
+boost::shared_ptr<utils::FastWaypointMap> TrafficSimulatorTest::fast_map_ = nullptr;
+boost::shared_ptr<router::LoopRouter> TrafficSimulatorTest::router_ = nullptr;
+boost::shared_ptr<CarlaWaypoint> TrafficSimulatorTest::start_waypoint_ = nullptr;
+
+TEST_F(TrafficSimulatorTest, offRouteAgent) {
+  if (!available()) return;
+
+  const boost::shared_ptr<CarlaWaypoint> agent_waypoint =
+    start_waypoint_->GetNext(20.0).front();
+  std::unordered_map<size_t, Vehicle> agents;
+  agents.emplace(1, vehicle(1, agent_waypoint, 10.0, 0.0));
+  const Snapshot snapshot(vehicle(0, start_waypoint_, 10.0, 0.0),
+                          agents, router_, map_, fast_map_);
+  ASSERT_EQ(snapshot.agents().count(1), 1);
+
+  // Move the agent onto a road which is not on the route.
+  const boost::shared_ptr<CarlaWaypoint> off_route_waypoint = offRouteWaypoint();
+  ASSERT_TRUE(off_route_waypoint);
+
+  TestTrafficSimulator simulator(snapshot, router_, map_, fast_map_);
+  Vehicle& agent = simulator.snapshot().agent(1);
+  agent.transform() = off_route_waypoint->GetTransform();
+  agent.waypointHint() = boost::none;
+
+  // The agent follows the lane it is on instead of the route.
+  utils::Expected<std::tuple<size_t, CarlaTransform, double, double, double>> tuple =
+    std::make_tuple(size_t(0), CarlaTransform(), 0.0, 0.0, 0.0);
+  ASSERT_NO_THROW(tuple = simulator.updatedAgentTuple(1, 1.0, 0.1));
+  ASSERT_TRUE(tuple);
+
+  const double movement = 10.0*0.1 + 0.5*1.0*0.1*0.1;
+  const boost::shared_ptr<CarlaWaypoint> next_waypoint =
+    off_route_waypoint->GetNext(movement).front();
+  EXPECT_EQ(std::get<0>(*tuple), 1);
+  EXPECT_NEAR(std::get<1>(*tuple).location.Distance(
+        next_waypoint->GetTransform().location), 0.0, 1e-3);
+  EXPECT_DOUBLE_EQ(std::get<2>(*tuple), 10.0 + 1.0*0.1);
+  EXPECT_DOUBLE_EQ(std::get<3>(*tuple), 1.0);
+
+  // The agent is also updated when it does not move.
+  agent.speed() = 0.0;
+  ASSERT_NO_THROW(tuple = simulator.updatedAgentTuple(1, 0.0, 0.1));
+  ASSERT_TRUE(tuple);
+  EXPECT_NEAR(std::get<1>(*tuple).location.Distance(
+        off_route_waypoint->GetTransform().location), 0.0, 1e-3);
+}
+
+TEST_F(TrafficSimulatorTest, frenetAgent) {
+  if (!available()) return;
+
+  const boost::shared_ptr<CarlaWaypoint> agent_waypoint =
+    start_waypoint_->GetNext(20.0).front();
+  std::unordered_map<size_t, Vehicle> agents;
+  agents.emplace(1, vehicle(1, agent_waypoint, 10.0, 0.5));
+  const Snapshot snapshot(vehicle(0, start_waypoint_, 10.0, 0.0),
+                          agents, router_, map_, fast_map_);
+  ASSERT_EQ(snapshot.agents().count(1), 1);
+  ASSERT_TRUE(snapshot.trafficLattice()->laneGraph());
+
+  TestTrafficSimulator simulator(snapshot, router_, map_, fast_map_);
+  simulator.frenetAgents() = true;
+  Vehicle& agent = simulator.snapshot().agent(1);
+
+  // Both updates should agree up to the resolution of the waypoints,
+  // at which the frenet update looks up the transform.
+  const double tolerance = 2.0 * fast_map_->resolution();
+  const double dt = 0.1;
+
+  for (size_t i = 0; i < 30; ++i) {
+    const double accel = agent.acceleration();
+    const utils::Expected<std::tuple<size_t, CarlaTransform, double, double, double>>
+      updated_tuple = simulator.updatedAgentTuple(1, accel, dt);
+    const boost::optional<std::tuple<size_t, CarlaTransform, double, double, double>>
+      frenet_tuple = simulator.frenetAgentTuple(1, accel, dt);
+    ASSERT_TRUE(updated_tuple);
+    ASSERT_TRUE(frenet_tuple);
+
+    EXPECT_EQ(std::get<0>(*frenet_tuple), std::get<0>(*updated_tuple));
+    EXPECT_NEAR(std::get<1>(*frenet_tuple).location.Distance(
+          std::get<1>(*updated_tuple).location), 0.0, tolerance);
+    EXPECT_NEAR(utils::shortestAngle(
+          std::get<1>(*frenet_tuple).rotation.yaw,
+          std::get<1>(*updated_tuple).rotation.yaw), 0.0, 1.0);
+    EXPECT_DOUBLE_EQ(std::get<2>(*frenet_tuple), std::get<2>(*updated_tuple));
+    EXPECT_DOUBLE_EQ(std::get<3>(*frenet_tuple), std::get<3>(*updated_tuple));
+
+    // Move the agent with the frenet update.
+    agent.transform() = std::get<1>(*frenet_tuple);
+    agent.speed() = std::get<2>(*frenet_tuple);
+    agent.waypointHint() = boost::none;
+  }
+
+  // The agents moving backwards are rejected.
+  agent.speed() = 0.0;
+  EXPECT_FALSE(simulator.frenetAgentTuple(1, -1.0, dt));
+}
+
+/// Simulate the acceleration options of the ego one by one and in lockstep,
+/// expecting the same outputs.
+void testLockstep(const Snapshot& snapshot,
+                  const ContinuousPath& path,
+                  const std::vector<double>& accels,
+                  const boost::shared_ptr<CarlaMap>& map,
+                  const boost::shared_ptr<utils::FastWaypointMap>& fast_map,
+                  const bool frenet_agents) {
+
+  std::vector<boost::shared_ptr<TrafficSimulator>> simulators;
+  std::vector<boost::shared_ptr<TrafficSimulator>> lockstep_simulators;
+  for (const double accel : accels) {
+    Snapshot accel_snapshot = snapshot;
+    accel_snapshot.ego().acceleration() = accel;
+    simulators.push_back(boost::make_shared<ConstAccelTrafficSimulator>(
+          accel_snapshot, map, fast_map));
+    lockstep_simulators.push_back(boost::make_shared<ConstAccelTrafficSimulator>(
+          accel_snapshot, map, fast_map));
+    simulators.back()->frenetAgents() = frenet_agents;
+    lockstep_simulators.back()->frenetAgents() = frenet_agents;
+  }
+
+  std::vector<double> lockstep_times;
+  std::vector<double> lockstep_costs;
+  std::vector<std::string> warnings;
+  const std::vector<utils::Expected<bool>> lockstep_outputs =
+    TrafficSimulator::trySimulateLockstep(
+        lockstep_simulators, path, 0.1, 5.0,
+        lockstep_times, lockstep_costs, warnings);
+  ASSERT_EQ(lockstep_outputs.size(), accels.size());
+  ASSERT_EQ(lockstep_times.size(), accels.size());
+  ASSERT_EQ(lockstep_costs.size(), accels.size());
+  ASSERT_EQ(warnings.size(), accels.size());
+
+  size_t collisions = 0;
+  for (size_t i = 0; i < accels.size(); ++i) {
+    SCOPED_TRACE("acceleration option " + std::to_string(accels[i]));
+    EXPECT_TRUE(warnings[i].empty()) << warnings[i];
+
+    double time = 0.0, cost = 0.0;
+    const utils::Expected<bool> output =
+      simulators[i]->trySimulate(path, 0.1, 5.0, time, cost);
+
+    ASSERT_EQ(static_cast<bool>(output), static_cast<bool>(lockstep_outputs[i]));
+    if (!output) continue;
+    ASSERT_EQ(*output, *(lockstep_outputs[i]));
+    if (!(*output)) {
+      ++collisions;
+      continue;
+    }
+
+    EXPECT_DOUBLE_EQ(time, lockstep_times[i]);
+    EXPECT_DOUBLE_EQ(cost, lockstep_costs[i]);
+
+    // The snapshots at the end of the simulations.
+    const Snapshot& end = simulators[i]->snapshot();
+    const Snapshot& lockstep_end = lockstep_simulators[i]->snapshot();
+
+    EXPECT_EQ(end.ego().transform().location.Distance(
+          lockstep_end.ego().transform().location), 0.0);
+    EXPECT_DOUBLE_EQ(end.ego().speed(), lockstep_end.ego().speed());
+
+    ASSERT_EQ(end.agents().size(), lockstep_end.agents().size());
+    for (const auto& agent : end.agents()) {
+      ASSERT_EQ(lockstep_end.agents().count(agent.first), 1);
+      const Vehicle& lockstep_agent = lockstep_end.agent(agent.first);
+      EXPECT_EQ(agent.second.transform().location.Distance(
+            lockstep_agent.transform().location), 0.0);
+      EXPECT_DOUBLE_EQ(agent.second.speed(), lockstep_agent.speed());
+      EXPECT_DOUBLE_EQ(agent.second.acceleration(), lockstep_agent.acceleration());
+    }
+  }
+
+  // Some but not all options collide with the leading agent, so that
+  // the traffic lattices of the simulators fork.
+  EXPECT_GT(collisions, 0);
+  EXPECT_LT(collisions, accels.size());
+  return;
+}
+
+TEST_F(TrafficSimulatorTest, lockstep) {
+  if (!available()) return;
+
+  // The ego is approaching a stopped agent, which can only be avoided by
+  // braking hard. The rest of the agents move regardless of the ego.
+  std::unordered_map<size_t, Vehicle> agents;
+  agents.emplace(1, vehicle(1, start_waypoint_->GetNext(48.0).front(), 0.0, 0.0));
+  agents.emplace(2, vehicle(2, start_waypoint_, 2.0, -0.5));
+
+  const boost::shared_ptr<CarlaWaypoint> ego_waypoint =
+    start_waypoint_->GetNext(20.0).front();
+  const boost::shared_ptr<CarlaWaypoint> left_waypoint = ego_waypoint->GetLeft();
+  const boost::shared_ptr<CarlaWaypoint> right_waypoint = ego_waypoint->GetRight();
+  const boost::shared_ptr<CarlaWaypoint> side_waypoint =
+    left_waypoint ? left_waypoint : right_waypoint;
+  if (side_waypoint) {
+    agents.emplace(3, vehicle(3, side_waypoint, 8.0, 1.0));
+    agents.emplace(4, vehicle(4, side_waypoint->GetNext(20.0).front(), 12.0, -1.0));
+  }
+
+  const Snapshot snapshot(vehicle(0, ego_waypoint, 10.0, 0.0),
+                          agents, router_, map_, fast_map_);
+  ASSERT_EQ(snapshot.agents().size(), agents.size());
+
+  const ContinuousPath path(
+      std::make_pair(snapshot.ego().transform(), 0.0),
+      std::make_pair(ego_waypoint->GetNext(50.0).front()->GetTransform(), 0.0),
+      ContinuousPath::LaneChangeType::KeepLane);
+
+  const std::vector<double> accels {-8.0, -4.0, -2.0, -1.0, 0.0, 1.0};
+  {
+    SCOPED_TRACE("map agents");
+    testLockstep(snapshot, path, accels, map_, fast_map_, false);
+  }
+  {
+    SCOPED_TRACE("frenet agents");
+    testLockstep(snapshot, path, accels, map_, fast_map_, true);
+  }
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}